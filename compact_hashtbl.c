@@ -0,0 +1,533 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A compact hash table after the layout of CPython's dict.
+ *
+ * The entries are appended to a dense array, so its order is the
+ * insertion order.  The index is an open addressed array of small
+ * signed integers: an entry position, INDEX_EMPTY or INDEX_DUMMY
+ * (a removed entry, which lookups have to probe past).  Its width is
+ * the smallest of 1, 2 or 4 bytes that can hold every position.
+ *
+ * Probing follows CPython: i = 5 * i + 1 + perturb, where perturb
+ * starts as the full hash and is shifted right on each step so that
+ * all the hash bits eventually take part.
+ *
+ * Removing an entry clears its key, leaving a hole in the dense
+ * array.  When the array fills the table is rebuilt: the live
+ * entries are compacted and the index is resized if needed.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memset */
+#if !defined(_MSC_VER)
+#include <stdint.h>		/* intptr_t */
+#endif
+#include "compact_hashtbl.h"
+#include "hashtbl_probes.h"
+
+#define UNUSED_PARAMETER(X)		(void) (X)
+
+#ifndef COMPACT_HASHTBL_MAX_TABLE_SIZE
+#define COMPACT_HASHTBL_MAX_TABLE_SIZE	(1 << 30)
+#endif
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define INDEX_EMPTY		(-1)
+#define INDEX_DUMMY		(-2)
+#define PERTURB_SHIFT		5
+#define MIN_INDEX_SIZE		8
+#define DEFAULT_LOAD_FACTOR	(2.0 / 3.0)
+#define MAX_LOAD_FACTOR		0.9
+
+struct c_hashtbl_entry {
+	void *key;		/* NULL if removed */
+	void *val;
+	unsigned int hash;	/* hash of key */
+};
+
+struct c_hashtbl {
+	double max_load_factor;
+	COMPACT_HASHTBL_HASH_FN hash_fn;
+	COMPACT_HASHTBL_EQUALS_FN equals_fn;
+	unsigned long nentries;		/* live entries */
+	long nused;			/* entries appended, including holes */
+	long first;			/* no live entries before this */
+	long usable;			/* size of the entry array */
+	int index_size;
+	int index_width;
+	COMPACT_HASHTBL_KEY_FREE_FN key_free_fn;
+	COMPACT_HASHTBL_VAL_FREE_FN val_free_fn;
+	COMPACT_HASHTBL_MALLOC_FN malloc_fn;
+	COMPACT_HASHTBL_FREE_FN free_fn;
+	COMPACT_HASHTBL_EVICTOR_FN evictor_fn;
+	struct c_hashtbl_entry *entries;
+	void *index;
+};
+
+static INLINE unsigned int direct_hash(const void *k)
+{
+	/* Magic numbers from Java 1.4. */
+	unsigned int h = (unsigned int)(uintptr_t) k;
+	h ^= (h >> 20) ^ (h >> 12);
+	return h ^ (h >> 7) ^ (h >> 4);
+}
+
+static INLINE int direct_equals(const void *a, const void *b)
+{
+	return a == b;
+}
+
+static INLINE int remove_eldest(const struct c_hashtbl *h,
+				unsigned long nentries)
+{
+	UNUSED_PARAMETER(h);
+	UNUSED_PARAMETER(nentries);
+	return 0;
+}
+
+static INLINE long get_index(const struct c_hashtbl *h, unsigned int i)
+{
+	switch (h->index_width) {
+	case 1:
+		return ((const signed char *)h->index)[i];
+	case 2:
+		return ((const short *)h->index)[i];
+	default:
+		return ((const int *)h->index)[i];
+	}
+}
+
+static INLINE void set_index(struct c_hashtbl *h, unsigned int i, long ix)
+{
+	switch (h->index_width) {
+	case 1:
+		((signed char *)h->index)[i] = (signed char)ix;
+		break;
+	case 2:
+		((short *)h->index)[i] = (short)ix;
+		break;
+	default:
+		((int *)h->index)[i] = (int)ix;
+		break;
+	}
+}
+
+static int index_width(int index_size)
+{
+	if (index_size <= 128)
+		return 1;
+	if (index_size <= 32768)
+		return 2;
+	return 4;
+}
+
+static INLINE long usable_size(int index_size, double max_load_factor)
+{
+	long n = (long)((double)index_size * max_load_factor);
+	return (n > 0) ? n : 1;
+}
+
+/*
+ * Search the index for k.  Returns the entry position, or -1 if k is
+ * not present.  The index slot is stored in slot, and the number of
+ * slots probed in depth.
+ */
+static INLINE long find(const struct c_hashtbl *h, unsigned int hv,
+			const void *k, unsigned int *slot,
+			unsigned int *depth)
+{
+	unsigned int mask = (unsigned int)h->index_size - 1;
+	unsigned int perturb = hv;
+	unsigned int i = hv & mask;
+	unsigned int n = 0;
+	long ix;
+
+	for (;;) {
+		n++;
+		ix = get_index(h, i);
+		if (ix == INDEX_EMPTY)
+			break;
+		if (ix >= 0 && h->entries[ix].hash == hv &&
+		    h->equals_fn(h->entries[ix].key, k))
+			break;
+		perturb >>= PERTURB_SHIFT;
+		i = (i * 5 + perturb + 1) & mask;
+	}
+
+	*slot = i;
+	*depth = n;
+	return (ix >= 0) ? ix : -1;
+}
+
+/* Returns the first empty index slot for hv. */
+
+static INLINE unsigned int find_empty_slot(const struct c_hashtbl *h,
+					   unsigned int hv)
+{
+	unsigned int mask = (unsigned int)h->index_size - 1;
+	unsigned int perturb = hv;
+	unsigned int i = hv & mask;
+
+	while (get_index(h, i) != INDEX_EMPTY) {
+		perturb >>= PERTURB_SHIFT;
+		i = (i * 5 + perturb + 1) & mask;
+	}
+
+	return i;
+}
+
+/* Returns the index slot that refers to entry position ix. */
+
+static INLINE unsigned int find_slot_of(const struct c_hashtbl *h, long ix)
+{
+	unsigned int hv = h->entries[ix].hash;
+	unsigned int mask = (unsigned int)h->index_size - 1;
+	unsigned int perturb = hv;
+	unsigned int i = hv & mask;
+
+	while (get_index(h, i) != ix) {
+		perturb >>= PERTURB_SHIFT;
+		i = (i * 5 + perturb + 1) & mask;
+	}
+
+	return i;
+}
+
+/*
+ * Rebuild the table with room for at least capacity entries,
+ * compacting away the holes left by removed entries.
+ */
+static int rebuild(struct c_hashtbl *h, long capacity)
+{
+	struct c_hashtbl_entry *entries;
+	void *index;
+	int size = MIN_INDEX_SIZE, width, old_size = h->index_size;
+	long usable, i, n = 0;
+
+	while (usable_size(size, h->max_load_factor) < capacity &&
+	       size < COMPACT_HASHTBL_MAX_TABLE_SIZE)
+		size <<= 1;
+
+	/* Can't shrink below the live entries. */
+	if (size < h->index_size && usable_size(size, h->max_load_factor) <
+	    (long)h->nentries)
+		size = h->index_size;
+
+	usable = usable_size(size, h->max_load_factor);
+	width = index_width(size);
+
+	if ((entries = h->malloc_fn((size_t) usable * sizeof(*entries))) == NULL)
+		return 1;
+
+	if ((index = h->malloc_fn((size_t) size * (size_t) width)) == NULL) {
+		h->free_fn(entries);
+		return 1;
+	}
+
+	HASHTBL_PROBE3(c_hashtbl, resize__start, h, old_size, size);
+
+	/* Every byte 0xff reads as INDEX_EMPTY at any width. */
+	memset(index, 0xff, (size_t) size * (size_t) width);
+
+	for (i = h->first; i < h->nused; i++) {
+		if (h->entries[i].key != NULL)
+			entries[n++] = h->entries[i];
+	}
+
+	if (h->entries != NULL)
+		h->free_fn(h->entries);
+	if (h->index != NULL)
+		h->free_fn(h->index);
+
+	h->entries = entries;
+	h->index = index;
+	h->index_size = size;
+	h->index_width = width;
+	h->usable = usable;
+	h->nused = n;
+	h->first = 0;
+
+	for (i = 0; i < n; i++)
+		set_index(h, find_empty_slot(h, entries[i].hash), i);
+
+	HASHTBL_PROBE3(c_hashtbl, resize__done, h, old_size, size);
+
+	return 0;
+}
+
+/* Unlink and free the entry at position ix, found in index slot. */
+
+static void remove_at(struct c_hashtbl *h, unsigned int slot, long ix)
+{
+	struct c_hashtbl_entry *entry = &h->entries[ix];
+
+	set_index(h, slot, INDEX_DUMMY);
+
+	if (h->key_free_fn != NULL)
+		h->key_free_fn(entry->key);
+	if (h->val_free_fn != NULL && entry->val != NULL)
+		h->val_free_fn(entry->val);
+
+	entry->key = NULL;
+	entry->val = NULL;
+	h->nentries--;
+
+	while (h->first < h->nused && h->entries[h->first].key == NULL)
+		h->first++;
+}
+
+int c_hashtbl_insert(struct c_hashtbl *h, void *k, void *v)
+{
+	unsigned int hv = h->hash_fn(k);
+	unsigned int slot, depth;
+	long ix;
+
+	if ((ix = find(h, hv, k, &slot, &depth)) >= 0) {
+		/* Replacing keeps the position in the order. */
+		if (h->val_free_fn != NULL)
+			h->val_free_fn(h->entries[ix].val);
+		h->entries[ix].val = v;
+		return 0;
+	}
+
+	if (h->nused == h->usable) {
+		/* Grows if mostly live, otherwise just compacts. */
+		if (rebuild(h, (long)h->nentries * 2 + 1) != 0 ||
+		    h->nused == h->usable)
+			return 1;
+		slot = find_empty_slot(h, hv);
+	}
+
+	ix = h->nused++;
+	h->entries[ix].key = k;
+	h->entries[ix].val = v;
+	h->entries[ix].hash = hv;
+	set_index(h, slot, ix);
+	h->nentries++;
+
+	HASHTBL_PROBE3(c_hashtbl, insert, h, hv, depth);
+
+	if (h->evictor_fn(h, h->nentries)) {
+		/* Evict oldest entry. */
+		ix = h->first;
+		HASHTBL_PROBE3(c_hashtbl, evict, h, h->entries[ix].hash, h->nentries);
+		remove_at(h, find_slot_of(h, ix), ix);
+	}
+
+	return 0;
+}
+
+void *c_hashtbl_lookup(struct c_hashtbl *h, const void *k)
+{
+	unsigned int hv = h->hash_fn(k);
+	unsigned int slot, depth;
+	long ix = find(h, hv, k, &slot, &depth);
+
+	HASHTBL_PROBE4(c_hashtbl, lookup, h, hv, depth, ix >= 0);
+
+	return (ix >= 0) ? h->entries[ix].val : NULL;
+}
+
+int c_hashtbl_remove(struct c_hashtbl *h, const void *k)
+{
+	unsigned int hv = h->hash_fn(k);
+	unsigned int slot, depth;
+	long ix = find(h, hv, k, &slot, &depth);
+
+	HASHTBL_PROBE4(c_hashtbl, remove, h, hv, depth, ix >= 0);
+
+	if (ix < 0)
+		return 1;
+
+	remove_at(h, slot, ix);
+	return 0;
+}
+
+void c_hashtbl_clear(struct c_hashtbl *h)
+{
+	long i;
+
+	for (i = h->first; i < h->nused; i++) {
+		struct c_hashtbl_entry *entry = &h->entries[i];
+		if (entry->key == NULL)
+			continue;
+		if (h->key_free_fn != NULL)
+			h->key_free_fn(entry->key);
+		if (h->val_free_fn != NULL)
+			h->val_free_fn(entry->val);
+	}
+
+	memset(h->index, 0xff, (size_t) h->index_size * (size_t) h->index_width);
+	h->nentries = 0;
+	h->nused = 0;
+	h->first = 0;
+}
+
+void c_hashtbl_delete(struct c_hashtbl *h)
+{
+	c_hashtbl_clear(h);
+	h->free_fn(h->entries);
+	h->free_fn(h->index);
+	h->free_fn(h);
+}
+
+unsigned long c_hashtbl_count(const struct c_hashtbl *h)
+{
+	return h->nentries;
+}
+
+int c_hashtbl_capacity(const struct c_hashtbl *h)
+{
+	return h->index_size;
+}
+
+int c_hashtbl_index_width(const struct c_hashtbl *h)
+{
+	return h->index_width;
+}
+
+double c_hashtbl_load_factor(const struct c_hashtbl *h)
+{
+	return (double)h->nentries / (double)h->index_size;
+}
+
+struct c_hashtbl *c_hashtbl_create(int capacity,
+				   double max_load_factor,
+				   COMPACT_HASHTBL_HASH_FN hash_fn,
+				   COMPACT_HASHTBL_EQUALS_FN equals_fn,
+				   COMPACT_HASHTBL_KEY_FREE_FN key_free_fn,
+				   COMPACT_HASHTBL_VAL_FREE_FN val_free_fn,
+				   COMPACT_HASHTBL_MALLOC_FN malloc_fn,
+				   COMPACT_HASHTBL_FREE_FN free_fn,
+				   COMPACT_HASHTBL_EVICTOR_FN evictor_fn)
+{
+	struct c_hashtbl *h;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+	hash_fn = (hash_fn != NULL) ? hash_fn : direct_hash;
+	equals_fn = (equals_fn != NULL) ? equals_fn : direct_equals;
+	evictor_fn = (evictor_fn != NULL) ? evictor_fn : remove_eldest;
+
+	if ((h = malloc_fn(sizeof(*h))) == NULL)
+		return NULL;
+
+	if (max_load_factor <= 0.0) {
+		max_load_factor = DEFAULT_LOAD_FACTOR;
+	} else if (max_load_factor > MAX_LOAD_FACTOR) {
+		max_load_factor = MAX_LOAD_FACTOR;
+	}
+
+	h->max_load_factor = max_load_factor;
+	h->hash_fn = hash_fn;
+	h->equals_fn = equals_fn;
+	h->nentries = 0;
+	h->nused = 0;
+	h->first = 0;
+	h->usable = 0;
+	h->index_size = 0;
+	h->index_width = 0;
+	h->key_free_fn = key_free_fn;
+	h->val_free_fn = val_free_fn;
+	h->malloc_fn = malloc_fn;
+	h->free_fn = free_fn;
+	h->evictor_fn = evictor_fn;
+	h->entries = NULL;
+	h->index = NULL;
+
+	if (rebuild(h, (capacity > 0) ? capacity : 1) != 0) {
+		free_fn(h);
+		h = NULL;
+	}
+
+	return h;
+}
+
+int c_hashtbl_resize(struct c_hashtbl *h, int capacity)
+{
+	return rebuild(h, capacity);
+}
+
+unsigned long c_hashtbl_apply(const struct c_hashtbl *h,
+			      COMPACT_HASHTBL_APPLY_FN apply,
+			      void *client_data)
+{
+	unsigned long nentries = 0;
+	long i;
+
+	for (i = h->nused - 1; i >= h->first; i--) {
+		const struct c_hashtbl_entry *entry = &h->entries[i];
+		if (entry->key == NULL)
+			continue;
+		nentries++;
+		if (!apply(entry->key, entry->val, client_data))
+			return nentries;
+	}
+
+	return nentries;
+}
+
+void c_hashtbl_iter_init(struct c_hashtbl *h,
+			 struct c_hashtbl_iter *iter,
+			 int direction)
+{
+	/* We have to do some funky casting in order to initialize the
+	 * private fields as they are declared const -- we don't want
+	 * clients changing them but we need to. */
+
+	*(int *) &iter->direction = direction;
+	*(const struct c_hashtbl **) &iter->h = h;
+	*(long *) &iter->pos = (direction >= 1) ? h->nused - 1 : h->first;
+	iter->key = iter->val = NULL;
+}
+
+int c_hashtbl_iter_next(struct c_hashtbl_iter *iter)
+{
+	const struct c_hashtbl *h = iter->h;
+	long *pos = (long *) &iter->pos;
+	const struct c_hashtbl_entry *entry;
+
+	while (*pos >= h->first && *pos < h->nused) {
+		entry = &h->entries[*pos];
+		*pos += (iter->direction >= 1) ? -1 : 1;
+		if (entry->key != NULL) {
+			iter->key = entry->key;
+			iter->val = entry->val;
+			return 1;
+		}
+	}
+
+	return 0;
+}
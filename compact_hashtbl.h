@@ -0,0 +1,226 @@
+#ifndef COMPACT_HASHTBL_H
+#define COMPACT_HASHTBL_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A compact, insertion ordered hash table.
+ *
+ * SYNOPSIS
+ *
+ * 1. A hash table is created with c_hashtbl_create().
+ * 2. To insert an entry use c_hashtbl_insert().
+ * 3. To lookup a key use c_hashtbl_lookup().
+ * 4. To remove a key use c_hashtbl_remove().
+ * 5. To apply a function to all entries use c_hashtbl_apply().
+ * 6. To clear all keys use c_hashtbl_clear().
+ * 7. To delete a hash table instance use c_hashtbl_delete().
+ * 8. To iterate over all entries use c_hashtbl_iter_init(), c_hashtbl_iter_next().
+ *
+ * The entries live in a dense array in insertion order, and a
+ * separate open addressed index of 1, 2 or 4 byte integers (as small
+ * as the table allows) maps hashes to positions in that array.
+ * Iterating is a sequential scan, an entry costs no pointers beyond
+ * its key and value, and a lookup touches two compact arrays.
+ *
+ * Compared with l_hashtbl there is no access order: the entries can
+ * only be kept in insertion order, and the evictor removes the
+ * oldest.  Removing a key leaves a hole in the entry array that is
+ * reclaimed the next time the array fills.
+ *
+ * Note: neither the keys or the values are copied so their lifetime
+ * must match that of the hash table.  NULL keys are not permitted.
+ * Inserting, removing or lookup up NULL keys is therefore undefined.
+ */
+
+#include <stddef.h>		/* size_t */
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct c_hashtbl;
+
+/* Hash function. */
+typedef unsigned int (*COMPACT_HASHTBL_HASH_FN) (const void *k);
+
+/* Key equality function. */
+typedef int (*COMPACT_HASHTBL_EQUALS_FN) (const void *a, const void *b);
+
+/* Apply function. */
+typedef int (*COMPACT_HASHTBL_APPLY_FN) (const void *key,
+					 const void *val,
+					 const void *client_data);
+
+/* Functions for deleting keys and values. */
+typedef void (*COMPACT_HASHTBL_KEY_FREE_FN) (void *k);
+typedef void (*COMPACT_HASHTBL_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*COMPACT_HASHTBL_MALLOC_FN) (size_t n);
+typedef void (*COMPACT_HASHTBL_FREE_FN) (void *ptr);
+
+/* Function for evicting oldest entries. */
+typedef int (*COMPACT_HASHTBL_EVICTOR_FN) (const struct c_hashtbl * h,
+					   unsigned long count);
+
+struct c_hashtbl_iter {
+	void *key;
+	void *val;
+	/* The remaining fields are private: don't modify them. */
+	const int direction;
+	const struct c_hashtbl *const h;
+	const long pos;
+};
+
+/*
+ * Creates a new hash table.
+ *
+ * @param initial_capacity - number of entries before the first resize
+ * @param max_load_factor  - of the index (0.0 uses a default value
+ *			     of 2/3; at most 0.9)
+ * @param hash_func	   - function that computes a hash value from a key
+ * @param equals_func	   - function that checks keys for equality
+ * @param key_free_func	   - function to delete keys
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ * @param evictor_func	   - function to evict entries as new keys are added
+ *
+ * Returns non-null if the table was created successfully.
+ */
+struct c_hashtbl *c_hashtbl_create(int initial_capacity,
+				   double max_load_factor,
+				   COMPACT_HASHTBL_HASH_FN hash_fun,
+				   COMPACT_HASHTBL_EQUALS_FN equals_fun,
+				   COMPACT_HASHTBL_KEY_FREE_FN key_free_func,
+				   COMPACT_HASHTBL_VAL_FREE_FN val_free_func,
+				   COMPACT_HASHTBL_MALLOC_FN malloc_func,
+				   COMPACT_HASHTBL_FREE_FN free_func,
+				   COMPACT_HASHTBL_EVICTOR_FN evictor_func);
+
+/*
+ * Deletes the hash table instance.
+ *
+ * All the entries are removed via c_hashtbl_clear().
+ */
+void c_hashtbl_delete(struct c_hashtbl *h);
+
+/*
+ * Removes a key and value from the table.
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int c_hashtbl_remove(struct c_hashtbl *h, const void *k);
+
+/*
+ * Clears all entries.
+ */
+void c_hashtbl_clear(struct c_hashtbl *h);
+
+/*
+ * Inserts a new key with associated value.  Replacing the value of
+ * an existing key doesn't change its position in the order.
+ *
+ * Returns 0 if insertion was successful, otherwise 1.
+ */
+int c_hashtbl_insert(struct c_hashtbl *h, void *k, void *v);
+
+/*
+ * Lookup an existing key.
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *c_hashtbl_lookup(struct c_hashtbl *h, const void *k);
+
+/*
+ * Returns the number of entries in the table.
+ */
+unsigned long c_hashtbl_count(const struct c_hashtbl *h);
+
+/*
+ * Returns the number of slots in the index.
+ */
+int c_hashtbl_capacity(const struct c_hashtbl *h);
+
+/*
+ * Returns the size of an index slot in bytes (1, 2 or 4).
+ */
+int c_hashtbl_index_width(const struct c_hashtbl *h);
+
+/*
+ * Apply a function to all entries, newest first (as l_hashtbl).
+ * Returning 0 from fn stops the enumeration.
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long c_hashtbl_apply(const struct c_hashtbl *h,
+			      COMPACT_HASHTBL_APPLY_FN fn,
+			      void *client_data);
+
+/*
+ * Returns the load factor of the index.
+ */
+double c_hashtbl_load_factor(const struct c_hashtbl *h);
+
+/*
+ * Resize the table so that it holds at least capacity entries
+ * before growing again.  Also reclaims the holes left by removed
+ * keys.
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int c_hashtbl_resize(struct c_hashtbl *h, int capacity);
+
+/*
+ * Initialize an iterator.
+ *
+ * @param direction - either 1 for FORWARD (newest first, as l_hashtbl)
+ *		      or -1 for REVERSE
+ *
+ * The current entry may be removed while iterating; inserting new
+ * keys invalidates the iterator.
+ */
+void c_hashtbl_iter_init(struct c_hashtbl *h,
+			 struct c_hashtbl_iter *iter,
+			 int direction);
+
+/*
+ * Advances the iterator.
+ *
+ * Returns 1 while there more entries, otherwise 0.  The key and value
+ * for each entry can be accessed through the iterator structure.
+ */
+int c_hashtbl_iter_next(struct c_hashtbl_iter *iter);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMPACT_HASHTBL_H */
@@ -0,0 +1,208 @@
+/* Copyright (c) 2009, 2010 <Andrew McDermott>
+ * 
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* compact_hashtbl_test.c - unit tests for c_hashtbl */
+
+#include <stdlib.h>
+#include "CUnitTest.h"
+#include "compact_hashtbl.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NKEYS			40000
+
+static struct c_hashtbl *new_table(COMPACT_HASHTBL_EVICTOR_FN evictor)
+{
+	return c_hashtbl_create(1, 0.0, hashtbl_int_hash, hashtbl_int_equals,
+				free, free, NULL, NULL, evictor);
+}
+
+/* Collect the keys in iteration order; returns how many. */
+
+static int keys_in_order(struct c_hashtbl *h, int direction, int *keys, int max)
+{
+	struct c_hashtbl_iter iter;
+	int n = 0;
+
+	c_hashtbl_iter_init(h, &iter, direction);
+	while (n < max && c_hashtbl_iter_next(&iter))
+		keys[n++] = *(int *)iter.key;
+
+	return n;
+}
+
+static unsigned long fifo_capacity;
+
+static int fifo_evictor(const struct c_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > fifo_capacity;
+}
+
+static int count_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(v);
+	UNUSED_PARAMETER(p);
+	return *(const int *)k > 3;
+}
+
+/* Test insert, lookup and remove as the index widens. */
+
+static int test1(void)
+{
+	int i, width = 1, *k;
+	struct c_hashtbl *h = new_table(NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(1, c_hashtbl_index_width(h));
+
+	for (i = 0; i < NKEYS; i++) {
+		CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, test_int(i), test_int(i * 2)));
+		CUT_ASSERT_TRUE(c_hashtbl_index_width(h) >= width);
+		width = c_hashtbl_index_width(h);
+	}
+
+	CUT_ASSERT_EQUAL(4, width);
+	CUT_ASSERT_EQUAL(NKEYS, c_hashtbl_count(h));
+	CUT_ASSERT_TRUE(c_hashtbl_load_factor(h) <= 2.0 / 3.0);
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(i * 2, *(int *)c_hashtbl_lookup(h, &i));
+
+	i = NKEYS;
+	CUT_ASSERT_NULL(c_hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(1, c_hashtbl_remove(h, &i));
+
+	for (i = 0; i < NKEYS; i += 2)
+		CUT_ASSERT_EQUAL(0, c_hashtbl_remove(h, &i));
+
+	CUT_ASSERT_EQUAL(NKEYS / 2, c_hashtbl_count(h));
+
+	for (i = 0; i < NKEYS; i++) {
+		if (i % 2 == 0)
+			CUT_ASSERT_NULL(c_hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_EQUAL(i * 2, *(int *)c_hashtbl_lookup(h, &i));
+	}
+
+	/* Replacing a value keeps the original key. */
+	i = 1;
+	k = test_int(i);
+	CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, k, test_int(-1)));
+	free(k);
+	CUT_ASSERT_EQUAL(-1, *(int *)c_hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(NKEYS / 2, c_hashtbl_count(h));
+
+	c_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test insertion order. */
+
+static int test2(void)
+{
+	int i, keys[16];
+	struct c_hashtbl *h = new_table(NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 8; i++)
+		CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, test_int(i), test_int(i)));
+
+	/* Remove 0 and 5, re-insert 5 (at the end), replace 3 (in place). */
+	i = 0;
+	CUT_ASSERT_EQUAL(0, c_hashtbl_remove(h, &i));
+	i = 5;
+	CUT_ASSERT_EQUAL(0, c_hashtbl_remove(h, &i));
+	CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, test_int(5), test_int(50)));
+	i = 3;
+	CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, &i, test_int(30)));
+	CUT_ASSERT_EQUAL(30, *(int *)c_hashtbl_lookup(h, &i));
+
+	CUT_ASSERT_EQUAL(7, keys_in_order(h, -1, keys, 16));
+	CUT_ASSERT_EQUAL(1, keys[0]);
+	CUT_ASSERT_EQUAL(2, keys[1]);
+	CUT_ASSERT_EQUAL(3, keys[2]);
+	CUT_ASSERT_EQUAL(4, keys[3]);
+	CUT_ASSERT_EQUAL(6, keys[4]);
+	CUT_ASSERT_EQUAL(7, keys[5]);
+	CUT_ASSERT_EQUAL(5, keys[6]);
+
+	CUT_ASSERT_EQUAL(7, keys_in_order(h, 1, keys, 16));
+	CUT_ASSERT_EQUAL(5, keys[0]);
+	CUT_ASSERT_EQUAL(7, keys[1]);
+	CUT_ASSERT_EQUAL(1, keys[6]);
+
+	/* The order survives a resize. */
+	CUT_ASSERT_EQUAL(0, c_hashtbl_resize(h, 1000));
+	CUT_ASSERT_TRUE(c_hashtbl_capacity(h) >= 1000);
+	CUT_ASSERT_EQUAL(7, keys_in_order(h, -1, keys, 16));
+	CUT_ASSERT_EQUAL(1, keys[0]);
+	CUT_ASSERT_EQUAL(5, keys[6]);
+
+	CUT_ASSERT_EQUAL(5, c_hashtbl_apply(h, count_fn, NULL));
+
+	c_hashtbl_clear(h);
+	CUT_ASSERT_EQUAL(0, c_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(0, keys_in_order(h, -1, keys, 16));
+	CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, test_int(9), test_int(9)));
+	CUT_ASSERT_EQUAL(1, keys_in_order(h, 1, keys, 16));
+
+	c_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test eviction of the oldest entries. */
+
+static int test3(void)
+{
+	int i, keys[16];
+	struct c_hashtbl *h = new_table(fifo_evictor);
+
+	CUT_ASSERT_NOT_NULL(h);
+	fifo_capacity = 10;
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, c_hashtbl_insert(h, test_int(i), test_int(i)));
+
+	CUT_ASSERT_EQUAL(10, c_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(10, keys_in_order(h, -1, keys, 16));
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(990 + i, keys[i]);
+
+	/* The holes are reclaimed rather than growing the table. */
+	CUT_ASSERT_TRUE(c_hashtbl_capacity(h) <= 32);
+
+	c_hashtbl_delete(h);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,833 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A concurrent hash table with lock-free lookups and cooperative,
+ * incremental resizing.
+ *
+ * Each slot is a word holding the head of its chain.  Its low bit is
+ * the slot's writer lock; lookups ignore it and walk the chain
+ * regardless, which is safe because writers only ever publish fully
+ * initialised nodes and never change a node once it is unlinked.
+ *
+ * A migration copies each chain into the new table rather than
+ * relinking it, since a lookup may be walking the old chain at the
+ * same time.  Once a slot's copies are in place the slot is set to
+ * the MOVED marker, which is final: writers that find it help with
+ * the migration and then retry in the new table.  A slot whose copies
+ * can't be allocated is left as it was and picked up by a later sweep.
+ *
+ * Unlinked nodes, and old tables, are retired rather than freed.  A
+ * two-epoch scheme tells when no lookup can still hold them: every
+ * operation counts itself in the current epoch for its duration, and
+ * a batch of retired objects is freed once the epoch has been flipped
+ * and the count for the previous one has drained to zero.  Nothing
+ * ever waits for that to happen; the batch is just retried later.
+ */
+
+#include <stddef.h>		/* size_t, offsetof, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdint.h>		/* uintptr_t */
+#include <sched.h>		/* sched_yield */
+#include <pthread.h>
+#include <stdatomic.h>
+#include "concurrent_hashtbl.h"
+
+#ifndef CONCURRENT_HASHTBL_MAX_TABLE_SIZE
+#define CONCURRENT_HASHTBL_MAX_TABLE_SIZE	(1 << 30)
+#endif
+
+#define MIN_TABLE_SIZE		16
+#define TRANSFER_STRIDE		16	/* slots claimed by a helper at once */
+#define RECLAIM_INTERVAL	64	/* retirements between reclaims */
+#define SPINS_BEFORE_YIELD	64
+#define NSTRIPES		16	/* of the per-epoch operation counts */
+#define CACHE_LINE_SIZE		64
+
+#define LOCKED			((uintptr_t) 1)
+#define MOVED			((uintptr_t) &moved)
+
+/* What a retired object still owns. */
+#define RETIRE_KEY		0x1
+#define RETIRE_VAL		0x2
+#define RETIRE_TABLE		0x4
+
+#define CONTAINER_OF(PTR, TYPE, MEMBER)				\
+	((TYPE *)(void *)((char *)(PTR) - offsetof(TYPE, MEMBER)))
+
+struct retired {
+	struct retired *next;
+	int flags;
+};
+
+struct node {
+	_Atomic(struct node *) next;
+	unsigned int hash;
+	void *key;
+	void *val;
+	struct retired retired;
+};
+
+struct table {
+	int size;
+	int resize_threshold;
+	_Atomic(struct table *) next;	/* being migrated to, or NULL */
+	atomic_int transfer_index;	/* slots below this are unclaimed */
+	atomic_int nmoved;		/* slots forwarded to next */
+	atomic_int failed;		/* a slot couldn't be copied */
+	struct retired retired;
+	_Atomic uintptr_t *bins;
+};
+
+/* An operation count on a cache line of its own. */
+union stripe {
+	atomic_long n;
+	char pad[CACHE_LINE_SIZE];
+};
+
+struct concurrent_hashtbl {
+	_Atomic(struct table *) table;
+	double max_load_factor;
+	HASHTBL_HASH_FN hash_fn;
+	HASHTBL_EQUALS_FN equals_fn;
+	HASHTBL_KEY_FREE_FN key_free_fn;
+	HASHTBL_VAL_FREE_FN val_free_fn;
+	HASHTBL_MALLOC_FN malloc_fn;
+	HASHTBL_FREE_FN free_fn;
+	atomic_long nentries;
+	atomic_int epoch;
+	union stripe active[2][NSTRIPES];
+	_Atomic(struct retired *) retired;
+	atomic_int nretired;
+	pthread_mutex_t reclaim_lock;
+	struct retired *pending;	/* waiting out the old epoch */
+};
+
+/* The forwarding marker; only its address is used. */
+static struct node moved;
+
+static atomic_int next_stripe;
+static _Thread_local int my_stripe = -1;
+
+static int roundup_to_next_power_of_2(int x)
+{
+	int n = 1;
+	while (n < x)
+		n <<= 1;
+	return n;
+}
+
+static unsigned int direct_hash(const void *k)
+{
+	/* As hashtbl's default, magic numbers from Java 1.4. */
+	unsigned int h = (unsigned int)(uintptr_t) k;
+	h ^= (h >> 20) ^ (h >> 12);
+	return h ^ (h >> 7) ^ (h >> 4);
+}
+
+static int direct_equals(const void *a, const void *b)
+{
+	return a == b;
+}
+
+/* Fold the high bits in, so that tables of any size see them. */
+static unsigned int spread(unsigned int h)
+{
+	return h ^ (h >> 16);
+}
+
+/*
+ * Counts the calling thread in the current epoch.  The epoch is
+ * checked again afterwards so that a count which raced with a flip
+ * is moved to the new epoch rather than being missed.  Returns a
+ * token for leave().
+ */
+static int enter(struct concurrent_hashtbl *c)
+{
+	int e;
+
+	if (my_stripe < 0)
+		my_stripe = atomic_fetch_add(&next_stripe, 1) % NSTRIPES;
+
+	for (;;) {
+		e = atomic_load(&c->epoch);
+		atomic_fetch_add(&c->active[e][my_stripe].n, 1);
+		if (atomic_load(&c->epoch) == e)
+			return e * NSTRIPES + my_stripe;
+		atomic_fetch_sub(&c->active[e][my_stripe].n, 1);
+	}
+}
+
+static void leave(struct concurrent_hashtbl *c, int token)
+{
+	atomic_fetch_sub(&c->active[token / NSTRIPES][token % NSTRIPES].n, 1);
+}
+
+static int epoch_drained(struct concurrent_hashtbl *c, int e)
+{
+	int i;
+
+	for (i = 0; i < NSTRIPES; i++) {
+		if (atomic_load(&c->active[e][i].n) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void retire(struct concurrent_hashtbl *c, struct retired *r, int flags)
+{
+	struct retired *head = atomic_load(&c->retired);
+
+	r->flags = flags;
+	do {
+		r->next = head;
+	} while (!atomic_compare_exchange_weak(&c->retired, &head, r));
+
+	atomic_fetch_add(&c->nretired, 1);
+}
+
+static void release(struct concurrent_hashtbl *c, struct retired *r)
+{
+	struct retired *next;
+	struct node *node;
+
+	for (; r != NULL; r = next) {
+		next = r->next;
+		if (r->flags & RETIRE_TABLE) {
+			c->free_fn(CONTAINER_OF(r, struct table, retired));
+			continue;
+		}
+		node = CONTAINER_OF(r, struct node, retired);
+		if ((r->flags & RETIRE_KEY) && c->key_free_fn != NULL)
+			c->key_free_fn(node->key);
+		if ((r->flags & RETIRE_VAL) && c->val_free_fn != NULL &&
+		    node->val != NULL)
+			c->val_free_fn(node->val);
+		c->free_fn(node);
+	}
+}
+
+/*
+ * Frees what no operation can still see.  Called outside enter() and
+ * leave(), and gives up rather than wait for the lock or for the
+ * previous epoch to drain.
+ */
+static void reclaim(struct concurrent_hashtbl *c)
+{
+	struct retired *batch;
+	int e;
+
+	if (atomic_load(&c->nretired) < RECLAIM_INTERVAL)
+		return;
+	if (pthread_mutex_trylock(&c->reclaim_lock) != 0)
+		return;
+
+	atomic_store(&c->nretired, 0);
+	e = atomic_load(&c->epoch);
+
+	if (c->pending != NULL && epoch_drained(c, !e)) {
+		release(c, c->pending);
+		c->pending = NULL;
+	}
+
+	if (c->pending == NULL) {
+		batch = atomic_exchange(&c->retired, NULL);
+		if (batch != NULL) {
+			c->pending = batch;
+			atomic_store(&c->epoch, !e);
+			if (epoch_drained(c, e)) {
+				release(c, c->pending);
+				c->pending = NULL;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&c->reclaim_lock);
+}
+
+static struct node *bin_head(struct table *t, int i)
+{
+	return (struct node *)(atomic_load(&t->bins[i]) & ~LOCKED);
+}
+
+/* Locks slot i, or returns MOVED (unlocked) if it has been forwarded. */
+
+static uintptr_t lock_bin(struct table *t, int i)
+{
+	uintptr_t head;
+	int spins = 0;
+
+	for (;;) {
+		head = atomic_load(&t->bins[i]);
+		if (head == MOVED)
+			return MOVED;
+		if ((head & LOCKED) == 0 &&
+		    atomic_compare_exchange_weak(&t->bins[i], &head, head | LOCKED))
+			return head;
+		if (++spins % SPINS_BEFORE_YIELD == 0)
+			sched_yield();
+	}
+}
+
+static void unlock_bin(struct table *t, int i, struct node *head)
+{
+	atomic_store(&t->bins[i], (uintptr_t) head);
+}
+
+/* Locks the slot for hv, following forwarding markers; updates *t. */
+
+static struct node *lock_slot(struct table **t, unsigned int hv, int *i)
+{
+	uintptr_t head;
+
+	for (;;) {
+		*i = (int)(hv & (unsigned int)((*t)->size - 1));
+		if ((head = lock_bin(*t, *i)) != MOVED)
+			return (struct node *) head;
+		*t = atomic_load(&(*t)->next);
+	}
+}
+
+static struct node *new_node(struct concurrent_hashtbl *c, unsigned int hv,
+			     void *k, void *v)
+{
+	struct node *node;
+
+	if ((node = c->malloc_fn(sizeof(*node))) == NULL)
+		return NULL;
+
+	atomic_init(&node->next, NULL);
+	node->hash = hv;
+	node->key = k;
+	node->val = v;
+	return node;
+}
+
+static struct table *new_table(struct concurrent_hashtbl *c, int size)
+{
+	struct table *t;
+	int i;
+
+	t = c->malloc_fn(sizeof(*t) + (size_t) size * sizeof(*t->bins));
+	if (t == NULL)
+		return NULL;
+
+	t->size = size;
+	t->resize_threshold = (int)(((double)size * c->max_load_factor) + 0.5);
+	atomic_init(&t->next, NULL);
+	atomic_init(&t->transfer_index, size);
+	atomic_init(&t->nmoved, 0);
+	atomic_init(&t->failed, 0);
+	t->bins = (_Atomic uintptr_t *)(void *)(t + 1);
+	for (i = 0; i < size; i++)
+		atomic_init(&t->bins[i], 0);
+
+	return t;
+}
+
+/*
+ * Copies slot i of t into slots i and i + t->size of nt, then
+ * forwards it.
+ */
+static void move_bin(struct concurrent_hashtbl *c, struct table *t,
+		     struct table *nt, int i)
+{
+	struct node *lo = NULL, *hi = NULL, *old, *p, *copy;
+	uintptr_t head;
+
+	if ((head = lock_bin(t, i)) == MOVED)
+		return;
+
+	old = (struct node *) head;
+	for (p = old; p != NULL; p = atomic_load(&p->next)) {
+		if ((copy = new_node(c, p->hash, p->key, p->val)) == NULL)
+			goto fail;
+		if (p->hash & (unsigned int)t->size) {
+			atomic_store(&copy->next, hi);
+			hi = copy;
+		} else {
+			atomic_store(&copy->next, lo);
+			lo = copy;
+		}
+	}
+
+	atomic_store(&nt->bins[i], (uintptr_t) lo);
+	atomic_store(&nt->bins[i + t->size], (uintptr_t) hi);
+	atomic_store(&t->bins[i], MOVED);
+
+	/* The copies own the keys and values now. */
+	for (p = old; p != NULL; p = atomic_load(&p->next))
+		retire(c, &p->retired, 0);
+
+	atomic_fetch_add(&t->nmoved, 1);
+	return;
+
+fail:
+	for (p = lo; p != NULL; p = copy) {
+		copy = atomic_load(&p->next);
+		c->free_fn(p);
+	}
+	for (p = hi; p != NULL; p = copy) {
+		copy = atomic_load(&p->next);
+		c->free_fn(p);
+	}
+	unlock_bin(t, i, old);
+	atomic_store(&t->failed, 1);
+}
+
+/*
+ * Called by every insert and remove.  Starts a migration if an
+ * insert took the table to its threshold (n is the new count, or 0),
+ * then, if one is running, moves the next unclaimed stride of slots
+ * and commits the new table once every slot has been forwarded.
+ */
+static void help_resize(struct concurrent_hashtbl *c, long n)
+{
+	struct table *t = atomic_load(&c->table);
+	struct table *nt = atomic_load(&t->next);
+	struct table *expected = NULL;
+	int i, lo, hi;
+
+	if (nt == NULL) {
+		if (n < t->resize_threshold ||
+		    t->size >= CONCURRENT_HASHTBL_MAX_TABLE_SIZE)
+			return;
+		/* allocation failures are benign; the next insert retries. */
+		if ((nt = new_table(c, 2 * t->size)) == NULL)
+			return;
+		if (!atomic_compare_exchange_strong(&t->next, &expected, nt)) {
+			c->free_fn(nt);
+			nt = expected;
+		}
+	}
+
+	if (atomic_load(&t->transfer_index) > 0 &&
+	    (hi = atomic_fetch_sub(&t->transfer_index, TRANSFER_STRIDE)) > 0) {
+		lo = (hi > TRANSFER_STRIDE) ? hi - TRANSFER_STRIDE : 0;
+		for (i = hi - 1; i >= lo; i--)
+			move_bin(c, t, nt, i);
+	} else if (atomic_exchange(&t->failed, 0)) {
+		for (i = 0; i < t->size; i++)
+			move_bin(c, t, nt, i);
+	}
+
+	if (atomic_load(&t->nmoved) == t->size) {
+		expected = t;
+		if (atomic_compare_exchange_strong(&c->table, &expected, nt))
+			retire(c, &t->retired, RETIRE_TABLE);
+	}
+}
+
+struct concurrent_hashtbl *concurrent_hashtbl_create(int capacity,
+						     double max_load_factor,
+						     HASHTBL_HASH_FN hash_fn,
+						     HASHTBL_EQUALS_FN equals_fn,
+						     HASHTBL_KEY_FREE_FN key_free_fn,
+						     HASHTBL_VAL_FREE_FN val_free_fn,
+						     HASHTBL_MALLOC_FN malloc_fn,
+						     HASHTBL_FREE_FN free_fn)
+{
+	struct concurrent_hashtbl *c;
+	struct table *t;
+	int i;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if (max_load_factor < 0.0) {
+		max_load_factor = 0.75f;
+	} else if (max_load_factor > 1.0) {
+		max_load_factor = 1.0f;
+	}
+
+	if (capacity < MIN_TABLE_SIZE) {
+		capacity = MIN_TABLE_SIZE;
+	} else if (capacity >= CONCURRENT_HASHTBL_MAX_TABLE_SIZE) {
+		capacity = CONCURRENT_HASHTBL_MAX_TABLE_SIZE;
+	} else {
+		capacity = roundup_to_next_power_of_2(capacity);
+	}
+
+	if ((c = malloc_fn(sizeof(*c))) == NULL)
+		return NULL;
+
+	c->max_load_factor = max_load_factor;
+	c->hash_fn = (hash_fn != NULL) ? hash_fn : direct_hash;
+	c->equals_fn = (equals_fn != NULL) ? equals_fn : direct_equals;
+	c->key_free_fn = key_free_fn;
+	c->val_free_fn = val_free_fn;
+	c->malloc_fn = malloc_fn;
+	c->free_fn = free_fn;
+	atomic_init(&c->nentries, 0);
+	atomic_init(&c->epoch, 0);
+	for (i = 0; i < NSTRIPES; i++) {
+		atomic_init(&c->active[0][i].n, 0);
+		atomic_init(&c->active[1][i].n, 0);
+	}
+	atomic_init(&c->retired, NULL);
+	atomic_init(&c->nretired, 0);
+	c->pending = NULL;
+
+	if ((t = new_table(c, capacity)) == NULL) {
+		free_fn(c);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&c->reclaim_lock, NULL) != 0) {
+		free_fn(t);
+		free_fn(c);
+		return NULL;
+	}
+
+	atomic_init(&c->table, t);
+	return c;
+}
+
+static void free_table(struct concurrent_hashtbl *c, struct table *t)
+{
+	struct node *p, *next;
+	int i;
+
+	for (i = 0; i < t->size; i++) {
+		if (atomic_load(&t->bins[i]) == MOVED)
+			continue;
+		for (p = bin_head(t, i); p != NULL; p = next) {
+			next = atomic_load(&p->next);
+			retire(c, &p->retired, RETIRE_KEY | RETIRE_VAL);
+		}
+	}
+
+	retire(c, &t->retired, RETIRE_TABLE);
+}
+
+void concurrent_hashtbl_delete(struct concurrent_hashtbl *c)
+{
+	struct table *t = atomic_load(&c->table);
+	struct table *nt = atomic_load(&t->next);
+
+	free_table(c, t);
+	if (nt != NULL)
+		free_table(c, nt);
+
+	release(c, c->pending);
+	release(c, atomic_exchange(&c->retired, NULL));
+	pthread_mutex_destroy(&c->reclaim_lock);
+	c->free_fn(c);
+}
+
+/*
+ * Finds k in the chain of a locked slot.  *prev is set to the node
+ * before it, or NULL if it is the head.
+ */
+static struct node *find_locked(struct concurrent_hashtbl *c,
+				struct node *head, unsigned int hv,
+				const void *k, struct node **prev)
+{
+	struct node *p;
+
+	*prev = NULL;
+	for (p = head; p != NULL; *prev = p, p = atomic_load(&p->next)) {
+		if (p->hash == hv && c->equals_fn(p->key, k))
+			break;
+	}
+
+	return p;
+}
+
+/*
+ * Links node in place of p, keeping p's key.  Nodes aren't changed
+ * once published, so a new value always means a new node.
+ */
+static void replace_node(struct node **head, struct node *prev,
+			 struct node *p, struct node *node)
+{
+	node->key = p->key;
+	atomic_store(&node->next, atomic_load(&p->next));
+	if (prev == NULL) {
+		*head = node;
+	} else {
+		atomic_store(&prev->next, node);
+	}
+}
+
+/* Unlinks p from a locked slot. */
+static void unlink_node(struct node **head, struct node *prev, struct node *p)
+{
+	if (prev == NULL) {
+		*head = atomic_load(&p->next);
+	} else {
+		atomic_store(&prev->next, atomic_load(&p->next));
+	}
+}
+
+int concurrent_hashtbl_insert(struct concurrent_hashtbl *c, void *k, void *v)
+{
+	unsigned int hv = spread(c->hash_fn(k));
+	struct node *node, *head, *p, *prev;
+	struct table *t;
+	long n = 0;
+	int token, i;
+
+	if ((node = new_node(c, hv, k, v)) == NULL)
+		return 1;
+
+	token = enter(c);
+	t = atomic_load(&c->table);
+	head = lock_slot(&t, hv, &i);
+
+	if ((p = find_locked(c, head, hv, k, &prev)) != NULL) {
+		replace_node(&head, prev, p, node);
+	} else {
+		atomic_store(&node->next, head);
+		head = node;
+	}
+
+	unlock_bin(t, i, head);
+
+	if (p != NULL) {
+		retire(c, &p->retired, RETIRE_VAL);
+	} else {
+		n = atomic_fetch_add(&c->nentries, 1) + 1;
+	}
+
+	help_resize(c, n);
+	leave(c, token);
+	reclaim(c);
+
+	return 0;
+}
+
+void *concurrent_hashtbl_lookup(struct concurrent_hashtbl *c, const void *k)
+{
+	unsigned int hv = spread(c->hash_fn(k));
+	struct table *t;
+	struct node *p;
+	uintptr_t head;
+	void *v = NULL;
+	int token;
+
+	token = enter(c);
+	t = atomic_load(&c->table);
+
+	for (;;) {
+		head = atomic_load(&t->bins[hv & (unsigned int)(t->size - 1)]);
+		if (head != MOVED)
+			break;
+		t = atomic_load(&t->next);
+	}
+
+	p = (struct node *)(head & ~LOCKED);
+	for (; p != NULL; p = atomic_load(&p->next)) {
+		if (p->hash == hv && c->equals_fn(p->key, k)) {
+			v = p->val;
+			break;
+		}
+	}
+
+	leave(c, token);
+	return v;
+}
+
+int concurrent_hashtbl_remove(struct concurrent_hashtbl *c, const void *k)
+{
+	unsigned int hv = spread(c->hash_fn(k));
+	struct node *head, *p, *prev;
+	struct table *t;
+	int token, i;
+
+	token = enter(c);
+	t = atomic_load(&c->table);
+	head = lock_slot(&t, hv, &i);
+
+	if ((p = find_locked(c, head, hv, k, &prev)) != NULL)
+		unlink_node(&head, prev, p);
+
+	unlock_bin(t, i, head);
+
+	if (p != NULL) {
+		retire(c, &p->retired, RETIRE_KEY | RETIRE_VAL);
+		atomic_fetch_sub(&c->nentries, 1);
+	}
+
+	help_resize(c, 0);
+	leave(c, token);
+	reclaim(c);
+
+	return (p != NULL) ? 0 : 1;
+}
+
+int concurrent_hashtbl_cas(struct concurrent_hashtbl *c, const void *k,
+			   void *expected, void *desired)
+{
+	unsigned int hv = spread(c->hash_fn(k));
+	struct node *node, *head, *p, *prev;
+	struct table *t;
+	int token, i, swapped = 0;
+
+	if ((node = new_node(c, hv, NULL, desired)) == NULL)
+		return -1;
+
+	token = enter(c);
+	t = atomic_load(&c->table);
+	head = lock_slot(&t, hv, &i);
+
+	p = find_locked(c, head, hv, k, &prev);
+	if (p != NULL && p->val == expected) {
+		replace_node(&head, prev, p, node);
+		swapped = 1;
+	}
+
+	unlock_bin(t, i, head);
+
+	if (swapped) {
+		retire(c, &p->retired, (expected != desired) ? RETIRE_VAL : 0);
+	} else {
+		c->free_fn(node);
+	}
+
+	help_resize(c, 0);
+	leave(c, token);
+	reclaim(c);
+
+	return swapped ? 0 : 1;
+}
+
+int concurrent_hashtbl_replace_if(struct concurrent_hashtbl *c, const void *k,
+				  void *v, HASHTBL_APPLY_FN pred,
+				  const void *client_data)
+{
+	unsigned int hv = spread(c->hash_fn(k));
+	struct node *node, *head, *p, *prev;
+	struct table *t;
+	int token, i, replaced = 0;
+
+	if ((node = new_node(c, hv, NULL, v)) == NULL)
+		return -1;
+
+	token = enter(c);
+	t = atomic_load(&c->table);
+	head = lock_slot(&t, hv, &i);
+
+	p = find_locked(c, head, hv, k, &prev);
+	if (p != NULL && pred(p->key, p->val, client_data)) {
+		replace_node(&head, prev, p, node);
+		replaced = 1;
+	}
+
+	unlock_bin(t, i, head);
+
+	if (replaced) {
+		retire(c, &p->retired, (p->val != v) ? RETIRE_VAL : 0);
+	} else {
+		c->free_fn(node);
+	}
+
+	help_resize(c, 0);
+	leave(c, token);
+	reclaim(c);
+
+	return replaced ? 0 : 1;
+}
+
+int concurrent_hashtbl_compute(struct concurrent_hashtbl *c, void *k,
+			       HASHTBL_COMPUTE_FN fn, void *client_data)
+{
+	unsigned int hv = spread(c->hash_fn(k));
+	struct node *node, *head, *p, *prev;
+	struct table *t;
+	long n = 0;
+	int token, i, used = 0;
+	void *v;
+
+	if ((node = new_node(c, hv, k, NULL)) == NULL)
+		return 1;
+
+	token = enter(c);
+	t = atomic_load(&c->table);
+	head = lock_slot(&t, hv, &i);
+
+	if ((p = find_locked(c, head, hv, k, &prev)) == NULL) {
+		if ((node->val = fn(k, NULL, client_data)) != NULL) {
+			atomic_store(&node->next, head);
+			head = node;
+			used = 1;
+		}
+	} else if ((v = fn(p->key, p->val, client_data)) == NULL) {
+		unlink_node(&head, prev, p);
+	} else if (v != p->val) {
+		node->val = v;
+		replace_node(&head, prev, p, node);
+		used = 1;
+	} else {
+		p = NULL;	/* unchanged */
+	}
+
+	unlock_bin(t, i, head);
+
+	if (p == NULL) {
+		if (used)
+			n = atomic_fetch_add(&c->nentries, 1) + 1;
+	} else if (used) {
+		retire(c, &p->retired, RETIRE_VAL);
+	} else {
+		retire(c, &p->retired, RETIRE_KEY | RETIRE_VAL);
+		atomic_fetch_sub(&c->nentries, 1);
+	}
+
+	if (!used)
+		c->free_fn(node);
+
+	help_resize(c, n);
+	leave(c, token);
+	reclaim(c);
+
+	return 0;
+}
+
+unsigned long concurrent_hashtbl_count(struct concurrent_hashtbl *c)
+{
+	return (unsigned long) atomic_load(&c->nentries);
+}
+
+int concurrent_hashtbl_capacity(struct concurrent_hashtbl *c)
+{
+	int token = enter(c);
+	int size = atomic_load(&c->table)->size;
+
+	leave(c, token);
+	return size;
+}
+
+int concurrent_hashtbl_resizing(struct concurrent_hashtbl *c)
+{
+	int token = enter(c);
+	int resizing = atomic_load(&atomic_load(&c->table)->next) != NULL;
+
+	leave(c, token);
+	return resizing;
+}
@@ -0,0 +1,165 @@
+#ifndef CONCURRENT_HASHTBL_H
+#define CONCURRENT_HASHTBL_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A thread-safe hash table whose lookups never block, and whose
+ * resizes are shared out between the threads writing to it.
+ *
+ * SYNOPSIS
+ *
+ * 1. A table is created with concurrent_hashtbl_create().
+ * 2. To insert an entry use concurrent_hashtbl_insert().
+ * 3. To lookup a key use concurrent_hashtbl_lookup().
+ * 4. To remove a key use concurrent_hashtbl_remove().
+ * 5. To update a value in place use concurrent_hashtbl_cas(),
+ *    concurrent_hashtbl_replace_if() or concurrent_hashtbl_compute().
+ * 6. To delete a table use concurrent_hashtbl_delete().
+ *
+ * Writers lock just the slot they change.  Lookups take no lock at
+ * all: entries are unlinked but only freed once every lookup that
+ * might still see them has finished.
+ *
+ * When an insert takes the table past its load factor a table of
+ * twice the size is allocated and the slots are migrated to it a
+ * stride at a time, in the manner of Java's ConcurrentHashMap: every
+ * insert or remove made while the migration is running claims the
+ * next stride of slots and moves it, leaving a forwarding marker in
+ * each slot it empties.  Lookups that meet a marker carry on in the
+ * new table, so they neither wait for nor take part in a migration,
+ * and no single writer pays for the whole resize.
+ *
+ * Values returned by concurrent_hashtbl_lookup() are not protected
+ * once the call returns: if another thread may remove or replace the
+ * key concurrently, the caller must arrange for the value to stay
+ * valid (e.g., by reference counting it).  Keys and values of removed
+ * entries are freed some time after the removal, by whichever thread
+ * is writing to the table then, so the free functions must be
+ * thread-safe.
+ */
+
+#include "hashtbl.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct concurrent_hashtbl;
+
+/*
+ * Creates a new concurrent hash table.
+ *
+ * The parameters are as for hashtbl_create(); the table always
+ * resizes automatically.
+ *
+ * Returns non-null if the table was created successfully.
+ */
+struct concurrent_hashtbl *concurrent_hashtbl_create(int initial_capacity,
+						     double max_load_factor,
+						     HASHTBL_HASH_FN hash_fun,
+						     HASHTBL_EQUALS_FN equals_fun,
+						     HASHTBL_KEY_FREE_FN key_free_func,
+						     HASHTBL_VAL_FREE_FN val_free_func,
+						     HASHTBL_MALLOC_FN malloc_func,
+						     HASHTBL_FREE_FN free_func);
+
+/*
+ * Deletes the table.  No other thread may be using it.
+ */
+void concurrent_hashtbl_delete(struct concurrent_hashtbl *c);
+
+/*
+ * Inserts a new key/value, or replaces the value of an existing key
+ * (keeping the existing key, as hashtbl_insert() does).
+ *
+ * Returns 0 on success, or 1 if memory couldn't be allocated.
+ */
+int concurrent_hashtbl_insert(struct concurrent_hashtbl *c, void *k, void *v);
+
+/*
+ * Returns the value of k, or NULL if k isn't in the table.  Never
+ * blocks.
+ */
+void *concurrent_hashtbl_lookup(struct concurrent_hashtbl *c, const void *k);
+
+/*
+ * Removes k.
+ *
+ * Returns 0 if k was removed, or 1 if it wasn't in the table.
+ */
+int concurrent_hashtbl_remove(struct concurrent_hashtbl *c, const void *k);
+
+/*
+ * As hashtbl_cas() and hashtbl_replace_if(), atomically with respect
+ * to other writers of k.  pred runs with k's slot locked and must
+ * not call back into the table.
+ *
+ * Returns 0 if the value was replaced, 1 if not, or -1 if memory
+ * couldn't be allocated.
+ */
+int concurrent_hashtbl_cas(struct concurrent_hashtbl *c, const void *k,
+			   void *expected, void *desired);
+int concurrent_hashtbl_replace_if(struct concurrent_hashtbl *c, const void *k,
+				  void *v, HASHTBL_APPLY_FN pred,
+				  const void *client_data);
+
+/*
+ * As hashtbl_compute(), atomically with respect to other writers of
+ * k: fn runs with k's slot locked, so it should be short and must not
+ * call back into the table.  Writers of keys in other slots, and all
+ * lookups, carry on meanwhile.
+ *
+ * Returns 0 on success, or 1 if memory couldn't be allocated (fn is
+ * then not called).
+ */
+int concurrent_hashtbl_compute(struct concurrent_hashtbl *c, void *k,
+			       HASHTBL_COMPUTE_FN fn, void *client_data);
+
+/*
+ * Returns the number of entries.
+ */
+unsigned long concurrent_hashtbl_count(struct concurrent_hashtbl *c);
+
+/*
+ * Returns the number of slots.  While a migration is running this is
+ * the size of the table being migrated from.
+ */
+int concurrent_hashtbl_capacity(struct concurrent_hashtbl *c);
+
+/*
+ * Returns 1 while a migration to a larger table is running, else 0.
+ */
+int concurrent_hashtbl_resizing(struct concurrent_hashtbl *c);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CONCURRENT_HASHTBL_H */
@@ -0,0 +1,338 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* concurrent_hashtbl_test.c - unit tests for concurrent_hashtbl */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "CUnitTest.h"
+#include "concurrent_hashtbl.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NKEYS			25000
+#define NWRITERS		4
+#define NREADERS		2
+#define NSTABLE			1000	/* keys never removed */
+
+static struct concurrent_hashtbl *new_table(int capacity)
+{
+	atomic_store(&test_nfrees, 0);
+	return concurrent_hashtbl_create(capacity, 0.75,
+					 hashtbl_int_hash, hashtbl_int_equals,
+					 test_counting_free, test_counting_free,
+					 NULL, NULL);
+}
+
+/* Test basic operations. */
+
+static int test1(void)
+{
+	struct concurrent_hashtbl *c = new_table(16);
+	int i;
+
+	CUT_ASSERT_NOT_NULL(c);
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_count(c));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, concurrent_hashtbl_insert(c, test_int(i), test_int(i * 2)));
+
+	CUT_ASSERT_EQUAL(1000, concurrent_hashtbl_count(c));
+	CUT_ASSERT_TRUE(concurrent_hashtbl_capacity(c) >= 1024);
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(i * 2, *(int *)concurrent_hashtbl_lookup(c, &i));
+
+	i = 1000;
+	CUT_ASSERT_NULL(concurrent_hashtbl_lookup(c, &i));
+	CUT_ASSERT_EQUAL(1, concurrent_hashtbl_remove(c, &i));
+
+	/* Replacing keeps the old key and drops the old value. */
+	i = 7;
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_insert(c, &i, test_int(-7)));
+	CUT_ASSERT_EQUAL(-7, *(int *)concurrent_hashtbl_lookup(c, &i));
+	CUT_ASSERT_EQUAL(1000, concurrent_hashtbl_count(c));
+
+	for (i = 0; i < 1000; i += 2)
+		CUT_ASSERT_EQUAL(0, concurrent_hashtbl_remove(c, &i));
+
+	CUT_ASSERT_EQUAL(500, concurrent_hashtbl_count(c));
+
+	for (i = 0; i < 1000; i++) {
+		if (i % 2 == 0) {
+			CUT_ASSERT_NULL(concurrent_hashtbl_lookup(c, &i));
+		} else {
+			CUT_ASSERT_NOT_NULL(concurrent_hashtbl_lookup(c, &i));
+		}
+	}
+
+	concurrent_hashtbl_delete(c);
+	CUT_ASSERT_EQUAL(2 * 1000 + 1, atomic_load(&test_nfrees));
+	return 0;
+}
+
+/* A resize is spread over the writes that follow it. */
+
+static int test2(void)
+{
+	struct concurrent_hashtbl *c = new_table(1024);
+	int i, nhelps = 0, missing = -1;
+
+	CUT_ASSERT_NOT_NULL(c);
+
+	for (i = 0; i < 767; i++)
+		CUT_ASSERT_EQUAL(0, concurrent_hashtbl_insert(c, test_int(i), test_int(i)));
+
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_resizing(c));
+
+	/* Crossing the threshold starts it, and moves just one stride. */
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_insert(c, test_int(i), test_int(i)));
+	CUT_ASSERT_EQUAL(1, concurrent_hashtbl_resizing(c));
+	CUT_ASSERT_EQUAL(1024, concurrent_hashtbl_capacity(c));
+
+	/* Lookups see every key, and don't help. */
+	for (i = 0; i < 768; i++)
+		CUT_ASSERT_EQUAL(i, *(int *)concurrent_hashtbl_lookup(c, &i));
+	CUT_ASSERT_EQUAL(1, concurrent_hashtbl_resizing(c));
+
+	while (concurrent_hashtbl_resizing(c)) {
+		CUT_ASSERT_EQUAL(1, concurrent_hashtbl_remove(c, &missing));
+		nhelps++;
+	}
+
+	/* 1024 slots in strides of 16, one of which was already moved. */
+	CUT_ASSERT_EQUAL(1024 / 16 - 1, nhelps);
+	CUT_ASSERT_EQUAL(2048, concurrent_hashtbl_capacity(c));
+
+	for (i = 0; i < 768; i++)
+		CUT_ASSERT_EQUAL(i, *(int *)concurrent_hashtbl_lookup(c, &i));
+
+	concurrent_hashtbl_delete(c);
+	CUT_ASSERT_EQUAL(2 * 768, atomic_load(&test_nfrees));
+	return 0;
+}
+
+/* Readers and writers race with many resizes. */
+
+struct worker {
+	pthread_t tid;
+	struct concurrent_hashtbl *c;
+	int first;
+	int last;
+};
+
+static atomic_int writers_done;
+static atomic_int nmisses;
+
+static void *write_worker(void *arg)
+{
+	struct worker *w = arg;
+	int i;
+
+	for (i = w->first; i < w->last; i++)
+		concurrent_hashtbl_insert(w->c, test_int(i), test_int(i));
+
+	for (i = w->first; i < w->last; i += 2)
+		concurrent_hashtbl_remove(w->c, &i);
+
+	return NULL;
+}
+
+static void *read_worker(void *arg)
+{
+	struct worker *w = arg;
+	const int *v;
+	int i;
+
+	while (!atomic_load(&writers_done)) {
+		for (i = w->first; i < w->last; i++) {
+			v = concurrent_hashtbl_lookup(w->c, &i);
+			if (v == NULL || *v != i)
+				atomic_fetch_add(&nmisses, 1);
+		}
+	}
+
+	return NULL;
+}
+
+static int test3(void)
+{
+	struct concurrent_hashtbl *c = new_table(16);
+	struct worker writers[NWRITERS], readers[NREADERS];
+	int i;
+
+	CUT_ASSERT_NOT_NULL(c);
+	atomic_store(&writers_done, 0);
+	atomic_store(&nmisses, 0);
+
+	for (i = -NSTABLE; i < 0; i++)
+		concurrent_hashtbl_insert(c, test_int(i), test_int(i));
+
+	for (i = 0; i < NREADERS; i++) {
+		readers[i].c = c;
+		readers[i].first = -NSTABLE;
+		readers[i].last = 0;
+		CUT_ASSERT_EQUAL(0, pthread_create(&readers[i].tid, NULL,
+						   read_worker, &readers[i]));
+	}
+
+	for (i = 0; i < NWRITERS; i++) {
+		writers[i].c = c;
+		writers[i].first = i * (NKEYS / NWRITERS);
+		writers[i].last = (i + 1) * (NKEYS / NWRITERS);
+		CUT_ASSERT_EQUAL(0, pthread_create(&writers[i].tid, NULL,
+						   write_worker, &writers[i]));
+	}
+
+	for (i = 0; i < NWRITERS; i++)
+		pthread_join(writers[i].tid, NULL);
+	atomic_store(&writers_done, 1);
+	for (i = 0; i < NREADERS; i++)
+		pthread_join(readers[i].tid, NULL);
+
+	CUT_ASSERT_EQUAL(0, atomic_load(&nmisses));
+	CUT_ASSERT_EQUAL(NSTABLE + NKEYS / 2, concurrent_hashtbl_count(c));
+	CUT_ASSERT_TRUE(concurrent_hashtbl_capacity(c) >= NSTABLE + NKEYS);
+
+	for (i = 0; i < NKEYS; i++) {
+		if (i % 2 == 0) {
+			CUT_ASSERT_NULL(concurrent_hashtbl_lookup(c, &i));
+		} else {
+			CUT_ASSERT_EQUAL(i, *(int *)concurrent_hashtbl_lookup(c, &i));
+		}
+	}
+
+	concurrent_hashtbl_delete(c);
+	CUT_ASSERT_EQUAL(2 * (NSTABLE + NKEYS), atomic_load(&test_nfrees));
+	return 0;
+}
+
+/* Read-modify-write from many threads, without a lock around it. */
+
+#define NUPDATES		5000
+#define NCOUNTERS		8
+
+static void *null_fn(const void *k, void *v, void *p)
+{
+	UNUSED_PARAMETER(k);
+	UNUSED_PARAMETER(v);
+	UNUSED_PARAMETER(p);
+	return NULL;
+}
+
+static void *increment_fn(const void *k, void *v, void *p)
+{
+	UNUSED_PARAMETER(k);
+	UNUSED_PARAMETER(p);
+	return test_int((v != NULL) ? *(int *)v + 1 : 1);
+}
+
+struct updater {
+	pthread_t tid;
+	struct concurrent_hashtbl *counters;
+	struct concurrent_hashtbl *tally;
+};
+
+static void *update_worker(void *arg)
+{
+	struct updater *u = arg;
+	static int tally_key = 0;
+	intptr_t old;
+	int i, k;
+
+	for (i = 0; i < NUPDATES; i++) {
+		k = i % NCOUNTERS;
+		concurrent_hashtbl_compute(u->counters, &k, increment_fn, NULL);
+		do {
+			old = (intptr_t) concurrent_hashtbl_lookup(u->tally, &tally_key);
+		} while (concurrent_hashtbl_cas(u->tally, &tally_key, (void *) old,
+						(void *)(old + 1)) != 0);
+	}
+
+	return NULL;
+}
+
+static int test4(void)
+{
+	static int keys[NCOUNTERS];
+	struct updater updaters[NWRITERS];
+	struct concurrent_hashtbl *counters, *tally;
+	int i;
+
+	/* Keys are static, and tally values are plain integers. */
+	counters = concurrent_hashtbl_create(16, 0.75, hashtbl_int_hash,
+					     hashtbl_int_equals, NULL,
+					     test_counting_free, NULL, NULL);
+	tally = concurrent_hashtbl_create(16, 0.75, hashtbl_int_hash,
+					  hashtbl_int_equals, NULL, NULL,
+					  NULL, NULL);
+	CUT_ASSERT_NOT_NULL(counters);
+	CUT_ASSERT_NOT_NULL(tally);
+	atomic_store(&test_nfrees, 0);
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, concurrent_hashtbl_insert(counters, &keys[i], test_int(0)));
+	}
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_insert(tally, &keys[0], (void *) 1));
+
+	for (i = 0; i < NWRITERS; i++) {
+		updaters[i].counters = counters;
+		updaters[i].tally = tally;
+		CUT_ASSERT_EQUAL(0, pthread_create(&updaters[i].tid, NULL,
+						   update_worker, &updaters[i]));
+	}
+
+	for (i = 0; i < NWRITERS; i++)
+		pthread_join(updaters[i].tid, NULL);
+
+	for (i = 0; i < NCOUNTERS; i++)
+		CUT_ASSERT_EQUAL(NWRITERS * NUPDATES / NCOUNTERS,
+				 *(int *)concurrent_hashtbl_lookup(counters, &i));
+	i = 0;
+	CUT_ASSERT_EQUAL(1 + NWRITERS * NUPDATES,
+			 (intptr_t) concurrent_hashtbl_lookup(tally, &i));
+
+	/* A compute returning NULL removes the key. */
+	CUT_ASSERT_EQUAL(1, concurrent_hashtbl_cas(tally, &i, NULL, (void *) 1));
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_compute(tally, &i, null_fn, NULL));
+	CUT_ASSERT_EQUAL(0, concurrent_hashtbl_count(tally));
+
+	concurrent_hashtbl_delete(counters);
+	concurrent_hashtbl_delete(tally);
+	CUT_ASSERT_EQUAL(NWRITERS * NUPDATES + NCOUNTERS, atomic_load(&test_nfrees));
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS
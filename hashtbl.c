@@ -37,12 +37,16 @@
  */
 
 #include <stddef.h>		/* size_t, offsetof, NULL */
+#include <limits.h>		/* CHAR_BIT */
 #include <stdlib.h>		/* malloc, free */
-#include <string.h>		/* strcmp */
+#include <string.h>		/* strcmp, memcpy, memmove */
+#include <time.h>		/* clock_gettime */
 #if !defined(_MSC_VER)
 #include <stdint.h>		/* intptr_t */
 #endif
 #include "hashtbl.h"
+#include "hashtbl_private.h"
+#include "hashtbl_probes.h"
 
 #define UNUSED_PARAMETER(X)		(void) (X)
 
@@ -50,34 +54,21 @@
 #define HASHTBL_MAX_TABLE_SIZE	(1 << 30)
 #endif
 
-#if defined(_MSC_VER)
-#define INLINE __inline
+/* How far hashtbl_iter_next_n() prefetches ahead, in slots. */
+#define PREFETCH_SLOTS		8
+
+/* Keys hashed and prefetched together by the batch operations. */
+#define BATCH_CHUNK		32
+
+/* Smallest batch whose new entries share one slab. */
+#define BATCH_SLAB_MIN		16
+
+#if defined(__GNUC__)
+#define PREFETCH(ADDR)		__builtin_prefetch((ADDR))
 #else
-#define INLINE inline
+#define PREFETCH(ADDR)		((void) (ADDR))
 #endif
 
-struct hashtbl {
-	double max_load_factor;
-	HASHTBL_HASH_FN hash_fn;
-	HASHTBL_EQUALS_FN equals_fn;
-	unsigned long nentries;
-	int table_size;
-	int resize_threshold;
-	int auto_resize;
-	HASHTBL_KEY_FREE_FN key_free_fn;
-	HASHTBL_VAL_FREE_FN val_free_fn;
-	HASHTBL_MALLOC_FN malloc_fn;
-	HASHTBL_FREE_FN free_fn;
-	struct hashtbl_entry **table;
-};
-
-struct hashtbl_entry {
-	struct hashtbl_entry *next;
-	void *key;
-	void *val;
-	unsigned int hash;	/* hash of key */
-};
-
 static int roundup_to_next_power_of_2(int x)
 {
 	int n = 1;
@@ -104,14 +95,26 @@ static int is_power_of_2(int x)
 	return ((x & (x - 1)) == 0);
 }
 
-static INLINE struct hashtbl_entry ** tbl_entry_ref(struct hashtbl *h,
-						    unsigned int hashval)
+/* Monotonic time in microseconds, used to time resizes. */
+static double now_usecs(void)
+{
+#if defined(_MSC_VER)
+	return (double)clock() * 1e6 / CLOCKS_PER_SEC;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+#endif
+}
+
+static INLINE struct hashtbl_node ** tbl_node_ref(struct hashtbl *h,
+						  unsigned int hashval)
 {
 	return &h->table[(int)hashval & (h->table_size - 1)];
 }
 
-static INLINE struct hashtbl_entry * tbl_entry(struct hashtbl *h,
-					       unsigned int hashval)
+static INLINE struct hashtbl_node * tbl_node(struct hashtbl *h,
+					     unsigned int hashval)
 {
 	return h->table[(int)hashval & (h->table_size - 1)];
 }
@@ -121,56 +124,95 @@ static INLINE int resize_threshold(int capacity, double max_load_factor)
 	return (int)(((double)capacity * max_load_factor) + 0.5);
 }
 
-static INLINE void unlink_entry(struct hashtbl *h,
-				struct hashtbl_entry **head,
-				struct hashtbl_entry *entry)
+static INLINE void unlink_node(struct hashtbl *h,
+			       struct hashtbl_node **head,
+			       struct hashtbl_node *node)
 {
-	*head = entry->next;
+	*head = node->next;
 	h->nentries--;
 }
 
-static INLINE void link_entry(struct hashtbl *h, struct hashtbl_entry *entry)
+static INLINE void link_node(struct hashtbl *h, struct hashtbl_node *node)
 {
-	struct hashtbl_entry **head = tbl_entry_ref(h, entry->hash);
-	entry->next = *head;
-	*head = entry;
+	struct hashtbl_node **head = tbl_node_ref(h, node->hash);
+	node->next = *head;
+	*head = node;
 	h->nentries++;
 }
 
-static INLINE struct hashtbl_entry *find_entry(struct hashtbl *h, unsigned int hv,
-					       const void *k)
+/*
+ * Search the hashed slot for k.  The number of entries walked is
+ * stored in depth.
+ */
+static INLINE struct hashtbl_node *find_node(struct hashtbl *h, unsigned int hv,
+					     const void *k, unsigned int *depth)
 {
-	struct hashtbl_entry *entry = tbl_entry(h, hv);
+	struct hashtbl_node *node = tbl_node(h, hv);
+	unsigned int n = 0;
 
-	while (entry != NULL) {
-		if (entry->hash == hv && h->equals_fn(entry->key, k))
+	while (node != NULL) {
+		n++;
+		if (node->hash == hv && h->equals_fn(hashtbl_node_key(h, node), k))
 			break;
-		entry = entry->next;
+		node = node->next;
 	}
 
-	return entry;
+	*depth = n;
+	return node;
 }
 
 /*
  * Remove an entry from the hash table without deleting the underlying
- * instance.  Returns the entry, or NULL if not found.
+ * instance.  Returns the node, or NULL if not found.
  */
-static struct hashtbl_entry *remove_key(struct hashtbl *h, const void *k)
+static struct hashtbl_node *remove_hashed(struct hashtbl *h, unsigned int hv,
+					   const void *k)
 {
-	unsigned int hv = h->hash_fn(k);
-	struct hashtbl_entry **head = tbl_entry_ref(h, hv);
-	struct hashtbl_entry *entry = *head;
-
-	while (entry != NULL) {
-		if (entry->hash == hv && h->equals_fn(entry->key, k)) {
-			unlink_entry(h, head, entry);
+	struct hashtbl_node **head = tbl_node_ref(h, hv);
+	struct hashtbl_node *node = *head;
+	unsigned int depth = 0;
+
+	while (node != NULL) {
+		depth++;
+		if (node->hash == hv && h->equals_fn(hashtbl_node_key(h, node), k)) {
+			unlink_node(h, head, node);
 			break;
 		}
-		head = &entry->next;
-		entry = entry->next;
+		head = &node->next;
+		node = node->next;
 	}
 
-	return entry;
+	HASHTBL_PROBE4(hashtbl, remove, h, hv, depth, node != NULL);
+	return node;
+}
+
+static struct hashtbl_node *remove_key(struct hashtbl *h, const void *k)
+{
+	return remove_hashed(h, h->hash_fn(k), k);
+}
+
+static struct hashtbl_node *lookup_key(struct hashtbl *h, const void *k)
+{
+	unsigned int hv = h->hash_fn(k);
+	unsigned int depth;
+	struct hashtbl_node *node = find_node(h, hv, k, &depth);
+
+	HASHTBL_PROBE4(hashtbl, lookup, h, hv, depth, node != NULL);
+
+	if (h->sampler != NULL)
+		hashtbl_sampler_record(h->sampler, hv, depth);
+
+	return node;
+}
+
+static INLINE void maybe_grow(struct hashtbl *h)
+{
+	if (h->auto_resize) {
+		if (h->nentries >= (unsigned int)h->resize_threshold) {
+			/* auto resize failures are benign. */
+			(void)hashtbl_resize(h, 2 * h->table_size);
+		}
+	}
 }
 
 static struct hashtbl_entry * hashtbl_entry_new(struct hashtbl *h, unsigned int hv,
@@ -183,85 +225,445 @@ static struct hashtbl_entry * hashtbl_entry_new(struct hashtbl *h, unsigned int
 
 	entry->key = k;
 	entry->val = v;
-	entry->hash = hv;
-	entry->next = NULL;
+	entry->node.hash = hv;
+	entry->node.next = NULL;
 
 	return entry;
 }
 
+/*
+ * Allocates a slab for n entries and adds it to the index, which is
+ * kept sorted by address so that hashtbl_entry_slab() can bisect it.
+ */
+static struct hashtbl_slab *slab_new(struct hashtbl *h, unsigned long n)
+{
+	struct hashtbl_slab *slab, **slabs;
+	int i;
+
+	slab = h->malloc_fn(offsetof(struct hashtbl_slab, entries) +
+			    n * sizeof(slab->entries[0]));
+	if (slab == NULL)
+		return NULL;
+
+	if (h->nslabs == h->slabs_size) {
+		int size = (h->slabs_size > 0) ? 2 * h->slabs_size : 4;
+		if ((slabs = h->malloc_fn((size_t) size * sizeof(*slabs))) == NULL) {
+			h->free_fn(slab);
+			return NULL;
+		}
+		if (h->slabs != NULL) {
+			memcpy(slabs, h->slabs, (size_t) h->nslabs * sizeof(*slabs));
+			h->free_fn(h->slabs);
+		}
+		h->slabs = slabs;
+		h->slabs_size = size;
+	}
+
+	for (i = h->nslabs; i > 0; i--) {
+		if ((uintptr_t)h->slabs[i - 1] < (uintptr_t)slab)
+			break;
+		h->slabs[i] = h->slabs[i - 1];
+	}
+	h->slabs[i] = slab;
+	h->nslabs++;
+
+	slab->nlive = 0;
+	slab->nused = 0;
+	slab->size = n;
+
+	return slab;
+}
+
+static void slab_free(struct hashtbl *h, struct hashtbl_slab *slab)
+{
+	int i;
+
+	for (i = 0; h->slabs[i] != slab; i++)
+		;
+	h->nslabs--;
+	memmove(&h->slabs[i], &h->slabs[i + 1],
+		(size_t)(h->nslabs - i) * sizeof(h->slabs[0]));
+	h->free_fn(slab);
+
+	if (h->nslabs == 0) {
+		h->free_fn(h->slabs);
+		h->slabs = NULL;
+		h->slabs_size = 0;
+	}
+}
+
+void hashtbl_entry_free(struct hashtbl *h, struct hashtbl_entry *entry)
+{
+	struct hashtbl_slab *slab;
+
+	if ((slab = hashtbl_entry_slab(h, entry)) == NULL) {
+		h->free_fn(entry);
+		return;
+	}
+
+	/* The slab being filled is kept until the pass ends. */
+	if (--slab->nlive == 0 && slab != h->defrag_slab)
+		slab_free(h, slab);
+}
+
+/*
+ * Releases an entry that has been unlinked from the table, and its
+ * key and value unless they are NULL (see hashtbl_steal()).
+ */
+static void release_entry(struct hashtbl *h, struct hashtbl_entry *entry,
+			  void *key, void *val)
+{
+	if (h->reclaim_fn != NULL && hashtbl_entry_slab(h, entry) == NULL) {
+		h->reclaim_fn(entry, key, val, h->reclaim_client_data);
+		return;
+	}
+
+	if (h->key_free_fn != NULL && key != NULL)
+		h->key_free_fn(key);
+	if (h->val_free_fn != NULL && val != NULL)
+		h->val_free_fn(val);
+	hashtbl_entry_free(h, entry);
+}
+
 int hashtbl_insert(struct hashtbl *h, void *k, void *v)
 {
+	struct hashtbl_node *node;
 	struct hashtbl_entry *entry;
-	unsigned int hv = h->hash_fn(k);
+	unsigned int hv;
+	unsigned int depth;
+
+	if (h->intrusive)
+		return 1;
+
+	hv = h->hash_fn(k);
 
-	if ((entry = find_entry(h, hv, k)) != NULL) {
+	if ((node = find_node(h, hv, k, &depth)) != NULL) {
+		entry = (struct hashtbl_entry *)node;
 		if (h->val_free_fn != NULL)
 			h->val_free_fn(entry->val);
 		entry->val = v;
 		return 0;
 	}
 
-	if (h->auto_resize) {
-		if (h->nentries >= (unsigned int)h->resize_threshold) {
-			/* auto resize failures are benign. */
-			(void)hashtbl_resize(h, 2 * h->table_size);
-		}
-	}
+	maybe_grow(h);
 
 	if ((entry = hashtbl_entry_new(h, hv, k, v)) == NULL)
 		return 1;
 
-	link_entry(h, entry);
+	link_node(h, &entry->node);
+	HASHTBL_PROBE3(hashtbl, insert, h, hv, depth);
 
 	return 0;
 }
 
 void * hashtbl_lookup(struct hashtbl *h, const void *k)
 {
-	struct hashtbl_entry *entry = find_entry(h, h->hash_fn(k), k);
-	return (entry != NULL) ? entry->val : NULL;
+	struct hashtbl_node *node = lookup_key(h, k);
+
+	return (node != NULL) ? hashtbl_node_val(h, node) : NULL;
+}
+
+/* Release a node that has been unlinked from the table. */
+
+static void release_node(struct hashtbl *h, struct hashtbl_node *node)
+{
+	struct hashtbl_entry *entry = (struct hashtbl_entry *)node;
+
+	if (h->intrusive) {
+		if (h->node_free_fn != NULL)
+			h->node_free_fn(node);
+		return;
+	}
+
+	release_entry(h, entry, entry->key, entry->val);
 }
 
 int hashtbl_remove(struct hashtbl *h, const void *k)
 {
-	struct hashtbl_entry *entry = remove_key(h, k);
+	struct hashtbl_node *node = remove_key(h, k);
 
-	if (entry != NULL) {
-		if (h->key_free_fn != NULL)
-			h->key_free_fn(entry->key);
-		if (h->val_free_fn != NULL && entry->val != NULL)
-			h->val_free_fn(entry->val);
-		h->free_fn(entry);
+	if (node == NULL)
+		return 1;
+
+	release_node(h, node);
+
+	return 0;
+}
+
+int hashtbl_steal(struct hashtbl *h, const void *k, void **key, void **val)
+{
+	struct hashtbl_node *node = remove_key(h, k);
+
+	if (node != NULL) {
+		if (key != NULL)
+			*key = hashtbl_node_key(h, node);
+		if (val != NULL)
+			*val = hashtbl_node_val(h, node);
+		if (!h->intrusive)
+			release_entry(h, (struct hashtbl_entry *)node, NULL, NULL);
 		return 0;
 	}
 
 	return 1;
 }
 
-void hashtbl_clear(struct hashtbl *h)
+int hashtbl_cas(struct hashtbl *h, const void *k, void *expected,
+		void *desired)
+{
+	struct hashtbl_entry *entry;
+
+	if (h->intrusive)
+		return 1;
+
+	entry = (struct hashtbl_entry *)lookup_key(h, k);
+	if (entry == NULL || entry->val != expected)
+		return 1;
+
+	if (h->val_free_fn != NULL && expected != NULL && expected != desired)
+		h->val_free_fn(expected);
+	entry->val = desired;
+
+	return 0;
+}
+
+int hashtbl_replace_if(struct hashtbl *h, const void *k, void *v,
+		       HASHTBL_APPLY_FN pred, const void *client_data)
+{
+	struct hashtbl_entry *entry;
+
+	if (h->intrusive)
+		return 1;
+
+	entry = (struct hashtbl_entry *)lookup_key(h, k);
+	if (entry == NULL || !pred(entry->key, entry->val, client_data))
+		return 1;
+
+	if (h->val_free_fn != NULL && entry->val != NULL && entry->val != v)
+		h->val_free_fn(entry->val);
+	entry->val = v;
+
+	return 0;
+}
+
+int hashtbl_compute(struct hashtbl *h, void *k, HASHTBL_COMPUTE_FN fn,
+		    void *client_data)
+{
+	struct hashtbl_entry *entry;
+	struct hashtbl_node *node;
+	unsigned int hv, depth;
+	void *v;
+
+	if (h->intrusive)
+		return 1;
+
+	hv = h->hash_fn(k);
+
+	if ((node = find_node(h, hv, k, &depth)) == NULL) {
+		/* Allocate first, so that fn's result is never lost. */
+		maybe_grow(h);
+		if ((entry = hashtbl_entry_new(h, hv, k, NULL)) == NULL)
+			return 1;
+		if ((entry->val = fn(k, NULL, client_data)) == NULL) {
+			hashtbl_entry_free(h, entry);
+			return 0;
+		}
+		link_node(h, &entry->node);
+		HASHTBL_PROBE3(hashtbl, insert, h, hv, depth);
+		return 0;
+	}
+
+	entry = (struct hashtbl_entry *)node;
+	v = fn(entry->key, entry->val, client_data);
+
+	if (v == NULL) {
+		remove_key(h, k);
+		release_entry(h, entry, entry->key, entry->val);
+	} else if (v != entry->val) {
+		if (h->val_free_fn != NULL && entry->val != NULL)
+			h->val_free_fn(entry->val);
+		entry->val = v;
+	}
+
+	return 0;
+}
+
+/*
+ * Grow once for a batch of n new keys, rather than doubling
+ * repeatedly as they go in.  A failure is benign: the inserts grow
+ * the table as usual.
+ */
+static void reserve(struct hashtbl *h, unsigned long n)
+{
+	int capacity = h->table_size;
+
+	if (!h->auto_resize)
+		return;
+
+	while (capacity < HASHTBL_MAX_TABLE_SIZE &&
+	       h->nentries + n > (unsigned long)resize_threshold(capacity,
+								   h->max_load_factor))
+		capacity *= 2;
+
+	if (capacity != h->table_size)
+		(void)hashtbl_resize(h, capacity);
+}
+
+/*
+ * Hash a chunk of keys and prefetch first their slots, then the head
+ * of each slot's chain, so that the misses overlap instead of being
+ * taken one key at a time.
+ */
+static void prefetch_chunk(struct hashtbl *h, void *const *keys,
+			   unsigned int *hv, int n)
 {
+	struct hashtbl_node *node;
 	int i;
-	struct hashtbl_entry *entry, *next;
 
-	for (i = 0; i < h->table_size; i++) {
-		next = h->table[i];
-		while ((entry = next) != NULL) {
-			if (h->key_free_fn != NULL)
-				h->key_free_fn(entry->key);
-			if (h->val_free_fn != NULL)
-				h->val_free_fn(entry->val);
-			next = entry->next;
-			entry->next = NULL;
-			h->free_fn(entry);
-			h->nentries--;
+	for (i = 0; i < n; i++) {
+		hv[i] = h->hash_fn(keys[i]);
+		PREFETCH(tbl_node_ref(h, hv[i]));
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((node = tbl_node(h, hv[i])) != NULL)
+			PREFETCH(node);
+	}
+}
+
+int hashtbl_insert_batch(struct hashtbl *h, void **keys, void **vals, int n)
+{
+	unsigned int hv[BATCH_CHUNK];
+	struct hashtbl_slab *slab = NULL;
+	struct hashtbl_entry *entry;
+	struct hashtbl_node *node;
+	unsigned int depth;
+	int i, j, m, ninserted = 0;
+
+	if (h->intrusive || n <= 0)
+		return 0;
+
+	reserve(h, (unsigned long)n);
+
+	/* Without a slab the entries are allocated one by one. */
+	if (n >= BATCH_SLAB_MIN)
+		slab = slab_new(h, (unsigned long)n);
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < BATCH_CHUNK) ? n - i : BATCH_CHUNK;
+		prefetch_chunk(h, keys + i, hv, m);
+
+		for (j = 0; j < m; j++) {
+			if ((node = find_node(h, hv[j], keys[i + j], &depth)) != NULL) {
+				entry = (struct hashtbl_entry *)node;
+				if (h->val_free_fn != NULL)
+					h->val_free_fn(entry->val);
+				entry->val = vals[i + j];
+				ninserted++;
+				continue;
+			}
+
+			maybe_grow(h);
+
+			if (slab != NULL && slab->nused < slab->size) {
+				entry = &slab->entries[slab->nused++];
+				slab->nlive++;
+				entry->key = keys[i + j];
+				entry->val = vals[i + j];
+				entry->node.hash = hv[j];
+			} else {
+				entry = hashtbl_entry_new(h, hv[j], keys[i + j],
+							  vals[i + j]);
+				if (entry == NULL)
+					goto out;
+			}
+
+			link_node(h, &entry->node);
+			HASHTBL_PROBE3(hashtbl, insert, h, hv[j], depth);
+			ninserted++;
+		}
+	}
+
+out:
+	/* Every key was already present. */
+	if (slab != NULL && slab->nlive == 0)
+		slab_free(h, slab);
+
+	return ninserted;
+}
+
+int hashtbl_remove_batch(struct hashtbl *h, void *const *keys, int n)
+{
+	unsigned int hv[BATCH_CHUNK];
+	struct hashtbl_node *node;
+	int i, j, m, nremoved = 0;
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < BATCH_CHUNK) ? n - i : BATCH_CHUNK;
+		prefetch_chunk(h, keys + i, hv, m);
+
+		for (j = 0; j < m; j++) {
+			if ((node = remove_hashed(h, hv[j], keys[i + j])) != NULL) {
+				release_node(h, node);
+				nremoved++;
+			}
+		}
+	}
+
+	return nremoved;
+}
+
+/* Removes and frees every entry in slot i. */
+
+static void clear_slot(struct hashtbl *h, int i)
+{
+	struct hashtbl_node *node, *next;
+	struct hashtbl_entry *entry;
+
+	next = h->table[i];
+	while ((node = next) != NULL) {
+		next = node->next;
+		node->next = NULL;
+		h->nentries--;
+		if (h->intrusive) {
+			if (h->node_free_fn != NULL)
+				h->node_free_fn(node);
+			continue;
 		}
-		h->table[i] = next;
+		entry = (struct hashtbl_entry *)node;
+		release_entry(h, entry, entry->key, entry->val);
+	}
+	h->table[i] = NULL;
+}
+
+/* Abandon any defragment in progress. */
+
+static void end_defragment(struct hashtbl *h)
+{
+	struct hashtbl_slab *slab = h->defrag_slab;
+
+	if (slab != NULL) {
+		h->defrag_slab = NULL;
+		if (slab->nlive == 0)
+			slab_free(h, slab);
 	}
 }
 
+void hashtbl_clear(struct hashtbl *h)
+{
+	int i;
+
+	for (i = 0; i < h->table_size; i++)
+		clear_slot(h, i);
+
+	end_defragment(h);
+}
+
 void hashtbl_delete(struct hashtbl *h)
 {
 	hashtbl_clear(h);
+	hashtbl_disable_sampling(h);
+	if (h->slabs != NULL)
+		h->free_fn(h->slabs);
 	h->free_fn(h->table);
 	h->free_fn(h);
 }
@@ -313,6 +715,20 @@ struct hashtbl *hashtbl_create(int capacity,
 	h->val_free_fn = val_free_fn;
 	h->malloc_fn = malloc_fn;
 	h->free_fn = free_fn;
+	h->resize_fn = NULL;
+	h->resize_client_data = NULL;
+	h->sampler = NULL;
+	h->intrusive = 0;
+	h->key_offset = 0;
+	h->node_key_fn = NULL;
+	h->node_free_fn = NULL;
+	h->slabs = NULL;
+	h->nslabs = 0;
+	h->slabs_size = 0;
+	h->defrag_slab = NULL;
+	h->defrag_pos = 0;
+	h->reclaim_fn = NULL;
+	h->reclaim_client_data = NULL;
 	h->table = NULL;
 
 	if (hashtbl_resize(h, capacity) != 0) {
@@ -326,9 +742,12 @@ struct hashtbl *hashtbl_create(int capacity,
 int hashtbl_resize(struct hashtbl *h, int capacity)
 {
 	int i;
-	struct hashtbl_entry **new_table;
+	struct hashtbl_node **new_table;
 	size_t nbytes;
 	struct hashtbl tmp_h;
+	int old_size = h->table_size;
+	struct hashtbl_resize_event event;
+	double start = 0.0;
 
 	if (capacity < 1) {
 		capacity = 1;
@@ -348,6 +767,18 @@ int hashtbl_resize(struct hashtbl *h, int capacity)
 	if ((tmp_h.table = h->malloc_fn(nbytes)) == NULL)
 		return 1;
 
+	HASHTBL_PROBE3(hashtbl, resize__start, h, old_size, capacity);
+
+	if (h->resize_fn != NULL) {
+		event.old_capacity = old_size;
+		event.new_capacity = capacity;
+		event.entries_moved = 0;
+		event.bytes_allocated = nbytes;
+		event.elapsed_usecs = 0.0;
+		h->resize_fn(h, HASHTBL_RESIZE_BEGIN, &event, h->resize_client_data);
+		start = now_usecs();
+	}
+
 	memset(tmp_h.table, 0, nbytes);
 	tmp_h.nentries = 0;
 	tmp_h.table_size = capacity;
@@ -355,11 +786,11 @@ int hashtbl_resize(struct hashtbl *h, int capacity)
 	/* Transfer all entries from old table to new table. */
 
 	for (i = 0; i < h->table_size; i++) {
-		struct hashtbl_entry **head = &h->table[i];
-		struct hashtbl_entry *entry;
-		while ((entry = *head) != NULL) {
-			unlink_entry(h, head, entry);
-			link_entry(&tmp_h, entry);
+		struct hashtbl_node **head = &h->table[i];
+		struct hashtbl_node *node;
+		while ((node = *head) != NULL) {
+			unlink_node(h, head, node);
+			link_node(&tmp_h, node);
 			/* Look for other chained keys in this slot */
 			head = &h->table[i];
 		}
@@ -372,9 +803,80 @@ int hashtbl_resize(struct hashtbl *h, int capacity)
 	h->nentries = tmp_h.nentries;
 	h->resize_threshold = resize_threshold(capacity, h->max_load_factor);
 
+	HASHTBL_PROBE3(hashtbl, resize__done, h, old_size, capacity);
+
+	if (h->resize_fn != NULL) {
+		event.entries_moved = h->nentries;
+		event.elapsed_usecs = now_usecs() - start;
+		h->resize_fn(h, HASHTBL_RESIZE_END, &event, h->resize_client_data);
+	}
+
+	return 0;
+}
+
+int hashtbl_defragment(struct hashtbl *h, long budget_usecs)
+{
+	struct hashtbl_slab *slab = h->defrag_slab;
+	double deadline = now_usecs() + (double)budget_usecs;
+
+	if (h->intrusive)
+		return 0;
+
+	if (slab == NULL) {
+		if (h->nentries == 0)
+			return 0;
+		if ((slab = slab_new(h, h->nentries)) == NULL)
+			return -1;
+		h->defrag_slab = slab;
+		h->defrag_pos = 0;
+	}
+
+	while (h->defrag_pos < h->table_size) {
+		struct hashtbl_node **ref = &h->table[h->defrag_pos];
+		struct hashtbl_node *node;
+
+		while ((node = *ref) != NULL) {
+			struct hashtbl_entry *entry = (struct hashtbl_entry *)node;
+			struct hashtbl_entry *copy;
+
+			if (hashtbl_entry_slab(h, entry) == slab) {
+				ref = &node->next;
+				continue;
+			}
+
+			/* Keys added since the pass began stay where they are. */
+			if (slab->nused == slab->size)
+				goto done;
+
+			copy = &slab->entries[slab->nused++];
+			*copy = *entry;
+			slab->nlive++;
+			*ref = &copy->node;
+			hashtbl_entry_free(h, entry);
+			ref = &copy->node.next;
+		}
+
+		h->defrag_pos++;
+
+		if (budget_usecs > 0 && (h->defrag_pos & 63) == 0 &&
+		    h->defrag_pos < h->table_size && now_usecs() >= deadline)
+			return 1;
+	}
+
+done:
+	end_defragment(h);
+
 	return 0;
 }
 
+void hashtbl_set_resize_callback(struct hashtbl *h,
+				 HASHTBL_RESIZE_FN fn,
+				 void *client_data)
+{
+	h->resize_fn = fn;
+	h->resize_client_data = client_data;
+}
+
 unsigned long hashtbl_apply(const struct hashtbl *h,
 			    HASHTBL_APPLY_FN apply,
 			    void *client_data)
@@ -383,18 +885,141 @@ unsigned long hashtbl_apply(const struct hashtbl *h,
 	int i;
 
 	for (i = 0; i < h->table_size; i++) {
-		struct hashtbl_entry *entry = h->table[i];
-		while (entry != NULL) {
+		struct hashtbl_node *node = h->table[i];
+		while (node != NULL) {
 			nentries++;
-			if (!apply(entry->key, entry->val, client_data))
+			if (!apply(hashtbl_node_key(h, node),
+				   hashtbl_node_val(h, node), client_data))
 				return nentries;
-			entry = entry->next;
+			node = node->next;
 		}
 	}
 
 	return nentries;
 }
 
+/* Reverse the bits of v (from Redis's dict.c). */
+
+static unsigned long rev(unsigned long v)
+{
+	unsigned long s = CHAR_BIT * sizeof(v);
+	unsigned long mask = ~0UL;
+
+	while ((s >>= 1) > 0) {
+		mask ^= (mask << s);
+		v = ((v >> s) & mask) | ((v << s) & ~mask);
+	}
+
+	return v;
+}
+
+/*
+ * The scan cursor is a slot index whose bits are incremented from the
+ * most significant end.  When the table doubles, slot i splits into
+ * i and i + old size, which sit next to each other in that order, so
+ * the slots already visited at the old size map to exactly the
+ * slots already visited at the new size.
+ */
+static INLINE unsigned long next_cursor(const struct hashtbl *h,
+					unsigned long cursor)
+{
+	/* Set the unmasked bits so that the increment carries over
+	 * them, then increment the reversed cursor. */
+	cursor |= ~((unsigned long)h->table_size - 1);
+	cursor = rev(cursor);
+	cursor++;
+	return rev(cursor);
+}
+
+static INLINE int cursor_slot(const struct hashtbl *h, unsigned long cursor)
+{
+	return (int)(cursor & ((unsigned long)h->table_size - 1));
+}
+
+/* Returns 1 if a step has used up its slots or its time. */
+
+static INLINE int step_done(int nslots, int max_slots,
+			    long budget_usecs, double deadline)
+{
+	if (max_slots > 0 && nslots >= max_slots)
+		return 1;
+	return (budget_usecs > 0 && (nslots & 63) == 0 &&
+		now_usecs() >= deadline);
+}
+
+unsigned long hashtbl_scan(struct hashtbl *h, unsigned long cursor,
+			   HASHTBL_SCAN_FN fn, void *p)
+{
+	struct hashtbl_node *node, *next;
+
+	for (node = h->table[cursor_slot(h, cursor)]; node != NULL; node = next) {
+		next = node->next;
+		fn(hashtbl_node_key(h, node), hashtbl_node_val(h, node), p);
+	}
+
+	return next_cursor(h, cursor);
+}
+
+int hashtbl_apply_step(struct hashtbl *h, unsigned long *cursor,
+		       HASHTBL_APPLY_FN fn, void *p,
+		       int max_slots, long budget_usecs)
+{
+	double deadline = now_usecs() + (double)budget_usecs;
+	int nslots = 0;
+
+	do {
+		struct hashtbl_node *node = h->table[cursor_slot(h, *cursor)];
+
+		for (; node != NULL; node = node->next) {
+			if (!fn(hashtbl_node_key(h, node),
+				hashtbl_node_val(h, node), p)) {
+				*cursor = 0;
+				return 0;
+			}
+		}
+
+		*cursor = next_cursor(h, *cursor);
+		nslots++;
+	} while (*cursor != 0 &&
+		 !step_done(nslots, max_slots, budget_usecs, deadline));
+
+	return *cursor != 0;
+}
+
+int hashtbl_clear_step(struct hashtbl *h, unsigned long *cursor,
+		       int max_slots, long budget_usecs)
+{
+	double deadline = now_usecs() + (double)budget_usecs;
+	int nslots = 0;
+
+	do {
+		clear_slot(h, cursor_slot(h, *cursor));
+		*cursor = next_cursor(h, *cursor);
+		nslots++;
+	} while (*cursor != 0 &&
+		 !step_done(nslots, max_slots, budget_usecs, deadline));
+
+	if (*cursor != 0)
+		return 1;
+
+	end_defragment(h);
+	return 0;
+}
+
+int hashtbl_delete_step(struct hashtbl *h, unsigned long *cursor,
+			int max_slots, long budget_usecs)
+{
+	if (hashtbl_clear_step(h, cursor, max_slots, budget_usecs) != 0)
+		return 1;
+
+	hashtbl_disable_sampling(h);
+	if (h->slabs != NULL)
+		h->free_fn(h->slabs);
+	h->free_fn(h->table);
+	h->free_fn(h);
+	return 0;
+}
+
 void hashtbl_iter_init(struct hashtbl *h, struct hashtbl_iter *iter)
 {
 	iter->key = iter->val = NULL;
@@ -405,7 +1030,48 @@ void hashtbl_iter_init(struct hashtbl *h, struct hashtbl_iter *iter)
 
 	*(int *)&iter->pos = h->table_size;
 	*(int *)&iter->pos = 0;
-	*(struct hashtbl_entry **)&iter->entry = NULL;
+	*(struct hashtbl_node **)&iter->node = NULL;
+}
+
+int hashtbl_iter_next_n(struct hashtbl *h, struct hashtbl_iter *iter,
+			void **keys, void **vals, int n)
+{
+	const struct hashtbl_node *node = iter->node;
+	int i = iter->pos, count = 0;
+
+	/* Step past the entry returned last. */
+	if (node != NULL && (node = node->next) == NULL)
+		i++;
+
+	while (count < n) {
+		if (node == NULL) {
+			for (; i < h->table_size; i++) {
+				if (i + PREFETCH_SLOTS < h->table_size)
+					PREFETCH(h->table[i + PREFETCH_SLOTS]);
+				if ((node = h->table[i]) != NULL)
+					break;
+			}
+			if (node == NULL)
+				break;
+		}
+
+		PREFETCH(node->next);
+		iter->key = hashtbl_node_key(h, node);
+		iter->val = hashtbl_node_val(h, node);
+		if (keys != NULL)
+			keys[count] = iter->key;
+		if (vals != NULL)
+			vals[count] = iter->val;
+		count++;
+
+		*(const struct hashtbl_node **)&iter->node = node;
+		*(int *)&iter->pos = i;
+
+		if ((node = node->next) == NULL)
+			i++;
+	}
+
+	return count;
 }
 
 int hashtbl_iter_next(struct hashtbl *h, struct hashtbl_iter *iter)
@@ -416,11 +1082,11 @@ int hashtbl_iter_next(struct hashtbl *h, struct hashtbl_iter *iter)
 	 * If we're already walking a chain then continue down that
 	 * chain.
 	 */
-	if (iter->entry != NULL) {
-		*(struct hashtbl_entry **)&iter->entry = iter->entry->next;
-		if (iter->entry != NULL) {
-			iter->key = iter->entry->key;
-			iter->val = iter->entry->val;
+	if (iter->node != NULL) {
+		*(struct hashtbl_node **)&iter->node = iter->node->next;
+		if (iter->node != NULL) {
+			iter->key = hashtbl_node_key(h, iter->node);
+			iter->val = hashtbl_node_val(h, iter->node);
 			return 1;
 		} else {
 			*(int *)&iter->pos = iter->pos + 1;
@@ -428,11 +1094,11 @@ int hashtbl_iter_next(struct hashtbl *h, struct hashtbl_iter *iter)
 	}
 
 	for (i = iter->pos; i < h->table_size; i++) {
-		*(struct hashtbl_entry **)&iter->entry = h->table[i];
+		*(struct hashtbl_node **)&iter->node = h->table[i];
 		*(int *)&iter->pos = i;
-		if (iter->entry != NULL) {
-			iter->key = iter->entry->key;
-			iter->val = iter->entry->val;
+		if (iter->node != NULL) {
+			iter->key = hashtbl_node_key(h, iter->node);
+			iter->val = hashtbl_node_val(h, iter->node);
 			return 1;
 		}
 	}
@@ -444,3 +1110,111 @@ double hashtbl_load_factor(const struct hashtbl *h)
 {
 	return (double)h->nentries / (double)h->table_size;
 }
+
+int hashtbl_enable_sampling(struct hashtbl *h, int capacity, unsigned int rate)
+{
+	struct hashtbl_sampler *s;
+
+	if ((s = hashtbl_sampler_create(capacity, rate,
+					h->malloc_fn, h->free_fn)) == NULL)
+		return 1;
+
+	hashtbl_disable_sampling(h);
+	h->sampler = s;
+
+	return 0;
+}
+
+void hashtbl_disable_sampling(struct hashtbl *h)
+{
+	if (h->sampler != NULL) {
+		hashtbl_sampler_delete(h->sampler);
+		h->sampler = NULL;
+	}
+}
+
+int hashtbl_hot_keys(const struct hashtbl *h,
+		     struct hashtbl_sample *out,
+		     int n,
+		     int order)
+{
+	if (h->sampler == NULL)
+		return 0;
+
+	return hashtbl_sampler_top(h->sampler, out, n, order);
+}
+
+struct hashtbl *hashtbl_create_intrusive(int capacity,
+					 double max_load_factor,
+					 int auto_resize,
+					 ptrdiff_t key_offset,
+					 HASHTBL_NODE_KEY_FN key_fn,
+					 HASHTBL_HASH_FN hash_fn,
+					 HASHTBL_EQUALS_FN equals_fn,
+					 HASHTBL_NODE_FREE_FN node_free_fn,
+					 HASHTBL_MALLOC_FN malloc_fn,
+					 HASHTBL_FREE_FN free_fn)
+{
+	struct hashtbl *h;
+
+	h = hashtbl_create(capacity, max_load_factor, auto_resize,
+			   hash_fn, equals_fn, NULL, NULL, malloc_fn, free_fn);
+
+	if (h != NULL) {
+		h->intrusive = 1;
+		h->key_offset = key_offset;
+		h->node_key_fn = key_fn;
+		h->node_free_fn = node_free_fn;
+	}
+
+	return h;
+}
+
+struct hashtbl_node *hashtbl_insert_node(struct hashtbl *h,
+					 struct hashtbl_node *node)
+{
+	const void *k = hashtbl_node_key(h, node);
+	unsigned int hv = h->hash_fn(k);
+	struct hashtbl_node **head = tbl_node_ref(h, hv);
+	struct hashtbl_node *old = *head;
+	unsigned int depth = 0;
+
+	node->hash = hv;
+
+	/* Replace an equal key in place. */
+
+	while (old != NULL) {
+		depth++;
+		if (old->hash == hv && h->equals_fn(hashtbl_node_key(h, old), k)) {
+			if (old == node)
+				return NULL;	/* already linked */
+			node->next = old->next;
+			*head = node;
+			old->next = NULL;
+			return old;
+		}
+		head = &old->next;
+		old = old->next;
+	}
+
+	maybe_grow(h);
+	link_node(h, node);
+	HASHTBL_PROBE3(hashtbl, insert, h, hv, depth);
+
+	return NULL;
+}
+
+struct hashtbl_node *hashtbl_lookup_node(struct hashtbl *h, const void *k)
+{
+	return lookup_key(h, k);
+}
+
+struct hashtbl_node *hashtbl_remove_node(struct hashtbl *h, const void *k)
+{
+	struct hashtbl_node *node = remove_key(h, k);
+
+	if (node != NULL)
+		node->next = NULL;
+
+	return node;
+}
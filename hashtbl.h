@@ -47,7 +47,8 @@
  * Inserting, removing or lookup up NULL keys is therefore undefined.
  */
 
-#include <stddef.h>		/* size_t */
+#include <stddef.h>		/* size_t, ptrdiff_t, offsetof */
+#include "hashtbl_sampler.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -57,6 +58,24 @@ extern "C" {
 struct hashtbl;
 struct hashtbl_entry;
 
+/*
+ * Linkage that an intrusive table (see hashtbl_create_intrusive())
+ * threads through the client's own structures.  The fields are
+ * private.
+ */
+struct hashtbl_node {
+	struct hashtbl_node *next;
+	unsigned int hash;	/* hash of key */
+};
+
+/* Returns the structure of the given type that embeds a node. */
+#define HASHTBL_CONTAINER_OF(NODE, TYPE, MEMBER)			\
+	((TYPE *)(void *)((char *)(NODE) - offsetof(TYPE, MEMBER)))
+
+/* Offset from the node to an embedded key, for hashtbl_create_intrusive(). */
+#define HASHTBL_KEY_OFFSET(TYPE, NODE_MEMBER, KEY_MEMBER)		\
+	((ptrdiff_t)offsetof(TYPE, KEY_MEMBER) - (ptrdiff_t)offsetof(TYPE, NODE_MEMBER))
+
 /* Hash function. */
 typedef unsigned int (*HASHTBL_HASH_FN) (const void *k);
 
@@ -68,6 +87,16 @@ typedef int (*HASHTBL_APPLY_FN) (const void *key,
 				 const void *val,
 				 const void *client_data);
 
+/* Scan function, see hashtbl_scan(). */
+typedef void (*HASHTBL_SCAN_FN) (const void *key,
+				 const void *val,
+				 void *client_data);
+
+/* Compute function, see hashtbl_compute(). */
+typedef void *(*HASHTBL_COMPUTE_FN) (const void *key,
+				     void *val,
+				     void *client_data);
+
 /* Functions for deleting keys and values. */
 typedef void (*HASHTBL_KEY_FREE_FN) (void *k);
 typedef void (*HASHTBL_VAL_FREE_FN) (void *v);
@@ -76,16 +105,43 @@ typedef void (*HASHTBL_VAL_FREE_FN) (void *v);
 typedef void *(*HASHTBL_MALLOC_FN) (size_t n);
 typedef void (*HASHTBL_FREE_FN) (void *ptr);
 
+/* Functions for finding the key of, and releasing, intrusive nodes. */
+typedef const void *(*HASHTBL_NODE_KEY_FN) (const struct hashtbl_node *node);
+typedef void (*HASHTBL_NODE_FREE_FN) (struct hashtbl_node *node);
+
 /* Function for evicting oldest entries. */
 typedef int (*HASHTBL_EVICTOR_FN) (const struct hashtbl * h,
 				   unsigned long count);
 
+/* Resize phases reported to the resize function. */
+#define HASHTBL_RESIZE_BEGIN	0
+#define HASHTBL_RESIZE_END	1
+
+/*
+ * Describes a resize.  For HASHTBL_RESIZE_BEGIN only the capacities and
+ * bytes_allocated are valid; entries_moved and elapsed_usecs are
+ * filled in for HASHTBL_RESIZE_END.
+ */
+struct hashtbl_resize_event {
+	int old_capacity;
+	int new_capacity;
+	unsigned long entries_moved;
+	size_t bytes_allocated;		/* size of the new slot array */
+	double elapsed_usecs;
+};
+
+/* Function called before and after each resize. */
+typedef void (*HASHTBL_RESIZE_FN) (const struct hashtbl *h,
+				   int phase,
+				   const struct hashtbl_resize_event *event,
+				   void *client_data);
+
 struct hashtbl_iter {
 	void *key;
 	void *val;
 	/* The remaining fields are private: don't modify them. */
 	const int pos;
-	const struct hashtbl_entry * const entry;
+	const struct hashtbl_node * const node;
 };
 
 /*
@@ -132,6 +188,19 @@ void hashtbl_delete(struct hashtbl *h);
  */
 int hashtbl_remove(struct hashtbl *h, const void *k);
 
+/*
+ * Removes a key from the table without calling the key and value
+ * free functions; ownership passes back to the caller.
+ *
+ * @param h   - hash table instance
+ * @param k   - key to remove
+ * @param key - if non-null, set to the stored key
+ * @param val - if non-null, set to the stored value
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int hashtbl_steal(struct hashtbl *h, const void *k, void **key, void **val);
+
 /*
  * Clears all entries and reclaims memory used by each entry.
  */
@@ -148,6 +217,75 @@ void hashtbl_clear(struct hashtbl *h);
  */
 int hashtbl_insert(struct hashtbl *h, void *k, void *v);
 
+/*
+ * Replaces the value of k with desired if, and only if, it is
+ * currently expected (compared as pointers).  The old value is
+ * released with the table's val_free_fn.
+ *
+ * @param h        - hash table instance
+ * @param k        - key to update
+ * @param expected - the value k must have
+ * @param desired  - the new value
+ *
+ * Returns 0 if the value was replaced, otherwise 1.
+ */
+int hashtbl_cas(struct hashtbl *h, const void *k, void *expected,
+		void *desired);
+
+/*
+ * Replaces the value of k with v if pred returns non-zero for the
+ * current key and value.  The old value is released with the table's
+ * val_free_fn; if nothing is replaced v still belongs to the caller.
+ *
+ * Returns 0 if the value was replaced, otherwise 1.
+ */
+int hashtbl_replace_if(struct hashtbl *h, const void *k, void *v,
+		       HASHTBL_APPLY_FN pred, const void *client_data);
+
+/*
+ * Updates k from its current value in one step.  fn is called with
+ * the stored key and value, or with k and NULL if k is absent, and
+ * returns the value k should have, NULL meaning none: the entry is
+ * then removed (or not added).  A new entry takes ownership of k; a
+ * replaced value is released with the table's val_free_fn, so fn
+ * must not free it itself.
+ *
+ * @param h           - hash table instance
+ * @param k           - key to update
+ * @param fn          - computes the new value; must not modify h
+ * @param client_data - passed to fn
+ *
+ * Returns 0 on success, or 1 if a new entry cannot be created (fn is
+ * then not called).
+ */
+int hashtbl_compute(struct hashtbl *h, void *k, HASHTBL_COMPUTE_FN fn,
+		    void *client_data);
+
+/*
+ * Inserts n keys with their values, as n calls to hashtbl_insert()
+ * would, but hashes and prefetches them a chunk at a time, grows the
+ * table at most once up front, and (for larger batches) allocates
+ * the new entries as one block.
+ *
+ * @param h    - hash table instance
+ * @param keys - keys to insert
+ * @param vals - values associated with keys
+ * @param n    - number of keys
+ *
+ * Returns the number of keys inserted or replaced.  If that is less
+ * than n, memory ran out and the keys from that index on (and their
+ * values) still belong to the caller.
+ */
+int hashtbl_insert_batch(struct hashtbl *h, void **keys, void **vals, int n);
+
+/*
+ * Removes n keys, as n calls to hashtbl_remove() would, hashing and
+ * prefetching them a chunk at a time.
+ *
+ * Returns the number of keys that were found and removed.
+ */
+int hashtbl_remove_batch(struct hashtbl *h, void *const *keys, int n);
+
 /*
  * Lookup an existing key.
  *
@@ -186,6 +324,63 @@ int hashtbl_capacity(const struct hashtbl *h);
  */
 unsigned long hashtbl_apply(const struct hashtbl *h, HASHTBL_APPLY_FN fn, void *p);
 
+/*
+ * Visits the entries of one slot (after the style of Redis's SCAN).
+ * Start with a cursor of 0 and pass the returned cursor to the next
+ * call; 0 is returned once the scan is complete.
+ *
+ * The slots are visited in reverse binary order, so every key that
+ * is in the table for the whole scan is visited even if the table
+ * grows between calls.  Keys may be visited more than once across a
+ * resize, and keys inserted or removed during the scan may or may
+ * not be visited.  The table can be modified freely between calls,
+ * which allows a long scan to be split into short steps (e.g. with
+ * a lock released in between); fn itself may only remove the key it
+ * was passed.
+ *
+ * @param h      - hash table instance
+ * @param cursor - 0 to start, or the value returned by the last call
+ * @param fn     - function to apply to each entry of the slot
+ * @param p      - arbitrary user data
+ *
+ * Returns the next cursor, or 0 when the scan is complete.
+ */
+unsigned long hashtbl_scan(struct hashtbl *h, unsigned long cursor,
+			   HASHTBL_SCAN_FN fn, void *p);
+
+/*
+ * Incremental versions of hashtbl_apply(), hashtbl_clear() and
+ * hashtbl_delete(), for tables too large to process in one go.
+ *
+ * Each call processes slots until max_slots have been visited or
+ * budget_usecs have passed (either may be 0 for no limit; at least
+ * one slot is always processed), and stores where it got to in
+ * *cursor, which must be 0 for the first call.  The slots are
+ * visited in the same order as hashtbl_scan() so the table may be
+ * modified, and may grow, between calls: every key that is present
+ * throughout is processed, keys inserted meanwhile may or may not
+ * be.  fn must not modify the table.
+ *
+ * hashtbl_apply_step() stops early if fn returns 0.  Once
+ * hashtbl_delete_step() has returned 0 the table no longer exists.
+ *
+ * @param h            - hash table instance
+ * @param cursor       - where to continue from, 0 to start
+ * @param max_slots    - slots to process in this call, or 0
+ * @param budget_usecs - time limit for this call, or 0
+ *
+ * Returns 1 if there is more to do, otherwise 0.
+ */
+int hashtbl_apply_step(struct hashtbl *h, unsigned long *cursor,
+		       HASHTBL_APPLY_FN fn, void *p,
+		       int max_slots, long budget_usecs);
+
+int hashtbl_clear_step(struct hashtbl *h, unsigned long *cursor,
+		       int max_slots, long budget_usecs);
+
+int hashtbl_delete_step(struct hashtbl *h, unsigned long *cursor,
+			int max_slots, long budget_usecs);
+
 /*
  * Returns the load factor of the hash table.
  *
@@ -204,6 +399,40 @@ double hashtbl_load_factor(const struct hashtbl *h);
  */
 int hashtbl_resize(struct hashtbl *h, int new_capacity);
 
+/*
+ * Relocates the entries into one new block of memory, in slot
+ * order, so that the entries of a chain (and of neighbouring slots)
+ * are adjacent again after a long run of inserts and removes.  The
+ * memory of the old entries is released as they are moved.
+ *
+ * With a positive budget_usecs the work stops once that much time
+ * has passed and continues from the same slot on the next call; the
+ * table can be used as normal between calls.  Keys inserted after a
+ * pass began may be left in place, and hashtbl_clear() abandons it.
+ * Iterators are invalidated.  Intrusive tables have nothing to
+ * relocate.
+ *
+ * @param h            - hash table instance
+ * @param budget_usecs - time limit for this call, or 0 for none
+ *
+ * Returns 0 when the pass is complete, 1 if the budget ran out with
+ * more left to do, or -1 if no memory could be allocated.
+ */
+int hashtbl_defragment(struct hashtbl *h, long budget_usecs);
+
+/*
+ * Registers a function to be called before and after every resize,
+ * including those triggered by hashtbl_insert().  Neither phase
+ * is reported if the new slot array cannot be allocated.
+ *
+ * @param h  - hash table instance
+ * @param fn - resize function, or NULL to remove it
+ * @param client_data - arbitrary user data passed to fn
+ */
+void hashtbl_set_resize_callback(struct hashtbl *h,
+				 HASHTBL_RESIZE_FN fn,
+				 void *client_data);
+
 /*
  * Initialize an iterator.
  *
@@ -220,6 +449,112 @@ void hashtbl_iter_init(struct hashtbl *h, struct hashtbl_iter *iter);
  */
 int hashtbl_iter_next(struct hashtbl *h, struct hashtbl_iter *iter);
 
+/*
+ * Advances the iterator by up to n entries at once, storing their
+ * keys and values in keys[] and vals[] (either may be NULL).  While
+ * scanning the slot array it prefetches the chains a few slots
+ * ahead, so a full iteration doesn't wait on one cache miss per
+ * entry.  Can be mixed with hashtbl_iter_next(); the iterator's key
+ * and value are those of the last entry returned.
+ *
+ * Returns the number of entries stored, which is 0 once there are no
+ * more entries.
+ */
+int hashtbl_iter_next_n(struct hashtbl *h, struct hashtbl_iter *iter,
+			void **keys, void **vals, int n);
+
+/*
+ * Starts sampling the keys passed to hashtbl_lookup() in a top-k
+ * sketch (see hashtbl_sampler.h).  Any previous samples are
+ * discarded.
+ *
+ * While sampling is enabled every lookup updates the sampler, so a
+ * lookup is no longer a pure read: threads that look up keys in a
+ * shared table must then serialize their lookups.
+ *
+ * @param h	   - hash table instance
+ * @param capacity - number of distinct hashes to track
+ * @param rate	   - sample one in every rate lookups
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int hashtbl_enable_sampling(struct hashtbl *h, int capacity, unsigned int rate);
+
+/*
+ * Stops sampling and discards the samples.
+ */
+void hashtbl_disable_sampling(struct hashtbl *h);
+
+/*
+ * Reports the sampled keys.
+ *
+ * @param h	- hash table instance
+ * @param out	- array of at least n samples
+ * @param n	- maximum number of samples to return
+ * @param order - HASHTBL_SAMPLE_BY_COUNT for the hottest keys, or
+ *		  HASHTBL_SAMPLE_BY_DEPTH for the deepest chains
+ *
+ * Returns the number of samples copied, or 0 if sampling is disabled.
+ */
+int hashtbl_hot_keys(const struct hashtbl *h,
+		     struct hashtbl_sample *out,
+		     int n,
+		     int order);
+
+/*
+ * Creates an intrusive hash table.  Instead of allocating an entry
+ * per key, the table links the hashtbl_node that clients embed in
+ * their own structures, so inserting never allocates (except to
+ * grow the slot array) and a lookup lands directly on the object.
+ *
+ * The key of a node is found with key_fn if non-null, otherwise it
+ * is the address key_offset bytes from the node (see
+ * HASHTBL_KEY_OFFSET()); equals_fun and hash_fun receive that address.
+ *
+ * @param node_free_func - called on the nodes dropped by
+ *			   hashtbl_remove(), hashtbl_clear() and
+ *			   hashtbl_delete() (NULL just unlinks them)
+ *
+ * The remaining parameters are as for hashtbl_create().
+ *
+ * Entries are added with hashtbl_insert_node(); hashtbl_insert()
+ * fails on an intrusive table.  Everywhere else the value of an
+ * entry is its node: hashtbl_lookup(), hashtbl_apply() and the
+ * iterators return the node as the value.
+ *
+ * Returns non-null if the table was created successfully.
+ */
+struct hashtbl *hashtbl_create_intrusive(int initial_capacity,
+					 double max_load_factor,
+					 int auto_resize,
+					 ptrdiff_t key_offset,
+					 HASHTBL_NODE_KEY_FN key_fn,
+					 HASHTBL_HASH_FN hash_fun,
+					 HASHTBL_EQUALS_FN equals_fun,
+					 HASHTBL_NODE_FREE_FN node_free_func,
+					 HASHTBL_MALLOC_FN malloc_func,
+					 HASHTBL_FREE_FN free_func);
+
+/*
+ * Links a node into an intrusive table.  A node already in the table
+ * with an equal key is unlinked and returned (without calling the
+ * node free function); otherwise returns NULL.  Inserting a node that
+ * is already linked does nothing and returns NULL.
+ */
+struct hashtbl_node *hashtbl_insert_node(struct hashtbl *h,
+					 struct hashtbl_node *node);
+
+/*
+ * Returns the node for k in an intrusive table, or NULL if not found.
+ */
+struct hashtbl_node *hashtbl_lookup_node(struct hashtbl *h, const void *k);
+
+/*
+ * Unlinks and returns the node for k from an intrusive table, without
+ * calling the node free function.  Returns NULL if not found.
+ */
+struct hashtbl_node *hashtbl_remove_node(struct hashtbl *h, const void *k);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,454 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* hashtbl_bench.c - per-operation cost across load factors
+ *
+ * For a fixed number of entries, sweeps max_load_factor and measures
+ * the cost of insert, lookup hit and lookup miss, and the memory
+ * used per entry.  Configurations that no other configuration beats
+ * on all of lookup, insert and memory cost are marked as being on
+ * the Pareto frontier.
+ *
+ * Usage: hashtbl_bench [-n entries] [-r repeats] [-e engine]
+ *
+ * Because tables grow in powers of 2 the achieved load factor (the
+ * "load" column) can differ from the requested maximum; neighbouring
+ * settings that yield the same capacity will report the same costs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashtbl.h"
+#include "linked_hashtbl.h"
+#include "compact_hashtbl.h"
+#include "soa_hashtbl.h"
+#include "hashtbl_funcs.h"
+
+#define UNUSED_PARAMETER(X)	(void)(X)
+#define NELEMENTS(X)		(sizeof((X)) / sizeof((X)[0]))
+
+#define MAX_CONFIGS		64
+
+struct engine {
+	const char *name;
+	double max_load_factor;	/* upper end of the sweep */
+	void *(*create) (double load_factor);
+	int (*insert) (void *h, void *k, void *v);
+	void *(*lookup) (void *h, const void *k);
+	int (*capacity) (const void *h);
+	void (*delete) (void *h);
+};
+
+struct result {
+	const struct engine *engine;
+	double load_factor;
+	double load;
+	int capacity;
+	double insert_ns;
+	double hit_ns;
+	double miss_ns;
+	double bytes_per_entry;
+	int pareto;
+};
+
+/* Allocation accounting: every block carries its size. */
+
+union bench_header {
+	size_t size;
+	long double align;
+};
+
+static size_t bytes_in_use;
+
+static void *bench_malloc(size_t n)
+{
+	union bench_header *p = malloc(sizeof(*p) + n);
+	if (p == NULL)
+		return NULL;
+	p->size = n;
+	bytes_in_use += n;
+	return p + 1;
+}
+
+static void bench_free(void *ptr)
+{
+	union bench_header *p = ptr;
+	if (p == NULL)
+		return;
+	p--;
+	bytes_in_use -= p->size;
+	free(p);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* A bijection on 32-bit integers, so that keys are distinct. */
+
+static unsigned int mix32(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static unsigned int bench_hash(const void *k)
+{
+	return mix32(*(const unsigned int *)k);
+}
+
+/* Engine adaptors. */
+
+static void *hashtbl_bench_create(double load_factor)
+{
+	return hashtbl_create(1, load_factor, 1,
+			      bench_hash, hashtbl_int_equals,
+			      NULL, NULL, bench_malloc, bench_free);
+}
+
+static int hashtbl_bench_insert(void *h, void *k, void *v)
+{
+	return hashtbl_insert(h, k, v);
+}
+
+static void *hashtbl_bench_lookup(void *h, const void *k)
+{
+	return hashtbl_lookup(h, k);
+}
+
+static int hashtbl_bench_capacity(const void *h)
+{
+	return hashtbl_capacity(h);
+}
+
+static void hashtbl_bench_delete(void *h)
+{
+	hashtbl_delete(h);
+}
+
+static void *l_hashtbl_bench_create(double load_factor)
+{
+	return l_hashtbl_create(1, load_factor, 1, 0,
+				bench_hash, hashtbl_int_equals,
+				NULL, NULL, bench_malloc, bench_free, NULL);
+}
+
+static int l_hashtbl_bench_insert(void *h, void *k, void *v)
+{
+	return l_hashtbl_insert(h, k, v);
+}
+
+static void *l_hashtbl_bench_lookup(void *h, const void *k)
+{
+	return l_hashtbl_lookup(h, k);
+}
+
+static int l_hashtbl_bench_capacity(const void *h)
+{
+	return l_hashtbl_capacity(h);
+}
+
+static void l_hashtbl_bench_delete(void *h)
+{
+	l_hashtbl_delete(h);
+}
+
+static void *c_hashtbl_bench_create(double load_factor)
+{
+	return c_hashtbl_create(1, load_factor,
+				bench_hash, hashtbl_int_equals,
+				NULL, NULL, bench_malloc, bench_free, NULL);
+}
+
+static int c_hashtbl_bench_insert(void *h, void *k, void *v)
+{
+	return c_hashtbl_insert(h, k, v);
+}
+
+static void *c_hashtbl_bench_lookup(void *h, const void *k)
+{
+	return c_hashtbl_lookup(h, k);
+}
+
+static int c_hashtbl_bench_capacity(const void *h)
+{
+	return c_hashtbl_capacity(h);
+}
+
+static void c_hashtbl_bench_delete(void *h)
+{
+	c_hashtbl_delete(h);
+}
+
+static void *soa_hashtbl_bench_create(double load_factor)
+{
+	return soa_hashtbl_create(1, load_factor,
+				  bench_hash, hashtbl_int_equals,
+				  NULL, NULL, bench_malloc, bench_free);
+}
+
+static int soa_hashtbl_bench_insert(void *h, void *k, void *v)
+{
+	return soa_hashtbl_insert(h, k, v);
+}
+
+static void *soa_hashtbl_bench_lookup(void *h, const void *k)
+{
+	return soa_hashtbl_lookup(h, k);
+}
+
+static int soa_hashtbl_bench_capacity(const void *h)
+{
+	return soa_hashtbl_capacity(h);
+}
+
+static void soa_hashtbl_bench_delete(void *h)
+{
+	soa_hashtbl_delete(h);
+}
+
+static const struct engine engines[] = {
+	{ "hashtbl", 1.0,
+	  hashtbl_bench_create, hashtbl_bench_insert, hashtbl_bench_lookup,
+	  hashtbl_bench_capacity, hashtbl_bench_delete },
+	{ "l_hashtbl", 1.0,
+	  l_hashtbl_bench_create, l_hashtbl_bench_insert, l_hashtbl_bench_lookup,
+	  l_hashtbl_bench_capacity, l_hashtbl_bench_delete },
+	{ "c_hashtbl", 0.875,
+	  c_hashtbl_bench_create, c_hashtbl_bench_insert, c_hashtbl_bench_lookup,
+	  c_hashtbl_bench_capacity, c_hashtbl_bench_delete },
+	{ "soa_hashtbl", 0.875,
+	  soa_hashtbl_bench_create, soa_hashtbl_bench_insert,
+	  soa_hashtbl_bench_lookup, soa_hashtbl_bench_capacity,
+	  soa_hashtbl_bench_delete },
+};
+
+static void shuffle(unsigned int *a, int n)
+{
+	int i;
+
+	for (i = n - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		unsigned int tmp = a[i];
+		a[i] = a[j];
+		a[j] = tmp;
+	}
+}
+
+static volatile unsigned long sink;
+
+static int measure(const struct engine *e, double load_factor,
+		   unsigned int *keys, unsigned int *misses, int n,
+		   int repeats, struct result *r)
+{
+	int i, rep;
+	double t;
+
+	r->engine = e;
+	r->load_factor = load_factor;
+	r->insert_ns = r->hit_ns = r->miss_ns = -1.0;
+
+	for (rep = 0; rep < repeats; rep++) {
+		size_t base = bytes_in_use;
+		void *h = e->create(load_factor);
+
+		if (h == NULL)
+			return 1;
+
+		t = now_ns();
+		for (i = 0; i < n; i++) {
+			if (e->insert(h, &keys[i], &keys[i]) != 0) {
+				e->delete(h);
+				return 1;
+			}
+		}
+		t = (now_ns() - t) / n;
+		if (r->insert_ns < 0 || t < r->insert_ns)
+			r->insert_ns = t;
+
+		r->capacity = e->capacity(h);
+		r->load = (double)n / r->capacity;
+		r->bytes_per_entry = (double)(bytes_in_use - base) / n;
+
+		/* Look keys up in a different order to insertion. */
+		shuffle(keys, n);
+
+		t = now_ns();
+		for (i = 0; i < n; i++)
+			sink += (e->lookup(h, &keys[i]) != NULL);
+		t = (now_ns() - t) / n;
+		if (r->hit_ns < 0 || t < r->hit_ns)
+			r->hit_ns = t;
+
+		t = now_ns();
+		for (i = 0; i < n; i++)
+			sink += (e->lookup(h, &misses[i]) != NULL);
+		t = (now_ns() - t) / n;
+		if (r->miss_ns < 0 || t < r->miss_ns)
+			r->miss_ns = t;
+
+		e->delete(h);
+	}
+
+	return 0;
+}
+
+static double lookup_cost(const struct result *r)
+{
+	return (r->hit_ns + r->miss_ns) / 2.0;
+}
+
+/* a dominates b if it is no worse on every cost and better on one. */
+
+static int dominates(const struct result *a, const struct result *b)
+{
+	if (lookup_cost(a) > lookup_cost(b) ||
+	    a->insert_ns > b->insert_ns ||
+	    a->bytes_per_entry > b->bytes_per_entry)
+		return 0;
+
+	return (lookup_cost(a) < lookup_cost(b) ||
+		a->insert_ns < b->insert_ns ||
+		a->bytes_per_entry < b->bytes_per_entry);
+}
+
+static void mark_pareto(struct result *results, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		results[i].pareto = 1;
+		for (j = 0; j < n; j++) {
+			if (j != i && dominates(&results[j], &results[i])) {
+				results[i].pareto = 0;
+				break;
+			}
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr, "usage: %s [-n entries] [-r repeats] [-e engine]\n",
+		prog);
+	fprintf(stderr, "engines:");
+	for (i = 0; i < NELEMENTS(engines); i++)
+		fprintf(stderr, " %s", engines[i].name);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, n = 1 << 20, repeats = 3, nresults = 0;
+	const char *engine_name = NULL;
+	unsigned int *keys, *misses;
+	struct result results[MAX_CONFIGS];
+	size_t e;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			repeats = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			engine_name = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (n < 1 || repeats < 1)
+		usage(argv[0]);
+
+	keys = malloc((size_t) n * sizeof(*keys));
+	misses = malloc((size_t) n * sizeof(*misses));
+
+	if (keys == NULL || misses == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < n; i++) {
+		keys[i] = mix32((unsigned int)i);
+		misses[i] = mix32((unsigned int)(i + n));
+	}
+
+	for (e = 0; e < NELEMENTS(engines); e++) {
+		double lf;
+
+		if (engine_name && strcmp(engine_name, engines[e].name) != 0)
+			continue;
+
+		for (lf = 0.25;
+		     lf <= engines[e].max_load_factor + 1e-9 &&
+			     nresults < MAX_CONFIGS;
+		     lf += 0.125) {
+			if (measure(&engines[e], lf, keys, misses, n,
+				    repeats, &results[nresults]) != 0) {
+				fprintf(stderr, "%s: insert failed at lf %.3f\n",
+					engines[e].name, lf);
+				continue;
+			}
+			nresults++;
+		}
+	}
+
+	if (nresults == 0)
+		usage(argv[0]);
+
+	mark_pareto(results, nresults);
+
+	printf("%d entries, best of %d\n\n", n, repeats);
+	printf("%-12s %6s %6s %10s %10s %8s %8s %11s %s\n",
+	       "engine", "max_lf", "load", "capacity", "insert_ns",
+	       "hit_ns", "miss_ns", "bytes/entry", "pareto");
+
+	for (i = 0; i < nresults; i++) {
+		const struct result *r = &results[i];
+		printf("%-12s %6.3f %6.3f %10d %10.1f %8.1f %8.1f %11.1f %s\n",
+		       r->engine->name, r->load_factor, r->load, r->capacity,
+		       r->insert_ns, r->hit_ns, r->miss_ns,
+		       r->bytes_per_entry, r->pareto ? "*" : "");
+	}
+
+	free(keys);
+	free(misses);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,976 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* hashtbl_fuzz.c - differential fuzzing of the table engines
+ *
+ * Each input is decoded as an engine selector byte followed by
+ * three byte operations (opcode, key, value).  Every operation is
+ * applied to the engine under test and to a trivial reference model
+ * and the two are compared: return codes, lookups, counts, the set
+ * of entries seen by iteration and apply, and for l_hashtbl the
+ * exact iteration order (both directions) and which entries get
+ * evicted.  S3-FIFO tables choose their own victims, so for those
+ * the model follows the table but checks that exactly one other
+ * entry went.  Key and value free calls and allocator balance are
+ * checked too, though concurrent_hashtbl defers its frees and so is
+ * only held to the totals once deleted.  Any divergence aborts.
+ *
+ * Built with -DHASHTBL_FUZZ_LIBFUZZER this is a libFuzzer target.
+ * Otherwise main() replays the files named on the command line ("-"
+ * reads stdin, which suits AFL), or with no arguments runs a number
+ * of random inputs:
+ *
+ *   hashtbl_fuzz [-i iterations] [-s seed] [file ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_MSC_VER)
+#include <stdint.h>		/* uint8_t, uintptr_t */
+#endif
+#include "hashtbl.h"
+#include "linked_hashtbl.h"
+#include "compact_hashtbl.h"
+#include "soa_hashtbl.h"
+#include "concurrent_hashtbl.h"
+#include "hashtbl_funcs.h"
+
+#define UNUSED_PARAMETER(X)	(void)(X)
+#define NELEMENTS(X)		(sizeof((X)) / sizeof((X)[0]))
+
+#define NKEYS			64	/* small, so that keys collide */
+#define EVICT_CAPACITY		16
+#define NHOTKEYS		24	/* keys of EVICT_CHOSEN engines */
+
+enum {
+	OP_INSERT,
+	OP_REMOVE,
+	OP_LOOKUP,
+	OP_RESIZE,
+	OP_ITERATE,
+	OP_APPLY,
+	OP_CLEAR,
+	NOPS
+};
+
+/* Entries an engine evicts beyond EVICT_CAPACITY. */
+#define EVICT_NONE	0
+#define EVICT_ELDEST	1
+#define EVICT_CHOSEN	2	/* any but the key just inserted */
+
+/* Iteration order guaranteed by an engine. */
+#define ORDER_NONE	0
+#define ORDER_INSERTION	1
+#define ORDER_ACCESS	2
+
+struct engine {
+	const char *name;
+	int order;
+	int evicts;
+	int deferred;		/* frees keys and values some time later */
+	void *(*create) (void);
+	void (*delete) (void *t);
+	int (*insert) (void *t, void *k, void *v);
+	int (*remove) (void *t, const void *k);
+	void *(*lookup) (void *t, const void *k);
+	int (*resize) (void *t, int capacity);
+	unsigned long (*count) (void *t);
+	/* Fills keys with the iteration order, returns the count. */
+	int (*iterate) (void *t, int direction, int *keys);
+	/* apply and resize may be NULL. */
+	unsigned long (*apply) (void *t, HASHTBL_APPLY_FN fn, void *p);
+	void (*clear) (void *t);
+};
+
+/* The reference model. */
+
+struct model {
+	int present[NKEYS];
+	uintptr_t val[NKEYS];
+	int order[NKEYS];	/* most recent first */
+	int n;
+	unsigned long key_frees;
+	unsigned long val_frees;
+};
+
+static int keys[NKEYS];
+static unsigned long key_frees, val_frees;
+static long live_allocs;
+
+#define CHECK(COND)							\
+	do {								\
+		if (!(COND)) {						\
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n",\
+				__FILE__, __LINE__, e->name, #COND);	\
+			abort();					\
+		}							\
+	} while (0)
+
+static void *fuzz_malloc(size_t n)
+{
+	void *p = malloc(n);
+	if (p != NULL)
+		live_allocs++;
+	return p;
+}
+
+static void fuzz_free(void *p)
+{
+	if (p != NULL)
+		live_allocs--;
+	free(p);
+}
+
+static void fuzz_key_free(void *k)
+{
+	UNUSED_PARAMETER(k);
+	key_frees++;
+}
+
+static void fuzz_val_free(void *v)
+{
+	UNUSED_PARAMETER(v);
+	val_frees++;
+}
+
+/* hashtbl */
+
+static void *hashtbl_fuzz_create(void)
+{
+	return hashtbl_create(1, 0.75, 1,
+			      hashtbl_int_hash, hashtbl_int_equals,
+			      fuzz_key_free, fuzz_val_free,
+			      fuzz_malloc, fuzz_free);
+}
+
+static void hashtbl_fuzz_delete(void *t)
+{
+	hashtbl_delete(t);
+}
+
+static int hashtbl_fuzz_insert(void *t, void *k, void *v)
+{
+	return hashtbl_insert(t, k, v);
+}
+
+static int hashtbl_fuzz_remove(void *t, const void *k)
+{
+	return hashtbl_remove(t, k);
+}
+
+static void *hashtbl_fuzz_lookup(void *t, const void *k)
+{
+	return hashtbl_lookup(t, k);
+}
+
+static int hashtbl_fuzz_resize(void *t, int capacity)
+{
+	return hashtbl_resize(t, capacity);
+}
+
+static unsigned long hashtbl_fuzz_count(void *t)
+{
+	return hashtbl_count(t);
+}
+
+static int hashtbl_fuzz_iterate(void *t, int direction, int *out)
+{
+	struct hashtbl_iter iter;
+	int n = 0;
+
+	UNUSED_PARAMETER(direction);
+	hashtbl_iter_init(t, &iter);
+	while (hashtbl_iter_next(t, &iter) && n <= NKEYS)
+		out[n++] = *(int *)iter.key;
+
+	return n;
+}
+
+static unsigned long hashtbl_fuzz_apply(void *t, HASHTBL_APPLY_FN fn, void *p)
+{
+	return hashtbl_apply(t, fn, p);
+}
+
+static void hashtbl_fuzz_clear(void *t)
+{
+	hashtbl_clear(t);
+}
+
+/* l_hashtbl */
+
+static int l_hashtbl_fuzz_evictor(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > EVICT_CAPACITY;
+}
+
+static void *l_hashtbl_fuzz_create_with(int access_order,
+					LINKED_HASHTBL_EVICTOR_FN evictor)
+{
+	return l_hashtbl_create(1, 0.75, 1, access_order,
+				hashtbl_int_hash, hashtbl_int_equals,
+				fuzz_key_free, fuzz_val_free,
+				fuzz_malloc, fuzz_free, evictor);
+}
+
+static void *l_hashtbl_fuzz_create(void)
+{
+	return l_hashtbl_fuzz_create_with(0, NULL);
+}
+
+static void *l_hashtbl_fuzz_create_lru(void)
+{
+	return l_hashtbl_fuzz_create_with(1, l_hashtbl_fuzz_evictor);
+}
+
+static void *l_hashtbl_fuzz_create_fifo(void)
+{
+	return l_hashtbl_fuzz_create_with(0, l_hashtbl_fuzz_evictor);
+}
+
+static void *l_hashtbl_fuzz_create_s3fifo(void)
+{
+	return l_hashtbl_fuzz_create_with(LINKED_HASHTBL_S3FIFO,
+					  l_hashtbl_fuzz_evictor);
+}
+
+static void l_hashtbl_fuzz_delete(void *t)
+{
+	l_hashtbl_delete(t);
+}
+
+static int l_hashtbl_fuzz_insert(void *t, void *k, void *v)
+{
+	return l_hashtbl_insert(t, k, v);
+}
+
+static int l_hashtbl_fuzz_remove(void *t, const void *k)
+{
+	return l_hashtbl_remove(t, k);
+}
+
+static void *l_hashtbl_fuzz_lookup(void *t, const void *k)
+{
+	return l_hashtbl_lookup(t, k);
+}
+
+static int l_hashtbl_fuzz_resize(void *t, int capacity)
+{
+	return l_hashtbl_resize(t, capacity);
+}
+
+static unsigned long l_hashtbl_fuzz_count(void *t)
+{
+	return l_hashtbl_count(t);
+}
+
+static int l_hashtbl_fuzz_iterate(void *t, int direction, int *out)
+{
+	struct l_hashtbl_iter iter;
+	int n = 0;
+
+	l_hashtbl_iter_init(t, &iter, direction);
+	while (l_hashtbl_iter_next(&iter) && n <= NKEYS)
+		out[n++] = *(int *)iter.key;
+
+	return n;
+}
+
+static unsigned long l_hashtbl_fuzz_apply(void *t, HASHTBL_APPLY_FN fn, void *p)
+{
+	return l_hashtbl_apply(t, (LINKED_HASHTBL_APPLY_FN)fn, p);
+}
+
+static void l_hashtbl_fuzz_clear(void *t)
+{
+	l_hashtbl_clear(t);
+}
+
+/* l_hashtbl, intrusive */
+
+struct fuzz_node {
+	struct l_hashtbl_node node;
+	void *key;
+	void *val;
+};
+
+#define FUZZ_NODE(NODE) LINKED_HASHTBL_CONTAINER_OF(NODE, struct fuzz_node, node)
+
+static const void *fuzz_node_key(const struct l_hashtbl_node *node)
+{
+	return FUZZ_NODE(node)->key;
+}
+
+static void fuzz_node_free(struct l_hashtbl_node *node)
+{
+	fuzz_key_free(FUZZ_NODE(node)->key);
+	fuzz_val_free(FUZZ_NODE(node)->val);
+	fuzz_free(FUZZ_NODE(node));
+}
+
+static void *l_hashtbl_fuzz_create_s3fifo_intrusive(void)
+{
+	return l_hashtbl_create_intrusive(1, 0.75, 1, LINKED_HASHTBL_S3FIFO, 0,
+					  fuzz_node_key,
+					  hashtbl_int_hash, hashtbl_int_equals,
+					  fuzz_node_free,
+					  fuzz_malloc, fuzz_free,
+					  l_hashtbl_fuzz_evictor);
+}
+
+static int l_hashtbl_fuzz_insert_node(void *t, void *k, void *v)
+{
+	struct fuzz_node *n = fuzz_malloc(sizeof(*n));
+	struct l_hashtbl_node *old;
+
+	if (n == NULL)
+		return 1;
+
+	/* Garbage in the node must not matter to the table. */
+	memset(n, 0xa5, sizeof(*n));
+	n->key = k;
+	n->val = v;
+
+	/* A replaced node keeps its key, as l_hashtbl_insert() does. */
+	if ((old = l_hashtbl_insert_node(t, &n->node)) != NULL) {
+		fuzz_val_free(FUZZ_NODE(old)->val);
+		fuzz_free(FUZZ_NODE(old));
+	}
+
+	return 0;
+}
+
+static void *l_hashtbl_fuzz_lookup_node(void *t, const void *k)
+{
+	struct l_hashtbl_node *node = l_hashtbl_lookup_node(t, k);
+
+	return node != NULL ? FUZZ_NODE(node)->val : NULL;
+}
+
+struct fuzz_node_apply {
+	HASHTBL_APPLY_FN fn;
+	void *p;
+};
+
+static int fuzz_node_apply_fn(const void *k, const void *v, const void *p)
+{
+	const struct fuzz_node_apply *a = p;
+
+	return a->fn(k, FUZZ_NODE(v)->val, a->p);
+}
+
+static unsigned long l_hashtbl_fuzz_apply_node(void *t, HASHTBL_APPLY_FN fn,
+					       void *p)
+{
+	struct fuzz_node_apply a;
+
+	a.fn = fn;
+	a.p = p;
+	return l_hashtbl_apply(t, fuzz_node_apply_fn, &a);
+}
+
+/* c_hashtbl */
+
+static int c_hashtbl_fuzz_evictor(const struct c_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > EVICT_CAPACITY;
+}
+
+static void *c_hashtbl_fuzz_create_with(COMPACT_HASHTBL_EVICTOR_FN evictor)
+{
+	return c_hashtbl_create(1, 0.0, hashtbl_int_hash, hashtbl_int_equals,
+				fuzz_key_free, fuzz_val_free,
+				fuzz_malloc, fuzz_free, evictor);
+}
+
+static void *c_hashtbl_fuzz_create(void)
+{
+	return c_hashtbl_fuzz_create_with(NULL);
+}
+
+static void *c_hashtbl_fuzz_create_fifo(void)
+{
+	return c_hashtbl_fuzz_create_with(c_hashtbl_fuzz_evictor);
+}
+
+static void c_hashtbl_fuzz_delete(void *t)
+{
+	c_hashtbl_delete(t);
+}
+
+static int c_hashtbl_fuzz_insert(void *t, void *k, void *v)
+{
+	return c_hashtbl_insert(t, k, v);
+}
+
+static int c_hashtbl_fuzz_remove(void *t, const void *k)
+{
+	return c_hashtbl_remove(t, k);
+}
+
+static void *c_hashtbl_fuzz_lookup(void *t, const void *k)
+{
+	return c_hashtbl_lookup(t, k);
+}
+
+static int c_hashtbl_fuzz_resize(void *t, int capacity)
+{
+	return c_hashtbl_resize(t, capacity);
+}
+
+static unsigned long c_hashtbl_fuzz_count(void *t)
+{
+	return c_hashtbl_count(t);
+}
+
+static int c_hashtbl_fuzz_iterate(void *t, int direction, int *out)
+{
+	struct c_hashtbl_iter iter;
+	int n = 0;
+
+	c_hashtbl_iter_init(t, &iter, direction);
+	while (c_hashtbl_iter_next(&iter) && n <= NKEYS)
+		out[n++] = *(int *)iter.key;
+
+	return n;
+}
+
+static unsigned long c_hashtbl_fuzz_apply(void *t, HASHTBL_APPLY_FN fn, void *p)
+{
+	return c_hashtbl_apply(t, (COMPACT_HASHTBL_APPLY_FN)fn, p);
+}
+
+static void c_hashtbl_fuzz_clear(void *t)
+{
+	c_hashtbl_clear(t);
+}
+
+/* soa_hashtbl */
+
+static void *soa_hashtbl_fuzz_create(void)
+{
+	return soa_hashtbl_create(1, 0.0, hashtbl_int_hash, hashtbl_int_equals,
+				  fuzz_key_free, fuzz_val_free,
+				  fuzz_malloc, fuzz_free);
+}
+
+static void soa_hashtbl_fuzz_delete(void *t)
+{
+	soa_hashtbl_delete(t);
+}
+
+static int soa_hashtbl_fuzz_insert(void *t, void *k, void *v)
+{
+	return soa_hashtbl_insert(t, k, v);
+}
+
+static int soa_hashtbl_fuzz_remove(void *t, const void *k)
+{
+	return soa_hashtbl_remove(t, k);
+}
+
+static void *soa_hashtbl_fuzz_lookup(void *t, const void *k)
+{
+	return soa_hashtbl_lookup(t, k);
+}
+
+static int soa_hashtbl_fuzz_resize(void *t, int capacity)
+{
+	return soa_hashtbl_resize(t, capacity);
+}
+
+static unsigned long soa_hashtbl_fuzz_count(void *t)
+{
+	return soa_hashtbl_count(t);
+}
+
+static int soa_hashtbl_fuzz_iterate(void *t, int direction, int *out)
+{
+	struct soa_hashtbl_iter iter;
+	int n = 0;
+
+	UNUSED_PARAMETER(direction);
+	soa_hashtbl_iter_init(t, &iter);
+	while (soa_hashtbl_iter_next(t, &iter) && n <= NKEYS)
+		out[n++] = *(int *)iter.key;
+
+	return n;
+}
+
+static unsigned long soa_hashtbl_fuzz_apply(void *t, HASHTBL_APPLY_FN fn, void *p)
+{
+	return soa_hashtbl_apply(t, (SOA_HASHTBL_APPLY_FN)fn, p);
+}
+
+static void soa_hashtbl_fuzz_clear(void *t)
+{
+	soa_hashtbl_clear(t);
+}
+
+/* concurrent_hashtbl */
+
+static void *concurrent_hashtbl_fuzz_create(void)
+{
+	return concurrent_hashtbl_create(1, 0.75,
+					 hashtbl_int_hash, hashtbl_int_equals,
+					 fuzz_key_free, fuzz_val_free,
+					 fuzz_malloc, fuzz_free);
+}
+
+static void concurrent_hashtbl_fuzz_delete(void *t)
+{
+	concurrent_hashtbl_delete(t);
+}
+
+static int concurrent_hashtbl_fuzz_insert(void *t, void *k, void *v)
+{
+	return concurrent_hashtbl_insert(t, k, v);
+}
+
+static int concurrent_hashtbl_fuzz_remove(void *t, const void *k)
+{
+	return concurrent_hashtbl_remove(t, k);
+}
+
+static void *concurrent_hashtbl_fuzz_lookup(void *t, const void *k)
+{
+	return concurrent_hashtbl_lookup(t, k);
+}
+
+static unsigned long concurrent_hashtbl_fuzz_count(void *t)
+{
+	return concurrent_hashtbl_count(t);
+}
+
+/* There is no iterator: probe every key instead. */
+
+static int concurrent_hashtbl_fuzz_iterate(void *t, int direction, int *out)
+{
+	int i, n = 0;
+
+	UNUSED_PARAMETER(direction);
+	for (i = 0; i < NKEYS; i++) {
+		if (concurrent_hashtbl_lookup(t, &keys[i]) != NULL)
+			out[n++] = i;
+	}
+
+	return n;
+}
+
+static void concurrent_hashtbl_fuzz_clear(void *t)
+{
+	int i;
+
+	for (i = 0; i < NKEYS; i++)
+		(void)concurrent_hashtbl_remove(t, &keys[i]);
+}
+
+static const struct engine engines[] = {
+	{ "hashtbl", ORDER_NONE, EVICT_NONE, 0,
+	  hashtbl_fuzz_create, hashtbl_fuzz_delete,
+	  hashtbl_fuzz_insert, hashtbl_fuzz_remove, hashtbl_fuzz_lookup,
+	  hashtbl_fuzz_resize, hashtbl_fuzz_count, hashtbl_fuzz_iterate,
+	  hashtbl_fuzz_apply, hashtbl_fuzz_clear },
+	{ "l_hashtbl", ORDER_INSERTION, EVICT_NONE, 0,
+	  l_hashtbl_fuzz_create, l_hashtbl_fuzz_delete,
+	  l_hashtbl_fuzz_insert, l_hashtbl_fuzz_remove, l_hashtbl_fuzz_lookup,
+	  l_hashtbl_fuzz_resize, l_hashtbl_fuzz_count, l_hashtbl_fuzz_iterate,
+	  l_hashtbl_fuzz_apply, l_hashtbl_fuzz_clear },
+	{ "l_hashtbl-fifo", ORDER_INSERTION, EVICT_ELDEST, 0,
+	  l_hashtbl_fuzz_create_fifo, l_hashtbl_fuzz_delete,
+	  l_hashtbl_fuzz_insert, l_hashtbl_fuzz_remove, l_hashtbl_fuzz_lookup,
+	  l_hashtbl_fuzz_resize, l_hashtbl_fuzz_count, l_hashtbl_fuzz_iterate,
+	  l_hashtbl_fuzz_apply, l_hashtbl_fuzz_clear },
+	{ "l_hashtbl-lru", ORDER_ACCESS, EVICT_ELDEST, 0,
+	  l_hashtbl_fuzz_create_lru, l_hashtbl_fuzz_delete,
+	  l_hashtbl_fuzz_insert, l_hashtbl_fuzz_remove, l_hashtbl_fuzz_lookup,
+	  l_hashtbl_fuzz_resize, l_hashtbl_fuzz_count, l_hashtbl_fuzz_iterate,
+	  l_hashtbl_fuzz_apply, l_hashtbl_fuzz_clear },
+	{ "l_hashtbl-s3fifo", ORDER_NONE, EVICT_CHOSEN, 0,
+	  l_hashtbl_fuzz_create_s3fifo, l_hashtbl_fuzz_delete,
+	  l_hashtbl_fuzz_insert, l_hashtbl_fuzz_remove, l_hashtbl_fuzz_lookup,
+	  l_hashtbl_fuzz_resize, l_hashtbl_fuzz_count, l_hashtbl_fuzz_iterate,
+	  l_hashtbl_fuzz_apply, l_hashtbl_fuzz_clear },
+	{ "l_hashtbl-s3fifo-intrusive", ORDER_NONE, EVICT_CHOSEN, 0,
+	  l_hashtbl_fuzz_create_s3fifo_intrusive, l_hashtbl_fuzz_delete,
+	  l_hashtbl_fuzz_insert_node, l_hashtbl_fuzz_remove,
+	  l_hashtbl_fuzz_lookup_node,
+	  l_hashtbl_fuzz_resize, l_hashtbl_fuzz_count, l_hashtbl_fuzz_iterate,
+	  l_hashtbl_fuzz_apply_node, l_hashtbl_fuzz_clear },
+	{ "c_hashtbl", ORDER_INSERTION, EVICT_NONE, 0,
+	  c_hashtbl_fuzz_create, c_hashtbl_fuzz_delete,
+	  c_hashtbl_fuzz_insert, c_hashtbl_fuzz_remove, c_hashtbl_fuzz_lookup,
+	  c_hashtbl_fuzz_resize, c_hashtbl_fuzz_count, c_hashtbl_fuzz_iterate,
+	  c_hashtbl_fuzz_apply, c_hashtbl_fuzz_clear },
+	{ "c_hashtbl-fifo", ORDER_INSERTION, EVICT_ELDEST, 0,
+	  c_hashtbl_fuzz_create_fifo, c_hashtbl_fuzz_delete,
+	  c_hashtbl_fuzz_insert, c_hashtbl_fuzz_remove, c_hashtbl_fuzz_lookup,
+	  c_hashtbl_fuzz_resize, c_hashtbl_fuzz_count, c_hashtbl_fuzz_iterate,
+	  c_hashtbl_fuzz_apply, c_hashtbl_fuzz_clear },
+	{ "soa_hashtbl", ORDER_NONE, EVICT_NONE, 0,
+	  soa_hashtbl_fuzz_create, soa_hashtbl_fuzz_delete,
+	  soa_hashtbl_fuzz_insert, soa_hashtbl_fuzz_remove, soa_hashtbl_fuzz_lookup,
+	  soa_hashtbl_fuzz_resize, soa_hashtbl_fuzz_count, soa_hashtbl_fuzz_iterate,
+	  soa_hashtbl_fuzz_apply, soa_hashtbl_fuzz_clear },
+	{ "concurrent_hashtbl", ORDER_NONE, EVICT_NONE, 1,
+	  concurrent_hashtbl_fuzz_create, concurrent_hashtbl_fuzz_delete,
+	  concurrent_hashtbl_fuzz_insert, concurrent_hashtbl_fuzz_remove,
+	  concurrent_hashtbl_fuzz_lookup,
+	  NULL, concurrent_hashtbl_fuzz_count, concurrent_hashtbl_fuzz_iterate,
+	  NULL, concurrent_hashtbl_fuzz_clear },
+};
+
+/* Model operations. */
+
+static void model_unlink(struct model *m, int k)
+{
+	int i;
+
+	for (i = 0; i < m->n; i++) {
+		if (m->order[i] == k) {
+			memmove(&m->order[i], &m->order[i + 1],
+				(size_t) (m->n - i - 1) * sizeof(m->order[0]));
+			m->n--;
+			return;
+		}
+	}
+}
+
+static void model_push_front(struct model *m, int k)
+{
+	memmove(&m->order[1], &m->order[0], (size_t) m->n * sizeof(m->order[0]));
+	m->order[0] = k;
+	m->n++;
+}
+
+static void model_remove(struct model *m, int k)
+{
+	m->present[k] = 0;
+	model_unlink(m, k);
+	m->key_frees++;
+	m->val_frees++;
+}
+
+static void model_insert(const struct engine *e, struct model *m, int k,
+			 uintptr_t v)
+{
+	if (m->present[k]) {
+		/* Replacing a value doesn't change the order. */
+		m->val[k] = v;
+		m->val_frees++;
+		return;
+	}
+
+	m->present[k] = 1;
+	m->val[k] = v;
+	model_push_front(m, k);
+
+	if (e->evicts == EVICT_ELDEST && m->n > EVICT_CAPACITY)
+		model_remove(m, m->order[m->n - 1]);
+}
+
+/* Follow the engine's choice of victim after inserting k. */
+
+static void model_evicted(const struct engine *e, void *t, struct model *m,
+			  int k)
+{
+	int order[NKEYS + 1], seen[NKEYS];
+	int i, n, victim = -1;
+
+	if (e->evicts != EVICT_CHOSEN || m->n <= EVICT_CAPACITY)
+		return;
+
+	n = e->iterate(t, 1, order);
+	CHECK(n == EVICT_CAPACITY);
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < n; i++) {
+		CHECK(order[i] >= 0 && order[i] < NKEYS);
+		CHECK(m->present[order[i]]);
+		seen[order[i]] = 1;
+	}
+	for (i = 0; i < NKEYS; i++) {
+		if (m->present[i] && !seen[i]) {
+			CHECK(victim == -1);
+			victim = i;
+		}
+	}
+	CHECK(victim != -1 && victim != k);
+	model_remove(m, victim);
+}
+
+struct apply_state {
+	const struct engine *e;
+	const struct model *m;
+	int seen[NKEYS];
+	unsigned long limit;
+	unsigned long n;
+};
+
+static int fuzz_apply_fn(const void *k, const void *v, const void *p)
+{
+	struct apply_state *s = (struct apply_state *)p;
+	const struct engine *e = s->e;
+	int key = *(const int *)k;
+
+	CHECK(key >= 0 && key < NKEYS);
+	CHECK(s->m->present[key]);
+	CHECK(s->m->val[key] == (uintptr_t)v);
+	CHECK(!s->seen[key]);
+	s->seen[key] = 1;
+
+	return ++s->n < s->limit;
+}
+
+static void check_iteration(const struct engine *e, void *t,
+			    const struct model *m)
+{
+	int order[NKEYS + 1], seen[NKEYS];
+	int i, n, direction;
+
+	for (direction = 1; direction >= -1; direction -= 2) {
+		n = e->iterate(t, direction, order);
+		CHECK(n == m->n);
+		memset(seen, 0, sizeof(seen));
+		for (i = 0; i < n; i++) {
+			CHECK(order[i] >= 0 && order[i] < NKEYS);
+			CHECK(m->present[order[i]]);
+			CHECK(!seen[order[i]]);
+			seen[order[i]] = 1;
+			if (e->order == ORDER_NONE)
+				continue;
+			if (direction == 1)
+				CHECK(order[i] == m->order[i]);
+			else
+				CHECK(order[i] == m->order[m->n - 1 - i]);
+		}
+		if (e->order == ORDER_NONE)
+			break;
+	}
+}
+
+static void run_ops(const struct engine *e, const uint8_t *data, size_t size)
+{
+	struct model m;
+	void *t;
+	size_t i;
+	long allocs_before = live_allocs;
+	/* S3-FIFO only promotes keys that come back soon. */
+	int nkeys = e->evicts == EVICT_CHOSEN ? NHOTKEYS : NKEYS;
+
+	memset(&m, 0, sizeof(m));
+	key_frees = val_frees = 0;
+
+	if ((t = e->create()) == NULL)
+		return;
+
+	for (i = 0; i + 3 <= size; i += 3) {
+		int op = data[i] % NOPS;
+		int k = data[i + 1] % nkeys;
+		uintptr_t v = (uintptr_t)data[i + 2] + 1;	/* never NULL */
+		void *got;
+
+		switch (op) {
+		case OP_INSERT:
+			CHECK(e->insert(t, &keys[k], (void *)v) == 0);
+			model_insert(e, &m, k, v);
+			model_evicted(e, t, &m, k);
+			break;
+		case OP_REMOVE:
+			CHECK(e->remove(t, &keys[k]) == !m.present[k]);
+			if (m.present[k])
+				model_remove(&m, k);
+			break;
+		case OP_LOOKUP:
+			got = e->lookup(t, &keys[k]);
+			if (m.present[k]) {
+				CHECK((uintptr_t)got == m.val[k]);
+				if (e->order == ORDER_ACCESS) {
+					model_unlink(&m, k);
+					model_push_front(&m, k);
+				}
+			} else {
+				CHECK(got == NULL);
+			}
+			break;
+		case OP_RESIZE:
+			if (e->resize != NULL)
+				CHECK(e->resize(t, data[i + 2] * 4) == 0);
+			break;
+		case OP_ITERATE:
+			check_iteration(e, t, &m);
+			break;
+		case OP_APPLY: {
+			struct apply_state s;
+			if (e->apply == NULL)
+				break;
+			memset(&s, 0, sizeof(s));
+			s.e = e;
+			s.m = &m;
+			s.limit = (unsigned long)data[i + 2] + 1;
+			CHECK(e->apply(t, fuzz_apply_fn, &s) == s.n);
+			CHECK(s.n == ((unsigned long)m.n < s.limit ?
+				      (unsigned long)m.n : s.limit));
+			break;
+		}
+		case OP_CLEAR:
+			/* Rarely, so that tables fill up and evict. */
+			if (data[i + 2] % 16 != 0)
+				break;
+			e->clear(t);
+			while (m.n > 0)
+				model_remove(&m, m.order[0]);
+			break;
+		}
+
+		CHECK(e->count(t) == (unsigned long)m.n);
+		if (e->deferred) {
+			CHECK(key_frees <= m.key_frees);
+			CHECK(val_frees <= m.val_frees);
+		} else {
+			CHECK(key_frees == m.key_frees);
+			CHECK(val_frees == m.val_frees);
+		}
+	}
+
+	check_iteration(e, t, &m);
+	e->delete(t);
+
+	CHECK(key_frees == m.key_frees + (unsigned long)m.n);
+	CHECK(val_frees == m.val_frees + (unsigned long)m.n);
+	CHECK(live_allocs == allocs_before);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+
+	run_ops(&engines[data[0] % NELEMENTS(engines)], data + 1, size - 1);
+	return 0;
+}
+
+static void init_keys(void)
+{
+	int i;
+
+	for (i = 0; i < NKEYS; i++)
+		keys[i] = i;
+}
+
+#if defined(HASHTBL_FUZZ_LIBFUZZER)
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	UNUSED_PARAMETER(argc);
+	UNUSED_PARAMETER(argv);
+	init_keys();
+	return 0;
+}
+
+#else
+
+static int replay(const char *path)
+{
+	FILE *fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "rb");
+	uint8_t *buf = NULL;
+	size_t n = 0, cap = 0, r;
+
+	if (fp == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	do {
+		if (n == cap) {
+			cap = cap ? 2 * cap : 4096;
+			if ((buf = realloc(buf, cap)) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		r = fread(buf + n, 1, cap - n, fp);
+		n += r;
+	} while (r > 0);
+
+	if (fp != stdin)
+		fclose(fp);
+
+	LLVMFuzzerTestOneInput(buf, n);
+	free(buf);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long iterations = 2000, it;
+	unsigned int seed = 1;
+	uint8_t buf[3 * 512 + 1];
+	int i, nfiles = 0;
+
+	init_keys();
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			iterations = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			seed = (unsigned int)strtoul(argv[++i], NULL, 0);
+		} else {
+			if (replay(argv[i]) != 0)
+				return EXIT_FAILURE;
+			nfiles++;
+		}
+	}
+
+	if (nfiles > 0)
+		return EXIT_SUCCESS;
+
+	srand(seed);
+
+	for (it = 0; it < iterations; it++) {
+		size_t n = 1 + (size_t)rand() % (sizeof(buf) - 1);
+		size_t j;
+		for (j = 0; j < n; j++)
+			buf[j] = (uint8_t)rand();
+		/* Cover every engine evenly. */
+		buf[0] = (uint8_t)(it % NELEMENTS(engines));
+		LLVMFuzzerTestOneInput(buf, n);
+	}
+
+	printf("hashtbl_fuzz: %lu inputs, %d engines, seed %u: ok\n",
+	       iterations, (int)NELEMENTS(engines), seed);
+
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,730 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* hashtbl_mt_bench.c - multi-threaded scalability benchmark
+ *
+ * Runs 1..N threads against each concurrency mode for a fixed time
+ * and reports aggregate throughput, the speedup over one thread and
+ * per-thread fairness (Jain's index and the min/max thread share).
+ *
+ * Usage: hashtbl_mt_bench [-t max_threads] [-d millis] [-k keys]
+ *			   [-w write_pct] [-s zipf_skew] [-m mode] [-P]
+ *
+ * The modes are a hashtbl and an LRU l_hashtbl behind one mutex
+ * (mutex, lru-mutex), lock striped hashtbl and LRU shards (striped,
+ * sharded-lru), and the lock-free concurrent_hashtbl (concurrent).
+ *
+ * Keys are drawn from a Zipf distribution with the given skew (0 is
+ * uniform).  A write removes the key if present and re-inserts it
+ * otherwise, so the table size stays roughly constant.  Threads are
+ * pinned round-robin to CPUs unless -P is given.
+ */
+
+#define _GNU_SOURCE		/* pthread_setaffinity_np */
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtbl.h"
+#include "linked_hashtbl.h"
+#include "sharded_hashtbl.h"
+#include "concurrent_hashtbl.h"
+
+#define UNUSED_PARAMETER(X)	(void)(X)
+#define NELEMENTS(X)		(sizeof((X)) / sizeof((X)[0]))
+
+#define CACHE_LINE_SIZE		64
+#define KEY_SCHEDULE_SIZE	(1 << 16)	/* pre-drawn keys per thread */
+
+struct mode {
+	const char *name;
+	void *(*create) (int nkeys);
+	void (*delete) (void *t);
+	void *(*lookup) (void *t, const void *k);
+	int (*insert) (void *t, void *k, void *v);
+	int (*remove) (void *t, const void *k);
+};
+
+struct worker {
+	pthread_t thread;
+	const struct mode *mode;
+	void *table;
+	unsigned int *keys;	/* the key space */
+	unsigned int *schedule;	/* indices into keys */
+	int write_pct;
+	int id;
+	int cpu;
+	unsigned long nops;
+	unsigned long hits;	/* lookups that found their key */
+	char pad[CACHE_LINE_SIZE];
+};
+
+static atomic_int start_flag;
+static atomic_int stop_flag;
+static volatile unsigned long sink;	/* the hits, summed after the join */
+
+static unsigned int mix32(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static unsigned int bench_hash(const void *k)
+{
+	return mix32(*(const unsigned int *)k);
+}
+
+static int bench_equals(const void *a, const void *b)
+{
+	return *(const unsigned int *)a == *(const unsigned int *)b;
+}
+
+static unsigned int xorshift32(unsigned int *state)
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* Mode: a single table behind a mutex. */
+
+struct locked_hashtbl {
+	pthread_mutex_t lock;
+	struct hashtbl *h;
+};
+
+static void *mutex_create(int nkeys)
+{
+	struct locked_hashtbl *t = malloc(sizeof(*t));
+
+	if (t == NULL)
+		return NULL;
+
+	if ((t->h = hashtbl_create(nkeys, 0.75, 1, bench_hash, bench_equals,
+				   NULL, NULL, NULL, NULL)) == NULL) {
+		free(t);
+		return NULL;
+	}
+
+	pthread_mutex_init(&t->lock, NULL);
+	return t;
+}
+
+static void mutex_delete(void *p)
+{
+	struct locked_hashtbl *t = p;
+	hashtbl_delete(t->h);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+static void *mutex_lookup(void *p, const void *k)
+{
+	struct locked_hashtbl *t = p;
+	void *v;
+
+	pthread_mutex_lock(&t->lock);
+	v = hashtbl_lookup(t->h, k);
+	pthread_mutex_unlock(&t->lock);
+
+	return v;
+}
+
+static int mutex_insert(void *p, void *k, void *v)
+{
+	struct locked_hashtbl *t = p;
+	int rc;
+
+	pthread_mutex_lock(&t->lock);
+	rc = hashtbl_insert(t->h, k, v);
+	pthread_mutex_unlock(&t->lock);
+
+	return rc;
+}
+
+static int mutex_remove(void *p, const void *k)
+{
+	struct locked_hashtbl *t = p;
+	int rc;
+
+	pthread_mutex_lock(&t->lock);
+	rc = hashtbl_remove(t->h, k);
+	pthread_mutex_unlock(&t->lock);
+
+	return rc;
+}
+
+/* Mode: an access ordered l_hashtbl (LRU) behind a mutex. */
+
+struct locked_l_hashtbl {
+	pthread_mutex_t lock;
+	struct l_hashtbl *h;
+};
+
+static unsigned long lru_capacity;
+
+static int lru_evictor(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > lru_capacity;
+}
+
+static void *lru_mutex_create(int nkeys)
+{
+	struct locked_l_hashtbl *t = malloc(sizeof(*t));
+
+	if (t == NULL)
+		return NULL;
+
+	lru_capacity = (unsigned long)nkeys;
+
+	if ((t->h = l_hashtbl_create(nkeys, 0.75, 1, 1,
+				     bench_hash, bench_equals,
+				     NULL, NULL, NULL, NULL,
+				     lru_evictor)) == NULL) {
+		free(t);
+		return NULL;
+	}
+
+	pthread_mutex_init(&t->lock, NULL);
+	return t;
+}
+
+static void lru_mutex_delete(void *p)
+{
+	struct locked_l_hashtbl *t = p;
+	l_hashtbl_delete(t->h);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+static void *lru_mutex_lookup(void *p, const void *k)
+{
+	struct locked_l_hashtbl *t = p;
+	void *v;
+
+	pthread_mutex_lock(&t->lock);
+	v = l_hashtbl_lookup(t->h, k);
+	pthread_mutex_unlock(&t->lock);
+
+	return v;
+}
+
+static int lru_mutex_insert(void *p, void *k, void *v)
+{
+	struct locked_l_hashtbl *t = p;
+	int rc;
+
+	pthread_mutex_lock(&t->lock);
+	rc = l_hashtbl_insert(t->h, k, v);
+	pthread_mutex_unlock(&t->lock);
+
+	return rc;
+}
+
+static int lru_mutex_remove(void *p, const void *k)
+{
+	struct locked_l_hashtbl *t = p;
+	int rc;
+
+	pthread_mutex_lock(&t->lock);
+	rc = l_hashtbl_remove(t->h, k);
+	pthread_mutex_unlock(&t->lock);
+
+	return rc;
+}
+
+/*
+ * Mode: lock striping, 64 hashtbl shards (sharded_hashtbl), each
+ * behind its own padded mutex.
+ */
+
+#define SHARD_BITS		6
+
+static void *striped_create(int nkeys)
+{
+	return sharded_hashtbl_create(SHARD_BITS, nkeys >> SHARD_BITS, 0.75,
+				      bench_hash, bench_equals,
+				      NULL, NULL, NULL, NULL);
+}
+
+static void striped_delete(void *p)
+{
+	sharded_hashtbl_delete(p);
+}
+
+static void *striped_lookup(void *p, const void *k)
+{
+	return sharded_hashtbl_lookup(p, k);
+}
+
+static int striped_insert(void *p, void *k, void *v)
+{
+	return sharded_hashtbl_insert(p, k, v);
+}
+
+static int striped_remove(void *p, const void *k)
+{
+	return sharded_hashtbl_remove(p, k);
+}
+
+/*
+ * Mode: a sharded LRU, 64 access ordered l_hashtbl shards each
+ * behind its own padded mutex and each holding 1/64 of the entries.
+ * As with sharded_hashtbl, the shard comes from the top bits of the
+ * hash so that it doesn't correlate with the slot.
+ */
+
+union lru_shard {
+	struct locked_l_hashtbl s;
+	char pad[2 * CACHE_LINE_SIZE];
+};
+
+static unsigned long lru_shard_capacity;
+
+static int lru_shard_evictor(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > lru_shard_capacity;
+}
+
+static void sharded_lru_delete(void *p)
+{
+	union lru_shard *shards = p;
+	int i;
+
+	for (i = 0; i < (1 << SHARD_BITS); i++) {
+		if (shards[i].s.h == NULL)
+			break;
+		l_hashtbl_delete(shards[i].s.h);
+		pthread_mutex_destroy(&shards[i].s.lock);
+	}
+	free(shards);
+}
+
+static void *sharded_lru_create(int nkeys)
+{
+	union lru_shard *shards = calloc(1 << SHARD_BITS, sizeof(*shards));
+	int i;
+
+	if (shards == NULL)
+		return NULL;
+
+	lru_shard_capacity = (unsigned long)(nkeys >> SHARD_BITS);
+	if (lru_shard_capacity == 0)
+		lru_shard_capacity = 1;
+
+	for (i = 0; i < (1 << SHARD_BITS); i++) {
+		if ((shards[i].s.h = l_hashtbl_create(nkeys >> SHARD_BITS, 0.75,
+						      1, 1, bench_hash,
+						      bench_equals, NULL, NULL,
+						      NULL, NULL,
+						      lru_shard_evictor)) == NULL) {
+			sharded_lru_delete(shards);
+			return NULL;
+		}
+		pthread_mutex_init(&shards[i].s.lock, NULL);
+	}
+
+	return shards;
+}
+
+static struct locked_l_hashtbl *lru_shard_for(void *p, const void *k)
+{
+	union lru_shard *shards = p;
+	unsigned int hv = bench_hash(k) * 2654435761U;
+
+	return &shards[hv >> (32 - SHARD_BITS)].s;
+}
+
+static void *sharded_lru_lookup(void *p, const void *k)
+{
+	return lru_mutex_lookup(lru_shard_for(p, k), k);
+}
+
+static int sharded_lru_insert(void *p, void *k, void *v)
+{
+	return lru_mutex_insert(lru_shard_for(p, k), k, v);
+}
+
+static int sharded_lru_remove(void *p, const void *k)
+{
+	return lru_mutex_remove(lru_shard_for(p, k), k);
+}
+
+/* Mode: concurrent_hashtbl, with lock-free lookups. */
+
+static void *concurrent_create(int nkeys)
+{
+	return concurrent_hashtbl_create(nkeys, 0.75, bench_hash, bench_equals,
+					 NULL, NULL, NULL, NULL);
+}
+
+static void concurrent_delete(void *p)
+{
+	concurrent_hashtbl_delete(p);
+}
+
+static void *concurrent_lookup(void *p, const void *k)
+{
+	return concurrent_hashtbl_lookup(p, k);
+}
+
+static int concurrent_insert(void *p, void *k, void *v)
+{
+	return concurrent_hashtbl_insert(p, k, v);
+}
+
+static int concurrent_remove(void *p, const void *k)
+{
+	return concurrent_hashtbl_remove(p, k);
+}
+
+static const struct mode modes[] = {
+	{ "mutex", mutex_create, mutex_delete,
+	  mutex_lookup, mutex_insert, mutex_remove },
+	{ "lru-mutex", lru_mutex_create, lru_mutex_delete,
+	  lru_mutex_lookup, lru_mutex_insert, lru_mutex_remove },
+	{ "striped", striped_create, striped_delete,
+	  striped_lookup, striped_insert, striped_remove },
+	{ "sharded-lru", sharded_lru_create, sharded_lru_delete,
+	  sharded_lru_lookup, sharded_lru_insert, sharded_lru_remove },
+	{ "concurrent", concurrent_create, concurrent_delete,
+	  concurrent_lookup, concurrent_insert, concurrent_remove },
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b != 0) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * Draws n key indices in [0, nkeys) from a Zipf distribution by
+ * binary searching the cumulative distribution.  This is done up
+ * front so that the sampling cost isn't measured.
+ */
+static void zipf_schedule(unsigned int *out, int n, int nkeys, double skew,
+			  unsigned int seed)
+{
+	double *cdf = malloc((size_t) nkeys * sizeof(*cdf));
+	double sum = 0.0;
+	unsigned int step = 2654435761U % (unsigned int)nkeys;
+	int i;
+
+	/*
+	 * Popular ranks are scattered across the key space by rank *
+	 * step mod nkeys, which is a bijection only if step is coprime
+	 * with nkeys.
+	 */
+	while (gcd(step, (unsigned int)nkeys) != 1)
+		step++;
+
+	if (cdf == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		sum += 1.0 / pow((double)(i + 1), skew);
+		cdf[i] = sum;
+	}
+
+	for (i = 0; i < n; i++) {
+		double u = (double)xorshift32(&seed) / 4294967296.0 * sum;
+		int lo = 0, hi = nkeys - 1;
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+			if (cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		out[i] = (unsigned int)((unsigned long long)lo * step %
+				       (unsigned int)nkeys);
+	}
+
+	free(cdf);
+}
+
+static void pin_to_cpu(int cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET((size_t)cpu, &set);
+	(void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	UNUSED_PARAMETER(cpu);
+#endif
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	const struct mode *m = w->mode;
+	unsigned int seed = (unsigned int)w->id * 7919U + 1U;
+	unsigned long nops = 0, hits = 0;
+	unsigned int i = 0;
+
+	if (w->cpu >= 0)
+		pin_to_cpu(w->cpu);
+
+	while (!atomic_load_explicit(&start_flag, memory_order_acquire))
+		;
+
+	while (!atomic_load_explicit(&stop_flag, memory_order_relaxed)) {
+		unsigned int *k = &w->keys[w->schedule[i++ & (KEY_SCHEDULE_SIZE - 1)]];
+
+		if ((int)(xorshift32(&seed) % 100) < w->write_pct) {
+			if (m->remove(w->table, k) != 0)
+				(void)m->insert(w->table, k, k);
+		} else {
+			hits += (m->lookup(w->table, k) != NULL);
+		}
+		nops++;
+	}
+
+	w->nops = nops;
+	w->hits = hits;
+	return NULL;
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void sleep_millis(int millis)
+{
+	struct timespec ts;
+	ts.tv_sec = millis / 1000;
+	ts.tv_nsec = (long)(millis % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+struct run_stats {
+	double ops_per_sec;
+	double fairness;	/* Jain's index: 1.0 is perfectly fair */
+	double min_share;	/* min thread ops / mean thread ops */
+	double max_share;
+};
+
+static int run(const struct mode *m, int nthreads, int millis, int nkeys,
+	       int write_pct, double skew, int pin, int ncpus,
+	       unsigned int *keys, struct run_stats *stats)
+{
+	struct worker *workers;
+	void *table;
+	double elapsed, sum = 0.0, sumsq = 0.0, min = -1.0, max = 0.0, mean;
+	int i;
+
+	if ((table = m->create(nkeys)) == NULL)
+		return 1;
+
+	for (i = 0; i < nkeys; i++)
+		(void)m->insert(table, &keys[i], &keys[i]);
+
+	workers = calloc((size_t) nthreads, sizeof(*workers));
+	if (workers == NULL) {
+		m->delete(table);
+		return 1;
+	}
+
+	atomic_store(&start_flag, 0);
+	atomic_store(&stop_flag, 0);
+
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &workers[i];
+		w->mode = m;
+		w->table = table;
+		w->keys = keys;
+		w->write_pct = write_pct;
+		w->id = i;
+		w->cpu = pin ? i % ncpus : -1;
+		w->schedule = malloc(KEY_SCHEDULE_SIZE * sizeof(*w->schedule));
+		if (w->schedule == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		zipf_schedule(w->schedule, KEY_SCHEDULE_SIZE, nkeys, skew,
+			      (unsigned int)i + 1U);
+		pthread_create(&w->thread, NULL, worker_main, w);
+	}
+
+	elapsed = now_secs();
+	atomic_store_explicit(&start_flag, 1, memory_order_release);
+	sleep_millis(millis);
+	atomic_store(&stop_flag, 1);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = now_secs() - elapsed;
+
+	for (i = 0; i < nthreads; i++) {
+		double x = (double)workers[i].nops;
+		sum += x;
+		sumsq += x * x;
+		if (min < 0 || x < min)
+			min = x;
+		if (x > max)
+			max = x;
+		sink += workers[i].hits;
+		free(workers[i].schedule);
+	}
+
+	mean = sum / nthreads;
+	stats->ops_per_sec = sum / elapsed;
+	stats->fairness = (sumsq > 0) ? (sum * sum) / (nthreads * sumsq) : 1.0;
+	stats->min_share = (mean > 0) ? min / mean : 0.0;
+	stats->max_share = (mean > 0) ? max / mean : 0.0;
+
+	free(workers);
+	m->delete(table);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr,
+		"usage: %s [-t max_threads] [-d millis] [-k keys] "
+		"[-w write_pct] [-s zipf_skew] [-m mode] [-P]\n", prog);
+	fprintf(stderr, "modes:");
+	for (i = 0; i < NELEMENTS(modes); i++)
+		fprintf(stderr, " %s", modes[i].name);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = ncpus, millis = 500, nkeys = 1 << 16;
+	int write_pct = 10, pin = 1, i, nthreads;
+	double skew = 0.0;
+	const char *mode_name = NULL;
+	unsigned int *keys;
+	size_t m;
+
+	if (ncpus < 1)
+		ncpus = max_threads = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			max_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			millis = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			nkeys = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			write_pct = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			skew = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			mode_name = argv[++i];
+		} else if (strcmp(argv[i], "-P") == 0) {
+			pin = 0;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || millis < 1 || nkeys < 1 ||
+	    write_pct < 0 || write_pct > 100 || skew < 0.0)
+		usage(argv[0]);
+
+	if ((keys = malloc((size_t) nkeys * sizeof(*keys))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < nkeys; i++)
+		keys[i] = mix32((unsigned int)i);
+
+	printf("%d keys, %d%% writes, zipf skew %.2f, %d ms per run, %s\n\n",
+	       nkeys, write_pct, skew, millis, pin ? "pinned" : "unpinned");
+	printf("%-12s %7s %14s %8s %8s %9s %9s\n",
+	       "mode", "threads", "ops/sec", "speedup", "jain",
+	       "min_share", "max_share");
+
+	for (m = 0; m < NELEMENTS(modes); m++) {
+		double base = 0.0;
+
+		if (mode_name && strcmp(mode_name, modes[m].name) != 0)
+			continue;
+
+		for (nthreads = 1; ; nthreads *= 2) {
+			struct run_stats stats;
+
+			if (nthreads > max_threads)
+				nthreads = max_threads;
+
+			if (run(&modes[m], nthreads, millis, nkeys, write_pct,
+				skew, pin, ncpus, keys, &stats) != 0) {
+				fprintf(stderr, "%s: run failed\n", modes[m].name);
+				break;
+			}
+
+			if (nthreads == 1)
+				base = stats.ops_per_sec;
+
+			printf("%-12s %7d %14.0f %8.2f %8.3f %9.2f %9.2f\n",
+			       modes[m].name, nthreads, stats.ops_per_sec,
+			       base > 0 ? stats.ops_per_sec / base : 0.0,
+			       stats.fairness, stats.min_share,
+			       stats.max_share);
+
+			if (nthreads == max_threads)
+				break;
+		}
+	}
+
+	free(keys);
+	return EXIT_SUCCESS;
+}
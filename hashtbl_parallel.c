@@ -0,0 +1,531 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Work-stealing bulk operations over a hashtbl's slots.
+ *
+ * The slot array is cut into chunks of CHUNK_SLOTS slots.  Worker w
+ * starts with the chunk range [w * nchunks / n, (w + 1) * nchunks / n)
+ * and takes chunks from the front of it.  When its range is empty it
+ * visits the other workers in turn and steals the upper half of the
+ * first non-empty range it finds.  A steal only moves chunks into the
+ * thief's range and no chunk is ever handed out twice, so a worker
+ * that finds every range empty can stop: any chunk it missed is held
+ * by a worker that has not yet stopped and will process it.
+ *
+ * Every chunk is processed by exactly one worker, so chains can be
+ * walked and relinked without locks; the only shared state is the
+ * ranges (one mutex each), a stop flag and the per-worker totals
+ * that are summed once the workers have finished.
+ *
+ * Entries that hashtbl_defragment() moved into a slab share its
+ * bookkeeping, so retain pushes those onto a lock-free list for the
+ * caller to release after the join.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcpy */
+#include <pthread.h>
+#include <stdatomic.h>
+#include "hashtbl_parallel.h"
+#include "hashtbl_private.h"
+
+#define CACHE_LINE_SIZE		64
+#define CHUNK_SLOTS		32
+#define MIN_CHUNK_BUFFER	256
+
+/*
+ * A worker's remaining chunks, padded so that no two workers' range
+ * locks share a cache line.
+ */
+union range {
+	struct {
+		pthread_mutex_t lock;
+		int next;
+		int end;
+	} r;
+	char pad[2 * CACHE_LINE_SIZE];
+};
+
+struct chunk_buffer {
+	char *buf;
+	size_t len;
+};
+
+struct scheduler {
+	const struct hashtbl *h;
+	int nchunks;
+	int nworkers;
+	union range *ranges;
+	atomic_int stop;
+	atomic_ulong total;
+	/* Processes one chunk, returns its contribution to total. */
+	unsigned long (*run_chunk)(struct scheduler *s, int chunk);
+	/* Operation arguments. */
+	HASHTBL_APPLY_FN apply_fn;
+	HASHTBL_COPY_FN copy_fn;
+	HASHTBL_SERIALIZE_FN serialize_fn;
+	void *client_data;
+	struct hashtbl *dst;
+	struct chunk_buffer *buffers;
+	_Atomic(struct hashtbl_node *) deferred;
+};
+
+struct worker {
+	pthread_t tid;
+	struct scheduler *s;
+	int id;
+};
+
+static int take_chunk(struct scheduler *s, int id)
+{
+	union range *own = &s->ranges[id];
+	int i, lo, hi, chunk = -1;
+
+	pthread_mutex_lock(&own->r.lock);
+	if (own->r.next < own->r.end)
+		chunk = own->r.next++;
+	pthread_mutex_unlock(&own->r.lock);
+
+	if (chunk >= 0)
+		return chunk;
+
+	for (i = 1; i < s->nworkers; i++) {
+		union range *victim = &s->ranges[(id + i) % s->nworkers];
+
+		pthread_mutex_lock(&victim->r.lock);
+		lo = victim->r.next;
+		hi = victim->r.end;
+		if (lo < hi) {
+			/* Take [mid, hi), leaving at least as much. */
+			lo += (hi - lo) / 2;
+			victim->r.end = lo;
+		}
+		pthread_mutex_unlock(&victim->r.lock);
+
+		if (lo < hi) {
+			pthread_mutex_lock(&own->r.lock);
+			own->r.next = lo + 1;
+			own->r.end = hi;
+			pthread_mutex_unlock(&own->r.lock);
+			return lo;
+		}
+	}
+
+	return -1;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct scheduler *s = w->s;
+	unsigned long total = 0;
+	int chunk;
+
+	while (!atomic_load_explicit(&s->stop, memory_order_relaxed) &&
+	       (chunk = take_chunk(s, w->id)) >= 0)
+		total += s->run_chunk(s, chunk);
+
+	atomic_fetch_add(&s->total, total);
+	return NULL;
+}
+
+/* Runs s->run_chunk over every chunk, returns the sum of the results. */
+
+static unsigned long run(struct scheduler *s, int nthreads)
+{
+	union range single;
+	struct worker *workers = NULL;
+	int i, nstarted = 1;
+
+	s->nchunks = (s->h->table_size + CHUNK_SLOTS - 1) / CHUNK_SLOTS;
+	s->nworkers = (nthreads < s->nchunks) ? nthreads : s->nchunks;
+	s->ranges = NULL;
+	atomic_init(&s->stop, 0);
+	atomic_init(&s->total, 0);
+
+	if (s->nworkers > 1) {
+		workers = malloc((size_t) s->nworkers * sizeof(*workers));
+		s->ranges = malloc((size_t) s->nworkers * sizeof(*s->ranges));
+	}
+
+	/* Without the memory to run in parallel the caller does it all. */
+
+	if (workers == NULL || s->ranges == NULL) {
+		free(workers);
+		free(s->ranges);
+		workers = NULL;
+		s->ranges = &single;
+		s->nworkers = 1;
+	}
+
+	for (i = 0; i < s->nworkers; i++) {
+		pthread_mutex_init(&s->ranges[i].r.lock, NULL);
+		s->ranges[i].r.next = (int)((long) i * s->nchunks / s->nworkers);
+		s->ranges[i].r.end = (int)((long) (i + 1) * s->nchunks / s->nworkers);
+	}
+
+	/*
+	 * The caller is worker 0.  Ranges of workers that fail to start
+	 * are stolen by the others.
+	 */
+
+	for (i = 1; i < s->nworkers; i++) {
+		workers[i].s = s;
+		workers[i].id = i;
+		if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0)
+			break;
+		nstarted++;
+	}
+
+	if (workers != NULL) {
+		workers[0].s = s;
+		workers[0].id = 0;
+		worker_main(&workers[0]);
+	} else {
+		struct worker self;
+		self.s = s;
+		self.id = 0;
+		worker_main(&self);
+	}
+
+	for (i = 1; i < nstarted; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	for (i = 0; i < s->nworkers; i++)
+		pthread_mutex_destroy(&s->ranges[i].r.lock);
+
+	if (workers != NULL) {
+		free(s->ranges);
+		free(workers);
+	}
+
+	return atomic_load(&s->total);
+}
+
+static void chunk_slots(const struct scheduler *s, int chunk, int *first, int *last)
+{
+	*first = chunk * CHUNK_SLOTS;
+	*last = *first + CHUNK_SLOTS;
+	if (*last > s->h->table_size)
+		*last = s->h->table_size;
+}
+
+/* Apply. */
+
+static unsigned long apply_chunk(struct scheduler *s, int chunk)
+{
+	unsigned long n = 0;
+	int i, last;
+
+	for (chunk_slots(s, chunk, &i, &last); i < last; i++) {
+		struct hashtbl_node *node;
+		for (node = s->h->table[i]; node != NULL; node = node->next) {
+			if (atomic_load_explicit(&s->stop, memory_order_relaxed))
+				return n;
+			n++;
+			if (!s->apply_fn(hashtbl_node_key(s->h, node),
+					 hashtbl_node_val(s->h, node), s->client_data)) {
+				atomic_store(&s->stop, 1);
+				return n;
+			}
+		}
+	}
+
+	return n;
+}
+
+unsigned long hashtbl_parallel_apply(const struct hashtbl *h,
+				     HASHTBL_APPLY_FN fn,
+				     void *client_data,
+				     int nthreads)
+{
+	struct scheduler s;
+
+	s.h = h;
+	s.run_chunk = apply_chunk;
+	s.apply_fn = fn;
+	s.client_data = client_data;
+
+	return run(&s, nthreads);
+}
+
+/* Retain. */
+
+static unsigned long retain_chunk(struct scheduler *s, int chunk)
+{
+	const struct hashtbl *h = s->h;
+	unsigned long nremoved = 0;
+	int i, last;
+
+	for (chunk_slots(s, chunk, &i, &last); i < last; i++) {
+		struct hashtbl_node **prev = &h->table[i];
+		struct hashtbl_node *node;
+		while ((node = *prev) != NULL) {
+			struct hashtbl_entry *entry;
+			struct hashtbl_slab *slab;
+			if (s->apply_fn(hashtbl_node_key(h, node),
+					hashtbl_node_val(h, node), s->client_data)) {
+				prev = &node->next;
+				continue;
+			}
+			*prev = node->next;
+			node->next = NULL;
+			nremoved++;
+			if (h->intrusive) {
+				if (h->node_free_fn != NULL)
+					h->node_free_fn(node);
+				continue;
+			}
+			entry = (struct hashtbl_entry *)node;
+			slab = hashtbl_entry_slab(h, entry);
+			if (h->reclaim_fn != NULL && slab == NULL) {
+				h->reclaim_fn(entry, entry->key, entry->val,
+					      h->reclaim_client_data);
+				continue;
+			}
+			if (h->key_free_fn != NULL)
+				h->key_free_fn(entry->key);
+			if (h->val_free_fn != NULL)
+				h->val_free_fn(entry->val);
+			if (slab == NULL) {
+				h->free_fn(node);
+				continue;
+			}
+			node->next = atomic_load(&s->deferred);
+			while (!atomic_compare_exchange_weak(&s->deferred,
+							     &node->next, node))
+				;
+		}
+	}
+
+	return nremoved;
+}
+
+unsigned long hashtbl_parallel_retain(struct hashtbl *h,
+				      HASHTBL_APPLY_FN fn,
+				      void *client_data,
+				      int nthreads)
+{
+	struct scheduler s;
+	struct hashtbl_node *node, *next;
+	unsigned long nremoved;
+
+	s.h = h;
+	s.run_chunk = retain_chunk;
+	s.apply_fn = fn;
+	s.client_data = client_data;
+	atomic_init(&s.deferred, NULL);
+
+	nremoved = run(&s, nthreads);
+	h->nentries -= nremoved;
+
+	next = atomic_load(&s.deferred);
+	while ((node = next) != NULL) {
+		next = node->next;
+		hashtbl_entry_free(h, (struct hashtbl_entry *)node);
+	}
+
+	return nremoved;
+}
+
+/* Clone. */
+
+static unsigned long clone_chunk(struct scheduler *s, int chunk)
+{
+	struct hashtbl *dst = s->dst;
+	unsigned long n = 0;
+	int i, last;
+
+	/*
+	 * Both tables have the same size so every entry lands in the
+	 * slot of the same index, which this worker owns.  Appending
+	 * keeps the chain order of the source.
+	 */
+
+	for (chunk_slots(s, chunk, &i, &last); i < last; i++) {
+		struct hashtbl_node **tail = &dst->table[i];
+		struct hashtbl_node *node;
+		struct hashtbl_entry *copy;
+		for (node = s->h->table[i]; node != NULL; node = node->next) {
+			const struct hashtbl_entry *entry = (struct hashtbl_entry *)node;
+			if ((copy = dst->malloc_fn(sizeof(*copy))) == NULL)
+				goto fail;
+			if (s->copy_fn(entry->key, entry->val,
+				       &copy->key, &copy->val, s->client_data) != 0) {
+				dst->free_fn(copy);
+				goto fail;
+			}
+			copy->node.hash = node->hash;
+			copy->node.next = NULL;
+			*tail = &copy->node;
+			tail = &copy->node.next;
+			n++;
+		}
+	}
+
+	return n;
+
+ fail:
+	atomic_store(&s->stop, 1);
+	return n;
+}
+
+struct hashtbl *hashtbl_parallel_clone(const struct hashtbl *h,
+				       HASHTBL_COPY_FN fn,
+				       void *client_data,
+				       int nthreads)
+{
+	struct scheduler s;
+	struct hashtbl *dst;
+
+	/* The client owns the objects of an intrusive table. */
+	if (h->intrusive)
+		return NULL;
+
+	dst = hashtbl_create(h->table_size, h->max_load_factor, h->auto_resize,
+			     h->hash_fn, h->equals_fn,
+			     h->key_free_fn, h->val_free_fn,
+			     h->malloc_fn, h->free_fn);
+
+	if (dst == NULL)
+		return NULL;
+
+	s.h = h;
+	s.run_chunk = clone_chunk;
+	s.copy_fn = fn;
+	s.client_data = client_data;
+	s.dst = dst;
+
+	dst->nentries = run(&s, nthreads);
+
+	if (atomic_load(&s.stop)) {
+		hashtbl_delete(dst);
+		return NULL;
+	}
+
+	return dst;
+}
+
+/* Serialize. */
+
+static unsigned long serialize_chunk(struct scheduler *s, int chunk)
+{
+	const struct hashtbl *h = s->h;
+	struct chunk_buffer *out = &s->buffers[chunk];
+	size_t size = 0, n;
+	char *buf;
+	int i, last;
+
+	for (chunk_slots(s, chunk, &i, &last); i < last; i++) {
+		struct hashtbl_node *node;
+		for (node = h->table[i]; node != NULL; node = node->next) {
+			const void *key = hashtbl_node_key(h, node);
+			const void *val = hashtbl_node_val(h, node);
+			/* Until the first buffer exists, ask for the length only. */
+			n = s->serialize_fn(out->buf != NULL ?
+					    out->buf + out->len : NULL,
+					    size - out->len, key, val,
+					    s->client_data);
+			if (n < size - out->len) {
+				out->len += n;
+				continue;
+			}
+			/* Grow (leaving room for a NUL) and format again. */
+			size = (size * 2 > out->len + n + 1) ?
+				size * 2 : out->len + n + 1;
+			if (size < MIN_CHUNK_BUFFER)
+				size = MIN_CHUNK_BUFFER;
+			if ((buf = h->malloc_fn(size)) == NULL) {
+				atomic_store(&s->stop, 1);
+				return 0;
+			}
+			if (out->buf != NULL) {
+				memcpy(buf, out->buf, out->len);
+				h->free_fn(out->buf);
+			}
+			out->buf = buf;
+			out->len += s->serialize_fn(out->buf + out->len, size - out->len,
+						    key, val, s->client_data);
+		}
+	}
+
+	return 0;
+}
+
+char *hashtbl_parallel_serialize(const struct hashtbl *h,
+				 HASHTBL_SERIALIZE_FN fn,
+				 void *client_data,
+				 int nthreads,
+				 size_t *len)
+{
+	struct scheduler s;
+	size_t total = 0;
+	char *result = NULL;
+	int i, nchunks = (h->table_size + CHUNK_SLOTS - 1) / CHUNK_SLOTS;
+
+	s.buffers = h->malloc_fn((size_t) nchunks * sizeof(*s.buffers));
+	if (s.buffers == NULL)
+		return NULL;
+
+	for (i = 0; i < nchunks; i++) {
+		s.buffers[i].buf = NULL;
+		s.buffers[i].len = 0;
+	}
+
+	s.h = h;
+	s.run_chunk = serialize_chunk;
+	s.serialize_fn = fn;
+	s.client_data = client_data;
+
+	run(&s, nthreads);
+
+	if (!atomic_load(&s.stop)) {
+		for (i = 0; i < nchunks; i++)
+			total += s.buffers[i].len;
+		if ((result = h->malloc_fn(total + 1)) != NULL) {
+			total = 0;
+			for (i = 0; i < nchunks; i++) {
+				if (s.buffers[i].len > 0)
+					memcpy(result + total, s.buffers[i].buf, s.buffers[i].len);
+				total += s.buffers[i].len;
+			}
+			result[total] = '\0';
+			if (len != NULL)
+				*len = total;
+		}
+	}
+
+	for (i = 0; i < nchunks; i++) {
+		if (s.buffers[i].buf != NULL)
+			h->free_fn(s.buffers[i].buf);
+	}
+	h->free_fn(s.buffers);
+
+	return result;
+}
@@ -0,0 +1,132 @@
+#ifndef HASHTBL_PARALLEL_H
+#define HASHTBL_PARALLEL_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Multi-threaded bulk operations over a hashtbl.
+ *
+ * SYNOPSIS
+ *
+ * 1. To apply a function to all entries use hashtbl_parallel_apply().
+ * 2. To remove entries selectively use hashtbl_parallel_retain().
+ * 3. To copy a table use hashtbl_parallel_clone().
+ * 4. To serialize a table use hashtbl_parallel_serialize().
+ *
+ * The slots are cut into chunks and each thread starts on an equal
+ * share of them.  A thread that runs out of work steals the upper
+ * half of the remaining chunks of another thread, so a table whose
+ * long chains are bunched together still keeps every thread busy.
+ *
+ * The table must not be modified by other threads while one of these
+ * operations runs.  Callback functions, including the table's free
+ * functions for hashtbl_parallel_retain(), are called concurrently
+ * from up to nthreads threads and must be thread-safe.
+ */
+
+#include "hashtbl.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Copies an entry for hashtbl_parallel_clone().  Stores the copies in
+ * *new_key and *new_val and returns 0, or returns 1 on failure.
+ */
+typedef int (*HASHTBL_COPY_FN) (const void *key,
+				const void *val,
+				void **new_key,
+				void **new_val,
+				void *client_data);
+
+/*
+ * Formats an entry for hashtbl_parallel_serialize(), as snprintf():
+ * writes at most size bytes to buf and returns the number of bytes
+ * the entry needs, which may exceed size.  buf is NULL when size is 0.
+ */
+typedef size_t (*HASHTBL_SERIALIZE_FN) (char *buf,
+					size_t size,
+					const void *key,
+					const void *val,
+					void *client_data);
+
+/*
+ * As hashtbl_apply(), using up to nthreads threads.  Returning 0 from
+ * fn stops the enumeration on all threads.
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long hashtbl_parallel_apply(const struct hashtbl *h,
+				     HASHTBL_APPLY_FN fn,
+				     void *client_data,
+				     int nthreads);
+
+/*
+ * Removes every entry for which fn returns 0, using up to nthreads
+ * threads.  Keys and values are freed as for hashtbl_remove().
+ *
+ * Returns the number of entries removed.
+ */
+unsigned long hashtbl_parallel_retain(struct hashtbl *h,
+				      HASHTBL_APPLY_FN fn,
+				      void *client_data,
+				      int nthreads);
+
+/*
+ * Creates a copy of h with the same capacity, functions and settings
+ * (but no resize callback or sampling), copying every entry with fn
+ * using up to nthreads threads.
+ *
+ * Returns NULL if memory is exhausted, fn fails or h is intrusive.
+ */
+struct hashtbl *hashtbl_parallel_clone(const struct hashtbl *h,
+				       HASHTBL_COPY_FN fn,
+				       void *client_data,
+				       int nthreads);
+
+/*
+ * Formats every entry with fn, using up to nthreads threads, and
+ * concatenates the results in the order hashtbl_apply() visits the
+ * entries.  The result is NUL terminated and its length (without the
+ * NUL) is stored in *len if len is non-null.
+ *
+ * Returns a buffer from the table's malloc function, to be released
+ * with its free function, or NULL if memory is exhausted.
+ */
+char *hashtbl_parallel_serialize(const struct hashtbl *h,
+				 HASHTBL_SERIALIZE_FN fn,
+				 void *client_data,
+				 int nthreads,
+				 size_t *len);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HASHTBL_PARALLEL_H */
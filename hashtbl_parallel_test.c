@@ -0,0 +1,235 @@
+/* Copyright (c) 2009, 2010 <Andrew McDermott>
+ * 
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* hashtbl_parallel_test.c - unit tests for hashtbl_parallel */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "CUnitTest.h"
+#include "hashtbl_parallel.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NKEYS			5000
+#define NTHREADS		4
+
+/* Most keys share a handful of slots: badly skewed chains. */
+
+static unsigned int skewed_hash(const void *k)
+{
+	int x = *(const int *)k;
+	return (x % 5 != 0) ? (unsigned int)(x % 3) : (unsigned int)x;
+}
+
+static struct hashtbl *new_table(void)
+{
+	struct hashtbl *h;
+	int i;
+
+	h = hashtbl_create(1 << 12, 0.75, 1, skewed_hash, hashtbl_int_equals,
+			   test_counting_free, test_counting_free, NULL, NULL);
+
+	for (i = 0; h != NULL && i < NKEYS; i++)
+		hashtbl_insert(h, test_int(i), test_int(i * 2));
+
+	atomic_store(&test_nfrees, 0);
+	return h;
+}
+
+static int is_even_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(v);
+	UNUSED_PARAMETER(p);
+	return *(const int *)k % 2 == 0;
+}
+
+static int copy_fn(const void *k, const void *v, void **new_k, void **new_v, void *p)
+{
+	if (p != NULL && *(const int *)k == *(const int *)p)
+		return 1;
+	*new_k = test_int(*(const int *)k);
+	*new_v = test_int(*(const int *)v);
+	return 0;
+}
+
+static size_t format_fn(char *buf, size_t size, const void *k, const void *v, void *p)
+{
+	UNUSED_PARAMETER(p);
+	return (size_t) snprintf(buf, size, "%d=%d,", *(const int *)k, *(const int *)v);
+}
+
+struct sequential_output {
+	char *buf;
+	size_t len;
+};
+
+static int sequential_format_fn(const void *k, const void *v, const void *p)
+{
+	struct sequential_output *out = (struct sequential_output *)p;
+	out->len += format_fn(out->buf + out->len, 32, k, v, NULL);
+	return 1;
+}
+
+/* Test parallel apply. */
+
+static int test1(void)
+{
+	int nthreads;
+	long expected = 0, i;
+	atomic_long sum;
+	struct hashtbl *h = new_table();
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < NKEYS; i++)
+		expected += i * 2;
+
+	for (nthreads = 1; nthreads <= 16; nthreads *= 2) {
+		atomic_init(&sum, 0);
+		CUT_ASSERT_EQUAL(NKEYS, hashtbl_parallel_apply(h, test_sum_fn, &sum, nthreads));
+		CUT_ASSERT_EQUAL(expected, atomic_load(&sum));
+	}
+
+	/* Stopping early stops every worker. */
+	CUT_ASSERT_EQUAL(1, hashtbl_parallel_apply(h, test_stop_fn, NULL, 1));
+	CUT_ASSERT_TRUE(hashtbl_parallel_apply(h, test_stop_fn, NULL, NTHREADS) <= NTHREADS);
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+/* Test parallel retain. */
+
+static int test2(void)
+{
+	int i;
+	struct hashtbl *h = new_table();
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(NKEYS / 2, hashtbl_parallel_retain(h, is_even_fn, NULL, NTHREADS));
+	CUT_ASSERT_EQUAL(NKEYS / 2, hashtbl_count(h));
+	CUT_ASSERT_EQUAL(NKEYS, atomic_load(&test_nfrees));
+
+	for (i = 0; i < NKEYS; i++) {
+		if (i % 2 == 0)
+			CUT_ASSERT_EQUAL(i * 2, *(int *)hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+	}
+
+	/* Entries in a defragmented slab are released after the join. */
+	CUT_ASSERT_EQUAL(0, hashtbl_defragment(h, 0));
+	CUT_ASSERT_EQUAL(0, hashtbl_parallel_retain(h, is_even_fn, NULL, NTHREADS));
+	CUT_ASSERT_EQUAL(NKEYS / 2, hashtbl_parallel_retain(h, test_stop_fn, NULL, NTHREADS));
+	CUT_ASSERT_EQUAL(0, hashtbl_count(h));
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+/* Test parallel clone. */
+
+static int test3(void)
+{
+	int i, bad_key = NKEYS - 1;
+	struct hashtbl *h = new_table();
+	struct hashtbl *clone;
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	clone = hashtbl_parallel_clone(h, copy_fn, NULL, NTHREADS);
+	CUT_ASSERT_NOT_NULL(clone);
+	CUT_ASSERT_EQUAL(NKEYS, hashtbl_count(clone));
+	CUT_ASSERT_EQUAL(hashtbl_capacity(h), hashtbl_capacity(clone));
+
+	for (i = 0; i < NKEYS; i++) {
+		CUT_ASSERT_EQUAL(i * 2, *(int *)hashtbl_lookup(clone, &i));
+		CUT_ASSERT_NOT_EQUAL(hashtbl_lookup(h, &i), hashtbl_lookup(clone, &i));
+	}
+
+	/* The copies are independent. */
+	for (i = 0; i < NKEYS; i += 2)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(clone, &i));
+	CUT_ASSERT_EQUAL(NKEYS, hashtbl_count(h));
+	CUT_ASSERT_EQUAL(NKEYS / 2, hashtbl_count(clone));
+	hashtbl_delete(clone);
+
+	/* A failed copy frees everything copied so far. */
+	atomic_store(&test_nfrees, 0);
+	CUT_ASSERT_NULL(hashtbl_parallel_clone(h, copy_fn, &bad_key, NTHREADS));
+	CUT_ASSERT_EQUAL(0, atomic_load(&test_nfrees) % 2);
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+/* Test parallel serialize. */
+
+static int test4(void)
+{
+	size_t len;
+	char *buf;
+	struct sequential_output expected;
+	struct hashtbl *h = new_table();
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	expected.buf = malloc(NKEYS * 32);
+	expected.len = 0;
+	hashtbl_apply(h, sequential_format_fn, &expected);
+
+	buf = hashtbl_parallel_serialize(h, format_fn, NULL, NTHREADS, &len);
+	CUT_ASSERT_NOT_NULL(buf);
+	CUT_ASSERT_EQUAL(expected.len, len);
+	CUT_ASSERT_EQUAL(0, strcmp(expected.buf, buf));
+	free(buf);
+
+	buf = hashtbl_parallel_serialize(h, format_fn, NULL, 1, NULL);
+	CUT_ASSERT_NOT_NULL(buf);
+	CUT_ASSERT_EQUAL(0, strcmp(expected.buf, buf));
+	free(buf);
+
+	hashtbl_clear(h);
+	buf = hashtbl_parallel_serialize(h, format_fn, NULL, NTHREADS, &len);
+	CUT_ASSERT_NOT_NULL(buf);
+	CUT_ASSERT_EQUAL(0, len);
+	CUT_ASSERT_EQUAL('\0', buf[0]);
+	free(buf);
+
+	free(expected.buf);
+	hashtbl_delete(h);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,160 @@
+#ifndef HASHTBL_PRIVATE_H
+#define HASHTBL_PRIVATE_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * The hashtbl representation, shared between hashtbl.c and modules
+ * that operate on a table's slots directly (hashtbl_parallel.c).
+ * Not part of the public API.
+ */
+
+#if !defined(_MSC_VER)
+#include <stdint.h>		/* uintptr_t */
+#endif
+#include "hashtbl.h"
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/*
+ * Takes over releasing a removed entry and its key and value.  mem
+ * is the entry's memory, which the function may reuse until it is
+ * released with the table's free_fn.  Called concurrently by
+ * hashtbl_parallel_retain().
+ */
+typedef void (*HASHTBL_RECLAIM_FN) (void *mem, void *key, void *val,
+				    void *client_data);
+
+struct hashtbl {
+	double max_load_factor;
+	HASHTBL_HASH_FN hash_fn;
+	HASHTBL_EQUALS_FN equals_fn;
+	unsigned long nentries;
+	int table_size;
+	int resize_threshold;
+	int auto_resize;
+	HASHTBL_KEY_FREE_FN key_free_fn;
+	HASHTBL_VAL_FREE_FN val_free_fn;
+	HASHTBL_MALLOC_FN malloc_fn;
+	HASHTBL_FREE_FN free_fn;
+	HASHTBL_RESIZE_FN resize_fn;
+	void *resize_client_data;
+	struct hashtbl_sampler *sampler;
+	int intrusive;		/* nodes are embedded in client objects */
+	ptrdiff_t key_offset;	/* of the key from the node, if intrusive */
+	HASHTBL_NODE_KEY_FN node_key_fn;
+	HASHTBL_NODE_FREE_FN node_free_fn;
+	struct hashtbl_slab **slabs;	/* by address, see hashtbl_entry_slab() */
+	int nslabs;
+	int slabs_size;
+	struct hashtbl_slab *defrag_slab; /* being filled, or NULL */
+	int defrag_pos;			/* next slot to relocate */
+	HASHTBL_RECLAIM_FN reclaim_fn;	/* see hashtbl_reclaim.h */
+	void *reclaim_client_data;
+	struct hashtbl_node **table;
+};
+
+/* An entry of a table that isn't intrusive. */
+struct hashtbl_entry {
+	struct hashtbl_node node;	/* must be first */
+	void *key;
+	void *val;
+};
+
+/*
+ * A block of entries relocated by hashtbl_defragment() or allocated
+ * by hashtbl_insert_batch().  Its entries are released one by one
+ * but the memory is only freed once all of them have gone.
+ */
+struct hashtbl_slab {
+	unsigned long nlive;		/* entries not yet released */
+	unsigned long nused;
+	unsigned long size;
+	struct hashtbl_entry entries[1];
+};
+
+/* Returns the slab that holds entry, or NULL if it was allocated alone. */
+
+static INLINE struct hashtbl_slab *hashtbl_entry_slab(const struct hashtbl *h,
+						      const struct hashtbl_entry *entry)
+{
+	struct hashtbl_slab *slab;
+	int lo = 0, hi = h->nslabs, mid;
+
+	/* Find the last slab that starts at or below entry. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)h->slabs[mid]->entries <= (uintptr_t)entry) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == 0)
+		return NULL;
+
+	slab = h->slabs[lo - 1];
+	if ((uintptr_t)entry < (uintptr_t)(slab->entries + slab->size))
+		return slab;
+
+	return NULL;
+}
+
+/*
+ * Releases the memory of an entry (not its key or value) with
+ * free_fn, or back to its slab.  Not thread safe, even for
+ * different entries.
+ */
+void hashtbl_entry_free(struct hashtbl *h, struct hashtbl_entry *entry);
+
+static INLINE void *hashtbl_node_key(const struct hashtbl *h,
+				     const struct hashtbl_node *node)
+{
+	if (!h->intrusive)
+		return ((const struct hashtbl_entry *)node)->key;
+	if (h->node_key_fn != NULL)
+		return (void *)h->node_key_fn(node);
+	return (char *)node + h->key_offset;
+}
+
+/* The value of an intrusive table's entry is its node. */
+
+static INLINE void *hashtbl_node_val(const struct hashtbl *h,
+				     const struct hashtbl_node *node)
+{
+	if (!h->intrusive)
+		return ((const struct hashtbl_entry *)node)->val;
+	return (void *)node;
+}
+
+#endif	/* HASHTBL_PRIVATE_H */
@@ -0,0 +1,82 @@
+#ifndef HASHTBL_PROBES_H
+#define HASHTBL_PROBES_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Static tracepoints for the hot table operations.
+ *
+ * The probes compile to nothing unless HASHTBL_ENABLE_PROBES is
+ * defined, in which case they become SystemTap/USDT markers (this
+ * needs <sys/sdt.h>, e.g. from systemtap-sdt-dev).  An unattached
+ * marker costs a single nop.
+ *
+ * Providers are "hashtbl", "l_hashtbl", "c_hashtbl" and "soa_hashtbl"
+ * and the probes are:
+ *
+ *   insert(h, hash, chain_len)	  - a new key was linked into the table
+ *   lookup(h, hash, chain_len, found)
+ *   remove(h, hash, chain_len, found)
+ *   resize__start(h, old_capacity, new_capacity)
+ *   resize__done(h, old_capacity, new_capacity)
+ *   evict(h, hash, nentries)	  - l_hashtbl and c_hashtbl only
+ *
+ * chain_len is the number of entries walked in the hashed slot (for
+ * c_hashtbl, the number of index slots probed and for soa_hashtbl,
+ * the number of groups).  The resize probes fire only once the new
+ * table has been allocated, so a failed resize fires neither.  The
+ * resize duration is the time between the start and done probes:
+ *
+ *   bpftrace -e 'usdt:./prog:hashtbl:resize__start { @t[arg0] = nsecs; }
+ *		  usdt:./prog:hashtbl:resize__done /@t[arg0]/ {
+ *			@usecs = hist((nsecs - @t[arg0]) / 1000);
+ *			delete(@t[arg0]); }'
+ */
+
+#if defined(HASHTBL_ENABLE_PROBES)
+
+#include <sys/sdt.h>
+
+#define HASHTBL_PROBE3(provider, name, a, b, c)	\
+	DTRACE_PROBE3(provider, name, a, b, c)
+#define HASHTBL_PROBE4(provider, name, a, b, c, d)	\
+	DTRACE_PROBE4(provider, name, a, b, c, d)
+
+#else
+
+/* Evaluate (and discard) the arguments so that locals which only
+ * exist to feed a probe don't trigger unused variable warnings. */
+
+#define HASHTBL_PROBE3(provider, name, a, b, c)		\
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#define HASHTBL_PROBE4(provider, name, a, b, c, d)	\
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+
+#endif
+
+#endif	/* HASHTBL_PROBES_H */
@@ -0,0 +1,290 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Deferred release of hash table entries.
+ *
+ * Producers push the removed entry itself onto a Treiber stack; the
+ * consumer thread swaps the whole stack out with one exchange, so
+ * there is no ABA problem and no per-entry synchronisation on its
+ * side.  The mutex and condition variable are only used to sleep and
+ * to wake up, never around the list.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <pthread.h>
+#include <stdatomic.h>
+#include "hashtbl_private.h"
+#include "linked_hashtbl_private.h"
+#include "hashtbl_reclaim.h"
+
+/* How a table that has been attached releases its entries. */
+struct binding {
+	struct binding *next;
+	struct hashtbl_reclaimer *r;
+	void (*key_free_fn) (void *k);
+	void (*val_free_fn) (void *v);
+	void (*free_fn) (void *ptr);
+};
+
+/* A queued entry, written over the entry's own memory. */
+struct record {
+	struct record *next;
+	struct binding *binding;
+	void *key;
+	void *val;
+};
+
+/* Compile-time checks that a record fits in both kinds of entry. */
+typedef char record_fits_hashtbl_entry
+	[sizeof(struct record) <= sizeof(struct hashtbl_entry) ? 1 : -1];
+typedef char record_fits_l_hashtbl_entry
+	[sizeof(struct record) <= sizeof(struct l_hashtbl_entry) ? 1 : -1];
+
+struct hashtbl_reclaimer {
+	_Atomic(struct record *) head;
+	atomic_ulong nqueued;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;		/* consumer waits for work */
+	pthread_cond_t released;	/* flushers wait for progress */
+	int stop;			/* under lock */
+	unsigned long nreleased;	/* under lock */
+	struct binding *bindings;	/* under lock */
+};
+
+static void push(struct hashtbl_reclaimer *r, struct record *rec)
+{
+	struct record *head;
+
+	/*
+	 * Counted before it is visible, so nreleased never overtakes
+	 * nqueued and hashtbl_reclaimer_flush() can compare the two.
+	 */
+	atomic_fetch_add(&r->nqueued, 1);
+
+	head = atomic_load(&r->head);
+	do {
+		rec->next = head;
+	} while (!atomic_compare_exchange_weak(&r->head, &head, rec));
+
+	/* Only the first producer after a drain has to wake the thread. */
+	if (head == NULL) {
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_signal(&r->wakeup);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+static void reclaim(void *mem, void *key, void *val, void *client_data)
+{
+	struct record *rec = mem;
+	struct binding *b = client_data;
+
+	rec->binding = b;
+	rec->key = key;
+	rec->val = val;
+	push(b->r, rec);
+}
+
+static unsigned long release_batch(struct record *rec)
+{
+	struct record *next;
+	unsigned long n = 0;
+
+	for (; rec != NULL; rec = next, n++) {
+		struct binding *b = rec->binding;
+		next = rec->next;
+		if (b->key_free_fn != NULL && rec->key != NULL)
+			b->key_free_fn(rec->key);
+		if (b->val_free_fn != NULL && rec->val != NULL)
+			b->val_free_fn(rec->val);
+		b->free_fn(rec);
+	}
+
+	return n;
+}
+
+static void *reclaimer_main(void *arg)
+{
+	struct hashtbl_reclaimer *r = arg;
+	struct record *batch;
+	unsigned long n;
+
+	pthread_mutex_lock(&r->lock);
+
+	for (;;) {
+		while (atomic_load(&r->head) == NULL && !r->stop)
+			pthread_cond_wait(&r->wakeup, &r->lock);
+		batch = atomic_exchange(&r->head, NULL);
+		if (batch == NULL)
+			break;		/* stopped and drained */
+		pthread_mutex_unlock(&r->lock);
+		n = release_batch(batch);
+		pthread_mutex_lock(&r->lock);
+		r->nreleased += n;
+		pthread_cond_broadcast(&r->released);
+	}
+
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+struct hashtbl_reclaimer *hashtbl_reclaimer_create(void)
+{
+	struct hashtbl_reclaimer *r;
+
+	if ((r = malloc(sizeof(*r))) == NULL)
+		return NULL;
+
+	atomic_init(&r->head, NULL);
+	atomic_init(&r->nqueued, 0);
+	r->stop = 0;
+	r->nreleased = 0;
+	r->bindings = NULL;
+
+	if (pthread_mutex_init(&r->lock, NULL) != 0)
+		goto fail_lock;
+	if (pthread_cond_init(&r->wakeup, NULL) != 0)
+		goto fail_wakeup;
+	if (pthread_cond_init(&r->released, NULL) != 0)
+		goto fail_released;
+	if (pthread_create(&r->thread, NULL, reclaimer_main, r) != 0)
+		goto fail_thread;
+
+	return r;
+
+fail_thread:
+	pthread_cond_destroy(&r->released);
+fail_released:
+	pthread_cond_destroy(&r->wakeup);
+fail_wakeup:
+	pthread_mutex_destroy(&r->lock);
+fail_lock:
+	free(r);
+	return NULL;
+}
+
+void hashtbl_reclaimer_delete(struct hashtbl_reclaimer *r)
+{
+	struct binding *b, *next;
+
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_signal(&r->wakeup);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->thread, NULL);
+
+	for (b = r->bindings; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+
+	pthread_cond_destroy(&r->released);
+	pthread_cond_destroy(&r->wakeup);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+static struct binding *new_binding(struct hashtbl_reclaimer *r,
+				   void (*key_free_fn) (void *k),
+				   void (*val_free_fn) (void *v),
+				   void (*free_fn) (void *ptr))
+{
+	struct binding *b;
+
+	if ((b = malloc(sizeof(*b))) == NULL)
+		return NULL;
+
+	b->r = r;
+	b->key_free_fn = key_free_fn;
+	b->val_free_fn = val_free_fn;
+	b->free_fn = free_fn;
+
+	/* Kept until the reclaimer goes: entries may outlive the table. */
+	pthread_mutex_lock(&r->lock);
+	b->next = r->bindings;
+	r->bindings = b;
+	pthread_mutex_unlock(&r->lock);
+
+	return b;
+}
+
+int hashtbl_reclaimer_attach(struct hashtbl_reclaimer *r, struct hashtbl *h)
+{
+	struct binding *b;
+
+	if (h->intrusive || h->reclaim_fn != NULL)
+		return 1;
+
+	b = new_binding(r, h->key_free_fn, h->val_free_fn, h->free_fn);
+	if (b == NULL)
+		return 1;
+
+	h->reclaim_fn = reclaim;
+	h->reclaim_client_data = b;
+	return 0;
+}
+
+int l_hashtbl_reclaimer_attach(struct hashtbl_reclaimer *r,
+			       struct l_hashtbl *l)
+{
+	struct binding *b;
+
+	if (l->intrusive || l->reclaim_fn != NULL)
+		return 1;
+
+	b = new_binding(r, l->key_free_fn, l->val_free_fn, l->free_fn);
+	if (b == NULL)
+		return 1;
+
+	l->reclaim_fn = reclaim;
+	l->reclaim_client_data = b;
+	return 0;
+}
+
+void hashtbl_reclaimer_flush(struct hashtbl_reclaimer *r)
+{
+	unsigned long target = atomic_load(&r->nqueued);
+
+	pthread_mutex_lock(&r->lock);
+	while (r->nreleased < target)
+		pthread_cond_wait(&r->released, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+}
+
+unsigned long hashtbl_reclaimer_count(struct hashtbl_reclaimer *r)
+{
+	unsigned long n;
+
+	pthread_mutex_lock(&r->lock);
+	n = r->nreleased;
+	pthread_mutex_unlock(&r->lock);
+
+	return n;
+}
@@ -0,0 +1,111 @@
+#ifndef HASHTBL_RECLAIM_H
+#define HASHTBL_RECLAIM_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A background thread that releases removed entries, and their keys
+ * and values, off the caller's thread.
+ *
+ * SYNOPSIS
+ *
+ * 1. A reclaimer is created with hashtbl_reclaimer_create().
+ * 2. Tables opt in with hashtbl_reclaimer_attach() or
+ *    l_hashtbl_reclaimer_attach().
+ * 3. To wait for everything queued so far use hashtbl_reclaimer_flush().
+ * 4. Delete the tables, then the reclaimer with
+ *    hashtbl_reclaimer_delete().
+ *
+ * Once attached, a table no longer calls its key_free_fn, val_free_fn
+ * and free_fn when an entry is removed, evicted or cleared.  The
+ * entry is pushed onto a lock-free list instead (the entry's own
+ * memory holds the link, so queueing never allocates) and the thread
+ * takes the whole list in one exchange and frees it as a batch.
+ * Producers only wake the thread when the list goes from empty to
+ * non-empty.
+ *
+ * Because the free functions now run on another thread they must be
+ * thread-safe, and a key or value must not be used after its entry
+ * has gone.  A value replaced by inserting an existing key is still
+ * freed in place, as its entry stays in the table, and so are entries
+ * relocated by hashtbl_defragment() or l_hashtbl_defragment().
+ *
+ * Several tables, on any number of threads, may share a reclaimer.
+ * Intrusive tables have nothing to reclaim and can't be attached.
+ */
+
+#include "hashtbl.h"
+#include "linked_hashtbl.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct hashtbl_reclaimer;
+
+/*
+ * Creates a reclaimer and starts its thread.
+ *
+ * Returns non-null if the reclaimer was created successfully.
+ */
+struct hashtbl_reclaimer *hashtbl_reclaimer_create(void);
+
+/*
+ * Releases everything still queued, stops the thread and deletes the
+ * reclaimer.  Every attached table must have been deleted first.
+ */
+void hashtbl_reclaimer_delete(struct hashtbl_reclaimer *r);
+
+/*
+ * Routes entries released by h (or l) through the reclaimer, from now
+ * until the table is deleted.  Not thread-safe with respect to the
+ * table.
+ *
+ * Returns 0 on success, or 1 if the table is intrusive, or already
+ * attached, or memory couldn't be allocated.
+ */
+int hashtbl_reclaimer_attach(struct hashtbl_reclaimer *r, struct hashtbl *h);
+int l_hashtbl_reclaimer_attach(struct hashtbl_reclaimer *r,
+			       struct l_hashtbl *l);
+
+/*
+ * Waits until every entry queued before the call has been released.
+ */
+void hashtbl_reclaimer_flush(struct hashtbl_reclaimer *r);
+
+/*
+ * Returns the number of entries released by the thread so far.
+ */
+unsigned long hashtbl_reclaimer_count(struct hashtbl_reclaimer *r);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HASHTBL_RECLAIM_H */
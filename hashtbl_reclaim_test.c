@@ -0,0 +1,217 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* hashtbl_reclaim_test.c - unit tests for hashtbl_reclaim */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "CUnitTest.h"
+#include "hashtbl_reclaim.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NKEYS			5000
+#define NTHREADS		4
+
+static pthread_t main_thread;
+static atomic_int nfrees;
+static atomic_int nfrees_inline;	/* on the main thread */
+
+static void counting_free(void *p)
+{
+	atomic_fetch_add(&nfrees, 1);
+	if (pthread_equal(pthread_self(), main_thread))
+		atomic_fetch_add(&nfrees_inline, 1);
+	free(p);
+}
+
+static void reset_counts(void)
+{
+	main_thread = pthread_self();
+	atomic_store(&nfrees, 0);
+	atomic_store(&nfrees_inline, 0);
+}
+
+static int evict_over_100(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > 100;
+}
+
+/* Remove, steal and clear all go through the reclaimer. */
+
+static int test1(void)
+{
+	struct hashtbl_reclaimer *r = hashtbl_reclaimer_create();
+	struct hashtbl *h;
+	void *k, *v;
+	int i;
+
+	reset_counts();
+	CUT_ASSERT_NOT_NULL(r);
+	h = hashtbl_create(16, 0.75, 1, hashtbl_int_hash, hashtbl_int_equals,
+			   counting_free, counting_free, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_reclaimer_attach(r, h));
+	CUT_ASSERT_EQUAL(1, hashtbl_reclaimer_attach(r, h));
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(i), test_int(i)));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, &i));
+
+	/* A stolen key and value belong to the caller. */
+	i = 1000;
+	CUT_ASSERT_EQUAL(0, hashtbl_steal(h, &i, &k, &v));
+	free(k);
+	free(v);
+
+	hashtbl_reclaimer_flush(r);
+	CUT_ASSERT_EQUAL(2 * 1000, atomic_load(&nfrees));
+	CUT_ASSERT_EQUAL(1000 + 1, (int)hashtbl_reclaimer_count(r));
+
+	hashtbl_clear(h);
+	hashtbl_reclaimer_flush(r);
+	CUT_ASSERT_EQUAL(2 * (NKEYS - 1), atomic_load(&nfrees));
+	CUT_ASSERT_EQUAL(0, atomic_load(&nfrees_inline));
+
+	hashtbl_delete(h);
+	hashtbl_reclaimer_delete(r);
+	return 0;
+}
+
+/* l_hashtbl evictions are reclaimed; intrusive tables are refused. */
+
+struct item {
+	struct hashtbl_node node;
+	int key;
+};
+
+static int test2(void)
+{
+	struct hashtbl_reclaimer *r = hashtbl_reclaimer_create();
+	struct l_hashtbl *l;
+	struct hashtbl *h;
+	int i;
+
+	reset_counts();
+	CUT_ASSERT_NOT_NULL(r);
+	l = l_hashtbl_create(16, 0.75, 1, 1, hashtbl_int_hash,
+			     hashtbl_int_equals, counting_free, counting_free,
+			     NULL, NULL, evict_over_100);
+	CUT_ASSERT_NOT_NULL(l);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_reclaimer_attach(r, l));
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(l, test_int(i), test_int(i)));
+
+	CUT_ASSERT_EQUAL(100, (int)l_hashtbl_count(l));
+	hashtbl_reclaimer_flush(r);
+	CUT_ASSERT_EQUAL(2 * (NKEYS - 100), atomic_load(&nfrees));
+	CUT_ASSERT_EQUAL(0, atomic_load(&nfrees_inline));
+
+	/* The rest are still queued when the reclaimer goes. */
+	l_hashtbl_delete(l);
+
+	h = hashtbl_create_intrusive(16, 0.75, 1,
+				     HASHTBL_KEY_OFFSET(struct item, node, key),
+				     NULL, hashtbl_int_hash, hashtbl_int_equals,
+				     NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(1, hashtbl_reclaimer_attach(r, h));
+	hashtbl_delete(h);
+
+	hashtbl_reclaimer_delete(r);
+	CUT_ASSERT_EQUAL(2 * NKEYS, atomic_load(&nfrees));
+	return 0;
+}
+
+/* Many producers share one reclaimer. */
+
+struct worker {
+	pthread_t tid;
+	struct hashtbl_reclaimer *r;
+	struct hashtbl *h;
+	int first;
+};
+
+static void *churn(void *arg)
+{
+	struct worker *w = arg;
+	int i, round;
+
+	for (round = 0; round < 10; round++) {
+		for (i = w->first; i < w->first + NKEYS / NTHREADS; i++)
+			hashtbl_insert(w->h, test_int(i), test_int(round));
+		for (i = w->first; i < w->first + NKEYS / NTHREADS; i++)
+			hashtbl_remove(w->h, &i);
+	}
+
+	return NULL;
+}
+
+static int test3(void)
+{
+	struct hashtbl_reclaimer *r = hashtbl_reclaimer_create();
+	struct worker workers[NTHREADS];
+	int i;
+
+	reset_counts();
+	CUT_ASSERT_NOT_NULL(r);
+
+	for (i = 0; i < NTHREADS; i++) {
+		workers[i].r = r;
+		workers[i].first = i * (NKEYS / NTHREADS);
+		workers[i].h = hashtbl_create(16, 0.75, 1, hashtbl_int_hash,
+					      hashtbl_int_equals, counting_free,
+					      counting_free, NULL, NULL);
+		CUT_ASSERT_NOT_NULL(workers[i].h);
+		CUT_ASSERT_EQUAL(0, hashtbl_reclaimer_attach(r, workers[i].h));
+	}
+
+	for (i = 0; i < NTHREADS; i++)
+		CUT_ASSERT_EQUAL(0, pthread_create(&workers[i].tid, NULL,
+						   churn, &workers[i]));
+
+	for (i = 0; i < NTHREADS; i++) {
+		pthread_join(workers[i].tid, NULL);
+		hashtbl_delete(workers[i].h);
+	}
+
+	hashtbl_reclaimer_delete(r);
+	CUT_ASSERT_EQUAL(10 * 2 * NKEYS, atomic_load(&nfrees));
+	CUT_ASSERT_EQUAL(0, atomic_load(&nfrees_inline));
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,314 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Consistent hashing over a set of hashtbl shards.
+ *
+ * The shard for a key is jump_hash(hash(key), nshards).  Adding a
+ * shard is done in two phases so that it either completes or leaves
+ * the router untouched: the keys destined for the new shard are
+ * first inserted into it, then stolen from their old shards (which
+ * cannot fail).
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcpy, memset */
+#include "hashtbl_router.h"
+#include "hashtbl_private.h"
+
+struct hashtbl_router {
+	int nshards;
+	int initial_capacity;
+	double max_load_factor;
+	HASHTBL_HASH_FN hash_fn;
+	HASHTBL_EQUALS_FN equals_fn;
+	HASHTBL_KEY_FREE_FN key_free_fn;
+	HASHTBL_VAL_FREE_FN val_free_fn;
+	HASHTBL_MALLOC_FN malloc_fn;
+	HASHTBL_FREE_FN free_fn;
+	struct hashtbl **shards;
+};
+
+int hashtbl_jump_hash(unsigned int hash, int nshards)
+{
+	/* Spread the 32-bit hash over 64 bits first (splitmix64). */
+	unsigned long long key = hash + 0x9e3779b97f4a7c15ULL;
+	long long b = -1, j = 0;
+
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+
+	while (j < nshards) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (long long)((double)(b + 1) *
+				((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+
+	return (int)b;
+}
+
+static struct hashtbl *new_shard(const struct hashtbl_router *r)
+{
+	return hashtbl_create(r->initial_capacity, r->max_load_factor, 1,
+			      r->hash_fn, r->equals_fn,
+			      r->key_free_fn, r->val_free_fn,
+			      r->malloc_fn, r->free_fn);
+}
+
+struct hashtbl_router *hashtbl_router_create(int nshards,
+					     int initial_capacity,
+					     double max_load_factor,
+					     HASHTBL_HASH_FN hash_fn,
+					     HASHTBL_EQUALS_FN equals_fn,
+					     HASHTBL_KEY_FREE_FN key_free_fn,
+					     HASHTBL_VAL_FREE_FN val_free_fn,
+					     HASHTBL_MALLOC_FN malloc_fn,
+					     HASHTBL_FREE_FN free_fn)
+{
+	struct hashtbl_router *r;
+	int i;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	/* The shards need to agree on the hash so we can route. */
+	if (hash_fn == NULL)
+		return NULL;
+
+	if (nshards < 1)
+		nshards = 1;
+
+	if ((r = malloc_fn(sizeof(*r))) == NULL)
+		return NULL;
+
+	r->nshards = 0;
+	r->initial_capacity = initial_capacity;
+	r->max_load_factor = max_load_factor;
+	r->hash_fn = hash_fn;
+	r->equals_fn = equals_fn;
+	r->key_free_fn = key_free_fn;
+	r->val_free_fn = val_free_fn;
+	r->malloc_fn = malloc_fn;
+	r->free_fn = free_fn;
+
+	if ((r->shards = malloc_fn((size_t) nshards * sizeof(*r->shards))) == NULL) {
+		free_fn(r);
+		return NULL;
+	}
+
+	for (i = 0; i < nshards; i++) {
+		if ((r->shards[i] = new_shard(r)) == NULL) {
+			hashtbl_router_delete(r);
+			return NULL;
+		}
+		r->nshards++;
+	}
+
+	return r;
+}
+
+void hashtbl_router_delete(struct hashtbl_router *r)
+{
+	int i;
+
+	for (i = 0; i < r->nshards; i++)
+		hashtbl_delete(r->shards[i]);
+
+	r->free_fn(r->shards);
+	r->free_fn(r);
+}
+
+int hashtbl_router_nshards(const struct hashtbl_router *r)
+{
+	return r->nshards;
+}
+
+int hashtbl_router_shard(const struct hashtbl_router *r, const void *k)
+{
+	return hashtbl_jump_hash(r->hash_fn(k), r->nshards);
+}
+
+struct hashtbl *hashtbl_router_table(const struct hashtbl_router *r,
+				     int shard)
+{
+	return r->shards[shard];
+}
+
+int hashtbl_router_insert(struct hashtbl_router *r, void *k, void *v)
+{
+	return hashtbl_insert(r->shards[hashtbl_router_shard(r, k)], k, v);
+}
+
+void *hashtbl_router_lookup(struct hashtbl_router *r, const void *k)
+{
+	return hashtbl_lookup(r->shards[hashtbl_router_shard(r, k)], k);
+}
+
+int hashtbl_router_remove(struct hashtbl_router *r, const void *k)
+{
+	return hashtbl_remove(r->shards[hashtbl_router_shard(r, k)], k);
+}
+
+unsigned long hashtbl_router_count(const struct hashtbl_router *r)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = 0; i < r->nshards; i++)
+		n += hashtbl_count(r->shards[i]);
+
+	return n;
+}
+
+int hashtbl_router_add_shard(struct hashtbl_router *r)
+{
+	struct hashtbl **shards, *shard;
+	struct hashtbl_iter iter;
+	int i, nshards = r->nshards + 1;
+
+	if ((shard = new_shard(r)) == NULL)
+		return 1;
+
+	/*
+	 * Stage without the free functions so that a failed copy can
+	 * just delete the shard; the old shards still own the entries.
+	 */
+
+	shard->key_free_fn = NULL;
+	shard->val_free_fn = NULL;
+
+	shards = r->malloc_fn((size_t) nshards * sizeof(*shards));
+	if (shards == NULL) {
+		hashtbl_delete(shard);
+		return 1;
+	}
+
+	/* Phase 1: copy the moving entries into the new shard. */
+
+	for (i = 0; i < r->nshards; i++) {
+		struct hashtbl *h = r->shards[i];
+		hashtbl_iter_init(h, &iter);
+		while (hashtbl_iter_next(h, &iter)) {
+			if (hashtbl_jump_hash(r->hash_fn(iter.key), nshards) != nshards - 1)
+				continue;
+			if (hashtbl_insert(shard, iter.key, iter.val) != 0) {
+				hashtbl_delete(shard);
+				r->free_fn(shards);
+				return 1;
+			}
+		}
+	}
+
+	/* Phase 2: the new shard owns them now. */
+
+	shard->key_free_fn = r->key_free_fn;
+	shard->val_free_fn = r->val_free_fn;
+
+	hashtbl_iter_init(shard, &iter);
+	while (hashtbl_iter_next(shard, &iter)) {
+		int from = hashtbl_jump_hash(r->hash_fn(iter.key), r->nshards);
+		(void)hashtbl_steal(r->shards[from], iter.key, NULL, NULL);
+	}
+
+	memcpy(shards, r->shards, (size_t) r->nshards * sizeof(*shards));
+	shards[r->nshards] = shard;
+	r->free_fn(r->shards);
+	r->shards = shards;
+	r->nshards = nshards;
+
+	return 0;
+}
+
+int hashtbl_router_route(const struct hashtbl_router *r,
+			 const void *const *keys,
+			 int n,
+			 int *order,
+			 int *offsets)
+{
+	int i, *shard_of;
+
+	if ((shard_of = r->malloc_fn((size_t) n * sizeof(*shard_of) + 1)) == NULL)
+		return 1;
+
+	/* Counting sort of the keys by shard. */
+
+	memset(offsets, 0, (size_t) (r->nshards + 1) * sizeof(*offsets));
+
+	for (i = 0; i < n; i++) {
+		shard_of[i] = hashtbl_router_shard(r, keys[i]);
+		offsets[shard_of[i] + 1]++;
+	}
+
+	for (i = 0; i < r->nshards; i++)
+		offsets[i + 1] += offsets[i];
+
+	for (i = 0; i < n; i++)
+		order[offsets[shard_of[i]]++] = i;
+
+	/* Filling order advanced each offset to the next shard's. */
+
+	for (i = r->nshards; i > 0; i--)
+		offsets[i] = offsets[i - 1];
+	offsets[0] = 0;
+
+	r->free_fn(shard_of);
+	return 0;
+}
+
+int hashtbl_router_lookup_batch(struct hashtbl_router *r,
+				const void *const *keys,
+				void **vals,
+				int n)
+{
+	int *order, *offsets, s, i;
+
+	order = r->malloc_fn((size_t) n * sizeof(*order) + 1);
+	offsets = r->malloc_fn((size_t) (r->nshards + 1) * sizeof(*offsets));
+
+	if (order == NULL || offsets == NULL ||
+	    hashtbl_router_route(r, keys, n, order, offsets) != 0) {
+		if (order != NULL)
+			r->free_fn(order);
+		if (offsets != NULL)
+			r->free_fn(offsets);
+		return 1;
+	}
+
+	for (s = 0; s < r->nshards; s++) {
+		struct hashtbl *h = r->shards[s];
+		for (i = offsets[s]; i < offsets[s + 1]; i++)
+			vals[order[i]] = hashtbl_lookup(h, keys[order[i]]);
+	}
+
+	r->free_fn(order);
+	r->free_fn(offsets);
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+#ifndef HASHTBL_ROUTER_H
+#define HASHTBL_ROUTER_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A consistent hashing front for a logical table split into shards.
+ *
+ * SYNOPSIS
+ *
+ * 1. A router over K hashtbl instances is created with hashtbl_router_create().
+ * 2. Keys are inserted, looked up and removed with hashtbl_router_insert(),
+ *    hashtbl_router_lookup() and hashtbl_router_remove().
+ * 3. A shard is added with hashtbl_router_add_shard().
+ * 4. Batches of keys are looked up with hashtbl_router_lookup_batch().
+ * 5. The router and its shards are deleted with hashtbl_router_delete().
+ *
+ * Keys are mapped to shards with Lamping and Veach's jump consistent
+ * hash, so growing from K to K+1 shards moves only the 1/(K+1) of
+ * the keys that now belong to the new shard.  hashtbl_jump_hash() is
+ * a pure function of the key's hash and the shard count: processes
+ * that keep their shards in other address spaces (e.g., shared
+ * memory segments) can use it, or hashtbl_router_route(), to decide
+ * where each key lives without holding the tables themselves.
+ */
+
+#include "hashtbl.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct hashtbl_router;
+
+/*
+ * Maps a hash onto one of nshards buckets, consistently.
+ *
+ * Returns a shard number in [0, nshards).
+ */
+int hashtbl_jump_hash(unsigned int hash, int nshards);
+
+/*
+ * Creates a new router and its shards.
+ *
+ * The remaining parameters are passed to hashtbl_create() for each
+ * shard.
+ *
+ * @param nshards - number of shards (at least 1)
+ *
+ * Returns non-null if the router was created successfully.
+ */
+struct hashtbl_router *hashtbl_router_create(int nshards,
+					     int initial_capacity,
+					     double max_load_factor,
+					     HASHTBL_HASH_FN hash_fun,
+					     HASHTBL_EQUALS_FN equals_fun,
+					     HASHTBL_KEY_FREE_FN key_free_func,
+					     HASHTBL_VAL_FREE_FN val_free_func,
+					     HASHTBL_MALLOC_FN malloc_func,
+					     HASHTBL_FREE_FN free_func);
+
+/*
+ * Deletes the router and all of its shards.
+ */
+void hashtbl_router_delete(struct hashtbl_router *r);
+
+/*
+ * Returns the number of shards.
+ */
+int hashtbl_router_nshards(const struct hashtbl_router *r);
+
+/*
+ * Returns the shard that k maps to.
+ */
+int hashtbl_router_shard(const struct hashtbl_router *r, const void *k);
+
+/*
+ * Returns the table backing a shard.
+ */
+struct hashtbl *hashtbl_router_table(const struct hashtbl_router *r,
+				     int shard);
+
+/*
+ * As hashtbl_insert(), hashtbl_lookup() and hashtbl_remove() on the
+ * shard that k maps to.
+ */
+int hashtbl_router_insert(struct hashtbl_router *r, void *k, void *v);
+void *hashtbl_router_lookup(struct hashtbl_router *r, const void *k);
+int hashtbl_router_remove(struct hashtbl_router *r, const void *k);
+
+/*
+ * Returns the number of entries across all shards.
+ */
+unsigned long hashtbl_router_count(const struct hashtbl_router *r);
+
+/*
+ * Adds a shard, moving the keys that now map to it out of the
+ * existing shards.  Nothing is moved if memory runs out.
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int hashtbl_router_add_shard(struct hashtbl_router *r);
+
+/*
+ * Groups a batch of keys by shard.
+ *
+ * On return order holds the indices of keys arranged so that the
+ * keys for shard s are order[offsets[s]] .. order[offsets[s+1]-1].
+ *
+ * @param keys	  - the batch
+ * @param n	  - number of keys
+ * @param order	  - array of n indices
+ * @param offsets - array of hashtbl_router_nshards() + 1 offsets
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int hashtbl_router_route(const struct hashtbl_router *r,
+			 const void *const *keys,
+			 int n,
+			 int *order,
+			 int *offsets);
+
+/*
+ * Looks up a batch of keys, one shard at a time.  vals[i] is set to
+ * the value for keys[i], or NULL if it is not present.
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int hashtbl_router_lookup_batch(struct hashtbl_router *r,
+				const void *const *keys,
+				void **vals,
+				int n);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HASHTBL_ROUTER_H */
@@ -0,0 +1,233 @@
+/* Copyright (c) 2009, 2010 <Andrew McDermott>
+ * 
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* hashtbl_router_test.c - unit tests for hashtbl_router */
+
+#include <stdlib.h>
+#include <string.h>
+#include "CUnitTest.h"
+#include "hashtbl_router.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NELEMENTS(X)		(sizeof((X)) / sizeof((X)[0]))
+
+#define NKEYS			1000
+
+static struct hashtbl_router *new_router(int nshards)
+{
+	return hashtbl_router_create(nshards, 16, 0.75,
+				     hashtbl_int_hash, hashtbl_int_equals,
+				     free, free, NULL, NULL);
+}
+
+/* Test basic routing. */
+
+static int test1(void)
+{
+	int i, s;
+	struct hashtbl_router *r = new_router(4);
+
+	CUT_ASSERT_NOT_NULL(r);
+	CUT_ASSERT_EQUAL(4, hashtbl_router_nshards(r));
+	CUT_ASSERT_EQUAL(0, hashtbl_router_count(r));
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_router_insert(r, test_int(i), test_int(i * 2)));
+
+	CUT_ASSERT_EQUAL(NKEYS, hashtbl_router_count(r));
+
+	for (i = 0; i < NKEYS; i++) {
+		CUT_ASSERT_EQUAL(i * 2, *(int *)hashtbl_router_lookup(r, &i));
+		s = hashtbl_router_shard(r, &i);
+		CUT_ASSERT_TRUE(s >= 0 && s < 4);
+		CUT_ASSERT_NOT_NULL(hashtbl_lookup(hashtbl_router_table(r, s), &i));
+	}
+
+	/* Every shard gets a fair share. */
+	for (s = 0; s < 4; s++)
+		CUT_ASSERT_TRUE(hashtbl_count(hashtbl_router_table(r, s)) > NKEYS / 8);
+
+	for (i = 0; i < NKEYS; i += 2)
+		CUT_ASSERT_EQUAL(0, hashtbl_router_remove(r, &i));
+	CUT_ASSERT_EQUAL(NKEYS / 2, hashtbl_router_count(r));
+	i = 0;
+	CUT_ASSERT_NULL(hashtbl_router_lookup(r, &i));
+	CUT_ASSERT_EQUAL(1, hashtbl_router_remove(r, &i));
+
+	hashtbl_router_delete(r);
+	return 0;
+}
+
+/* Test jump hash only ever moves keys to the new shard. */
+
+static int test2(void)
+{
+	unsigned int k;
+	int n;
+
+	for (k = 0; k < 2000; k++) {
+		CUT_ASSERT_EQUAL(0, hashtbl_jump_hash(k, 1));
+		for (n = 1; n < 40; n++) {
+			int before = hashtbl_jump_hash(k, n);
+			int after = hashtbl_jump_hash(k, n + 1);
+			CUT_ASSERT_TRUE(before >= 0 && before < n);
+			CUT_ASSERT_TRUE(after == before || after == n);
+		}
+	}
+
+	return 0;
+}
+
+/* Test adding a shard moves about 1/K of the keys. */
+
+static int test3(void)
+{
+	int i, moved = 0, before[NKEYS];
+	struct hashtbl_router *r = new_router(4);
+
+	CUT_ASSERT_NOT_NULL(r);
+
+	for (i = 0; i < NKEYS; i++) {
+		CUT_ASSERT_EQUAL(0, hashtbl_router_insert(r, test_int(i), test_int(i)));
+		before[i] = hashtbl_router_shard(r, &i);
+	}
+
+	CUT_ASSERT_EQUAL(0, hashtbl_router_add_shard(r));
+	CUT_ASSERT_EQUAL(5, hashtbl_router_nshards(r));
+	CUT_ASSERT_EQUAL(NKEYS, hashtbl_router_count(r));
+
+	for (i = 0; i < NKEYS; i++) {
+		int s = hashtbl_router_shard(r, &i);
+		CUT_ASSERT_EQUAL(i, *(int *)hashtbl_router_lookup(r, &i));
+		if (s != before[i]) {
+			CUT_ASSERT_EQUAL(4, s);
+			moved++;
+		}
+	}
+
+	CUT_ASSERT_EQUAL(moved, hashtbl_count(hashtbl_router_table(r, 4)));
+	CUT_ASSERT_TRUE(moved > NKEYS / 10 && moved < NKEYS * 3 / 10);
+
+	hashtbl_router_delete(r);
+	return 0;
+}
+
+/* Test batch routing and lookup. */
+
+static int test4(void)
+{
+	int i, s, ints[64];
+	const void *keys[64];
+	void *vals[64];
+	int order[64], offsets[4];
+	struct hashtbl_router *r = new_router(3);
+
+	CUT_ASSERT_NOT_NULL(r);
+
+	for (i = 0; i < 32; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_router_insert(r, test_int(i), test_int(i + 100)));
+
+	for (i = 0; i < 64; i++) {
+		ints[i] = 63 - i;
+		keys[i] = &ints[i];
+	}
+
+	CUT_ASSERT_EQUAL(0, hashtbl_router_route(r, keys, 64, order, offsets));
+	CUT_ASSERT_EQUAL(0, offsets[0]);
+	CUT_ASSERT_EQUAL(64, offsets[3]);
+	for (s = 0; s < 3; s++) {
+		for (i = offsets[s]; i < offsets[s + 1]; i++)
+			CUT_ASSERT_EQUAL(s, hashtbl_router_shard(r, keys[order[i]]));
+	}
+
+	CUT_ASSERT_EQUAL(0, hashtbl_router_lookup_batch(r, keys, vals, 64));
+	for (i = 0; i < 64; i++) {
+		if (ints[i] < 32)
+			CUT_ASSERT_EQUAL(ints[i] + 100, *(int *)vals[i]);
+		else
+			CUT_ASSERT_NULL(vals[i]);
+	}
+
+	hashtbl_router_delete(r);
+	return 0;
+}
+
+/* Test a failed shard add leaves every entry where it was. */
+
+static int test5_budget;
+
+static void *test5_malloc(size_t n)
+{
+	if (test5_budget-- <= 0)
+		return NULL;
+	return malloc(n);
+}
+
+static int test5(void)
+{
+	int i, budget, rc = 1;
+	struct hashtbl_router *r;
+
+	test5_budget = 1 << 30;
+	r = hashtbl_router_create(4, 16, 0.75,
+				  hashtbl_int_hash, hashtbl_int_equals,
+				  test_counting_free, test_counting_free,
+				  test5_malloc, free);
+	CUT_ASSERT_NOT_NULL(r);
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_router_insert(r, test_int(i), test_int(i)));
+
+	/* Fail at each allocation in turn until the add succeeds. */
+
+	for (budget = 0; rc != 0; budget++) {
+		test5_budget = budget;
+		rc = hashtbl_router_add_shard(r);
+		CUT_ASSERT_EQUAL(0, test_nfrees);
+		CUT_ASSERT_EQUAL(NKEYS, hashtbl_router_count(r));
+		CUT_ASSERT_EQUAL(4 + (rc == 0), hashtbl_router_nshards(r));
+	}
+
+	CUT_ASSERT_TRUE(budget > 2);
+	test5_budget = 1 << 30;
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(i, *(int *)hashtbl_router_lookup(r, &i));
+
+	hashtbl_router_delete(r);
+	CUT_ASSERT_EQUAL(2 * NKEYS, test_nfrees);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_RUN_TEST(test5);
+CUT_END_TEST_HARNESS
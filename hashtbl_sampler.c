@@ -0,0 +1,228 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Hot key sampling using the space-saving algorithm (Metwally,
+ * Agrawal and El Abbadi, 2005).
+ *
+ * A fixed array of counters is kept.  A sampled hash that is already
+ * tracked has its counter incremented.  Otherwise it takes a free
+ * counter or, when all are in use, replaces the hash with the
+ * smallest count, inheriting that count (recorded as the error).
+ *
+ * To keep the cost off the lookup path a sample is only taken every
+ * `rate' calls on average.  The gap between samples is randomized so
+ * that periodic access patterns don't alias with the sampling rate.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <limits.h>		/* UINT_MAX */
+#include <stdlib.h>		/* malloc, free, qsort */
+#include <string.h>		/* memset, memcpy */
+#include "hashtbl_sampler.h"
+
+/* Largest rate for which 2 * rate - 1 doesn't wrap. */
+#define MAX_RATE		(UINT_MAX / 2)
+
+struct hashtbl_sampler {
+	unsigned int rate;
+	unsigned int countdown;
+	unsigned int seed;	/* xorshift state */
+	int capacity;
+	int nused;
+	void *(*malloc_fn) (size_t n);
+	void (*free_fn) (void *ptr);
+	struct hashtbl_sample *samples;
+};
+
+static unsigned int xorshift32(unsigned int *state)
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* Next gap is uniform in [1, 2 * rate - 1], i.e., a mean of rate. */
+
+static unsigned int next_countdown(struct hashtbl_sampler *s)
+{
+	if (s->rate <= 1)
+		return 1;
+	return 1 + xorshift32(&s->seed) % (2 * s->rate - 1);
+}
+
+struct hashtbl_sampler *hashtbl_sampler_create(int capacity,
+					       unsigned int rate,
+					       void *(*malloc_fn) (size_t n),
+					       void (*free_fn) (void *ptr))
+{
+	struct hashtbl_sampler *s;
+	size_t nbytes;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if (capacity < 1)
+		capacity = 1;
+
+	if ((s = malloc_fn(sizeof(*s))) == NULL)
+		return NULL;
+
+	nbytes = (size_t) capacity * sizeof(*s->samples);
+
+	if ((s->samples = malloc_fn(nbytes)) == NULL) {
+		free_fn(s);
+		return NULL;
+	}
+
+	if (rate < 1) {
+		rate = 1;
+	} else if (rate > MAX_RATE) {
+		rate = MAX_RATE;
+	}
+
+	s->rate = rate;
+	s->seed = 2463534242U;
+	s->capacity = capacity;
+	s->malloc_fn = malloc_fn;
+	s->free_fn = free_fn;
+	hashtbl_sampler_reset(s);
+
+	return s;
+}
+
+void hashtbl_sampler_delete(struct hashtbl_sampler *s)
+{
+	s->free_fn(s->samples);
+	s->free_fn(s);
+}
+
+void hashtbl_sampler_reset(struct hashtbl_sampler *s)
+{
+	memset(s->samples, 0, (size_t) s->capacity * sizeof(*s->samples));
+	s->nused = 0;
+	s->countdown = next_countdown(s);
+}
+
+void hashtbl_sampler_record(struct hashtbl_sampler *s,
+			    unsigned int hash,
+			    unsigned int depth)
+{
+	struct hashtbl_sample *sample, *min;
+	int i;
+
+	if (--s->countdown > 0)
+		return;
+
+	s->countdown = next_countdown(s);
+
+	for (i = 0; i < s->nused; i++) {
+		if (s->samples[i].hash == hash)
+			break;
+	}
+
+	if (i < s->nused) {
+		sample = &s->samples[i];
+	} else if (s->nused < s->capacity) {
+		sample = &s->samples[s->nused++];
+		sample->hash = hash;
+		sample->count = 0;
+		sample->error = 0;
+		sample->max_depth = 0;
+	} else {
+		/* Replace the least frequent hash. */
+		min = &s->samples[0];
+		for (i = 1; i < s->nused; i++) {
+			if (s->samples[i].count < min->count)
+				min = &s->samples[i];
+		}
+		sample = min;
+		sample->hash = hash;
+		sample->error = sample->count;
+		sample->max_depth = 0;
+	}
+
+	sample->count++;
+	if (depth > sample->max_depth)
+		sample->max_depth = depth;
+}
+
+static int compare_by_count(const void *a, const void *b)
+{
+	const struct hashtbl_sample *x = a;
+	const struct hashtbl_sample *y = b;
+
+	if (x->count != y->count)
+		return (x->count < y->count) ? 1 : -1;
+	if (x->max_depth != y->max_depth)
+		return (x->max_depth < y->max_depth) ? 1 : -1;
+	return 0;
+}
+
+static int compare_by_depth(const void *a, const void *b)
+{
+	const struct hashtbl_sample *x = a;
+	const struct hashtbl_sample *y = b;
+
+	if (x->max_depth != y->max_depth)
+		return (x->max_depth < y->max_depth) ? 1 : -1;
+	if (x->count != y->count)
+		return (x->count < y->count) ? 1 : -1;
+	return 0;
+}
+
+int hashtbl_sampler_top(const struct hashtbl_sampler *s,
+			struct hashtbl_sample *out,
+			int n,
+			int order)
+{
+	struct hashtbl_sample *tmp;
+	size_t nbytes = (size_t) s->nused * sizeof(*tmp);
+
+	if (n <= 0 || s->nused == 0)
+		return 0;
+
+	/* Sort a copy so that the sketch is left undisturbed. */
+
+	if ((tmp = s->malloc_fn(nbytes)) == NULL)
+		return 0;
+
+	memcpy(tmp, s->samples, nbytes);
+	qsort(tmp, (size_t) s->nused, sizeof(*tmp),
+	      (order == HASHTBL_SAMPLE_BY_DEPTH) ?
+	      compare_by_depth : compare_by_count);
+
+	if (n > s->nused)
+		n = s->nused;
+
+	memcpy(out, tmp, (size_t) n * sizeof(*tmp));
+	s->free_fn(tmp);
+
+	return n;
+}
@@ -0,0 +1,118 @@
+#ifndef HASHTBL_SAMPLER_H
+#define HASHTBL_SAMPLER_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A sampling profiler for hot keys.
+ *
+ * The sampler is fed the hash and the chain depth of looked up keys.
+ * One in every `rate' lookups (on average) is recorded in a
+ * space-saving top-k sketch of `capacity' counters.  The heaviest
+ * hitters are guaranteed to be retained; each reported count may
+ * overestimate the true count by at most its `error'.
+ *
+ * Samplers are normally attached to a table with
+ * hashtbl_enable_sampling() or l_hashtbl_enable_sampling() rather
+ * than used directly.
+ */
+
+#include <stddef.h>		/* size_t */
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct hashtbl_sampler;
+
+/* Ordering of the results from hashtbl_sampler_top(). */
+#define HASHTBL_SAMPLE_BY_COUNT	0	/* hottest keys first */
+#define HASHTBL_SAMPLE_BY_DEPTH	1	/* deepest chains first */
+
+struct hashtbl_sample {
+	unsigned int hash;	/* hash of the sampled key */
+	unsigned long count;	/* estimated number of samples */
+	unsigned long error;	/* maximum overestimation of count */
+	unsigned int max_depth;	/* longest chain walk observed */
+};
+
+/*
+ * Creates a new sampler.
+ *
+ * @param capacity    - number of counters in the sketch (k)
+ * @param rate	      - record one in every rate lookups (0 means 1,
+ *			and rates above UINT_MAX / 2 are clamped to it)
+ * @param malloc_func - function to allocate memory (e.g., malloc)
+ * @param free_func   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the sampler was created successfully.
+ */
+struct hashtbl_sampler *hashtbl_sampler_create(int capacity,
+					       unsigned int rate,
+					       void *(*malloc_func) (size_t n),
+					       void (*free_func) (void *ptr));
+
+/*
+ * Deletes the sampler instance.
+ */
+void hashtbl_sampler_delete(struct hashtbl_sampler *s);
+
+/*
+ * Offers a lookup to the sampler.  This updates the sampler's state,
+ * so concurrent callers must be serialized.
+ *
+ * @param s	- sampler instance
+ * @param hash	- hash of the looked up key
+ * @param depth - number of chain entries walked by the lookup
+ */
+void hashtbl_sampler_record(struct hashtbl_sampler *s,
+			    unsigned int hash,
+			    unsigned int depth);
+
+/*
+ * Copies up to n of the tracked keys into out, ordered by order
+ * (HASHTBL_SAMPLE_BY_COUNT or HASHTBL_SAMPLE_BY_DEPTH).
+ *
+ * Returns the number of samples copied.
+ */
+int hashtbl_sampler_top(const struct hashtbl_sampler *s,
+			struct hashtbl_sample *out,
+			int n,
+			int order);
+
+/*
+ * Discards all recorded samples.
+ */
+void hashtbl_sampler_reset(struct hashtbl_sampler *s);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HASHTBL_SAMPLER_H */
@@ -33,6 +33,7 @@
 #include "CUnitTest.h"
 #include "hashtbl.h"
 #include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
 
 #ifndef HASHTBL_MAX_LOAD_FACTOR
 #define HASHTBL_MAX_LOAD_FACTOR	0.75f
@@ -1036,6 +1037,741 @@ static int test24(void)
 	return 0;
 }
 
+/* Test resize notifications. */
+
+struct test25_stats {
+	int nbegin;
+	int nend;
+	int last_old;
+	int last_new;
+	unsigned long moved;
+	size_t nbytes;
+};
+
+static void test25_resize_fn(const struct hashtbl *h,
+			     int phase,
+			     const struct hashtbl_resize_event *ev,
+			     void *client_data)
+{
+	struct test25_stats *stats = client_data;
+
+	UNUSED_PARAMETER(h);
+
+	if (phase == HASHTBL_RESIZE_BEGIN) {
+		stats->nbegin++;
+	} else {
+		stats->nend++;
+		stats->moved += ev->entries_moved;
+	}
+	stats->last_old = ev->old_capacity;
+	stats->last_new = ev->new_capacity;
+	stats->nbytes = ev->bytes_allocated;
+}
+
+static int test25_nomem;
+
+static void *test25_malloc(size_t n)
+{
+	return test25_nomem ? NULL : malloc(n);
+}
+
+static int test25(void)
+{
+	int i, keys[16];
+	struct test25_stats stats;
+	struct hashtbl *h;
+
+	memset(&stats, 0, sizeof(stats));
+
+	h = hashtbl_create(4, 1.0, 1,
+			   hashtbl_int_hash, hashtbl_int_equals,
+			   NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	hashtbl_set_resize_callback(h, test25_resize_fn, &stats);
+
+	for (i = 0; i < 4; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	}
+	CUT_ASSERT_EQUAL(0, stats.nbegin);
+
+	keys[4] = 4;
+	CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[4], &keys[4]));
+	CUT_ASSERT_EQUAL(1, stats.nbegin);
+	CUT_ASSERT_EQUAL(1, stats.nend);
+	CUT_ASSERT_EQUAL(4, stats.last_old);
+	CUT_ASSERT_EQUAL(8, stats.last_new);
+	CUT_ASSERT_EQUAL(4, stats.moved);
+	CUT_ASSERT_EQUAL(8 * sizeof(void *), stats.nbytes);
+
+	/* No notification if the size doesn't change. */
+	CUT_ASSERT_EQUAL(0, hashtbl_resize(h, 8));
+	CUT_ASSERT_EQUAL(1, stats.nbegin);
+
+	hashtbl_set_resize_callback(h, NULL, NULL);
+	CUT_ASSERT_EQUAL(0, hashtbl_resize(h, 16));
+	CUT_ASSERT_EQUAL(1, stats.nend);
+
+	hashtbl_delete(h);
+
+	/* Nor if the new slot array can't be allocated. */
+	h = hashtbl_create(4, 1.0, 1,
+			   hashtbl_int_hash, hashtbl_int_equals,
+			   NULL, NULL, test25_malloc, free);
+	CUT_ASSERT_NOT_NULL(h);
+	hashtbl_set_resize_callback(h, test25_resize_fn, &stats);
+	test25_nomem = 1;
+	CUT_ASSERT_EQUAL(1, hashtbl_resize(h, 64));
+	test25_nomem = 0;
+	CUT_ASSERT_EQUAL(1, stats.nbegin);
+	CUT_ASSERT_EQUAL(1, stats.nend);
+	CUT_ASSERT_EQUAL(0, hashtbl_resize(h, 64));
+	CUT_ASSERT_EQUAL(2, stats.nbegin);
+	CUT_ASSERT_EQUAL(2, stats.nend);
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+/* Test hot key sampling. */
+
+static int test26(void)
+{
+	int i, keys[8];
+	struct hashtbl_sample top[8];
+	struct hashtbl *h;
+
+	/* A single slot so that every key shares one chain. */
+	h = hashtbl_create(1, HASHTBL_MAX_LOAD_FACTOR, 0,
+			   hashtbl_int_hash, hashtbl_int_equals,
+			   NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+
+	for (i = 0; i < 8; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	}
+
+	CUT_ASSERT_EQUAL(0, hashtbl_enable_sampling(h, 4, 1));
+
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_NOT_NULL(hashtbl_lookup(h, &keys[7]));
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_NOT_NULL(hashtbl_lookup(h, &keys[0]));
+
+	CUT_ASSERT_EQUAL(2, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+	CUT_ASSERT_EQUAL(7, top[0].hash);
+	CUT_ASSERT_EQUAL(100, top[0].count);
+	CUT_ASSERT_EQUAL(1, top[0].max_depth);
+	CUT_ASSERT_EQUAL(0, top[1].hash);
+	CUT_ASSERT_EQUAL(10, top[1].count);
+	CUT_ASSERT_EQUAL(8, top[1].max_depth);
+
+	CUT_ASSERT_EQUAL(2, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_DEPTH));
+	CUT_ASSERT_EQUAL(0, top[0].hash);
+
+	/* Overflow the sketch: the heavy hitter must survive. */
+	for (i = 1; i < 7; i++)
+		CUT_ASSERT_NOT_NULL(hashtbl_lookup(h, &keys[i]));
+	CUT_ASSERT_EQUAL(4, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+	CUT_ASSERT_EQUAL(7, top[0].hash);
+	CUT_ASSERT_EQUAL(0, top[0].error);
+
+	hashtbl_disable_sampling(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+
+	/* Sampling 1 in N records roughly 1/N of the lookups. */
+	CUT_ASSERT_EQUAL(0, hashtbl_enable_sampling(h, 4, 10));
+	for (i = 0; i < 10000; i++)
+		hashtbl_lookup(h, &keys[3]);
+	CUT_ASSERT_EQUAL(1, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+	CUT_ASSERT_TRUE(top[0].count > 500 && top[0].count < 2000);
+
+	/* A huge rate samples rarely rather than wrapping to every lookup. */
+	CUT_ASSERT_EQUAL(0, hashtbl_enable_sampling(h, 4, 0x80000001U));
+	for (i = 0; i < 10000; i++)
+		hashtbl_lookup(h, &keys[3]);
+	CUT_ASSERT_EQUAL(0, hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+/* Test hashtbl_steal() leaves the key and value with the caller. */
+
+static int test27(void)
+{
+	int i;
+	void *key, *val;
+	HASHTBL_INT(h);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 10; i++) {
+		int *k = malloc(sizeof(int));
+		int *v = malloc(sizeof(int));
+		*k = i;
+		*v = i * 10;
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, k, v));
+	}
+
+	i = 3;
+	CUT_ASSERT_EQUAL(0, hashtbl_steal(h, &i, &key, &val));
+	CUT_ASSERT_EQUAL(9, hashtbl_count(h));
+	CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(1, hashtbl_steal(h, &i, &key, &val));
+
+	/* Stolen keys and values outlive the table. */
+	hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(3, *(int *)key);
+	CUT_ASSERT_EQUAL(30, *(int *)val);
+	free(key);
+	free(val);
+
+	return 0;
+}
+
+/* Test intrusive tables. */
+
+struct intrusive_obj {
+	char pad;
+	int id;
+	struct hashtbl_node node;
+	int released;
+};
+
+static void intrusive_release(struct hashtbl_node *node)
+{
+	HASHTBL_CONTAINER_OF(node, struct intrusive_obj, node)->released++;
+}
+
+static const void *intrusive_key(const struct hashtbl_node *node)
+{
+	return &HASHTBL_CONTAINER_OF(node, struct intrusive_obj, node)->id;
+}
+
+static int test28(void)
+{
+	int i, k, pass;
+	struct intrusive_obj objs[300], dup;
+	struct hashtbl_iter iter;
+	struct hashtbl *h;
+
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 0) {
+			h = hashtbl_create_intrusive(4, 0.75f, 1,
+						     HASHTBL_KEY_OFFSET(struct intrusive_obj, node, id),
+						     NULL, hashtbl_int_hash, hashtbl_int_equals,
+						     intrusive_release, NULL, NULL);
+		} else {
+			h = hashtbl_create_intrusive(4, 0.75f, 1, 0, intrusive_key,
+						     hashtbl_int_hash, hashtbl_int_equals,
+						     intrusive_release, NULL, NULL);
+		}
+		CUT_ASSERT_NOT_NULL(h);
+
+		for (i = 0; i < 300; i++) {
+			objs[i].id = i;
+			objs[i].released = 0;
+			CUT_ASSERT_NULL(hashtbl_insert_node(h, &objs[i].node));
+		}
+
+		CUT_ASSERT_EQUAL(300, hashtbl_count(h));
+		CUT_ASSERT_EQUAL(1, hashtbl_insert(h, &i, &i));
+
+		for (i = 0; i < 300; i++) {
+			CUT_ASSERT_EQUAL(&objs[i].node, hashtbl_lookup_node(h, &i));
+			CUT_ASSERT_EQUAL(&objs[i].node, hashtbl_lookup(h, &i));
+		}
+		k = 300;
+		CUT_ASSERT_NULL(hashtbl_lookup_node(h, &k));
+
+		/* Replacing hands back the old node. */
+		dup.id = 7;
+		dup.released = 0;
+		CUT_ASSERT_EQUAL(&objs[7].node, hashtbl_insert_node(h, &dup.node));
+		CUT_ASSERT_EQUAL(&dup.node, hashtbl_lookup_node(h, &dup.id));
+		CUT_ASSERT_EQUAL(300, hashtbl_count(h));
+		CUT_ASSERT_EQUAL(0, objs[7].released);
+
+		/* remove_node unlinks, remove releases. */
+		k = 8;
+		CUT_ASSERT_EQUAL(&objs[8].node, hashtbl_remove_node(h, &k));
+		CUT_ASSERT_NULL(hashtbl_remove_node(h, &k));
+		CUT_ASSERT_EQUAL(0, objs[8].released);
+		k = 9;
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, &k));
+		CUT_ASSERT_EQUAL(1, objs[9].released);
+		CUT_ASSERT_EQUAL(298, hashtbl_count(h));
+
+		/* Iterators see the key and the node. */
+		hashtbl_iter_init(h, &iter);
+		i = 0;
+		while (hashtbl_iter_next(h, &iter)) {
+			struct intrusive_obj *obj;
+			obj = HASHTBL_CONTAINER_OF(iter.val, struct intrusive_obj, node);
+			CUT_ASSERT_EQUAL(&obj->id, iter.key);
+			i++;
+		}
+		CUT_ASSERT_EQUAL(298, i);
+
+		hashtbl_delete(h);
+		CUT_ASSERT_EQUAL(1, dup.released);
+		for (i = 0; i < 300; i++)
+			CUT_ASSERT_EQUAL(((i == 7 || i == 8) ? 0 : 1), objs[i].released);
+	}
+
+	return 0;
+}
+
+static int test29_nallocs;
+
+static void *test29_malloc(size_t n)
+{
+	test29_nallocs++;
+	return malloc(n);
+}
+
+static void test29_free(void *p)
+{
+	test29_nallocs--;
+	free(p);
+}
+
+/* Test defragmenting, to completion and incrementally. */
+
+static int test29(void)
+{
+	int i, rc, *k;
+	struct hashtbl *h = hashtbl_create(16, HASHTBL_MAX_LOAD_FACTOR, 1,
+					   hashtbl_int_hash, hashtbl_int_equals,
+					   free, free,
+					   test29_malloc, test29_free);
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_defragment(h, 0));
+
+	for (i = 0; i < 2000; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(i), test_int(i)));
+
+	for (i = 0; i < 2000; i += 2)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, &i));
+
+	/* The table, its slots and 1000 entries. */
+	CUT_ASSERT_EQUAL(1002, test29_nallocs);
+	CUT_ASSERT_EQUAL(0, hashtbl_defragment(h, 0));
+	CUT_ASSERT_EQUAL(4, test29_nallocs);	/* and the slab and its index */
+
+	for (i = 0; i < 2000; i++) {
+		if (i % 2 == 0)
+			CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_EQUAL(i, *(int *)hashtbl_lookup(h, &i));
+	}
+
+	/* Entries are freed back to the slab, which goes with the last. */
+	for (i = 1; i < 1000; i += 2)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, &i));
+	CUT_ASSERT_EQUAL(4, test29_nallocs);
+	for (i = 1000; i < 2000; i++) {
+		k = test_int(i);
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, k, test_int(i)));
+		if (i % 2 == 1)
+			free(k);	/* replaced, the table kept its key */
+	}
+	for (i = 1001; i < 2000; i += 2)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, &i));
+	CUT_ASSERT_EQUAL(2 + 500, test29_nallocs);
+
+	/* Incrementally, with the table changing between steps. */
+	i = 0;
+	while ((rc = hashtbl_defragment(h, 1)) == 1) {
+		int j = 2000 + i++;
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(j), test_int(j)));
+		j = 1000 + 2 * (i % 250);
+		hashtbl_remove(h, &j);
+	}
+	CUT_ASSERT_EQUAL(0, rc);
+
+	for (i = 1000; i < 2000; i += 2) {
+		int *v = hashtbl_lookup(h, &i);
+		if (v != NULL)
+			CUT_ASSERT_EQUAL(i, *v);
+	}
+
+	/* Clearing abandons a pass, if one is still going. */
+	CUT_ASSERT_TRUE(hashtbl_defragment(h, 1) >= 0);
+	hashtbl_clear(h);
+	CUT_ASSERT_EQUAL(2, test29_nallocs);
+
+	hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+	return 0;
+}
+
+/* Test batched iteration, mixed with single steps. */
+
+static int test30(void)
+{
+	int i, j, n, total = 0;
+	static int keys[3000];
+	static char seen[3000];
+	void *k[7], *v[7];
+	struct hashtbl_iter iter;
+	struct hashtbl *h = hashtbl_create(64, HASHTBL_MAX_LOAD_FACTOR, 1,
+					   hashtbl_int_hash, hashtbl_int_equals,
+					   NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	hashtbl_iter_init(h, &iter);
+	CUT_ASSERT_EQUAL(0, hashtbl_iter_next_n(h, &iter, k, v, 7));
+
+	for (i = 0; i < 3000; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	}
+
+	hashtbl_iter_init(h, &iter);
+	for (;;) {
+		if ((n = hashtbl_iter_next_n(h, &iter, k, v, 7)) == 0)
+			break;
+		CUT_ASSERT_TRUE(n <= 7);
+		for (j = 0; j < n; j++) {
+			CUT_ASSERT_EQUAL(k[j], v[j]);
+			CUT_ASSERT_EQUAL(0, seen[*(int *)k[j]]++);
+		}
+		CUT_ASSERT_EQUAL(k[n - 1], iter.key);
+		total += n;
+		if (hashtbl_iter_next(h, &iter)) {
+			CUT_ASSERT_EQUAL(0, seen[*(int *)iter.key]++);
+			total++;
+		}
+	}
+
+	CUT_ASSERT_EQUAL(3000, total);
+	CUT_ASSERT_EQUAL(0, hashtbl_iter_next(h, &iter));
+	CUT_ASSERT_EQUAL(0, hashtbl_iter_next_n(h, &iter, NULL, NULL, 7));
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+static void test31_scan_fn(const void *k, const void *v, void *p)
+{
+	UNUSED_PARAMETER(v);
+	((char *)p)[*(const int *)k]++;
+}
+
+static void test31_remove_odd_fn(const void *k, const void *v, void *p)
+{
+	UNUSED_PARAMETER(v);
+	if (*(const int *)k % 2 == 1)
+		hashtbl_remove(p, k);
+}
+
+/* Test scanning with a cursor while the table grows. */
+
+static int test31(void)
+{
+	int i, steps = 0;
+	static int keys[1000];
+	static char seen[1000];
+	unsigned long cursor = 0;
+	struct hashtbl *h = hashtbl_create(8, HASHTBL_MAX_LOAD_FACTOR, 1,
+					   hashtbl_int_hash, hashtbl_int_equals,
+					   NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	/* One step per slot. */
+	do {
+		cursor = hashtbl_scan(h, cursor, test31_scan_fn, seen);
+		steps++;
+	} while (cursor != 0);
+	CUT_ASSERT_EQUAL(hashtbl_capacity(h), steps);
+	steps = 0;
+
+	for (i = 0; i < 1000; i++)
+		keys[i] = i;
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+
+	/* Grow the table part way through the scan. */
+	do {
+		cursor = hashtbl_scan(h, cursor, test31_scan_fn, seen);
+		if (++steps == 20) {
+			for (i = 100; i < 1000; i++)
+				CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+		}
+	} while (cursor != 0);
+
+	CUT_ASSERT_TRUE(steps > 20);
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_TRUE(seen[i] >= 1);
+
+	/* The callback may remove the key it is passed. */
+	do {
+		cursor = hashtbl_scan(h, cursor, test31_remove_odd_fn, h);
+	} while (cursor != 0);
+
+	CUT_ASSERT_EQUAL(500, hashtbl_count(h));
+	for (i = 0; i < 1000; i++) {
+		if (i % 2 == 0)
+			CUT_ASSERT_NOT_NULL(hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+	}
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+static int test32_sum_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(v);
+	*(long *)p += *(const int *)k;
+	return 1;
+}
+
+static int test32_stop_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(k);
+	UNUSED_PARAMETER(v);
+	return ++*(int *)p < 10;
+}
+
+/* Test incremental apply, clear and delete. */
+
+static int test32(void)
+{
+	int i, rc, steps = 0, napplied = 0;
+	long sum = 0;
+	unsigned long cursor = 0;
+	struct hashtbl *h = hashtbl_create(16, HASHTBL_MAX_LOAD_FACTOR, 1,
+					   hashtbl_int_hash, hashtbl_int_equals,
+					   free, free, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(i), test_int(i)));
+
+	/* At most 8 slots per step. */
+	while ((rc = hashtbl_apply_step(h, &cursor, test32_sum_fn, &sum, 8, 0)) == 1)
+		steps++;
+	CUT_ASSERT_EQUAL(0, rc);
+	CUT_ASSERT_EQUAL(0, cursor);
+	CUT_ASSERT_EQUAL(hashtbl_capacity(h) / 8 - 1, steps);
+	CUT_ASSERT_EQUAL(999 * 1000 / 2, sum);
+
+	/* Stopping early. */
+	CUT_ASSERT_EQUAL(0, hashtbl_apply_step(h, &cursor, test32_stop_fn, &napplied, 0, 0));
+	CUT_ASSERT_EQUAL(10, napplied);
+	CUT_ASSERT_EQUAL(0, cursor);
+
+	/* Clear in steps, with the table growing part way through. */
+	CUT_ASSERT_EQUAL(1, hashtbl_clear_step(h, &cursor, 4, 0));
+	CUT_ASSERT_TRUE(hashtbl_count(h) < 1000);
+	for (i = 1000; i < 2000; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(i), test_int(i)));
+	while (hashtbl_clear_step(h, &cursor, 4, 1000) == 1)
+		;
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(i), test_int(i)));
+	while (hashtbl_delete_step(h, &cursor, 16, 0) == 1)
+		;
+
+	return 0;
+}
+
+static int test33_odd_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(k);
+	UNUSED_PARAMETER(p);
+	return *(const int *)v % 2 != 0;
+}
+
+/* Increments the count for a key; drops it when it reaches *limit. */
+
+static void *test33_count_fn(const void *k, void *v, void *p)
+{
+	int n = (v != NULL) ? *(int *)v + 1 : 1;
+
+	UNUSED_PARAMETER(k);
+	return (n < *(int *)p) ? test_int(n) : NULL;
+}
+
+/* Test cas, replace_if and compute. */
+
+static int test33(void)
+{
+	int i, limit = 3;
+	int *v;
+	struct hashtbl *h = hashtbl_create(16, HASHTBL_MAX_LOAD_FACTOR, 1,
+					   hashtbl_int_hash, hashtbl_int_equals,
+					   free, free, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, test_int(i), test_int(i)));
+
+	i = 4;
+	v = test_int(40);
+	CUT_ASSERT_EQUAL(1, hashtbl_cas(h, &i, v, v));
+	CUT_ASSERT_EQUAL(0, hashtbl_cas(h, &i, hashtbl_lookup(h, &i), v));
+	CUT_ASSERT_EQUAL(40, *(int *)hashtbl_lookup(h, &i));
+	i = 10;
+	CUT_ASSERT_EQUAL(1, hashtbl_cas(h, &i, NULL, v));
+
+	/* 4 is now even, so only replaced if odd fails. */
+	i = 4;
+	v = test_int(41);
+	CUT_ASSERT_EQUAL(1, hashtbl_replace_if(h, &i, v, test33_odd_fn, NULL));
+	i = 5;
+	CUT_ASSERT_EQUAL(0, hashtbl_replace_if(h, &i, v, test33_odd_fn, NULL));
+	CUT_ASSERT_EQUAL(41, *(int *)hashtbl_lookup(h, &i));
+
+	/* Absent keys are added, and removed when fn returns NULL. */
+	CUT_ASSERT_EQUAL(0, hashtbl_compute(h, test_int(100), test33_count_fn, &limit));
+	i = 100;
+	CUT_ASSERT_EQUAL(0, hashtbl_compute(h, &i, test33_count_fn, &limit));
+	CUT_ASSERT_EQUAL(2, *(int *)hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(11, hashtbl_count(h));
+	CUT_ASSERT_EQUAL(0, hashtbl_compute(h, &i, test33_count_fn, &limit));
+	CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(10, hashtbl_count(h));
+
+	limit = 0;
+	CUT_ASSERT_EQUAL(0, hashtbl_compute(h, &i, test33_count_fn, &limit));
+	CUT_ASSERT_NULL(hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(10, hashtbl_count(h));
+
+	hashtbl_delete(h);
+	return 0;
+}
+
+static void test34_resize_fn(const struct hashtbl *h, int phase,
+			     const struct hashtbl_resize_event *event,
+			     void *client_data)
+{
+	UNUSED_PARAMETER(h);
+	UNUSED_PARAMETER(event);
+	if (phase == HASHTBL_RESIZE_END)
+		(*(int *)client_data)++;
+}
+
+/* Test batched insert and remove. */
+
+static int test34(void)
+{
+	int i, nresizes = 0;
+	static int ints[130];
+	void *keys[130], *vals[130];
+	struct hashtbl *h = hashtbl_create(16, HASHTBL_MAX_LOAD_FACTOR, 1,
+					   hashtbl_int_hash, hashtbl_int_equals,
+					   free, free,
+					   test29_malloc, test29_free);
+
+	CUT_ASSERT_NOT_NULL(h);
+	hashtbl_set_resize_callback(h, test34_resize_fn, &nresizes);
+	CUT_ASSERT_EQUAL(0, hashtbl_insert_batch(h, keys, vals, 0));
+
+	/* The table grows once, up front, and the entries share a slab. */
+	for (i = 0; i < 100; i++) {
+		keys[i] = test_int(i);
+		vals[i] = test_int(i);
+	}
+	CUT_ASSERT_EQUAL(100, hashtbl_insert_batch(h, keys, vals, 100));
+	CUT_ASSERT_EQUAL(100, hashtbl_count(h));
+	CUT_ASSERT_EQUAL(1, nresizes);
+	CUT_ASSERT_EQUAL(4, test29_nallocs);
+
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(i, *(int *)hashtbl_lookup(h, &i));
+
+	/* Half replace existing keys, whose copies stay with the caller. */
+	for (i = 0; i < 50; i++) {
+		keys[i] = test_int(75 + i);
+		vals[i] = test_int(-(75 + i));
+	}
+	CUT_ASSERT_EQUAL(50, hashtbl_insert_batch(h, keys, vals, 50));
+	CUT_ASSERT_EQUAL(125, hashtbl_count(h));
+	for (i = 0; i < 25; i++)
+		free(keys[i]);
+	for (i = 75; i < 125; i++)
+		CUT_ASSERT_EQUAL(-i, *(int *)hashtbl_lookup(h, &i));
+
+	/* Small batches allocate entries one at a time. */
+	for (i = 0; i < 3; i++) {
+		keys[i] = test_int(200 + i);
+		vals[i] = test_int(200 + i);
+	}
+	CUT_ASSERT_EQUAL(3, hashtbl_insert_batch(h, keys, vals, 3));
+	CUT_ASSERT_EQUAL(128, hashtbl_count(h));
+
+	for (i = 0; i < 130; i++) {
+		ints[i] = (i < 125) ? i : 200 + (i - 125);
+		keys[i] = &ints[i];
+	}
+	CUT_ASSERT_EQUAL(128, hashtbl_remove_batch(h, keys, 130));
+	CUT_ASSERT_EQUAL(0, hashtbl_count(h));
+	CUT_ASSERT_EQUAL(0, hashtbl_remove_batch(h, keys, 130));
+
+	/* Only the table and its slots are left. */
+	CUT_ASSERT_EQUAL(2, test29_nallocs);
+	hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	return 0;
+}
+
+/* Test inserting a node that is already linked is a no-op. */
+
+static unsigned int test35_hash(const void *k)
+{
+	UNUSED_PARAMETER(k);
+	return 7;
+}
+
+static int test35(void)
+{
+	int i;
+	struct intrusive_obj objs[8];
+	struct hashtbl *h;
+
+	h = hashtbl_create_intrusive(4, 0.75f, 0,
+				     HASHTBL_KEY_OFFSET(struct intrusive_obj, node, id),
+				     NULL, test35_hash, hashtbl_int_equals,
+				     intrusive_release, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 8; i++) {
+		objs[i].id = i;
+		objs[i].released = 0;
+		CUT_ASSERT_NULL(hashtbl_insert_node(h, &objs[i].node));
+	}
+
+	/* The head, middle and tail of the one chain. */
+	CUT_ASSERT_NULL(hashtbl_insert_node(h, &objs[7].node));
+	CUT_ASSERT_NULL(hashtbl_insert_node(h, &objs[3].node));
+	CUT_ASSERT_NULL(hashtbl_insert_node(h, &objs[0].node));
+
+	CUT_ASSERT_EQUAL(8, hashtbl_count(h));
+	for (i = 0; i < 8; i++)
+		CUT_ASSERT_EQUAL(&objs[i].node, hashtbl_lookup_node(h, &i));
+
+	hashtbl_delete(h);
+	for (i = 0; i < 8; i++)
+		CUT_ASSERT_EQUAL(1, objs[i].released);
+
+	return 0;
+}
+
 CUT_BEGIN_TEST_HARNESS
 CUT_RUN_TEST(test1);
 CUT_RUN_TEST(test2);
@@ -1061,4 +1797,15 @@ CUT_RUN_TEST(test21);
 CUT_RUN_TEST(test22);
 CUT_RUN_TEST(test23);
 CUT_RUN_TEST(test24);
+CUT_RUN_TEST(test25);
+CUT_RUN_TEST(test26);
+CUT_RUN_TEST(test27);
+CUT_RUN_TEST(test28);
+CUT_RUN_TEST(test29);
+CUT_RUN_TEST(test30);
+CUT_RUN_TEST(test31);
+CUT_RUN_TEST(test32);
+CUT_RUN_TEST(test33);
+CUT_RUN_TEST(test34);
+CUT_RUN_TEST(test35);
 CUT_END_TEST_HARNESS
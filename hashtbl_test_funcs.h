@@ -0,0 +1,85 @@
+#ifndef HASHTBL_TEST_FUNCS_H
+#define HASHTBL_TEST_FUNCS_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Helpers shared by the unit tests of the table engines and the
+ * modules built on them.  Not part of the library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "hashtbl_funcs.h"	/* INLINE */
+
+#define UNUSED_PARAMETER(X)	(void)(X)
+
+/* Returns a malloc'ed int, for keys and values that a table frees. */
+
+static INLINE int *test_int(int x)
+{
+	int *p = malloc(sizeof(*p));
+
+	if (p == NULL) {
+		fprintf(stderr, "out of memory\n");
+		abort();
+	}
+
+	*p = x;
+	return p;
+}
+
+/* Number of calls to test_counting_free(), from any thread. */
+
+static atomic_int test_nfrees;
+
+static INLINE void test_counting_free(void *p)
+{
+	atomic_fetch_add(&test_nfrees, 1);
+	free(p);
+}
+
+/* Apply functions: add each int value to the atomic_long p, or stop. */
+
+static INLINE int test_sum_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(k);
+	atomic_fetch_add((atomic_long *)p, *(const int *)v);
+	return 1;
+}
+
+static INLINE int test_stop_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(k);
+	UNUSED_PARAMETER(v);
+	UNUSED_PARAMETER(p);
+	return 0;
+}
+
+#endif	/* HASHTBL_TEST_FUNCS_H */
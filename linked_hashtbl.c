@@ -42,11 +42,14 @@
 
 #include <stddef.h>		/* size_t, offsetof, NULL */
 #include <stdlib.h>		/* malloc, free */
-#include <string.h>		/* strcmp */
+#include <string.h>		/* strcmp, memcpy, memmove */
+#include <time.h>		/* clock_gettime */
 #if !defined(_MSC_VER)
 #include <stdint.h>		/* intptr_t */
 #endif
 #include "linked_hashtbl.h"
+#include "linked_hashtbl_private.h"
+#include "hashtbl_probes.h"
 
 #define UNUSED_PARAMETER(X)		(void) (X)
 
@@ -54,45 +57,54 @@
 #define LINKED_HASHTBL_MAX_TABLE_SIZE	(1 << 30)
 #endif
 
-#if defined(_MSC_VER)
-#define INLINE __inline
+#if defined(__GNUC__)
+#define PREFETCH(ADDR)			__builtin_prefetch((ADDR))
 #else
-#define INLINE inline
+#define PREFETCH(ADDR)			((void) (ADDR))
 #endif
 
-#define LIST_ENTRY(PTR, TYPE, FIELD)			\
-	(TYPE *)(((TYPE *)PTR) - offsetof(TYPE, FIELD))
+/* Keys hashed and prefetched together by the batch operations. */
+#define BATCH_CHUNK			32
 
-struct l_hashtbl_list_head {
-	struct l_hashtbl_list_head *next, *prev;
-};
+/* Smallest batch whose new entries share one slab. */
+#define BATCH_SLAB_MIN			16
 
-struct l_hashtbl {
-	struct l_hashtbl_list_head	  all_entries;
-	double				  max_load_factor;
-	LINKED_HASHTBL_HASH_FN		  hash_fn;
-	LINKED_HASHTBL_EQUALS_FN	  equals_fn;
-	unsigned long			  nentries;
-	int				  table_size;
-	int				  resize_threshold;
-	int				  auto_resize;
-	int				  access_order;
-	LINKED_HASHTBL_KEY_FREE_FN	  key_free_fn;
-	LINKED_HASHTBL_VAL_FREE_FN	  val_free_fn;
-	LINKED_HASHTBL_MALLOC_FN	  malloc_fn;
-	LINKED_HASHTBL_FREE_FN		  free_fn;
-	LINKED_HASHTBL_EVICTOR_FN	  evictor_fn;
-	struct l_hashtbl_entry		**table;
+/*
+ * A key being loaded by l_hashtbl_get_or_load(), or refreshed ahead
+ * of its deadline by a worker.  Callers that miss on the same key
+ * wait for it rather than load the key again.
+ */
+struct l_hashtbl_load {
+	struct l_hashtbl_load	*next;
+	struct l_hashtbl_load	*queue_next;	/* refreshes waiting for a worker */
+	const void		*key;	/* the caller's, or the entry's */
+	unsigned int		 hash;
+	int			 refresh;
+	int			 owns_key;	/* entry went while refreshing */
+	int			 done;
+	int			 nwaiters;
+	void			*val;	/* the result, NULL if the load failed */
+	LINKED_HASHTBL_LOAD_FN	 loader;
+	void			*client_data;
+	pthread_cond_t		 cond;
 };
 
-struct l_hashtbl_entry {
-	struct l_hashtbl_list_head	 list;	/* all_entries list */
-	struct l_hashtbl_entry		*next;	/* per slot list */
-	void				*key;
-	void				*val;
-	unsigned int			 hash;	/* hash of key */
+/*
+ * A hash evicted from the S3-FIFO small queue.  The ghost FIFO is a
+ * direct-mapped table of these: a hash is a ghost while fewer than
+ * the main queue's worth of hashes have been evicted after it.
+ */
+struct l_hashtbl_ghost {
+	unsigned int		 hash;
+	unsigned int		 seq;	/* 0 if unused */
 };
 
+/* Largest S3-FIFO hit count. */
+#define S3FIFO_MAX_FREQ			3
+
+#define LIST_ENTRY(PTR, TYPE, FIELD)			\
+	((TYPE *)(void *)((char *)(PTR) - offsetof(TYPE, FIELD)))
+
 static INLINE void list_init(struct l_hashtbl_list_head *head)
 {
 	head->next = head;
@@ -149,28 +161,124 @@ static int is_power_of_2(int x)
 	return ((x & (x - 1)) == 0);
 }
 
+/* Monotonic time in microseconds, used to time resizes. */
+static double now_usecs(void)
+{
+#if defined(_MSC_VER)
+	return (double)clock() * 1e6 / CLOCKS_PER_SEC;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+#endif
+}
+
+/* When a value loaded now was loaded, if the table tracks that. */
+
+static INLINE double load_stamp(const struct l_hashtbl *h)
+{
+	return (h->expire_usecs > 0 || h->refresh_usecs > 0) ? now_usecs() : 0.0;
+}
+
+/* Only a table that has had expiry or refresh enabled stamps entries. */
+
+static INLINE size_t entry_size(const struct l_hashtbl *h)
+{
+	return h->timed ? sizeof(struct l_hashtbl_timed_entry) :
+		sizeof(struct l_hashtbl_entry);
+}
+
+static INLINE void stamp_entry(const struct l_hashtbl *h,
+			       struct l_hashtbl_entry *entry)
+{
+	if (h->timed)
+		((struct l_hashtbl_timed_entry *)entry)->loaded_at = load_stamp(h);
+}
+
+/* Stamp every entry as loaded now, e.g. when expiry is switched on. */
+
+static void stamp_entries(struct l_hashtbl *h)
+{
+	struct l_hashtbl_list_head *list, *head = &h->all_entries;
+	double now = load_stamp(h);
+
+	if (!h->timed)
+		return;
+
+	for (list = head->next; list != head; list = list->next) {
+		struct l_hashtbl_node *node;
+		node = LIST_ENTRY(list, struct l_hashtbl_node, list);
+		((struct l_hashtbl_timed_entry *)node)->loaded_at = now;
+	}
+}
+
+/* Keep a defragment pass's position valid when node leaves the list. */
+
+static INLINE void defrag_skip(struct l_hashtbl *h,
+			       struct l_hashtbl_node *node)
+{
+	if (h->defrag_pos == &node->list)
+		h->defrag_pos = node->list.next;
+}
+
+/* Keep the S3-FIFO queues valid when node leaves the list. */
+
+static INLINE void s3_skip(struct l_hashtbl *h, struct l_hashtbl_node *node)
+{
+	if (h->access_order == LINKED_HASHTBL_S3FIFO) {
+		if (h->s3_main == &node->list)
+			h->s3_main = node->list.next;
+		if (node->small)
+			h->s3_nsmall--;
+	}
+}
+
 static INLINE void record_access(struct l_hashtbl *h,
-				 struct l_hashtbl_entry *entry)
+				 struct l_hashtbl_node *node)
 {
-	if (h->access_order) {
+	if (h->access_order == LINKED_HASHTBL_S3FIFO) {
+		if (node->freq < S3FIFO_MAX_FREQ)
+			node->freq++;
+	} else if (h->access_order) {
 		/* move to head of all_entries */
-		list_remove(&entry->list);
-		list_add_before(&entry->list, &h->all_entries);
+		defrag_skip(h, node);
+		list_remove(&node->list);
+		list_add_before(&node->list, &h->all_entries);
 	}
 }
 
-static INLINE struct l_hashtbl_entry ** tbl_entry_ref(struct l_hashtbl *h,
-						      unsigned int hashval)
+static INLINE struct l_hashtbl_node ** tbl_node_ref(struct l_hashtbl *h,
+						    unsigned int hashval)
 {
 	return &h->table[(int)hashval & (h->table_size -1)];
 }
 
-static INLINE struct l_hashtbl_entry * tbl_entry(struct l_hashtbl *h,
-						 unsigned int hashval)
+static INLINE struct l_hashtbl_node * tbl_node(struct l_hashtbl *h,
+					       unsigned int hashval)
 {
 	return h->table[(int)hashval & (h->table_size -1)];
 }
 
+static INLINE const void *node_key(const struct l_hashtbl *h,
+				   const struct l_hashtbl_node *node)
+{
+	if (!h->intrusive)
+		return ((const struct l_hashtbl_entry *)node)->key;
+	if (h->node_key_fn != NULL)
+		return h->node_key_fn(node);
+	return (const char *)node + h->key_offset;
+}
+
+/* The value of an intrusive table's entry is its node. */
+
+static INLINE void *node_val(const struct l_hashtbl *h,
+			     const struct l_hashtbl_node *node)
+{
+	if (!h->intrusive)
+		return ((const struct l_hashtbl_entry *)node)->val;
+	return (void *)node;
+}
+
 static INLINE int remove_eldest(const struct l_hashtbl *h,
 				unsigned long nentries)
 {
@@ -179,83 +287,253 @@ static INLINE int remove_eldest(const struct l_hashtbl *h,
 	return 0;
 }
 
-static INLINE struct l_hashtbl_entry *find_entry(struct l_hashtbl *h,
-						 unsigned int hv,
-						 const void *k)
+/* Evictor of a table of absent keys, which has its own budget. */
+
+static int evict_absent(const struct l_hashtbl *h, unsigned long nentries)
+{
+	return nentries > h->max_entries;
+}
+
+/*
+ * Search the hashed slot for k.  The number of entries walked is
+ * stored in depth.
+ */
+static INLINE struct l_hashtbl_node *find_node(struct l_hashtbl *h,
+					       unsigned int hv,
+					       const void *k,
+					       unsigned int *depth)
 {
-	struct l_hashtbl_entry *entry = tbl_entry(h, hv);
+	struct l_hashtbl_node *node = tbl_node(h, hv);
+	unsigned int n = 0;
 
-	while (entry != NULL) {
-		if (entry->hash == hv && h->equals_fn(entry->key, k))
+	while (node != NULL) {
+		n++;
+		if (node->hash == hv && h->equals_fn(node_key(h, node), k))
 			break;
-		entry = entry->next;
+		node = node->next;
 	}
 
-	return entry;
+	*depth = n;
+	return node;
 }
 
 /*
  * Remove an entry from the hash table without deleting the underlying
- * instance.  Returns the entry, or NULL if not found.
+ * instance.  Returns the node, or NULL if not found.
  */
-static struct l_hashtbl_entry *remove_key(struct l_hashtbl *h,
-					  const void *k)
+static struct l_hashtbl_node *remove_hashed(struct l_hashtbl *h,
+					    unsigned int hv, const void *k)
 {
-	unsigned int hv = h->hash_fn(k);
-	struct l_hashtbl_entry **slot_ref = tbl_entry_ref(h, hv);
-	struct l_hashtbl_entry *entry = *slot_ref;
+	struct l_hashtbl_node **slot_ref = tbl_node_ref(h, hv);
+	struct l_hashtbl_node *node = *slot_ref;
+	unsigned int depth = 0;
 
-	while (entry != NULL) {
-		if (entry->hash == hv && h->equals_fn(entry->key, k)) {
+	while (node != NULL) {
+		depth++;
+		if (node->hash == hv && h->equals_fn(node_key(h, node), k)) {
 			/* advance previous node to next entry. */
-			*slot_ref = entry->next;
+			*slot_ref = node->next;
 			h->nentries--;
-			list_remove(&entry->list);
+			defrag_skip(h, node);
+			s3_skip(h, node);
+			list_remove(&node->list);
 			break;
 		}
-		slot_ref = &entry->next;
-		entry = entry->next;
+		slot_ref = &node->next;
+		node = node->next;
 	}
 
-	return entry;
+	HASHTBL_PROBE4(l_hashtbl, remove, h, hv, depth, node != NULL);
+	return node;
 }
 
-int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
+static struct l_hashtbl_node *remove_key(struct l_hashtbl *h,
+					 const void *k)
+{
+	return remove_hashed(h, h->hash_fn(k), k);
+}
+
+static void free_node(struct l_hashtbl *h, struct l_hashtbl_node *node);
+
+/* Find k, removing it instead if it has expired. */
+
+static struct l_hashtbl_node *lookup_key(struct l_hashtbl *h, const void *k)
 {
-	struct l_hashtbl_entry *entry, **slot_ref;
 	unsigned int hv = h->hash_fn(k);
+	unsigned int depth;
+	struct l_hashtbl_node *node = find_node(h, hv, k, &depth);
 
-	if ((entry = find_entry(h, hv, k)) != NULL) {
-		/* Replace the current value. This should not affect
-		 * the iteration order as the key already exists. */
-		if (h->val_free_fn != NULL)
-			h->val_free_fn(entry->val);
-		entry->val = v;
+	HASHTBL_PROBE4(l_hashtbl, lookup, h, hv, depth, node != NULL);
+
+	if (h->sampler != NULL)
+		hashtbl_sampler_record(h->sampler, hv, depth);
+
+	if (node != NULL && h->expire_usecs > 0 &&
+	    now_usecs() - ((struct l_hashtbl_timed_entry *)node)->loaded_at >=
+	    h->expire_usecs) {
+		free_node(h, remove_hashed(h, hv, k));
+		return NULL;
+	}
+
+	if (node != NULL)
+		record_access(h, node);
+
+	return node;
+}
+
+/*
+ * The S3-FIFO queues share the list of all entries: the small queue
+ * runs from its head up to s3_main, the head of the main queue, which
+ * runs on to the eldest entry.  Moving the oldest small entry to the
+ * main queue is then just a step of s3_main.
+ */
+
+/* Move node to the head of the main queue. */
+
+static void s3_push_main(struct l_hashtbl *h, struct l_hashtbl_node *node)
+{
+	list_add_before(&node->list, h->s3_main->prev);
+	h->s3_main = &node->list;
+}
+
+/* Remember that hv was evicted from the small queue. */
+
+static void s3_ghost_add(struct l_hashtbl *h, unsigned int hv)
+{
+	struct l_hashtbl_ghost *ghost;
+	unsigned int size = h->s3_ghost_mask + 1;
+
+	/* Size the table for twice the entries, dropping its history. */
+	if (h->s3_ghost == NULL || h->nentries > size / 2) {
+		size = (unsigned int)roundup_to_next_power_of_2((int)h->nentries * 2);
+		if (size < 16)
+			size = 16;
+		if ((ghost = h->malloc_fn(size * sizeof(*ghost))) == NULL)
+			return;
+		memset(ghost, 0, size * sizeof(*ghost));
+		if (h->s3_ghost != NULL)
+			h->free_fn(h->s3_ghost);
+		h->s3_ghost = ghost;
+		h->s3_ghost_mask = size - 1;
+	}
+
+	if (++h->s3_ghost_seq == 0)
+		h->s3_ghost_seq = 1;
+	ghost = &h->s3_ghost[hv & h->s3_ghost_mask];
+	ghost->hash = hv;
+	ghost->seq = h->s3_ghost_seq;
+}
+
+/* Returns 1, forgetting it, if hv is in the ghost FIFO. */
+
+static int s3_ghost_hit(struct l_hashtbl *h, unsigned int hv)
+{
+	struct l_hashtbl_ghost *ghost;
+	unsigned long nmain = h->nentries - h->s3_nsmall;
+
+	if (h->s3_ghost == NULL)
+		return 0;
+
+	ghost = &h->s3_ghost[hv & h->s3_ghost_mask];
+	if (ghost->seq == 0 || ghost->hash != hv ||
+	    h->s3_ghost_seq - ghost->seq >= (nmain > 0 ? nmain : 1))
 		return 0;
+
+	ghost->seq = 0;
+	return 1;
+}
+
+static void s3_link(struct l_hashtbl *h, struct l_hashtbl_node *node)
+{
+	node->freq = 0;
+	if (s3_ghost_hit(h, node->hash)) {
+		node->small = 0;
+		s3_push_main(h, node);
+	} else {
+		node->small = 1;
+		h->s3_nsmall++;
+		list_add_before(&node->list, &h->all_entries);
 	}
+}
 
-	if ((entry = h->malloc_fn(sizeof(*entry))) == NULL)
-		return 1;
+/*
+ * Choose the entry to evict, promoting and reinserting on the way.
+ * Returns NULL only if the new node is the sole entry.
+ */
+static struct l_hashtbl_node *s3_victim(struct l_hashtbl *h,
+					struct l_hashtbl_node *new_node)
+{
+	struct l_hashtbl_list_head *head = &h->all_entries;
+	struct l_hashtbl_node *node;
+
+	for (;;) {
+		int from_small = h->s3_nsmall > 0 &&
+			(h->s3_main == head || h->s3_nsmall * 10 >= h->nentries);
+
+		node = LIST_ENTRY(from_small ? h->s3_main->prev : head->prev,
+				  struct l_hashtbl_node, list);
+
+		/* A new key is only evicted if nothing else can be. */
+		if (from_small && node == new_node) {
+			if (h->s3_main == head)
+				return NULL;
+			from_small = 0;
+			node = LIST_ENTRY(head->prev, struct l_hashtbl_node, list);
+		}
 
-	entry->key = k;
-	entry->val = v;
-	entry->hash = hv;
+		if (from_small) {
+			if (node->freq <= 1) {
+				s3_ghost_add(h, node->hash);
+				return node;
+			}
+			node->small = 0;
+			node->freq = 0;
+			h->s3_nsmall--;
+			h->s3_main = &node->list;
+		} else {
+			if (node->freq == 0)
+				return node;
+			node->freq--;
+			if (&node->list != h->s3_main) {
+				defrag_skip(h, node);
+				list_remove(&node->list);
+				s3_push_main(h, node);
+			}
+		}
+	}
+}
 
+/*
+ * Link a node for a new key, then evict and grow as required.
+ */
+static void link_new_node(struct l_hashtbl *h,
+			  struct l_hashtbl_node *node,
+			  unsigned int depth)
+{
 	/* Link new entry at the head of the chain for this slot. */
-	slot_ref = tbl_entry_ref(h, hv);
-	entry->next = *slot_ref;
+	struct l_hashtbl_node **slot_ref = tbl_node_ref(h, node->hash);
+	struct l_hashtbl_node *new_node = node;
+	node->next = *slot_ref;
 
 	/* Move new entry to the head of all entries. */
-	*slot_ref = entry;
-	list_add_before(&entry->list, &h->all_entries);
+	*slot_ref = node;
+	if (h->access_order == LINKED_HASHTBL_S3FIFO)
+		s3_link(h, node);
+	else
+		list_add_before(&node->list, &h->all_entries);
 
 	h->nentries++;
+	HASHTBL_PROBE3(l_hashtbl, insert, h, node->hash, depth);
 
 	if (h->evictor_fn(h, h->nentries)) {
-		/* Evict oldest entry. */
-		struct l_hashtbl_list_head *node = h->all_entries.prev;
-		entry = LIST_ENTRY(node, struct l_hashtbl_entry, list);
-		l_hashtbl_remove(h, entry->key);
+		/* Evict oldest entry, or S3-FIFO's choice. */
+		struct l_hashtbl_list_head *eldest = h->all_entries.prev;
+		node = LIST_ENTRY(eldest, struct l_hashtbl_node, list);
+		if (h->access_order == LINKED_HASHTBL_S3FIFO &&
+		    (node = s3_victim(h, new_node)) == NULL)
+			node = new_node;
+		HASHTBL_PROBE3(l_hashtbl, evict, h, node->hash, h->nentries);
+		l_hashtbl_remove(h, node_key(h, node));
 	}
 
 	if (h->auto_resize) {
@@ -264,64 +542,897 @@ int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
 			(void)l_hashtbl_resize(h, 2 * h->table_size);
 		}
 	}
+}
+
+/* A key being inserted is no longer known to be absent. */
+
+static INLINE void forget_absent(struct l_hashtbl *h, const void *k)
+{
+	if (h->absent != NULL && h->absent->nentries > 0)
+		(void)l_hashtbl_remove(h->absent, k);
+}
+
+int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
+{
+	struct l_hashtbl_node *node;
+	struct l_hashtbl_entry *entry;
+	unsigned int hv;
+	unsigned int depth;
+
+	if (h->intrusive)
+		return 1;
+
+	hv = h->hash_fn(k);
+
+	if ((node = find_node(h, hv, k, &depth)) != NULL) {
+		/* Replace the current value. This should not affect
+		 * the iteration order as the key already exists. */
+		entry = (struct l_hashtbl_entry *)node;
+		if (h->val_free_fn != NULL)
+			h->val_free_fn(entry->val);
+		entry->val = v;
+		stamp_entry(h, entry);
+		return 0;
+	}
+
+	if ((entry = h->malloc_fn(entry_size(h))) == NULL)
+		return 1;
+
+	forget_absent(h, k);
+	entry->key = k;
+	entry->val = v;
+	stamp_entry(h, entry);
+	entry->node.hash = hv;
+
+	link_new_node(h, &entry->node, depth);
 
 	return 0;
 }
 
 void *l_hashtbl_lookup(struct l_hashtbl *h, const void *k)
 {
-	unsigned int hv = h->hash_fn(k);
-	struct l_hashtbl_entry *entry = find_entry(h, hv, k);
+	struct l_hashtbl_node *node = lookup_key(h, k);
+
+	return (node != NULL) ? node_val(h, node) : NULL;
+}
+
+int l_hashtbl_lookup_status(struct l_hashtbl *h, const void *k, void **val)
+{
+	struct l_hashtbl_node *node = lookup_key(h, k);
+
+	if (val != NULL)
+		*val = (node != NULL) ? node_val(h, node) : NULL;
+
+	if (node != NULL)
+		return LINKED_HASHTBL_FOUND;
+	if (h->absent != NULL && lookup_key(h->absent, k) != NULL)
+		return LINKED_HASHTBL_ABSENT;
+	return LINKED_HASHTBL_NOT_CACHED;
+}
+
+/* Returns the i'th entry of slab. */
+
+static INLINE struct l_hashtbl_entry *slab_entry(const struct l_hashtbl_slab *slab,
+						 unsigned long i)
+{
+	return (struct l_hashtbl_entry *)(void *)
+		((const char *)slab->entries + i * slab->stride);
+}
 
-	if (entry != NULL) {
-		record_access(h, entry);
-		return entry->val;
+/* Returns the slab that holds entry, or NULL if it was allocated alone. */
+
+static INLINE struct l_hashtbl_slab *entry_slab(const struct l_hashtbl *h,
+						const struct l_hashtbl_entry *entry)
+{
+	struct l_hashtbl_slab *slab;
+	int lo = 0, hi = h->nslabs, mid;
+
+	/* Find the last slab that starts at or below entry. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)h->slabs[mid]->entries <= (uintptr_t)entry) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
 
+	if (lo == 0)
+		return NULL;
+
+	slab = h->slabs[lo - 1];
+	if ((uintptr_t)entry < (uintptr_t)slab_entry(slab, slab->size))
+		return slab;
+
 	return NULL;
 }
 
-int l_hashtbl_remove(struct l_hashtbl *h, const void *k)
+/*
+ * Allocates a slab for n entries and adds it to the index, which is
+ * kept sorted by address so that entry_slab() can bisect it.
+ */
+static struct l_hashtbl_slab *slab_new(struct l_hashtbl *h, unsigned long n)
 {
-	struct l_hashtbl_entry *entry = remove_key(h, k);
+	struct l_hashtbl_slab *slab, **slabs;
+	int i;
 
-	if (entry != NULL) {
-		if (h->key_free_fn != NULL)
-			h->key_free_fn(entry->key);
-		if (h->val_free_fn != NULL && entry->val != NULL)
-			h->val_free_fn(entry->val);
+	slab = h->malloc_fn(offsetof(struct l_hashtbl_slab, entries) +
+			    n * entry_size(h));
+	if (slab == NULL)
+		return NULL;
+
+	if (h->nslabs == h->slabs_size) {
+		int size = (h->slabs_size > 0) ? 2 * h->slabs_size : 4;
+		if ((slabs = h->malloc_fn((size_t) size * sizeof(*slabs))) == NULL) {
+			h->free_fn(slab);
+			return NULL;
+		}
+		if (h->slabs != NULL) {
+			memcpy(slabs, h->slabs, (size_t) h->nslabs * sizeof(*slabs));
+			h->free_fn(h->slabs);
+		}
+		h->slabs = slabs;
+		h->slabs_size = size;
+	}
+
+	for (i = h->nslabs; i > 0; i--) {
+		if ((uintptr_t)h->slabs[i - 1] < (uintptr_t)slab)
+			break;
+		h->slabs[i] = h->slabs[i - 1];
+	}
+	h->slabs[i] = slab;
+	h->nslabs++;
+
+	slab->nlive = 0;
+	slab->nused = 0;
+	slab->size = n;
+	slab->stride = entry_size(h);
+
+	return slab;
+}
+
+static void slab_free(struct l_hashtbl *h, struct l_hashtbl_slab *slab)
+{
+	int i;
+
+	for (i = 0; h->slabs[i] != slab; i++)
+		;
+	h->nslabs--;
+	memmove(&h->slabs[i], &h->slabs[i + 1],
+		(size_t)(h->nslabs - i) * sizeof(h->slabs[0]));
+	h->free_fn(slab);
+
+	if (h->nslabs == 0) {
+		h->free_fn(h->slabs);
+		h->slabs = NULL;
+		h->slabs_size = 0;
+	}
+}
+
+/* Release the memory of an entry (not its key or value). */
+
+static void entry_free(struct l_hashtbl *h, struct l_hashtbl_entry *entry)
+{
+	struct l_hashtbl_slab *slab;
+
+	if ((slab = entry_slab(h, entry)) == NULL) {
 		h->free_fn(entry);
+		return;
+	}
+
+	/* A slab being filled is kept until the pass or batch ends. */
+	if (--slab->nlive == 0 && slab != h->defrag_slab &&
+	    slab != h->batch_slab)
+		slab_free(h, slab);
+}
+
+/*
+ * Copy entry into the next entry of slab and point the list and the
+ * chain at the copy.  The caller copies any stamp and frees entry.
+ */
+static struct l_hashtbl_entry *move_entry(struct l_hashtbl *h,
+					  struct l_hashtbl_slab *slab,
+					  struct l_hashtbl_entry *entry)
+{
+	struct l_hashtbl_entry *copy = slab_entry(slab, slab->nused++);
+	struct l_hashtbl_node *node = &entry->node, **slot_ref;
+
+	*copy = *entry;
+	slab->nlive++;
+
+	/* Point the list neighbours and the chain at the copy. */
+	copy->node.list.prev->next = &copy->node.list;
+	copy->node.list.next->prev = &copy->node.list;
+	if (h->s3_main == &node->list)
+		h->s3_main = &copy->node.list;
+	for (slot_ref = tbl_node_ref(h, node->hash); *slot_ref != node;
+	     slot_ref = &(*slot_ref)->next)
+		;
+	*slot_ref = &copy->node;
+
+	return copy;
+}
+
+/*
+ * Make room for a load stamp in every entry.  Tables start without
+ * one; the first time expiry or refresh ahead is enabled the entries
+ * are copied into a slab of stamped entries, abandoning any defragment
+ * pass.  The caller then stamps them.  Returns 1 if there was no memory.
+ */
+static int make_timed(struct l_hashtbl *h)
+{
+	struct l_hashtbl_list_head *list, *next, *head = &h->all_entries;
+	struct l_hashtbl_slab *slab = NULL;
+
+	if (h->timed)
+		return 0;
+
+	h->timed = 1;
+	if (h->nentries > 0 && (slab = slab_new(h, h->nentries)) == NULL) {
+		h->timed = 0;
+		return 1;
+	}
+
+	if (h->defrag_slab != NULL) {
+		if (h->defrag_slab->nlive == 0)
+			slab_free(h, h->defrag_slab);
+		h->defrag_slab = NULL;
+		h->defrag_pos = NULL;
+	}
+
+	for (list = head->next; list != head; list = next) {
+		struct l_hashtbl_node *node;
+		struct l_hashtbl_entry *copy;
+		next = list->next;
+		node = LIST_ENTRY(list, struct l_hashtbl_node, list);
+		copy = move_entry(h, slab, (struct l_hashtbl_entry *)node);
+		((struct l_hashtbl_timed_entry *)copy)->loaded_at = 0.0;
+		entry_free(h, (struct l_hashtbl_entry *)node);
+	}
+
+	return 0;
+}
+
+/* Release a node that has been unlinked from the table. */
+
+static void free_node(struct l_hashtbl *h, struct l_hashtbl_node *node)
+{
+	struct l_hashtbl_entry *entry = (struct l_hashtbl_entry *)node;
+	struct l_hashtbl_load *load;
+
+	if (h->intrusive) {
+		if (h->node_free_fn != NULL)
+			h->node_free_fn(node);
+		return;
+	}
+
+	/* A refresh in flight is using the key: it frees it when done. */
+	for (load = (h->nrefreshing > 0) ? h->loads : NULL;
+	     load != NULL; load = load->next) {
+		if (load->refresh && load->key == entry->key) {
+			load->owns_key = 1;
+			entry->key = NULL;
+			break;
+		}
+	}
+
+	if (h->reclaim_fn != NULL && entry_slab(h, entry) == NULL) {
+		h->reclaim_fn(entry, entry->key, entry->val, h->reclaim_client_data);
+		return;
+	}
+
+	if (h->key_free_fn != NULL && entry->key != NULL)
+		h->key_free_fn(entry->key);
+	if (h->val_free_fn != NULL && entry->val != NULL)
+		h->val_free_fn(entry->val);
+	entry_free(h, entry);
+}
+
+int l_hashtbl_remove(struct l_hashtbl *h, const void *k)
+{
+	struct l_hashtbl_node *node = remove_key(h, k);
+
+	if (node != NULL) {
+		free_node(h, node);
 		return 0;
 	}
 
 	return 1;
 }
 
-void l_hashtbl_clear(struct l_hashtbl *h)
+/*
+ * Grow once for a batch of n new keys.  Only for tables that never
+ * evict: a cache would otherwise be sized for keys it won't keep.
+ */
+static void reserve(struct l_hashtbl *h, unsigned long n)
+{
+	int capacity = h->table_size;
+
+	if (!h->auto_resize || h->evictor_fn != remove_eldest)
+		return;
+
+	while (capacity < LINKED_HASHTBL_MAX_TABLE_SIZE &&
+	       h->nentries + n >= (unsigned long)resize_threshold(capacity,
+								    h->max_load_factor))
+		capacity *= 2;
+
+	if (capacity != h->table_size)
+		(void)l_hashtbl_resize(h, capacity);
+}
+
+/* Hash a chunk of keys, then prefetch their slots and chain heads. */
+
+static void prefetch_chunk(struct l_hashtbl *h, void *const *keys,
+			   unsigned int *hv, int n)
 {
-	struct l_hashtbl_list_head *node, *tmp, *head = &h->all_entries;
+	struct l_hashtbl_node *node;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		hv[i] = h->hash_fn(keys[i]);
+		PREFETCH(tbl_node_ref(h, hv[i]));
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((node = tbl_node(h, hv[i])) != NULL)
+			PREFETCH(node);
+	}
+}
+
+int l_hashtbl_insert_batch(struct l_hashtbl *h, void **keys, void **vals,
+			   int n)
+{
+	unsigned int hv[BATCH_CHUNK];
+	struct l_hashtbl_slab *slab = NULL;
 	struct l_hashtbl_entry *entry;
-	size_t nbytes = (size_t) h->table_size * sizeof(*h->table);
+	struct l_hashtbl_node *node;
+	unsigned int depth;
+	int i, j, m, ninserted = 0;
 
-	for (node = head->next, tmp = node->next;
-	     node != head; node = tmp, tmp = node->next) {
-		entry = LIST_ENTRY(node, struct l_hashtbl_entry, list);
-		if (h->key_free_fn != NULL)
-			h->key_free_fn(entry->key);
+	if (h->intrusive || n <= 0)
+		return 0;
+
+	reserve(h, (unsigned long)n);
+
+	/*
+	 * Evicting tables allocate entries one by one: a slab would
+	 * stay allocated for as long as any one of its keys survived.
+	 * The slab is pinned until the batch ends, so that releasing
+	 * the entries taken so far can't free it under the loop.
+	 */
+	if (n >= BATCH_SLAB_MIN && h->evictor_fn == remove_eldest)
+		slab = slab_new(h, (unsigned long)n);
+	h->batch_slab = slab;
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < BATCH_CHUNK) ? n - i : BATCH_CHUNK;
+		prefetch_chunk(h, keys + i, hv, m);
+
+		for (j = 0; j < m; j++) {
+			if ((node = find_node(h, hv[j], keys[i + j], &depth)) != NULL) {
+				entry = (struct l_hashtbl_entry *)node;
+				if (h->val_free_fn != NULL)
+					h->val_free_fn(entry->val);
+				entry->val = vals[i + j];
+				stamp_entry(h, entry);
+				ninserted++;
+				continue;
+			}
+
+			if (slab != NULL && slab->nused < slab->size) {
+				entry = slab_entry(slab, slab->nused++);
+				slab->nlive++;
+			} else if ((entry = h->malloc_fn(entry_size(h))) == NULL) {
+				goto out;
+			}
+
+			forget_absent(h, keys[i + j]);
+			entry->key = keys[i + j];
+			entry->val = vals[i + j];
+			stamp_entry(h, entry);
+			entry->node.hash = hv[j];
+			link_new_node(h, &entry->node, depth);
+			ninserted++;
+		}
+	}
+
+out:
+	h->batch_slab = NULL;
+	if (slab != NULL && slab->nlive == 0)
+		slab_free(h, slab);
+
+	return ninserted;
+}
+
+int l_hashtbl_remove_batch(struct l_hashtbl *h, void *const *keys, int n)
+{
+	unsigned int hv[BATCH_CHUNK];
+	struct l_hashtbl_node *node;
+	int i, j, m, nremoved = 0;
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < BATCH_CHUNK) ? n - i : BATCH_CHUNK;
+		prefetch_chunk(h, keys + i, hv, m);
+
+		for (j = 0; j < m; j++) {
+			if ((node = remove_hashed(h, hv[j], keys[i + j])) != NULL) {
+				free_node(h, node);
+				nremoved++;
+			}
+		}
+	}
+
+	return nremoved;
+}
+
+void l_hashtbl_lock(struct l_hashtbl *h)
+{
+	pthread_mutex_lock(&h->lock);
+}
+
+void l_hashtbl_unlock(struct l_hashtbl *h)
+{
+	pthread_mutex_unlock(&h->lock);
+}
+
+/*
+ * Stores a loaded key and value, as l_hashtbl_insert() would, except
+ * that the table owns key even if another thread inserted it first.
+ * Returns the stored value, or NULL if there was no memory.
+ */
+static void *store_loaded(struct l_hashtbl *h, unsigned int hv,
+			  void *key, void *val)
+{
+	struct l_hashtbl_entry *entry;
+	struct l_hashtbl_node *node;
+	unsigned int depth;
+
+	if ((node = find_node(h, hv, key, &depth)) != NULL) {
+		entry = (struct l_hashtbl_entry *)node;
 		if (h->val_free_fn != NULL)
 			h->val_free_fn(entry->val);
-		list_remove(&entry->list);
-		h->free_fn(entry);
+		entry->val = val;
+		stamp_entry(h, entry);
+		if (h->key_free_fn != NULL)
+			h->key_free_fn(key);
+		return val;
+	}
+
+	if ((entry = h->malloc_fn(entry_size(h))) == NULL) {
+		if (h->key_free_fn != NULL)
+			h->key_free_fn(key);
+		if (h->val_free_fn != NULL)
+			h->val_free_fn(val);
+		return NULL;
+	}
+
+	forget_absent(h, key);
+	entry->key = key;
+	entry->val = val;
+	stamp_entry(h, entry);
+	entry->node.hash = hv;
+	link_new_node(h, &entry->node, depth);
+
+	return val;
+}
+
+/*
+ * Mark key absent, removing any entry for it.  The key is freed if
+ * absent keys are not cached.
+ */
+static void mark_absent(struct l_hashtbl *h, void *key)
+{
+	struct l_hashtbl_node *node;
+
+	if (key == NULL)
+		return;
+
+	if ((node = remove_key(h, key)) != NULL)
+		free_node(h, node);
+
+	if (h->absent != NULL)
+		(void)store_loaded(h->absent, h->hash_fn(key), key, NULL);
+	else if (h->key_free_fn != NULL)
+		h->key_free_fn(key);
+}
+
+int l_hashtbl_set_negative(struct l_hashtbl *h, unsigned long capacity,
+			   long expire_usecs)
+{
+	if (h->intrusive || expire_usecs < 0)
+		return 1;
+
+	if (capacity == 0) {
+		if (h->absent != NULL)
+			l_hashtbl_delete(h->absent);
+		h->absent = NULL;
+		return 0;
+	}
+
+	if (h->absent == NULL) {
+		h->absent = l_hashtbl_create(16, h->max_load_factor, 1,
+					     h->access_order,
+					     h->hash_fn, h->equals_fn,
+					     h->key_free_fn, NULL,
+					     h->malloc_fn, h->free_fn,
+					     evict_absent);
+		if (h->absent == NULL)
+			return 1;
+	}
+
+	if (expire_usecs > 0 && make_timed(h->absent) != 0)
+		return 1;
+
+	h->absent->max_entries = capacity;
+	h->absent->expire_usecs = (double)expire_usecs;
+
+	/* Existing absent keys count as marked now. */
+	stamp_entries(h->absent);
+
+	/* Shed the eldest keys over a smaller budget. */
+	while (h->absent->nentries > capacity) {
+		struct l_hashtbl_list_head *eldest = h->absent->all_entries.prev;
+		struct l_hashtbl_node *node;
+		node = LIST_ENTRY(eldest, struct l_hashtbl_node, list);
+		l_hashtbl_remove(h->absent, node_key(h->absent, node));
+	}
+
+	return 0;
+}
+
+int l_hashtbl_insert_absent(struct l_hashtbl *h, void *k)
+{
+	if (h->absent == NULL)
+		return 1;
+
+	mark_absent(h, k);
+	return 0;
+}
+
+static void load_free(struct l_hashtbl *h, struct l_hashtbl_load *load)
+{
+	pthread_cond_destroy(&load->cond);
+	h->free_fn(load);
+}
+
+/* Returns the load of k in flight, or NULL. */
+
+static struct l_hashtbl_load *find_load(struct l_hashtbl *h, unsigned int hv,
+					const void *k)
+{
+	struct l_hashtbl_load *load;
+
+	for (load = h->loads; load != NULL; load = load->next) {
+		if (load->hash == hv && h->equals_fn(load->key, k))
+			break;
+	}
+
+	return load;
+}
+
+static struct l_hashtbl_load *load_new(struct l_hashtbl *h, unsigned int hv,
+				       const void *k,
+				       LINKED_HASHTBL_LOAD_FN loader,
+				       void *client_data)
+{
+	struct l_hashtbl_load *load;
+
+	if ((load = h->malloc_fn(sizeof(*load))) == NULL)
+		return NULL;
+
+	if (pthread_cond_init(&load->cond, NULL) != 0) {
+		h->free_fn(load);
+		return NULL;
+	}
+
+	load->queue_next = NULL;
+	load->key = k;
+	load->hash = hv;
+	load->refresh = 0;
+	load->owns_key = 0;
+	load->done = 0;
+	load->nwaiters = 0;
+	load->val = NULL;
+	load->loader = loader;
+	load->client_data = client_data;
+	load->next = h->loads;
+	h->loads = load;
+
+	return load;
+}
+
+/* Publish the result of a load to its waiters. */
+
+static void load_done(struct l_hashtbl *h, struct l_hashtbl_load *load,
+		      void *val)
+{
+	struct l_hashtbl_load **ref;
+
+	for (ref = &h->loads; *ref != load; ref = &(*ref)->next)
+		;
+	*ref = load->next;
+
+	load->val = val;
+	load->done = 1;
+
+	if (load->nwaiters > 0)
+		pthread_cond_broadcast(&load->cond);
+	else
+		load_free(h, load);
+}
+
+/* Queue a refresh of a stale entry, unless k is already loading. */
+
+static void refresh_ahead(struct l_hashtbl *h, struct l_hashtbl_entry *entry,
+			  LINKED_HASHTBL_LOAD_FN loader, void *client_data)
+{
+	struct l_hashtbl_load *load;
+
+	if (find_load(h, entry->node.hash, entry->key) != NULL)
+		return;
+
+	load = load_new(h, entry->node.hash, entry->key, loader, client_data);
+	if (load == NULL)
+		return;		/* the next lookup tries again */
+
+	load->refresh = 1;
+	h->nrefreshing++;
+	*h->refresh_tail = load;
+	h->refresh_tail = &load->queue_next;
+	pthread_cond_signal(&h->refresh_cond);
+}
+
+/*
+ * Store the result of a refresh.  The entry keeps its stale value if
+ * the load failed; if the entry went meanwhile, the value is dropped
+ * unless callers are waiting for it.
+ */
+static void refresh_done(struct l_hashtbl *h, struct l_hashtbl_load *load,
+			 void *key, void *val)
+{
+	unsigned int depth;
+
+	if (key == NULL) {
+		val = NULL;
+	} else if (load->nwaiters > 0 ||
+		   find_node(h, load->hash, load->key, &depth) != NULL) {
+		val = store_loaded(h, load->hash, key, val);
+	} else {
+		if (h->key_free_fn != NULL)
+			h->key_free_fn(key);
+		if (h->val_free_fn != NULL)
+			h->val_free_fn(val);
+		val = NULL;
+	}
+
+	h->nrefreshing--;
+	if (load->owns_key && h->key_free_fn != NULL)
+		h->key_free_fn((void *)load->key);
+
+	load_done(h, load, val);
+}
+
+static void *refresh_worker(void *arg)
+{
+	struct l_hashtbl *h = arg;
+	struct l_hashtbl_load *load;
+	void *key, *val;
+	int rc;
+
+	pthread_mutex_lock(&h->lock);
+
+	for (;;) {
+		while (h->refresh_head == NULL && !h->stopping)
+			pthread_cond_wait(&h->refresh_cond, &h->lock);
+		if (h->stopping)
+			break;
+
+		load = h->refresh_head;
+		if ((h->refresh_head = load->queue_next) == NULL)
+			h->refresh_tail = &h->refresh_head;
+		pthread_mutex_unlock(&h->lock);
+
+		rc = load->loader(load->key, &key, &val, load->client_data);
+
+		pthread_mutex_lock(&h->lock);
+		if (rc != 0) {
+			if (rc == LINKED_HASHTBL_ABSENT)
+				mark_absent(h, key);
+			key = NULL;
+			val = NULL;
+		}
+		refresh_done(h, load, key, val);
+	}
+
+	pthread_mutex_unlock(&h->lock);
+	return NULL;
+}
+
+/* Stop the refresh workers, dropping the refreshes not yet started. */
+
+static void refresh_stop(struct l_hashtbl *h)
+{
+	struct l_hashtbl_load *load;
+	int i;
+
+	if (h->nworkers == 0)
+		return;
+
+	pthread_mutex_lock(&h->lock);
+	h->stopping = 1;
+	pthread_cond_broadcast(&h->refresh_cond);
+	pthread_mutex_unlock(&h->lock);
+
+	for (i = 0; i < h->nworkers; i++)
+		pthread_join(h->workers[i], NULL);
+
+	while ((load = h->refresh_head) != NULL) {
+		h->refresh_head = load->queue_next;
+		refresh_done(h, load, NULL, NULL);
+	}
+
+	h->refresh_tail = &h->refresh_head;
+	pthread_cond_destroy(&h->refresh_cond);
+	h->free_fn(h->workers);
+	h->workers = NULL;
+	h->nworkers = 0;
+	h->stopping = 0;
+}
+
+int l_hashtbl_set_expiry(struct l_hashtbl *h, long expire_usecs,
+			 long refresh_usecs, int nthreads)
+{
+	if (h->intrusive || h->nworkers > 0 || expire_usecs < 0 ||
+	    refresh_usecs < 0 || (refresh_usecs > 0 && nthreads < 1))
+		return 1;
+
+	if ((expire_usecs > 0 || refresh_usecs > 0) && make_timed(h) != 0)
+		return 1;
+
+	if (refresh_usecs > 0) {
+		h->workers = h->malloc_fn((size_t)nthreads * sizeof(*h->workers));
+		if (h->workers == NULL)
+			return 1;
+		if (pthread_cond_init(&h->refresh_cond, NULL) != 0) {
+			h->free_fn(h->workers);
+			h->workers = NULL;
+			return 1;
+		}
+		while (h->nworkers < nthreads) {
+			if (pthread_create(&h->workers[h->nworkers], NULL,
+					   refresh_worker, h) != 0) {
+				if (h->nworkers > 0) {
+					refresh_stop(h);
+				} else {
+					pthread_cond_destroy(&h->refresh_cond);
+					h->free_fn(h->workers);
+					h->workers = NULL;
+				}
+				return 1;
+			}
+			h->nworkers++;
+		}
+	}
+
+	h->expire_usecs = (double)expire_usecs;
+	h->refresh_usecs = (double)refresh_usecs;
+
+	/* Existing entries count as loaded now. */
+	stamp_entries(h);
+
+	return 0;
+}
+
+void *l_hashtbl_get_or_load(struct l_hashtbl *h, const void *k,
+			    LINKED_HASHTBL_LOAD_FN loader, void *client_data)
+{
+	struct l_hashtbl_entry *entry;
+	struct l_hashtbl_load *load;
+	struct l_hashtbl_node *node;
+	unsigned int hv;
+	void *key, *val;
+	int rc;
+
+	if (h->intrusive)
+		return NULL;
+
+	hv = h->hash_fn(k);
+	pthread_mutex_lock(&h->lock);
+
+	if ((node = lookup_key(h, k)) != NULL) {
+		entry = (struct l_hashtbl_entry *)node;
+		val = entry->val;
+		/* Past the soft deadline: answer now, reload behind. */
+		if (h->refresh_usecs > 0 &&
+		    now_usecs() - ((struct l_hashtbl_timed_entry *)entry)->loaded_at >=
+		    h->refresh_usecs)
+			refresh_ahead(h, entry, loader, client_data);
+		pthread_mutex_unlock(&h->lock);
+		return val;
+	}
+
+	if (h->absent != NULL && lookup_key(h->absent, k) != NULL) {
+		pthread_mutex_unlock(&h->lock);
+		return NULL;
+	}
+
+	if ((load = find_load(h, hv, k)) != NULL) {
+		/* Share the result of the load in flight. */
+		load->nwaiters++;
+		while (!load->done)
+			pthread_cond_wait(&load->cond, &h->lock);
+		val = load->val;
+		if (--load->nwaiters == 0)
+			load_free(h, load);
+		pthread_mutex_unlock(&h->lock);
+		return val;
+	}
+
+	if ((load = load_new(h, hv, k, loader, client_data)) == NULL) {
+		pthread_mutex_unlock(&h->lock);
+		return NULL;
+	}
+
+	pthread_mutex_unlock(&h->lock);
+
+	rc = loader(k, &key, &val, client_data);
+
+	pthread_mutex_lock(&h->lock);
+
+	/* A failed load is not cached: the next miss loads again. */
+	if (rc == 0) {
+		val = store_loaded(h, hv, key, val);
+	} else {
+		if (rc == LINKED_HASHTBL_ABSENT)
+			mark_absent(h, key);
+		val = NULL;
+	}
+	load_done(h, load, val);
+
+	pthread_mutex_unlock(&h->lock);
+
+	return val;
+}
+
+void l_hashtbl_clear(struct l_hashtbl *h)
+{
+	struct l_hashtbl_list_head *list, *tmp, *head = &h->all_entries;
+	struct l_hashtbl_node *node;
+	size_t nbytes = (size_t) h->table_size * sizeof(*h->table);
+
+	for (list = head->next, tmp = list->next;
+	     list != head; list = tmp, tmp = list->next) {
+		node = LIST_ENTRY(list, struct l_hashtbl_node, list);
+		list_remove(&node->list);
 		h->nentries--;
+		free_node(h, node);
 	}
 
 	memset(h->table, 0, nbytes);
 	list_init(&h->all_entries);
+	h->s3_main = &h->all_entries;
+	h->s3_nsmall = 0;
+
+	if (h->absent != NULL)
+		l_hashtbl_clear(h->absent);
+
+	/* Abandon any defragment in progress. */
+	if (h->defrag_slab != NULL) {
+		slab_free(h, h->defrag_slab);
+		h->defrag_slab = NULL;
+	}
 }
 
 void l_hashtbl_delete(struct l_hashtbl *h)
 {
+	refresh_stop(h);
 	l_hashtbl_clear(h);
+	if (h->absent != NULL)
+		l_hashtbl_delete(h->absent);
+	if (h->s3_ghost != NULL)
+		h->free_fn(h->s3_ghost);
+	l_hashtbl_disable_sampling(h);
+	pthread_mutex_destroy(&h->lock);
 	h->free_fn(h->table);
 	h->free_fn(h);
 }
@@ -378,10 +1489,48 @@ struct l_hashtbl *l_hashtbl_create(int capacity,
 	h->malloc_fn = malloc_fn;
 	h->free_fn = free_fn;
 	h->evictor_fn = evictor_fn;
+	h->resize_fn = NULL;
+	h->resize_client_data = NULL;
+	h->sampler = NULL;
+	h->intrusive = 0;
+	h->key_offset = 0;
+	h->node_key_fn = NULL;
+	h->node_free_fn = NULL;
+	h->slabs = NULL;
+	h->nslabs = 0;
+	h->slabs_size = 0;
+	h->defrag_slab = NULL;
+	h->batch_slab = NULL;
+	h->defrag_pos = NULL;
+	h->reclaim_fn = NULL;
+	h->reclaim_client_data = NULL;
+	h->loads = NULL;
+	h->expire_usecs = 0;
+	h->refresh_usecs = 0;
+	h->timed = 0;
+	h->nrefreshing = 0;
+	h->refresh_head = NULL;
+	h->refresh_tail = &h->refresh_head;
+	h->workers = NULL;
+	h->nworkers = 0;
+	h->stopping = 0;
+	h->s3_main = &h->all_entries;
+	h->s3_nsmall = 0;
+	h->s3_ghost = NULL;
+	h->s3_ghost_mask = 0;
+	h->s3_ghost_seq = 0;
+	h->absent = NULL;
+	h->max_entries = 0;
 	h->table = NULL;
 	list_init(&h->all_entries);
 
+	if (pthread_mutex_init(&h->lock, NULL) != 0) {
+		free_fn(h);
+		return NULL;
+	}
+
 	if (l_hashtbl_resize(h, capacity) != 0) {
+		pthread_mutex_destroy(&h->lock);
 		free_fn(h);
 		h = NULL;
 	}
@@ -391,10 +1540,13 @@ struct l_hashtbl *l_hashtbl_create(int capacity,
 
 int l_hashtbl_resize(struct l_hashtbl *h, int capacity)
 {
-	struct l_hashtbl_list_head *node, *head = &h->all_entries;
-	struct l_hashtbl_entry *entry, **new_table;
+	struct l_hashtbl_list_head *list, *head = &h->all_entries;
+	struct l_hashtbl_node *node, **new_table;
 	size_t nbytes;
 	struct l_hashtbl tmp_h;
+	int old_size = h->table_size;
+	struct l_hashtbl_resize_event event;
+	double start = 0.0;
 
 	if (capacity < 1) {
 		capacity = 1;
@@ -414,17 +1566,29 @@ int l_hashtbl_resize(struct l_hashtbl *h, int capacity)
 	if ((tmp_h.table = h->malloc_fn(nbytes)) == NULL)
 		return 1;
 
+	HASHTBL_PROBE3(l_hashtbl, resize__start, h, old_size, capacity);
+
+	if (h->resize_fn != NULL) {
+		event.old_capacity = old_size;
+		event.new_capacity = capacity;
+		event.entries_moved = 0;
+		event.bytes_allocated = nbytes;
+		event.elapsed_usecs = 0.0;
+		h->resize_fn(h, LINKED_HASHTBL_RESIZE_BEGIN, &event, h->resize_client_data);
+		start = now_usecs();
+	}
+
 	memset(tmp_h.table, 0, nbytes);
 	tmp_h.table_size = capacity;
 
 	/* Transfer all entries from old table to new table. */
 
-	for (node = head->next; node != head; node = node->next) {
-		struct l_hashtbl_entry **slot_ref;
-		entry = LIST_ENTRY(node, struct l_hashtbl_entry, list);
-		slot_ref = tbl_entry_ref(&tmp_h, entry->hash);
-		entry->next = *slot_ref;
-		*slot_ref = entry;
+	for (list = head->next; list != head; list = list->next) {
+		struct l_hashtbl_node **slot_ref;
+		node = LIST_ENTRY(list, struct l_hashtbl_node, list);
+		slot_ref = tbl_node_ref(&tmp_h, node->hash);
+		node->next = *slot_ref;
+		*slot_ref = node;
 	}
 
 	if (h->table != NULL)
@@ -433,22 +1597,87 @@ int l_hashtbl_resize(struct l_hashtbl *h, int capacity)
 	h->table_size = capacity;
 	h->resize_threshold = resize_threshold(capacity, h->max_load_factor);
 
+	HASHTBL_PROBE3(l_hashtbl, resize__done, h, old_size, capacity);
+
+	if (h->resize_fn != NULL) {
+		event.entries_moved = h->nentries;
+		event.elapsed_usecs = now_usecs() - start;
+		h->resize_fn(h, LINKED_HASHTBL_RESIZE_END, &event, h->resize_client_data);
+	}
+
 	return 0;
 }
 
+int l_hashtbl_defragment(struct l_hashtbl *h, long budget_usecs)
+{
+	struct l_hashtbl_slab *slab = h->defrag_slab;
+	struct l_hashtbl_list_head *head = &h->all_entries;
+	double deadline = now_usecs() + (double)budget_usecs;
+	unsigned long n = 0;
+
+	if (h->intrusive)
+		return 0;
+
+	if (slab == NULL) {
+		if (h->nentries == 0)
+			return 0;
+		if ((slab = slab_new(h, h->nentries)) == NULL)
+			return -1;
+		h->defrag_slab = slab;
+		h->defrag_pos = head->next;
+	}
+
+	while (h->defrag_pos != head && slab->nused < slab->size) {
+		struct l_hashtbl_node *node;
+		struct l_hashtbl_entry *entry, *copy;
+
+		node = LIST_ENTRY(h->defrag_pos, struct l_hashtbl_node, list);
+		entry = (struct l_hashtbl_entry *)node;
+		h->defrag_pos = node->list.next;
+
+		if (entry_slab(h, entry) == slab)
+			continue;
+
+		copy = move_entry(h, slab, entry);
+		if (h->timed)
+			((struct l_hashtbl_timed_entry *)copy)->loaded_at =
+				((struct l_hashtbl_timed_entry *)entry)->loaded_at;
+		entry_free(h, entry);
+
+		if (budget_usecs > 0 && (++n & 63) == 0 &&
+		    h->defrag_pos != head && now_usecs() >= deadline)
+			return 1;
+	}
+
+	h->defrag_slab = NULL;
+	h->defrag_pos = NULL;
+	if (slab->nlive == 0)
+		slab_free(h, slab);
+
+	return 0;
+}
+
+void l_hashtbl_set_resize_callback(struct l_hashtbl *h,
+				   LINKED_HASHTBL_RESIZE_FN fn,
+				   void *client_data)
+{
+	h->resize_fn = fn;
+	h->resize_client_data = client_data;
+}
+
 unsigned long l_hashtbl_apply(const struct l_hashtbl *h,
 			      LINKED_HASHTBL_APPLY_FN apply,
 			      void *client_data)
 {
 	unsigned long nentries = 0;
-	struct l_hashtbl_list_head *node;
+	struct l_hashtbl_list_head *list;
 	const struct l_hashtbl_list_head *head = &h->all_entries;
 
-	for (node = head->next; node != head; node = node->next) {
-		struct l_hashtbl_entry *entry;
-		entry = LIST_ENTRY(node, struct l_hashtbl_entry, list);
+	for (list = head->next; list != head; list = list->next) {
+		struct l_hashtbl_node *node;
+		node = LIST_ENTRY(list, struct l_hashtbl_node, list);
 		nentries++;
-		if (apply(entry->key, entry->val, client_data) != 1)
+		if (apply(node_key(h, node), node_val(h, node), client_data) != 1)
 			return nentries;
 	}
 
@@ -470,6 +1699,7 @@ void l_hashtbl_iter_init(struct l_hashtbl *h,
 	end = (struct l_hashtbl_list_head **)&iter->end;
 
 	*(int *) &iter->direction = direction;
+	*(const struct l_hashtbl **) &iter->h = h;
 	*pos = (direction >= 1) ? h->all_entries.next : h->all_entries.prev;
 	*end = &h->all_entries;
 	iter->key = iter->val = NULL;
@@ -477,7 +1707,7 @@ void l_hashtbl_iter_init(struct l_hashtbl *h,
 
 int l_hashtbl_iter_next(struct l_hashtbl_iter *iter)
 {
-	struct l_hashtbl_entry *entry;
+	struct l_hashtbl_node *entry;
 	struct l_hashtbl_list_head *node, **node_ref;
 
 	node = (struct l_hashtbl_list_head *)iter->pos;
@@ -491,14 +1721,160 @@ int l_hashtbl_iter_next(struct l_hashtbl_iter *iter)
 	else
 		*node_ref = node->prev;
 
-	entry = LIST_ENTRY(node, struct l_hashtbl_entry, list);
-	iter->key = entry->key;
-	iter->val = entry->val;
+	entry = LIST_ENTRY(node, struct l_hashtbl_node, list);
+	iter->key = (void *)node_key(iter->h, entry);
+	iter->val = node_val(iter->h, entry);
 
 	return 1;
 }
 
+int l_hashtbl_iter_next_n(struct l_hashtbl_iter *iter,
+			  void **keys, void **vals, int n)
+{
+	const struct l_hashtbl_list_head *list = iter->pos;
+	struct l_hashtbl_node *node;
+	int count = 0;
+
+	while (count < n && list != iter->end) {
+		node = LIST_ENTRY(list, struct l_hashtbl_node, list);
+		list = (iter->direction >= 1) ? list->next : list->prev;
+
+		/* Start loading the next node before reading this one. */
+		PREFETCH(list);
+
+		iter->key = (void *)node_key(iter->h, node);
+		iter->val = node_val(iter->h, node);
+		if (keys != NULL)
+			keys[count] = iter->key;
+		if (vals != NULL)
+			vals[count] = iter->val;
+		count++;
+	}
+
+	*(const struct l_hashtbl_list_head **)&iter->pos = list;
+
+	return count;
+}
+
 double l_hashtbl_load_factor(const struct l_hashtbl *h)
 {
 	return (double)h->nentries / (double)h->table_size;
 }
+
+int l_hashtbl_enable_sampling(struct l_hashtbl *h, int capacity, unsigned int rate)
+{
+	struct hashtbl_sampler *s;
+
+	if ((s = hashtbl_sampler_create(capacity, rate,
+					h->malloc_fn, h->free_fn)) == NULL)
+		return 1;
+
+	l_hashtbl_disable_sampling(h);
+	h->sampler = s;
+
+	return 0;
+}
+
+void l_hashtbl_disable_sampling(struct l_hashtbl *h)
+{
+	if (h->sampler != NULL) {
+		hashtbl_sampler_delete(h->sampler);
+		h->sampler = NULL;
+	}
+}
+
+int l_hashtbl_hot_keys(const struct l_hashtbl *h,
+		       struct hashtbl_sample *out,
+		       int n,
+		       int order)
+{
+	if (h->sampler == NULL)
+		return 0;
+
+	return hashtbl_sampler_top(h->sampler, out, n, order);
+}
+
+struct l_hashtbl *l_hashtbl_create_intrusive(int capacity,
+					     double max_load_factor,
+					     int auto_resize,
+					     int access_order,
+					     ptrdiff_t key_offset,
+					     LINKED_HASHTBL_NODE_KEY_FN key_fn,
+					     LINKED_HASHTBL_HASH_FN hash_fn,
+					     LINKED_HASHTBL_EQUALS_FN equals_fn,
+					     LINKED_HASHTBL_NODE_FREE_FN node_free_fn,
+					     LINKED_HASHTBL_MALLOC_FN malloc_fn,
+					     LINKED_HASHTBL_FREE_FN free_fn,
+					     LINKED_HASHTBL_EVICTOR_FN evictor_fn)
+{
+	struct l_hashtbl *h;
+
+	h = l_hashtbl_create(capacity, max_load_factor, auto_resize,
+			     access_order, hash_fn, equals_fn, NULL, NULL,
+			     malloc_fn, free_fn, evictor_fn);
+
+	if (h != NULL) {
+		h->intrusive = 1;
+		h->key_offset = key_offset;
+		h->node_key_fn = key_fn;
+		h->node_free_fn = node_free_fn;
+	}
+
+	return h;
+}
+
+struct l_hashtbl_node *l_hashtbl_insert_node(struct l_hashtbl *h,
+					     struct l_hashtbl_node *node)
+{
+	const void *k = node_key(h, node);
+	unsigned int hv = h->hash_fn(k);
+	struct l_hashtbl_node **slot_ref = tbl_node_ref(h, hv);
+	struct l_hashtbl_node *old = *slot_ref;
+	unsigned int depth = 0;
+
+	node->hash = hv;
+
+	/* Replace an equal key in place, in the chain and the list. */
+
+	while (old != NULL) {
+		depth++;
+		if (old->hash == hv && h->equals_fn(node_key(h, old), k)) {
+			if (old == node)
+				return NULL;	/* already linked */
+			node->next = old->next;
+			*slot_ref = node;
+			node->list = old->list;
+			node->list.prev->next = &node->list;
+			node->list.next->prev = &node->list;
+			node->freq = old->freq;
+			node->small = old->small;
+			if (h->s3_main == &old->list)
+				h->s3_main = &node->list;
+			if (h->defrag_pos == &old->list)
+				h->defrag_pos = &node->list;
+			old->next = NULL;
+			return old;
+		}
+		slot_ref = &old->next;
+		old = old->next;
+	}
+
+	link_new_node(h, node, depth);
+
+	return NULL;
+}
+
+struct l_hashtbl_node *l_hashtbl_lookup_node(struct l_hashtbl *h, const void *k)
+{
+	return lookup_key(h, k);
+}
+
+struct l_hashtbl_node *l_hashtbl_remove_node(struct l_hashtbl *h, const void *k)
+{
+	struct l_hashtbl_node *node = remove_key(h, k);
+
+	if (node != NULL)
+		node->next = NULL;
+
+	return node;
+}
@@ -41,13 +41,15 @@
  * 5. To clear all keys use l_hashtbl_clear().
  * 6. To delete a hash table instance use l_hashtbl_delete().
  * 7. To iterate over all entries use l_hashtbl_iter_init(), l_hashtbl_iter_next().
+ * 8. To load missed keys once across threads use l_hashtbl_get_or_load().
  *
  * Note: neither the keys or the values are copied so their lifetime
  * must match that of the hash table.  NULL keys are not permitted.
  * Inserting, removing or lookup up NULL keys is therefore undefined.
  */
 
-#include <stddef.h>		/* size_t */
+#include <stddef.h>		/* size_t, ptrdiff_t, offsetof */
+#include "hashtbl_sampler.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -55,7 +57,32 @@ extern "C" {
 
 /* Opaque types. */
 struct l_hashtbl;
-struct l_hashtbl_list_head;
+
+/* Links of the list running through all of a table's entries. */
+struct l_hashtbl_list_head {
+	struct l_hashtbl_list_head *next, *prev;
+};
+
+/*
+ * Linkage that an intrusive table (see l_hashtbl_create_intrusive())
+ * threads through the client's own structures.  The fields are
+ * private.
+ */
+struct l_hashtbl_node {
+	struct l_hashtbl_list_head list;	/* all_entries list */
+	struct l_hashtbl_node *next;		/* per slot list */
+	unsigned int hash;			/* hash of key */
+	unsigned char freq;			/* S3-FIFO hits, 0..3 */
+	unsigned char small;			/* in the S3-FIFO small queue */
+};
+
+/* Returns the structure of the given type that embeds a node. */
+#define LINKED_HASHTBL_CONTAINER_OF(NODE, TYPE, MEMBER)			\
+	((TYPE *)(void *)((char *)(NODE) - offsetof(TYPE, MEMBER)))
+
+/* Offset from the node to an embedded key, for l_hashtbl_create_intrusive(). */
+#define LINKED_HASHTBL_KEY_OFFSET(TYPE, NODE_MEMBER, KEY_MEMBER)		\
+	((ptrdiff_t)offsetof(TYPE, KEY_MEMBER) - (ptrdiff_t)offsetof(TYPE, NODE_MEMBER))
 
 /* Hash function. */
 typedef unsigned int (*LINKED_HASHTBL_HASH_FN) (const void *k);
@@ -76,15 +103,65 @@ typedef void (*LINKED_HASHTBL_VAL_FREE_FN) (void *v);
 typedef void *(*LINKED_HASHTBL_MALLOC_FN) (size_t n);
 typedef void (*LINKED_HASHTBL_FREE_FN) (void *ptr);
 
+/* Functions for finding the key of, and releasing, intrusive nodes. */
+typedef const void *(*LINKED_HASHTBL_NODE_KEY_FN) (const struct l_hashtbl_node *node);
+typedef void (*LINKED_HASHTBL_NODE_FREE_FN) (struct l_hashtbl_node *node);
+
+/* Results of l_hashtbl_lookup_status(). */
+#define LINKED_HASHTBL_NOT_CACHED	0
+#define LINKED_HASHTBL_FOUND		1
+#define LINKED_HASHTBL_ABSENT		2	/* known not to exist */
+
+/*
+ * Function that loads k on a miss in l_hashtbl_get_or_load(): it
+ * returns 0 and stores the key (usually a copy of k) and value the
+ * table should own, or returns non-zero if k could not be loaded.
+ * Returning LINKED_HASHTBL_ABSENT instead, with just the key stored,
+ * says that k does not exist; see l_hashtbl_set_negative().
+ */
+typedef int (*LINKED_HASHTBL_LOAD_FN) (const void *k,
+				       void **key,
+				       void **val,
+				       void *client_data);
+
 /* Function for evicting oldest entries. */
 typedef int (*LINKED_HASHTBL_EVICTOR_FN) (const struct l_hashtbl * h,
 					  unsigned long count);
 
+/*
+ * Value of access_order for S3-FIFO eviction (see l_hashtbl_create()).
+ */
+#define LINKED_HASHTBL_S3FIFO		2
+
+/* Resize phases reported to the resize function. */
+#define LINKED_HASHTBL_RESIZE_BEGIN	0
+#define LINKED_HASHTBL_RESIZE_END	1
+
+/*
+ * Describes a resize.  For LINKED_HASHTBL_RESIZE_BEGIN only the capacities and
+ * bytes_allocated are valid; entries_moved and elapsed_usecs are
+ * filled in for LINKED_HASHTBL_RESIZE_END.
+ */
+struct l_hashtbl_resize_event {
+	int old_capacity;
+	int new_capacity;
+	unsigned long entries_moved;
+	size_t bytes_allocated;		/* size of the new slot array */
+	double elapsed_usecs;
+};
+
+/* Function called before and after each resize. */
+typedef void (*LINKED_HASHTBL_RESIZE_FN) (const struct l_hashtbl *h,
+					  int phase,
+					  const struct l_hashtbl_resize_event *event,
+					  void *client_data);
+
 struct l_hashtbl_iter {
   void *key;
   void *val;
   /* The remaining fields are private: don't modify them. */
   const int direction;
+  const struct l_hashtbl *const h;
   const struct l_hashtbl_list_head *const pos;
   const struct l_hashtbl_list_head *const end;
 };
@@ -95,7 +172,9 @@ struct l_hashtbl_iter {
  * @param initial_capacity - initial size of the table
  * @param max_load_factor  - before resizing (0.0 uses a default value)
  * @param auto_resize	   - if true, table grows (pow2) as new keys are added
- * @param access_order	   - if true, iteration order is most recently accessed
+ * @param access_order	   - if true, iteration order is most recently accessed;
+ *			     LINKED_HASHTBL_S3FIFO instead keeps the order
+ *			     and changes which entry is evicted (below)
  * @param hash_func	   - function that computes a hash value from a key
  * @param equals_func	   - function that checks keys for equality
  * @param key_free_func	   - function to delete keys
@@ -105,6 +184,19 @@ struct l_hashtbl_iter {
  * @param evictor_func	   - function to evict entries as new keys are added
  *
  * Returns non-null if the table was created successfully.
+ *
+ * With LINKED_HASHTBL_S3FIFO, new keys enter a small FIFO queue and
+ * a hit only bumps a counter in the entry; nothing is moved on the
+ * lookup path.  When the evictor asks for an eviction, the small
+ * queue (kept to about 10% of the entries) gives up its oldest entry
+ * unless it was hit more than once, in which case it moves to the
+ * main FIFO queue instead.  The main queue's oldest entry is evicted
+ * unless it was hit since it was last considered, in which case it
+ * goes back to the head of the queue.  The hashes of keys evicted
+ * from the small queue are remembered in a ghost FIFO about the size
+ * of the main queue, and such keys go straight to the main queue if
+ * they come back.  Iteration runs over the small queue, newest first,
+ * and then the main queue.
  */
 struct l_hashtbl *l_hashtbl_create(int initial_capacity,
 				   double max_load_factor,
@@ -153,6 +245,28 @@ void l_hashtbl_clear(struct l_hashtbl *h);
  */
 int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v);
 
+/*
+ * Inserts n keys with their values, as n calls to l_hashtbl_insert()
+ * would (including any evictions), but hashes and prefetches them a
+ * chunk at a time and, for larger batches, allocates the new entries
+ * as one block.  A table that never evicts is grown at most once, up
+ * front.
+ *
+ * Returns the number of keys inserted or replaced.  If that is less
+ * than n, memory ran out and the keys from that index on (and their
+ * values) still belong to the caller.
+ */
+int l_hashtbl_insert_batch(struct l_hashtbl *h, void **keys, void **vals,
+			   int n);
+
+/*
+ * Removes n keys, as n calls to l_hashtbl_remove() would, hashing and
+ * prefetching them a chunk at a time.
+ *
+ * Returns the number of keys that were found and removed.
+ */
+int l_hashtbl_remove_batch(struct l_hashtbl *h, void *const *keys, int n);
+
 /*
  * Lookup an existing key.
  *
@@ -163,6 +277,138 @@ int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v);
  */
 void *l_hashtbl_lookup(struct l_hashtbl *h, const void *k);
 
+/*
+ * Lookup a key, telling a key known not to exist (see
+ * l_hashtbl_set_negative()) from one that is not cached.
+ *
+ * @param h   - hash table instance
+ * @param k   - the search key
+ * @param val - if non-NULL, set to the value, or NULL if not found
+ *
+ * Returns LINKED_HASHTBL_FOUND, LINKED_HASHTBL_ABSENT or
+ * LINKED_HASHTBL_NOT_CACHED.
+ */
+int l_hashtbl_lookup_status(struct l_hashtbl *h, const void *k, void **val);
+
+/*
+ * Looks up k and, if it is absent, loads it with loader and inserts
+ * the key and value that loader returns.  Safe to call from many
+ * threads at once: only the first caller to miss on a key runs
+ * loader, and the others wait for it and share its result.  The
+ * loader runs without the table locked, so loads of different keys
+ * proceed in parallel, but it must not use the table itself.  If
+ * loader fails, the callers waiting on it get NULL and nothing is
+ * cached, so the next miss tries again.
+ *
+ * Other calls may only be made while loads are in flight if they
+ * are bracketed with l_hashtbl_lock() and l_hashtbl_unlock().  As
+ * with any lookup, the value returned is not protected once the call
+ * returns: if other threads may remove, replace or evict k, the
+ * caller must arrange for the value to stay valid (e.g., by
+ * reference counting it).  With refresh ahead the table's own
+ * workers replace and free values, so this applies even if no other
+ * thread uses the table; see l_hashtbl_set_expiry().
+ *
+ * @param h           - hash table instance (not intrusive)
+ * @param k           - the search key, which the caller keeps
+ * @param loader      - function to load k on a miss
+ * @param client_data - arbitrary user data passed to loader
+ *
+ * Returns the value of k, or NULL if it could not be loaded.
+ */
+void *l_hashtbl_get_or_load(struct l_hashtbl *h, const void *k,
+			    LINKED_HASHTBL_LOAD_FN loader, void *client_data);
+
+/*
+ * Gives values a lifetime, counted from when they were inserted or
+ * loaded (entries already in the table count from now).
+ *
+ * Entries only record their load time once a lifetime has been set.
+ * The first call that sets one copies the existing entries into a
+ * single block of larger entries, ending any l_hashtbl_defragment()
+ * pass, and every later entry is that larger size too.
+ *
+ * A lookup of a key older than expire_usecs misses, and the entry is
+ * removed.  Expired entries are only removed when they are looked up
+ * and until then still count towards l_hashtbl_count().
+ *
+ * Once a key is older than refresh_usecs, l_hashtbl_get_or_load()
+ * still returns its value at once but also queues one refresh of it
+ * on a pool of nthreads workers, which run the caller's loader and
+ * replace the value if it succeeds.  A failed refresh keeps the old
+ * value, and the next l_hashtbl_get_or_load() tries again.  A key
+ * that expires or is removed while being refreshed gets the refreshed
+ * value only if callers are waiting for it.  Plain lookups never
+ * trigger refreshes.
+ *
+ * A refresh frees the value it replaces with val_free_fn, on the
+ * worker thread and at any time, possibly just after
+ * l_hashtbl_get_or_load() has returned that value to a caller.  A
+ * table with refresh ahead and a val_free_fn must therefore not free
+ * values outright: val_free_fn should defer the free until no caller
+ * can still be using the value (e.g., to a point where the callers
+ * are quiescent).  A reference count that callers take once the call
+ * has returned is not enough, as by then the value may be gone.
+ *
+ * @param h             - hash table instance (not intrusive)
+ * @param expire_usecs  - hard lifetime, or 0 for none
+ * @param refresh_usecs - soft lifetime (less than expire_usecs), or 0
+ *                        for no refresh ahead
+ * @param nthreads      - number of refresh workers
+ *
+ * The client_data given to l_hashtbl_get_or_load() must stay valid
+ * until its refreshes have run.  The lifetimes cannot be changed once
+ * workers have been started; l_hashtbl_delete() stops them.
+ *
+ * Returns 0 on success, or 1 if the table is intrusive, the arguments
+ * are invalid, the entries could not be copied or the workers could
+ * not be started.
+ */
+int l_hashtbl_set_expiry(struct l_hashtbl *h, long expire_usecs,
+			 long refresh_usecs, int nthreads);
+
+/*
+ * Caches keys known not to exist, so that repeated lookups of them
+ * need not go to the backing store.  Absent keys are kept apart from
+ * the table's entries: up to capacity of them, the eldest dropped
+ * first, each for expire_usecs (0 for no limit).  They never evict
+ * or count as entries.
+ *
+ * l_hashtbl_get_or_load() returns NULL for an absent key without
+ * calling the loader, and marks the key absent when the loader (or a
+ * refresh) returns LINKED_HASHTBL_ABSENT.  Inserting a key clears its
+ * mark.  Calling this again keeps the keys already marked, restarting
+ * their lifetimes.
+ *
+ * @param h            - hash table instance (not intrusive)
+ * @param capacity     - maximum number of absent keys, or 0 to stop
+ *                       caching them
+ * @param expire_usecs - lifetime of an absent key, or 0 for none
+ *
+ * Returns 0 on success, or 1 if the table is intrusive or no memory
+ * could be allocated.
+ */
+int l_hashtbl_set_negative(struct l_hashtbl *h, unsigned long capacity,
+			   long expire_usecs);
+
+/*
+ * Marks k as known not to exist, removing any entry for it.  The
+ * table owns k from then on, even if k was already marked.
+ *
+ * Returns 0 if k was marked, or 1 if negative caching is not enabled
+ * (k still belongs to the caller).
+ */
+int l_hashtbl_insert_absent(struct l_hashtbl *h, void *k);
+
+/*
+ * Lock and unlock the table against l_hashtbl_get_or_load() running
+ * in other threads.  The lock is not recursive and no other call
+ * takes it, so l_hashtbl_get_or_load() must not be called with it
+ * held.
+ */
+void l_hashtbl_lock(struct l_hashtbl *h);
+void l_hashtbl_unlock(struct l_hashtbl *h);
+
 /*
  * Returns the number of entries in the table.
  *
@@ -211,6 +457,37 @@ double l_hashtbl_load_factor(const struct l_hashtbl *h);
  */
 int l_hashtbl_resize(struct l_hashtbl *h, int new_capacity);
 
+/*
+ * Relocates the entries into one new block of memory, in iteration
+ * order, so that walking the list (and the chains) touches adjacent
+ * memory again after a long run of inserts and removes.  The memory
+ * of the old entries is released as they are moved.
+ *
+ * With a positive budget_usecs the work stops once that much time
+ * has passed and continues from the same entry on the next call;
+ * the table can be used as normal between calls.  Keys inserted or
+ * accessed (with access order) after a pass began may be left in
+ * place, and l_hashtbl_clear() abandons it.  Iterators are
+ * invalidated.  Intrusive tables have nothing to relocate.
+ *
+ * Returns 0 when the pass is complete, 1 if the budget ran out with
+ * more left to do, or -1 if no memory could be allocated.
+ */
+int l_hashtbl_defragment(struct l_hashtbl *h, long budget_usecs);
+
+/*
+ * Registers a function to be called before and after every resize,
+ * including those triggered by l_hashtbl_insert().  Neither phase
+ * is reported if the new slot array cannot be allocated.
+ *
+ * @param h  - hash table instance
+ * @param fn - resize function, or NULL to remove it
+ * @param client_data - arbitrary user data passed to fn
+ */
+void l_hashtbl_set_resize_callback(struct l_hashtbl *h,
+				   LINKED_HASHTBL_RESIZE_FN fn,
+				   void *client_data);
+
 /*
  * Initialize an iterator.
  *
@@ -230,6 +507,119 @@ void l_hashtbl_iter_init(struct l_hashtbl *h,
  */
 int l_hashtbl_iter_next(struct l_hashtbl_iter *iter);
 
+/*
+ * Advances the iterator by up to n entries at once, storing their
+ * keys and values in keys[] and vals[] (either may be NULL).  Each
+ * node is prefetched as soon as its address is known, so the loads
+ * for a block of entries overlap; after l_hashtbl_defragment() the
+ * list is in memory order and the walk becomes sequential.  Can be
+ * mixed with l_hashtbl_iter_next(); the iterator's key and value are
+ * those of the last entry returned.
+ *
+ * Returns the number of entries stored, which is 0 once there are no
+ * more entries.
+ */
+int l_hashtbl_iter_next_n(struct l_hashtbl_iter *iter,
+			  void **keys, void **vals, int n);
+
+/*
+ * Starts sampling the keys passed to l_hashtbl_lookup() in a top-k
+ * sketch (see hashtbl_sampler.h).  Any previous samples are
+ * discarded.
+ *
+ * While sampling is enabled every lookup updates the sampler, so
+ * threads that look up keys in a shared table must serialize their
+ * lookups even if the table is in insertion order.
+ *
+ * @param h	   - hash table instance
+ * @param capacity - number of distinct hashes to track
+ * @param rate	   - sample one in every rate lookups
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int l_hashtbl_enable_sampling(struct l_hashtbl *h, int capacity, unsigned int rate);
+
+/*
+ * Stops sampling and discards the samples.
+ */
+void l_hashtbl_disable_sampling(struct l_hashtbl *h);
+
+/*
+ * Reports the sampled keys.
+ *
+ * @param h	- hash table instance
+ * @param out	- array of at least n samples
+ * @param n	- maximum number of samples to return
+ * @param order - HASHTBL_SAMPLE_BY_COUNT for the hottest keys, or
+ *		  HASHTBL_SAMPLE_BY_DEPTH for the deepest chains
+ *
+ * Returns the number of samples copied, or 0 if sampling is disabled.
+ */
+int l_hashtbl_hot_keys(const struct l_hashtbl *h,
+		       struct hashtbl_sample *out,
+		       int n,
+		       int order);
+
+/*
+ * Creates an intrusive hash table.  Instead of allocating an entry
+ * per key, the table links the l_hashtbl_node that clients embed in
+ * their own structures, so inserting never allocates (except to
+ * grow the slot array) and a lookup lands directly on the object.
+ *
+ * The key of a node is found with key_fn if non-null, otherwise it
+ * is the address key_offset bytes from the node (see
+ * LINKED_HASHTBL_KEY_OFFSET()); equals_fun and hash_fun receive that
+ * address.
+ *
+ * @param node_free_func - called on the nodes dropped by
+ *			   l_hashtbl_remove(), eviction,
+ *			   l_hashtbl_clear() and l_hashtbl_delete()
+ *			   (NULL just unlinks them)
+ *
+ * The remaining parameters are as for l_hashtbl_create().
+ *
+ * Entries are added with l_hashtbl_insert_node(); l_hashtbl_insert()
+ * fails on an intrusive table.  Everywhere else the value of an
+ * entry is its node: l_hashtbl_lookup(), l_hashtbl_apply() and the
+ * iterators return the node as the value.
+ *
+ * Returns non-null if the table was created successfully.
+ */
+struct l_hashtbl *l_hashtbl_create_intrusive(int initial_capacity,
+					     double max_load_factor,
+					     int auto_resize,
+					     int access_order,
+					     ptrdiff_t key_offset,
+					     LINKED_HASHTBL_NODE_KEY_FN key_fn,
+					     LINKED_HASHTBL_HASH_FN hash_fun,
+					     LINKED_HASHTBL_EQUALS_FN equals_fun,
+					     LINKED_HASHTBL_NODE_FREE_FN node_free_func,
+					     LINKED_HASHTBL_MALLOC_FN malloc_func,
+					     LINKED_HASHTBL_FREE_FN free_func,
+					     LINKED_HASHTBL_EVICTOR_FN evictor_func);
+
+/*
+ * Links a node into an intrusive table.  A node already in the table
+ * with an equal key is unlinked and returned (without calling the
+ * node free function), and the new node takes its place in the
+ * iteration order; otherwise returns NULL.  Inserting a node that is
+ * already linked does nothing and returns NULL.
+ */
+struct l_hashtbl_node *l_hashtbl_insert_node(struct l_hashtbl *h,
+					     struct l_hashtbl_node *node);
+
+/*
+ * Returns the node for k in an intrusive table, or NULL if not found.
+ * Counts as an access for access ordered tables.
+ */
+struct l_hashtbl_node *l_hashtbl_lookup_node(struct l_hashtbl *h, const void *k);
+
+/*
+ * Unlinks and returns the node for k from an intrusive table, without
+ * calling the node free function.  Returns NULL if not found.
+ */
+struct l_hashtbl_node *l_hashtbl_remove_node(struct l_hashtbl *h, const void *k);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,136 @@
+#ifndef LINKED_HASHTBL_PRIVATE_H
+#define LINKED_HASHTBL_PRIVATE_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * The l_hashtbl representation, shared between linked_hashtbl.c and
+ * modules that manage a table's entries (hashtbl_reclaim.c).  Not
+ * part of the public API.
+ */
+
+#include <stddef.h>		/* ptrdiff_t */
+#include <pthread.h>
+#include "linked_hashtbl.h"
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/*
+ * Takes over releasing a removed entry and its key and value.  mem
+ * is the entry's memory, which the function may reuse until it is
+ * released with the table's free_fn.
+ */
+typedef void (*LINKED_HASHTBL_RECLAIM_FN) (void *mem, void *key, void *val,
+					   void *client_data);
+
+struct l_hashtbl {
+	struct l_hashtbl_list_head	  all_entries;
+	double				  max_load_factor;
+	LINKED_HASHTBL_HASH_FN		  hash_fn;
+	LINKED_HASHTBL_EQUALS_FN	  equals_fn;
+	unsigned long			  nentries;
+	int				  table_size;
+	int				  resize_threshold;
+	int				  auto_resize;
+	int				  access_order;
+	LINKED_HASHTBL_KEY_FREE_FN	  key_free_fn;
+	LINKED_HASHTBL_VAL_FREE_FN	  val_free_fn;
+	LINKED_HASHTBL_MALLOC_FN	  malloc_fn;
+	LINKED_HASHTBL_FREE_FN		  free_fn;
+	LINKED_HASHTBL_EVICTOR_FN	  evictor_fn;
+	LINKED_HASHTBL_RESIZE_FN	  resize_fn;
+	void				 *resize_client_data;
+	struct hashtbl_sampler		 *sampler;
+	int				  intrusive;
+	ptrdiff_t			  key_offset;
+	LINKED_HASHTBL_NODE_KEY_FN	  node_key_fn;
+	LINKED_HASHTBL_NODE_FREE_FN	  node_free_fn;
+	struct l_hashtbl_slab		**slabs;	/* by address */
+	int				  nslabs;
+	int				  slabs_size;
+	struct l_hashtbl_slab		 *defrag_slab;	/* being filled, or NULL */
+	struct l_hashtbl_slab		 *batch_slab;	/* likewise, by a batch */
+	struct l_hashtbl_list_head	 *defrag_pos;	/* next node to relocate */
+	LINKED_HASHTBL_RECLAIM_FN	  reclaim_fn;	/* see hashtbl_reclaim.h */
+	void				 *reclaim_client_data;
+	pthread_mutex_t			  lock;		/* see l_hashtbl_lock() */
+	struct l_hashtbl_load		 *loads;	/* in flight */
+	double				  expire_usecs;	/* see l_hashtbl_set_expiry() */
+	double				  refresh_usecs;
+	int				  timed;	/* entries are stamped */
+	int				  nrefreshing;	/* refreshes in loads */
+	struct l_hashtbl_load		 *refresh_head;	/* waiting for a worker */
+	struct l_hashtbl_load		**refresh_tail;
+	pthread_cond_t			  refresh_cond;
+	pthread_t			 *workers;
+	int				  nworkers;
+	int				  stopping;
+	struct l_hashtbl_list_head	 *s3_main;	/* head of the main queue */
+	unsigned long			  s3_nsmall;
+	struct l_hashtbl_ghost		 *s3_ghost;	/* by hash, or NULL */
+	unsigned int			  s3_ghost_mask;
+	unsigned int			  s3_ghost_seq;
+	struct l_hashtbl		 *absent;	/* keys known not to exist */
+	unsigned long			  max_entries;	/* of an absent table */
+	struct l_hashtbl_node		**table;
+};
+
+/* An entry of a table that isn't intrusive. */
+struct l_hashtbl_entry {
+	struct l_hashtbl_node		 node;	/* must be first */
+	void				*key;
+	void				*val;
+};
+
+/*
+ * An entry of a table that has ever had expiry or refresh ahead
+ * enabled, which also records when its value was loaded.
+ */
+struct l_hashtbl_timed_entry {
+	struct l_hashtbl_entry		 entry;	/* must be first */
+	double				 loaded_at;	/* usecs */
+};
+
+/*
+ * A block of entries relocated by l_hashtbl_defragment() or
+ * allocated by l_hashtbl_insert_batch().  Its entries are released
+ * one by one but the memory is only freed once all of them have gone.
+ */
+struct l_hashtbl_slab {
+	unsigned long			 nlive;	/* entries not yet released */
+	unsigned long			 nused;
+	unsigned long			 size;
+	size_t				 stride;	/* bytes per entry */
+	struct l_hashtbl_entry		 entries[1];
+};
+
+#endif	/* LINKED_HASHTBL_PRIVATE_H */
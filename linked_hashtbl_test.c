@@ -30,6 +30,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 #include "CUnitTest.h"
 #include "hashtbl_funcs.h"
 #include "linked_hashtbl.h"
@@ -1307,6 +1310,1145 @@ static int test25(void)
 	return 0;
 }
 
+/* Test resize notifications. */
+
+struct test26_stats {
+	int nbegin;
+	int nend;
+	int last_old;
+	int last_new;
+	unsigned long moved;
+};
+
+static void test26_resize_fn(const struct l_hashtbl *h,
+			     int phase,
+			     const struct l_hashtbl_resize_event *ev,
+			     void *client_data)
+{
+	struct test26_stats *stats = client_data;
+
+	UNUSED_PARAMETER(h);
+
+	if (phase == LINKED_HASHTBL_RESIZE_BEGIN) {
+		stats->nbegin++;
+	} else {
+		stats->nend++;
+		stats->moved += ev->entries_moved;
+	}
+	stats->last_old = ev->old_capacity;
+	stats->last_new = ev->new_capacity;
+}
+
+static int test26(void)
+{
+	int i, keys[16];
+	struct test26_stats stats;
+	struct l_hashtbl *h;
+
+	memset(&stats, 0, sizeof(stats));
+
+	h = l_hashtbl_create(4, 1.0, 1, 0,
+			     hashtbl_int_hash, hashtbl_int_equals,
+			     NULL, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	l_hashtbl_set_resize_callback(h, test26_resize_fn, &stats);
+
+	/* l_hashtbl resizes once the threshold is reached. */
+	for (i = 0; i < 4; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, &keys[i], &keys[i]));
+	}
+	CUT_ASSERT_EQUAL(1, stats.nbegin);
+	CUT_ASSERT_EQUAL(1, stats.nend);
+	CUT_ASSERT_EQUAL(4, stats.last_old);
+	CUT_ASSERT_EQUAL(8, stats.last_new);
+	CUT_ASSERT_EQUAL(4, stats.moved);
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_resize(h, 64));
+	CUT_ASSERT_EQUAL(2, stats.nend);
+	CUT_ASSERT_EQUAL(64, stats.last_new);
+	CUT_ASSERT_EQUAL(8, stats.moved);
+
+	l_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test hot key sampling. */
+
+static int test27(void)
+{
+	int i, keys[8], missing = 100;
+	struct hashtbl_sample top[8];
+	struct l_hashtbl *h;
+
+	/* A single slot so that every key shares one chain. */
+	h = l_hashtbl_create(1, LINKED_HASHTBL_MAX_LOAD_FACTOR, 0, 1,
+			     hashtbl_int_hash, hashtbl_int_equals,
+			     NULL, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 8; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, &keys[i], &keys[i]));
+	}
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_enable_sampling(h, 8, 1));
+
+	for (i = 0; i < 50; i++)
+		CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &keys[5]));
+	for (i = 0; i < 5; i++)
+		CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &keys[0]));
+	CUT_ASSERT_NULL(l_hashtbl_lookup(h, &missing));
+
+	CUT_ASSERT_EQUAL(3, l_hashtbl_hot_keys(h, top, 8, HASHTBL_SAMPLE_BY_COUNT));
+	CUT_ASSERT_EQUAL(5, top[0].hash);
+	CUT_ASSERT_EQUAL(50, top[0].count);
+	CUT_ASSERT_EQUAL(3, top[0].max_depth);
+	CUT_ASSERT_EQUAL(0, top[1].hash);
+	CUT_ASSERT_EQUAL(100, top[2].hash);
+
+	/* A miss walks the whole chain, as does the oldest key. */
+	CUT_ASSERT_EQUAL(2, l_hashtbl_hot_keys(h, top, 2, HASHTBL_SAMPLE_BY_DEPTH));
+	CUT_ASSERT_EQUAL(0, top[0].hash);
+	CUT_ASSERT_EQUAL(8, top[0].max_depth);
+	CUT_ASSERT_EQUAL(100, top[1].hash);
+	CUT_ASSERT_EQUAL(8, top[1].max_depth);
+
+	l_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test intrusive tables. */
+
+struct intrusive_obj {
+	struct l_hashtbl_node node;
+	int id;
+	int released;
+};
+
+static void intrusive_release(struct l_hashtbl_node *node)
+{
+	LINKED_HASHTBL_CONTAINER_OF(node, struct intrusive_obj, node)->released++;
+}
+
+static unsigned long intrusive_capacity;
+
+static int intrusive_evictor(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > intrusive_capacity;
+}
+
+static int test28(void)
+{
+	int i, k;
+	struct intrusive_obj objs[100], dup;
+	struct l_hashtbl_iter iter;
+	struct l_hashtbl *h;
+
+	intrusive_capacity = 50;
+	h = l_hashtbl_create_intrusive(4, 0.75f, 1, 1,
+				       LINKED_HASHTBL_KEY_OFFSET(struct intrusive_obj, node, id),
+				       NULL, hashtbl_int_hash, hashtbl_int_equals,
+				       intrusive_release, NULL, NULL,
+				       intrusive_evictor);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 100; i++) {
+		objs[i].id = i;
+		objs[i].released = 0;
+		CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &objs[i].node));
+	}
+
+	/* The eldest 50 were evicted through the release function. */
+	CUT_ASSERT_EQUAL(50, l_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(1, l_hashtbl_insert(h, &i, &i));
+	for (i = 0; i < 100; i++) {
+		CUT_ASSERT_EQUAL((i < 50 ? 1 : 0), objs[i].released);
+		if (i < 50)
+			CUT_ASSERT_NULL(l_hashtbl_lookup_node(h, &i));
+	}
+
+	/* Touch 50 so that it becomes the most recently used... */
+	k = 50;
+	CUT_ASSERT_EQUAL(&objs[50].node, l_hashtbl_lookup_node(h, &k));
+
+	/* ...then replace 60, which keeps its place in the order. */
+	dup.id = 60;
+	dup.released = 0;
+	CUT_ASSERT_EQUAL(&objs[60].node, l_hashtbl_insert_node(h, &dup.node));
+	CUT_ASSERT_EQUAL(&dup.node, l_hashtbl_lookup(h, &dup.id));
+	CUT_ASSERT_EQUAL(0, objs[60].released);
+
+	l_hashtbl_iter_init(h, &iter, -1);
+	CUT_ASSERT_TRUE(l_hashtbl_iter_next(&iter));
+	CUT_ASSERT_EQUAL(51, *(const int *)iter.key);
+	l_hashtbl_iter_init(h, &iter, 1);
+	CUT_ASSERT_TRUE(l_hashtbl_iter_next(&iter));
+	CUT_ASSERT_EQUAL(&dup.node, iter.val);
+	CUT_ASSERT_TRUE(l_hashtbl_iter_next(&iter));
+	CUT_ASSERT_EQUAL(&objs[50].node, iter.val);
+
+	k = 51;
+	CUT_ASSERT_EQUAL(&objs[51].node, l_hashtbl_remove_node(h, &k));
+	CUT_ASSERT_EQUAL(0, objs[51].released);
+	CUT_ASSERT_EQUAL(49, l_hashtbl_count(h));
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(1, dup.released);
+	for (i = 52; i < 100; i++)
+		CUT_ASSERT_EQUAL((i == 60 ? 0 : 1), objs[i].released);
+
+	return 0;
+}
+
+static int test29_nallocs;
+
+static void *test29_malloc(size_t n)
+{
+	test29_nallocs++;
+	return malloc(n);
+}
+
+static void test29_free(void *p)
+{
+	test29_nallocs--;
+	free(p);
+}
+
+static int *test29_int(int x)
+{
+	int *p = malloc(sizeof(int));
+	assert(p != NULL);
+	*p = x;
+	return p;
+}
+
+/* Test defragmenting keeps the order, with access order and churn. */
+
+static int test29(void)
+{
+	int i, rc, expected;
+	struct l_hashtbl_iter iter;
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 1,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, free,
+					       test29_malloc, test29_free, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_defragment(h, 0));
+
+	for (i = 0; i < 2000; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	for (i = 0; i < 2000; i += 2)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_remove(h, &i));
+
+	CUT_ASSERT_EQUAL(1002, test29_nallocs);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_defragment(h, 0));
+	CUT_ASSERT_EQUAL(4, test29_nallocs);	/* and the slab and its index */
+
+	/* Newest first, as before. */
+	expected = 1999;
+	l_hashtbl_iter_init(h, &iter, 1);
+	while (l_hashtbl_iter_next(&iter)) {
+		CUT_ASSERT_EQUAL(expected, *(int *)iter.key);
+		CUT_ASSERT_EQUAL(expected, *(int *)iter.val);
+		expected -= 2;
+	}
+	CUT_ASSERT_EQUAL(-1, expected);
+
+	/* Incrementally, while lookups move entries to the head and
+	 * removes take the entry the pass is due to move next. */
+	for (i = 0; i < 2000; i += 2)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	i = 0;
+	while ((rc = l_hashtbl_defragment(h, 1)) == 1) {
+		int j = 1 + 2 * (i++ % 1000);
+		CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &j));
+		j = 2 * (i % 1000);
+		l_hashtbl_remove(h, &j);
+	}
+	CUT_ASSERT_EQUAL(0, rc);
+
+	for (i = 1; i < 2000; i += 2)
+		CUT_ASSERT_EQUAL(i, *(int *)l_hashtbl_lookup(h, &i));
+
+	CUT_ASSERT_TRUE(l_hashtbl_defragment(h, 1) >= 0);
+	l_hashtbl_clear(h);
+	CUT_ASSERT_EQUAL(2, test29_nallocs);
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+	return 0;
+}
+
+/* Test batched iteration matches single steps in both directions. */
+
+static int test30(void)
+{
+	int i, j, n, direction, total;
+	static int keys[1000];
+	void *k[7], *v[7];
+	struct l_hashtbl_iter iter, iter2;
+	struct l_hashtbl *h = l_hashtbl_create(ht_size, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 0,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       NULL, NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 1000; i++) {
+		keys[i] = i;
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, &keys[i], &keys[i]));
+	}
+
+	for (direction = -1; direction <= 1; direction += 2) {
+		total = 0;
+		l_hashtbl_iter_init(h, &iter, direction);
+		l_hashtbl_iter_init(h, &iter2, direction);
+		while ((n = l_hashtbl_iter_next_n(&iter, k, v, 7)) > 0) {
+			for (j = 0; j < n; j++) {
+				CUT_ASSERT_EQUAL(1, l_hashtbl_iter_next(&iter2));
+				CUT_ASSERT_EQUAL(iter2.key, k[j]);
+				CUT_ASSERT_EQUAL(iter2.val, v[j]);
+			}
+			CUT_ASSERT_EQUAL(k[n - 1], iter.key);
+			total += n;
+		}
+		CUT_ASSERT_EQUAL(0, l_hashtbl_iter_next(&iter2));
+		CUT_ASSERT_EQUAL(1000, total);
+	}
+
+	/* Oldest first in reverse. */
+	l_hashtbl_iter_init(h, &iter, -1);
+	CUT_ASSERT_EQUAL(7, l_hashtbl_iter_next_n(&iter, k, NULL, 7));
+	CUT_ASSERT_EQUAL(0, *(int *)k[0]);
+	CUT_ASSERT_EQUAL(1, l_hashtbl_iter_next(&iter));
+	CUT_ASSERT_EQUAL(7, *(int *)iter.key);
+
+	l_hashtbl_delete(h);
+	return 0;
+}
+
+static int test31_keep_10(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return count > 10;
+}
+
+static int test31_keep_none(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	UNUSED_PARAMETER(count);
+	return 1;
+}
+
+/* Test batched insert and remove, with and without eviction. */
+
+static int test31(void)
+{
+	int i, capacity;
+	static int ints[100];
+	void *keys[100], *vals[100];
+	struct l_hashtbl_iter iter;
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 0,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, free,
+					       test29_malloc, test29_free, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 100; i++) {
+		keys[i] = test29_int(i);
+		vals[i] = test29_int(i);
+	}
+	CUT_ASSERT_EQUAL(100, l_hashtbl_insert_batch(h, keys, vals, 100));
+	CUT_ASSERT_EQUAL(100, l_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(4, test29_nallocs);	/* table, slots, slab, index */
+	capacity = l_hashtbl_capacity(h);
+
+	/* Replacing keeps the insertion order. */
+	for (i = 0; i < 20; i++) {
+		keys[i] = test29_int(90 + i);
+		vals[i] = test29_int(-(90 + i));
+	}
+	CUT_ASSERT_EQUAL(20, l_hashtbl_insert_batch(h, keys, vals, 20));
+	for (i = 0; i < 10; i++)
+		free(keys[i]);
+	CUT_ASSERT_EQUAL(110, l_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(capacity, l_hashtbl_capacity(h));
+
+	l_hashtbl_iter_init(h, &iter, -1);
+	for (i = 0; i < 110; i++) {
+		CUT_ASSERT_EQUAL(1, l_hashtbl_iter_next(&iter));
+		CUT_ASSERT_EQUAL(i, *(int *)iter.key);
+		CUT_ASSERT_EQUAL((i < 90 ? i : -i), *(int *)iter.val);
+	}
+	CUT_ASSERT_EQUAL(0, l_hashtbl_iter_next(&iter));
+
+	for (i = 0; i < 100; i++) {
+		ints[i] = i * 2;
+		keys[i] = &ints[i];
+	}
+	CUT_ASSERT_EQUAL(55, l_hashtbl_remove_batch(h, keys, 100));
+	CUT_ASSERT_EQUAL(55, l_hashtbl_count(h));
+	for (i = 0; i < 100; i++)
+		ints[i] = i * 2 + 1;
+	CUT_ASSERT_EQUAL(55, l_hashtbl_remove_batch(h, keys, 100));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(2, test29_nallocs);
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	/* A bounded table evicts as it goes, eldest first. */
+	h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR, 1, 0,
+			     hashtbl_int_hash, hashtbl_int_equals,
+			     free, free,
+			     test29_malloc, test29_free, test31_keep_10);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 30; i++) {
+		keys[i] = test29_int(i);
+		vals[i] = test29_int(i);
+	}
+	CUT_ASSERT_EQUAL(30, l_hashtbl_insert_batch(h, keys, vals, 30));
+	CUT_ASSERT_EQUAL(10, l_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(16, l_hashtbl_capacity(h));
+	CUT_ASSERT_EQUAL(12, test29_nallocs);	/* no slab held by survivors */
+
+	l_hashtbl_iter_init(h, &iter, -1);
+	for (i = 20; i < 30; i++) {
+		CUT_ASSERT_EQUAL(1, l_hashtbl_iter_next(&iter));
+		CUT_ASSERT_EQUAL(i, *(int *)iter.key);
+	}
+	CUT_ASSERT_EQUAL(0, l_hashtbl_iter_next(&iter));
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	/* Every entry can go before the batch ends. */
+	h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR, 1, 0,
+			     hashtbl_int_hash, hashtbl_int_equals,
+			     free, free,
+			     test29_malloc, test29_free, test31_keep_none);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 30; i++) {
+		keys[i] = test29_int(i);
+		vals[i] = test29_int(i);
+	}
+	CUT_ASSERT_EQUAL(30, l_hashtbl_insert_batch(h, keys, vals, 30));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(2, test29_nallocs);
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	return 0;
+}
+
+#define TEST32_NTHREADS		8
+
+struct test32_loader {
+	pthread_mutex_t lock;
+	int nloads;
+	int fail;
+};
+
+static int test32_load(const void *k, void **key, void **val, void *client_data)
+{
+	struct test32_loader *loader = client_data;
+	struct timespec ts = { 0, 10 * 1000 * 1000 };
+	int fail;
+
+	pthread_mutex_lock(&loader->lock);
+	loader->nloads++;
+	fail = loader->fail;
+	pthread_mutex_unlock(&loader->lock);
+
+	/* Slow enough for the other threads to miss on k too. */
+	nanosleep(&ts, NULL);
+
+	if (fail)
+		return 1;
+
+	*key = test29_int(*(const int *)k);
+	*val = test29_int(-*(const int *)k);
+	return 0;
+}
+
+struct test32_worker {
+	pthread_t tid;
+	struct l_hashtbl *h;
+	struct test32_loader *loader;
+	void *val;
+};
+
+static void *test32_get(void *arg)
+{
+	struct test32_worker *w = arg;
+	int k = 42;
+
+	w->val = l_hashtbl_get_or_load(w->h, &k, test32_load, w->loader);
+	return NULL;
+}
+
+/* Test that concurrent misses on a key share one load. */
+
+static int test32(void)
+{
+	int i, k = 7;
+	struct test32_loader loader;
+	struct test32_worker workers[TEST32_NTHREADS];
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 0,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, free,
+					       test29_malloc, test29_free, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, pthread_mutex_init(&loader.lock, NULL));
+	loader.nloads = 0;
+
+	/* A failed load is not cached. */
+	loader.fail = 1;
+	CUT_ASSERT_NULL(l_hashtbl_get_or_load(h, &k, test32_load, &loader));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+	loader.fail = 0;
+	CUT_ASSERT_EQUAL(-7, *(int *)l_hashtbl_get_or_load(h, &k, test32_load, &loader));
+	CUT_ASSERT_EQUAL(2, loader.nloads);
+	CUT_ASSERT_EQUAL(-7, *(int *)l_hashtbl_get_or_load(h, &k, test32_load, &loader));
+	CUT_ASSERT_EQUAL(2, loader.nloads);
+	CUT_ASSERT_EQUAL(1, l_hashtbl_count(h));
+
+	for (i = 0; i < TEST32_NTHREADS; i++) {
+		workers[i].h = h;
+		workers[i].loader = &loader;
+		CUT_ASSERT_EQUAL(0, pthread_create(&workers[i].tid, NULL,
+						   test32_get, &workers[i]));
+	}
+
+	for (i = 0; i < TEST32_NTHREADS; i++)
+		CUT_ASSERT_EQUAL(0, pthread_join(workers[i].tid, NULL));
+
+	CUT_ASSERT_EQUAL(3, loader.nloads);
+	CUT_ASSERT_EQUAL(2, l_hashtbl_count(h));
+	k = 42;
+	for (i = 0; i < TEST32_NTHREADS; i++) {
+		CUT_ASSERT_NOT_NULL(workers[i].val);
+		CUT_ASSERT_EQUAL(l_hashtbl_lookup(h, &k), workers[i].val);
+	}
+
+	/* Other calls are made under the table lock. */
+	l_hashtbl_lock(h);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_remove(h, &k));
+	l_hashtbl_unlock(h);
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+	pthread_mutex_destroy(&loader.lock);
+
+	return 0;
+}
+
+static int test33_load(const void *k, void **key, void **val, void *client_data)
+{
+	struct test32_loader *loader = client_data;
+	struct timespec ts = { 0, 10 * 1000 * 1000 };
+	int n, fail;
+
+	pthread_mutex_lock(&loader->lock);
+	n = ++loader->nloads;
+	fail = loader->fail;
+	pthread_mutex_unlock(&loader->lock);
+	nanosleep(&ts, NULL);
+
+	if (fail)
+		return 1;
+
+	*key = test29_int(*(const int *)k);
+	*val = test29_int(n);
+	return 0;
+}
+
+/*
+ * Values the table has freed, kept until test33_drain() so that a
+ * value replaced by a refresh stays readable by the caller it was
+ * just returned to.
+ */
+static pthread_mutex_t test33_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *test33_retired[16];
+static int test33_nretired;
+
+static void test33_retire(void *val)
+{
+	pthread_mutex_lock(&test33_retired_lock);
+	assert(test33_nretired < (int)(sizeof(test33_retired) / sizeof(test33_retired[0])));
+	test33_retired[test33_nretired++] = val;
+	pthread_mutex_unlock(&test33_retired_lock);
+}
+
+/* Free the retired values; returns how many there were. */
+
+static int test33_drain(void)
+{
+	int n;
+
+	pthread_mutex_lock(&test33_retired_lock);
+	for (n = 0; n < test33_nretired; n++)
+		free(test33_retired[n]);
+	test33_nretired = 0;
+	pthread_mutex_unlock(&test33_retired_lock);
+	return n;
+}
+
+static int test33_nloads(struct test32_loader *loader)
+{
+	int n;
+
+	pthread_mutex_lock(&loader->lock);
+	n = loader->nloads;
+	pthread_mutex_unlock(&loader->lock);
+	return n;
+}
+
+static int test33_lookup(struct l_hashtbl *h, int k)
+{
+	int *v;
+
+	l_hashtbl_lock(h);
+	v = l_hashtbl_lookup(h, &k);
+	l_hashtbl_unlock(h);
+	return (v != NULL) ? *v : 0;
+}
+
+static void test33_sleep(long usecs)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = (usecs % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Test expiry and refresh ahead.  A refresh frees the value it
+ * replaces on a worker thread, even one just returned here, so the
+ * table's values are retired and only freed by test33_drain().
+ */
+
+static int test33(void)
+{
+	int i, k = 1;
+	struct test32_loader loader;
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 0,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, test33_retire,
+					       test29_malloc, test29_free, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, pthread_mutex_init(&loader.lock, NULL));
+	loader.nloads = 0;
+	loader.fail = 0;
+
+	CUT_ASSERT_EQUAL(1, l_hashtbl_set_expiry(h, 0, 50000, 0));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_expiry(h, 10 * 1000000, 50000, 2));
+	CUT_ASSERT_EQUAL(1, l_hashtbl_set_expiry(h, 10 * 1000000, 50000, 2));
+
+	CUT_ASSERT_EQUAL(1, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	CUT_ASSERT_EQUAL(1, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	CUT_ASSERT_EQUAL(1, test33_nloads(&loader));
+
+	/* Past the soft deadline the stale value comes back at once. */
+	test33_sleep(60000);
+	CUT_ASSERT_EQUAL(1, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	for (i = 0; i < 1000 && test33_lookup(h, k) == 1; i++)
+		test33_sleep(1000);
+	CUT_ASSERT_EQUAL(2, test33_lookup(h, k));
+	CUT_ASSERT_EQUAL(2, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	CUT_ASSERT_EQUAL(2, test33_nloads(&loader));
+	CUT_ASSERT_EQUAL(1, test33_drain());	/* the refresh freed 1 */
+
+	/* A failed refresh keeps the stale value. */
+	loader.fail = 1;
+	test33_sleep(60000);
+	CUT_ASSERT_EQUAL(2, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	for (i = 0; i < 1000 && test33_nloads(&loader) == 2; i++)
+		test33_sleep(1000);
+	CUT_ASSERT_EQUAL(3, test33_nloads(&loader));
+	CUT_ASSERT_EQUAL(2, test33_lookup(h, k));
+	CUT_ASSERT_EQUAL(1, l_hashtbl_count(h));
+
+	/* A key removed while refreshing is not brought back. */
+	loader.fail = 0;
+	test33_sleep(60000);
+	CUT_ASSERT_EQUAL(2, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	l_hashtbl_lock(h);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_remove(h, &k));
+	l_hashtbl_unlock(h);
+	for (i = 0; i < 1000 && test33_nloads(&loader) == 3; i++)
+		test33_sleep(1000);
+	test33_sleep(20000);
+	CUT_ASSERT_EQUAL(0, test33_lookup(h, k));
+
+	/* Refreshes not yet run are dropped. */
+	CUT_ASSERT_EQUAL(5, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	test33_sleep(60000);
+	CUT_ASSERT_EQUAL(5, *(int *)l_hashtbl_get_or_load(h, &k, test33_load, &loader));
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+	CUT_ASSERT_TRUE(test33_drain() > 0);
+
+	/* Hard expiry, without refresh. */
+	h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR, 1, 0,
+			     hashtbl_int_hash, hashtbl_int_equals,
+			     free, NULL,
+			     test29_malloc, test29_free, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(k), (void *)-1));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_expiry(h, 50000, 0, 0));
+	CUT_ASSERT_EQUAL(-1, (intptr_t)l_hashtbl_lookup(h, &k));
+	test33_sleep(60000);
+	CUT_ASSERT_NULL(l_hashtbl_lookup(h, &k));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+
+	/* Keys inserted later count from then. */
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(k), (void *)-2));
+	CUT_ASSERT_EQUAL(-2, (intptr_t)l_hashtbl_lookup(h, &k));
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+	pthread_mutex_destroy(&loader.lock);
+
+	return 0;
+}
+
+static int test34_load(const void *k, void **key, void **val, void *client_data)
+{
+	struct test32_loader *loader = client_data;
+
+	loader->nloads++;
+	*key = test29_int(*(const int *)k);
+	if (*(const int *)k % 2 == 1)
+		return LINKED_HASHTBL_ABSENT;
+	*val = test29_int(-*(const int *)k);
+	return 0;
+}
+
+/* Test caching keys known not to exist. */
+
+static int test34(void)
+{
+	int k;
+	void *v;
+	struct test32_loader loader;
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 0,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, free,
+					       test29_malloc, test29_free, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+	loader.nloads = 0;
+
+	k = 1;
+	CUT_ASSERT_EQUAL(1, l_hashtbl_insert_absent(h, &k));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_negative(h, 2, 50000));
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_NOT_CACHED, l_hashtbl_lookup_status(h, &k, NULL));
+
+	/* Absent keys have their own budget and don't count as entries. */
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(1)));
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_ABSENT, l_hashtbl_lookup_status(h, &k, &v));
+	CUT_ASSERT_NULL(v);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(2)));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(3)));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(3)));
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_NOT_CACHED, l_hashtbl_lookup_status(h, &k, NULL));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+
+	/* Inserting a key clears its mark, and marking removes the entry. */
+	k = 2;
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(2), test29_int(-2)));
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_FOUND, l_hashtbl_lookup_status(h, &k, &v));
+	CUT_ASSERT_EQUAL(-2, *(int *)v);
+	k = 3;
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_ABSENT, l_hashtbl_lookup_status(h, &k, NULL));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(2)));
+	k = 2;
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_ABSENT, l_hashtbl_lookup_status(h, &k, NULL));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+
+	/* Absent keys are not loaded, and loaders can report them. */
+	CUT_ASSERT_NULL(l_hashtbl_get_or_load(h, &k, test34_load, &loader));
+	CUT_ASSERT_EQUAL(0, loader.nloads);
+	k = 5;
+	CUT_ASSERT_NULL(l_hashtbl_get_or_load(h, &k, test34_load, &loader));
+	CUT_ASSERT_NULL(l_hashtbl_get_or_load(h, &k, test34_load, &loader));
+	CUT_ASSERT_EQUAL(1, loader.nloads);
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_ABSENT, l_hashtbl_lookup_status(h, &k, NULL));
+	k = 4;
+	CUT_ASSERT_EQUAL(-4, *(int *)l_hashtbl_get_or_load(h, &k, test34_load, &loader));
+	CUT_ASSERT_EQUAL(2, loader.nloads);
+
+	/* Absent keys expire on their own clock. */
+	test33_sleep(60000);
+	k = 5;
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_NOT_CACHED, l_hashtbl_lookup_status(h, &k, NULL));
+	k = 4;
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_FOUND, l_hashtbl_lookup_status(h, &k, NULL));
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(7)));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_negative(h, 0, 0));
+	k = 7;
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_NOT_CACHED, l_hashtbl_lookup_status(h, &k, NULL));
+	CUT_ASSERT_EQUAL(1, l_hashtbl_insert_absent(h, &k));
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_negative(h, 10, 0));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert_absent(h, test29_int(7)));
+
+	/* Keys marked before expiry was enabled start their clock then. */
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_negative(h, 10, 50000));
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_ABSENT, l_hashtbl_lookup_status(h, &k, NULL));
+	test33_sleep(60000);
+	CUT_ASSERT_EQUAL(LINKED_HASHTBL_NOT_CACHED, l_hashtbl_lookup_status(h, &k, NULL));
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	return 0;
+}
+
+static int test35_order(struct l_hashtbl *h, int *keys)
+{
+	struct l_hashtbl_iter iter;
+	int n = 0;
+
+	l_hashtbl_iter_init(h, &iter, 1);
+	while (l_hashtbl_iter_next(&iter))
+		keys[n++] = *(int *)iter.key;
+	return n;
+}
+
+/* Test S3-FIFO eviction. */
+
+static int test35(void)
+{
+	int i, k, order[16], order2[16];
+	static const int expected[] = { 19, 18, 17, 16, 14, 4, 3, 2, 1, 0 };
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, LINKED_HASHTBL_S3FIFO,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, free,
+					       test29_malloc, test29_free,
+					       test31_keep_10);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+
+	/* Hits bump a counter and move nothing. */
+	CUT_ASSERT_EQUAL(10, test35_order(h, order));
+	for (k = 0; k < 5; k++) {
+		CUT_ASSERT_EQUAL(k, *(int *)l_hashtbl_lookup(h, &k));
+		CUT_ASSERT_EQUAL(k, *(int *)l_hashtbl_lookup(h, &k));
+	}
+	CUT_ASSERT_EQUAL(10, test35_order(h, order2));
+	CUT_ASSERT_EQUAL(0, memcmp(order, order2, 10 * sizeof(order[0])));
+
+	/* Keys hit twice move to the main queue; the others go. */
+	for (i = 10; i < 20; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	CUT_ASSERT_EQUAL(10, l_hashtbl_count(h));
+	for (k = 0; k < 20; k++) {
+		if (k < 5 || k >= 15)
+			CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &k));
+		else
+			CUT_ASSERT_NULL(l_hashtbl_lookup(h, &k));
+	}
+
+	/* A key back from the ghost FIFO goes to the main queue. */
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(14), test29_int(14)));
+	CUT_ASSERT_EQUAL(10, test35_order(h, order));
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(expected[i], order[i]);
+
+	/* A scan of new keys only churns the small queue. */
+	for (i = 20; i < 40; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	CUT_ASSERT_EQUAL(10, test35_order(h, order));
+	for (i = 0; i < 6; i++)
+		CUT_ASSERT_EQUAL(expected[i + 4], order[i + 4]);
+
+	/*
+	 * Fill the main queue: all ten keys are promoted and its oldest,
+	 * not hit since, is evicted.  Then, with the small queue below
+	 * its share, main entries hit since get another round.
+	 */
+	l_hashtbl_clear(h);
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	for (k = 0; k < 10; k++) {
+		CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &k));
+		CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &k));
+	}
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(10), test29_int(10)));
+	k = 0;
+	CUT_ASSERT_NULL(l_hashtbl_lookup(h, &k));
+	for (k = 1; k <= 2; k++)
+		CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &k));
+	k = 10;
+	CUT_ASSERT_EQUAL(0, l_hashtbl_remove(h, &k));
+	for (i = 11; i <= 12; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	k = 11;
+	CUT_ASSERT_NULL(l_hashtbl_lookup(h, &k));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(11), test29_int(11)));
+	for (k = 1; k <= 12; k++) {
+		if (k == 3 || k == 10)
+			CUT_ASSERT_NULL(l_hashtbl_lookup(h, &k));
+		else
+			CUT_ASSERT_NOT_NULL(l_hashtbl_lookup(h, &k));
+	}
+
+	/* Removing entries keeps the queues intact. */
+	for (k = 0; k < 40; k++)
+		(void)l_hashtbl_remove(h, &k);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+	for (i = 0; i < 30; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(i)));
+	CUT_ASSERT_EQUAL(10, test35_order(h, order));
+	CUT_ASSERT_EQUAL(29, order[0]);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_defragment(h, 0));
+	l_hashtbl_clear(h);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(1), test29_int(1)));
+	CUT_ASSERT_EQUAL(1, l_hashtbl_count(h));
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	return 0;
+}
+
+static struct intrusive_obj *test36_obj(int id)
+{
+	struct intrusive_obj *obj = malloc(sizeof(*obj));
+
+	assert(obj != NULL);
+	/* The table must not trust the node's contents. */
+	memset(obj, 0xff, sizeof(*obj));
+	obj->id = id;
+	obj->released = 0;
+	return obj;
+}
+
+static void test36_release(struct l_hashtbl_node *node)
+{
+	free(LINKED_HASHTBL_CONTAINER_OF(node, struct intrusive_obj, node));
+}
+
+static void test36_hit(struct l_hashtbl *h, int k)
+{
+	assert(l_hashtbl_lookup_node(h, &k) != NULL);
+	assert(l_hashtbl_lookup_node(h, &k) != NULL);
+}
+
+/* Test replacing the nodes of an intrusive S3-FIFO table. */
+
+static int test36(void)
+{
+	int i, k;
+	struct l_hashtbl_node *old;
+	struct l_hashtbl *h;
+
+	intrusive_capacity = 4;
+	h = l_hashtbl_create_intrusive(8, LINKED_HASHTBL_MAX_LOAD_FACTOR, 1,
+				       LINKED_HASHTBL_S3FIFO,
+				       LINKED_HASHTBL_KEY_OFFSET(struct intrusive_obj, node, id),
+				       NULL, hashtbl_int_hash, hashtbl_int_equals,
+				       test36_release, NULL, NULL,
+				       intrusive_evictor);
+	CUT_ASSERT_NOT_NULL(h);
+
+	/* 1, 2 and 3 in the main queue, with 3 at its head; 4 small. */
+	for (i = 0; i < 4; i++) {
+		CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &test36_obj(i)->node));
+		test36_hit(h, i);
+	}
+	CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &test36_obj(4)->node));
+	k = 0;
+	CUT_ASSERT_NULL(l_hashtbl_lookup_node(h, &k));
+
+	/* Replace both queue heads and release the old nodes. */
+	for (k = 3; k <= 4; k++) {
+		old = l_hashtbl_insert_node(h, &test36_obj(k)->node);
+		CUT_ASSERT_NOT_NULL(old);
+		test36_release(old);
+	}
+	CUT_ASSERT_EQUAL(4, l_hashtbl_count(h));
+
+	/* The replaced small entry is still the first to go... */
+	CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &test36_obj(5)->node));
+	k = 4;
+	CUT_ASSERT_NULL(l_hashtbl_lookup_node(h, &k));
+
+	/* ...and the replaced main entry goes after 1 and 2. */
+	for (i = 6; i < 9; i++) {
+		test36_hit(h, i - 1);
+		CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &test36_obj(i)->node));
+	}
+	for (k = 0; k < 9; k++) {
+		if (k <= 4)
+			CUT_ASSERT_NULL(l_hashtbl_lookup_node(h, &k));
+		else
+			CUT_ASSERT_NOT_NULL(l_hashtbl_lookup_node(h, &k));
+	}
+
+	/* Emptying the table leaves no small entries counted. */
+	for (k = 5; k < 9; k++)
+		test36_release(l_hashtbl_remove_node(h, &k));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_count(h));
+	for (i = 10; i < 15; i++)
+		CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &test36_obj(i)->node));
+	k = 10;
+	CUT_ASSERT_NULL(l_hashtbl_lookup_node(h, &k));
+	CUT_ASSERT_EQUAL(4, l_hashtbl_count(h));
+
+	l_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test inserting a node that is already linked is a no-op. */
+
+static unsigned int test37_hash(const void *k)
+{
+	UNUSED_PARAMETER(k);
+	return 7;
+}
+
+static int test37(void)
+{
+	int i;
+	struct intrusive_obj objs[8];
+	struct l_hashtbl_iter iter;
+	struct l_hashtbl *h;
+
+	h = l_hashtbl_create_intrusive(4, 0.75f, 0, 0,
+				       LINKED_HASHTBL_KEY_OFFSET(struct intrusive_obj, node, id),
+				       NULL, test37_hash, hashtbl_int_equals,
+				       intrusive_release, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 8; i++) {
+		objs[i].id = i;
+		objs[i].released = 0;
+		CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &objs[i].node));
+	}
+
+	/* The head, middle and tail of the one chain. */
+	CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &objs[7].node));
+	CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &objs[3].node));
+	CUT_ASSERT_NULL(l_hashtbl_insert_node(h, &objs[0].node));
+
+	CUT_ASSERT_EQUAL(8, l_hashtbl_count(h));
+	for (i = 0; i < 8; i++)
+		CUT_ASSERT_EQUAL(&objs[i].node, l_hashtbl_lookup_node(h, &i));
+
+	/* Nor does it move the node in the order (newest first). */
+	i = 0;
+	l_hashtbl_iter_init(h, &iter, 1);
+	while (l_hashtbl_iter_next(&iter)) {
+		CUT_ASSERT_EQUAL(7 - i, *(const int *)iter.key);
+		i++;
+	}
+	CUT_ASSERT_EQUAL(8, i);
+
+	l_hashtbl_delete(h);
+	for (i = 0; i < 8; i++)
+		CUT_ASSERT_EQUAL(1, objs[i].released);
+
+	return 0;
+}
+
+/* Test entries only carry a load stamp once expiry is enabled. */
+
+static size_t test38_last;
+
+static void *test38_malloc(size_t n)
+{
+	test38_last = n;
+	return test29_malloc(n);
+}
+
+static int test38(void)
+{
+	int i;
+	size_t untimed;
+	void *keys[64], *vals[64];
+	struct l_hashtbl_iter iter;
+	struct l_hashtbl *h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR,
+					       1, 0,
+					       hashtbl_int_hash, hashtbl_int_equals,
+					       free, free,
+					       test38_malloc, test29_free, NULL);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	/* Half in a batch slab, half allocated one by one. */
+	for (i = 0; i < 64; i++) {
+		keys[i] = test29_int(i);
+		vals[i] = test29_int(-i);
+	}
+	CUT_ASSERT_EQUAL(64, l_hashtbl_insert_batch(h, keys, vals, 64));
+	for (i = 64; i < 128; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(i), test29_int(-i)));
+	untimed = test38_last;
+	for (i = 0; i < 128; i += 3)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_remove(h, &i));
+
+	/* Likely leaving a defragment pass part done. */
+	CUT_ASSERT_TRUE(l_hashtbl_defragment(h, 1) >= 0);
+
+	/* Enabling expiry moves every entry, keeping the order. */
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_expiry(h, 50000, 0, 0));
+	CUT_ASSERT_EQUAL(85, l_hashtbl_count(h));
+	i = 127;
+	l_hashtbl_iter_init(h, &iter, 1);
+	while (l_hashtbl_iter_next(&iter)) {
+		if (i % 3 == 0)
+			i--;
+		CUT_ASSERT_EQUAL(i, *(const int *)iter.key);
+		i--;
+	}
+	CUT_ASSERT_EQUAL(0, i);
+	for (i = 0; i < 128; i++) {
+		if (i % 3 == 0)
+			CUT_ASSERT_NULL(l_hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_EQUAL(-i, *(int *)l_hashtbl_lookup(h, &i));
+	}
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(200), test29_int(-200)));
+	CUT_ASSERT_TRUE(test38_last > untimed);
+
+	/* Turning expiry off again keeps the stamps. */
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_expiry(h, 0, 0, 0));
+	CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, test29_int(201), test29_int(-201)));
+	CUT_ASSERT_TRUE(test38_last > untimed);
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_set_expiry(h, 50000, 0, 0));
+	test33_sleep(60000);
+	i = 1;
+	CUT_ASSERT_NULL(l_hashtbl_lookup(h, &i));
+	i = 200;
+	CUT_ASSERT_NULL(l_hashtbl_lookup(h, &i));
+
+	l_hashtbl_delete(h);
+	CUT_ASSERT_EQUAL(0, test29_nallocs);
+
+	return 0;
+}
 
 CUT_BEGIN_TEST_HARNESS
 CUT_RUN_TEST(test1);
@@ -1334,4 +2476,17 @@ CUT_RUN_TEST(test22);
 CUT_RUN_TEST(test23);
 CUT_RUN_TEST(test24);
 CUT_RUN_TEST(test25);
+CUT_RUN_TEST(test26);
+CUT_RUN_TEST(test27);
+CUT_RUN_TEST(test28);
+CUT_RUN_TEST(test29);
+CUT_RUN_TEST(test30);
+CUT_RUN_TEST(test31);
+CUT_RUN_TEST(test32);
+CUT_RUN_TEST(test33);
+CUT_RUN_TEST(test34);
+CUT_RUN_TEST(test35);
+CUT_RUN_TEST(test36);
+CUT_RUN_TEST(test37);
+CUT_RUN_TEST(test38);
 CUT_END_TEST_HARNESS
@@ -0,0 +1,379 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A hash table sharded over 2^k hashtbl instances.
+ *
+ * The shard is taken from the top bits of hash * 2654435761 (Knuth's
+ * multiplicative hash), so even identity hashes of small integers are
+ * spread across shards, and the choice doesn't correlate with the
+ * low bits the shards use to pick a slot.
+ *
+ * Bulk operations hand shards out to worker threads from a shared
+ * atomic cursor; the calling thread is one of the workers.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdint.h>		/* uintptr_t */
+#include <pthread.h>
+#include <stdatomic.h>
+#include "sharded_hashtbl.h"
+
+#define CACHE_LINE_SIZE		64
+#define MAX_SHARD_BITS		16
+
+/*
+ * Each shard is padded to two cache lines.  Whatever the alignment
+ * of the array, no two shard locks then share a line.
+ */
+union shard {
+	struct {
+		pthread_mutex_t lock;
+		struct hashtbl *h;
+	} s;
+	char pad[2 * CACHE_LINE_SIZE];
+};
+
+struct sharded_hashtbl {
+	int shard_bits;
+	int nshards;
+	HASHTBL_HASH_FN hash_fn;
+	HASHTBL_FREE_FN free_fn;
+	union shard *shards;
+};
+
+static unsigned int direct_hash(const void *k)
+{
+	/* As hashtbl's default, magic numbers from Java 1.4. */
+	unsigned int h = (unsigned int)(uintptr_t) k;
+	h ^= (h >> 20) ^ (h >> 12);
+	return h ^ (h >> 7) ^ (h >> 4);
+}
+
+static union shard *shard_for(struct sharded_hashtbl *s, const void *k)
+{
+	unsigned int hv = s->hash_fn(k) * 2654435761U;
+
+	if (s->shard_bits == 0)
+		return &s->shards[0];
+
+	return &s->shards[hv >> (32 - s->shard_bits)];
+}
+
+struct sharded_hashtbl *sharded_hashtbl_create(int shard_bits,
+					       int initial_capacity,
+					       double max_load_factor,
+					       HASHTBL_HASH_FN hash_fn,
+					       HASHTBL_EQUALS_FN equals_fn,
+					       HASHTBL_KEY_FREE_FN key_free_fn,
+					       HASHTBL_VAL_FREE_FN val_free_fn,
+					       HASHTBL_MALLOC_FN malloc_fn,
+					       HASHTBL_FREE_FN free_fn)
+{
+	struct sharded_hashtbl *s;
+	int i;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	/* The shards must agree with us on the hash so we can route. */
+	hash_fn = (hash_fn != NULL) ? hash_fn : direct_hash;
+
+	if (shard_bits < 0) {
+		shard_bits = 0;
+	} else if (shard_bits > MAX_SHARD_BITS) {
+		shard_bits = MAX_SHARD_BITS;
+	}
+
+	if ((s = malloc_fn(sizeof(*s))) == NULL)
+		return NULL;
+
+	s->shard_bits = shard_bits;
+	s->nshards = 0;
+	s->hash_fn = hash_fn;
+	s->free_fn = free_fn;
+
+	s->shards = malloc_fn(((size_t) 1 << shard_bits) * sizeof(*s->shards));
+	if (s->shards == NULL) {
+		free_fn(s);
+		return NULL;
+	}
+
+	for (i = 0; i < (1 << shard_bits); i++) {
+		union shard *shard = &s->shards[i];
+		shard->s.h = hashtbl_create(initial_capacity, max_load_factor, 1,
+					    hash_fn, equals_fn,
+					    key_free_fn, val_free_fn,
+					    malloc_fn, free_fn);
+		if (shard->s.h == NULL) {
+			sharded_hashtbl_delete(s);
+			return NULL;
+		}
+		pthread_mutex_init(&shard->s.lock, NULL);
+		s->nshards++;
+	}
+
+	return s;
+}
+
+void sharded_hashtbl_delete(struct sharded_hashtbl *s)
+{
+	int i;
+
+	for (i = 0; i < s->nshards; i++) {
+		hashtbl_delete(s->shards[i].s.h);
+		pthread_mutex_destroy(&s->shards[i].s.lock);
+	}
+
+	s->free_fn(s->shards);
+	s->free_fn(s);
+}
+
+int sharded_hashtbl_insert(struct sharded_hashtbl *s, void *k, void *v)
+{
+	union shard *shard = shard_for(s, k);
+	int rc;
+
+	pthread_mutex_lock(&shard->s.lock);
+	rc = hashtbl_insert(shard->s.h, k, v);
+	pthread_mutex_unlock(&shard->s.lock);
+
+	return rc;
+}
+
+void *sharded_hashtbl_lookup(struct sharded_hashtbl *s, const void *k)
+{
+	union shard *shard = shard_for(s, k);
+	void *v;
+
+	pthread_mutex_lock(&shard->s.lock);
+	v = hashtbl_lookup(shard->s.h, k);
+	pthread_mutex_unlock(&shard->s.lock);
+
+	return v;
+}
+
+int sharded_hashtbl_remove(struct sharded_hashtbl *s, const void *k)
+{
+	union shard *shard = shard_for(s, k);
+	int rc;
+
+	pthread_mutex_lock(&shard->s.lock);
+	rc = hashtbl_remove(shard->s.h, k);
+	pthread_mutex_unlock(&shard->s.lock);
+
+	return rc;
+}
+
+int sharded_hashtbl_cas(struct sharded_hashtbl *s, const void *k,
+			void *expected, void *desired)
+{
+	union shard *shard = shard_for(s, k);
+	int rc;
+
+	pthread_mutex_lock(&shard->s.lock);
+	rc = hashtbl_cas(shard->s.h, k, expected, desired);
+	pthread_mutex_unlock(&shard->s.lock);
+
+	return rc;
+}
+
+int sharded_hashtbl_replace_if(struct sharded_hashtbl *s, const void *k,
+			       void *v, HASHTBL_APPLY_FN pred,
+			       const void *client_data)
+{
+	union shard *shard = shard_for(s, k);
+	int rc;
+
+	pthread_mutex_lock(&shard->s.lock);
+	rc = hashtbl_replace_if(shard->s.h, k, v, pred, client_data);
+	pthread_mutex_unlock(&shard->s.lock);
+
+	return rc;
+}
+
+int sharded_hashtbl_compute(struct sharded_hashtbl *s, void *k,
+			    HASHTBL_COMPUTE_FN fn, void *client_data)
+{
+	union shard *shard = shard_for(s, k);
+	int rc;
+
+	pthread_mutex_lock(&shard->s.lock);
+	rc = hashtbl_compute(shard->s.h, k, fn, client_data);
+	pthread_mutex_unlock(&shard->s.lock);
+
+	return rc;
+}
+
+unsigned long sharded_hashtbl_count(struct sharded_hashtbl *s)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = 0; i < s->nshards; i++) {
+		pthread_mutex_lock(&s->shards[i].s.lock);
+		n += hashtbl_count(s->shards[i].s.h);
+		pthread_mutex_unlock(&s->shards[i].s.lock);
+	}
+
+	return n;
+}
+
+int sharded_hashtbl_nshards(const struct sharded_hashtbl *s)
+{
+	return s->nshards;
+}
+
+/* Bulk operations. */
+
+struct bulk_op {
+	struct sharded_hashtbl *s;
+	atomic_int next_shard;
+	atomic_int stop;
+	atomic_ulong nentries;
+	HASHTBL_APPLY_FN apply_fn;
+	void *client_data;
+};
+
+/* Per-thread view of a bulk operation. */
+struct bulk_worker {
+	struct bulk_op *op;
+	int skipped;
+};
+
+static int bulk_apply_fn(const void *k, const void *v, const void *p)
+{
+	struct bulk_worker *w = (struct bulk_worker *)p;
+	struct bulk_op *op = w->op;
+
+	/*
+	 * Another thread has stopped the enumeration.  hashtbl_apply()
+	 * still counts this entry, so note that it was skipped.
+	 */
+	if (atomic_load_explicit(&op->stop, memory_order_relaxed)) {
+		w->skipped = 1;
+		return 0;
+	}
+
+	if (!op->apply_fn(k, v, op->client_data)) {
+		atomic_store_explicit(&op->stop, 1, memory_order_relaxed);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void *bulk_worker(void *arg)
+{
+	struct bulk_worker w;
+	unsigned long n;
+	int i;
+
+	w.op = arg;
+
+	while ((i = atomic_fetch_add(&w.op->next_shard, 1)) < w.op->s->nshards) {
+		union shard *shard = &w.op->s->shards[i];
+
+		if (atomic_load_explicit(&w.op->stop, memory_order_relaxed))
+			break;
+
+		pthread_mutex_lock(&shard->s.lock);
+		if (w.op->apply_fn != NULL) {
+			w.skipped = 0;
+			n = hashtbl_apply(shard->s.h, bulk_apply_fn, &w);
+			atomic_fetch_add(&w.op->nentries, n - (unsigned long) w.skipped);
+		} else {
+			hashtbl_clear(shard->s.h);
+		}
+		pthread_mutex_unlock(&shard->s.lock);
+	}
+
+	return NULL;
+}
+
+static void run_bulk(struct bulk_op *op, int nthreads)
+{
+	pthread_t *threads = NULL;
+	int i, nstarted = 0;
+
+	if (nthreads > op->s->nshards)
+		nthreads = op->s->nshards;
+
+	if (nthreads > 1)
+		threads = malloc((size_t) (nthreads - 1) * sizeof(*threads));
+
+	/* If threads can't be had the caller does all the work. */
+
+	if (threads != NULL) {
+		for (i = 0; i < nthreads - 1; i++) {
+			if (pthread_create(&threads[i], NULL, bulk_worker, op) != 0)
+				break;
+			nstarted++;
+		}
+	}
+
+	bulk_worker(op);
+
+	for (i = 0; i < nstarted; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
+
+unsigned long sharded_hashtbl_apply(struct sharded_hashtbl *s,
+				    HASHTBL_APPLY_FN fn,
+				    void *client_data,
+				    int nthreads)
+{
+	struct bulk_op op;
+
+	op.s = s;
+	atomic_init(&op.next_shard, 0);
+	atomic_init(&op.stop, 0);
+	atomic_init(&op.nentries, 0);
+	op.apply_fn = fn;
+	op.client_data = client_data;
+
+	run_bulk(&op, nthreads);
+
+	return atomic_load(&op.nentries);
+}
+
+void sharded_hashtbl_clear(struct sharded_hashtbl *s, int nthreads)
+{
+	struct bulk_op op;
+
+	op.s = s;
+	atomic_init(&op.next_shard, 0);
+	atomic_init(&op.stop, 0);
+	atomic_init(&op.nentries, 0);
+	op.apply_fn = NULL;
+	op.client_data = NULL;
+
+	run_bulk(&op, nthreads);
+}
@@ -0,0 +1,147 @@
+#ifndef SHARDED_HASHTBL_H
+#define SHARDED_HASHTBL_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A thread-safe hash table made of 2^k independently locked hashtbl
+ * shards.
+ *
+ * SYNOPSIS
+ *
+ * 1. A sharded table is created with sharded_hashtbl_create().
+ * 2. To insert an entry use sharded_hashtbl_insert().
+ * 3. To lookup a key use sharded_hashtbl_lookup().
+ * 4. To remove a key use sharded_hashtbl_remove().
+ * 5. To apply a function to all entries use sharded_hashtbl_apply().
+ * 6. To clear all keys use sharded_hashtbl_clear().
+ * 7. To delete a sharded table use sharded_hashtbl_delete().
+ *
+ * Keys are routed on the high bits of their (remixed) hash, which
+ * are independent of the low bits each shard indexes its slots on.
+ * Every shard has its own lock on its own cache line, so operations
+ * on different shards never contend and a resize only stalls the
+ * 1/2^k of the keys in the shard being resized.
+ *
+ * Values returned by sharded_hashtbl_lookup() are not protected once
+ * the call returns: if another thread may remove or replace the key
+ * concurrently, the caller must arrange for the value to stay valid
+ * (e.g., by reference counting it).
+ */
+
+#include "hashtbl.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct sharded_hashtbl;
+
+/*
+ * Creates a new sharded hash table.
+ *
+ * @param shard_bits	   - the table has 2^shard_bits shards (0..16)
+ * @param initial_capacity - initial size of each shard
+ *
+ * The remaining parameters are as for hashtbl_create(); shards
+ * always resize automatically.
+ *
+ * Returns non-null if the table was created successfully.
+ */
+struct sharded_hashtbl *sharded_hashtbl_create(int shard_bits,
+					       int initial_capacity,
+					       double max_load_factor,
+					       HASHTBL_HASH_FN hash_fun,
+					       HASHTBL_EQUALS_FN equals_fun,
+					       HASHTBL_KEY_FREE_FN key_free_func,
+					       HASHTBL_VAL_FREE_FN val_free_func,
+					       HASHTBL_MALLOC_FN malloc_func,
+					       HASHTBL_FREE_FN free_func);
+
+/*
+ * Deletes the table.  No other thread may be using it.
+ */
+void sharded_hashtbl_delete(struct sharded_hashtbl *s);
+
+/*
+ * As hashtbl_insert(), hashtbl_lookup() and hashtbl_remove(), under
+ * the lock of the shard that k maps to.
+ */
+int sharded_hashtbl_insert(struct sharded_hashtbl *s, void *k, void *v);
+void *sharded_hashtbl_lookup(struct sharded_hashtbl *s, const void *k);
+int sharded_hashtbl_remove(struct sharded_hashtbl *s, const void *k);
+
+/*
+ * As hashtbl_cas(), hashtbl_replace_if() and hashtbl_compute(), under
+ * the lock of the shard that k maps to, so pred and fn run atomically
+ * with respect to every key in that shard.  They must not call back
+ * into the table.
+ */
+int sharded_hashtbl_cas(struct sharded_hashtbl *s, const void *k,
+			void *expected, void *desired);
+int sharded_hashtbl_replace_if(struct sharded_hashtbl *s, const void *k,
+			       void *v, HASHTBL_APPLY_FN pred,
+			       const void *client_data);
+int sharded_hashtbl_compute(struct sharded_hashtbl *s, void *k,
+			    HASHTBL_COMPUTE_FN fn, void *client_data);
+
+/*
+ * Returns the number of entries across all shards.
+ */
+unsigned long sharded_hashtbl_count(struct sharded_hashtbl *s);
+
+/*
+ * Returns the number of shards.
+ */
+int sharded_hashtbl_nshards(const struct sharded_hashtbl *s);
+
+/*
+ * Apply a function to all entries, running up to nthreads shards at
+ * once.  Each shard is locked while fn runs over it, so fn must not
+ * call back into the table, and must be thread-safe if nthreads > 1.
+ * Returning 0 from fn stops the enumeration (other threads stop at
+ * their next entry).
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long sharded_hashtbl_apply(struct sharded_hashtbl *s,
+				    HASHTBL_APPLY_FN fn,
+				    void *client_data,
+				    int nthreads);
+
+/*
+ * Clears all entries, running up to nthreads shards at once.
+ */
+void sharded_hashtbl_clear(struct sharded_hashtbl *s, int nthreads);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SHARDED_HASHTBL_H */
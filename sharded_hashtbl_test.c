@@ -0,0 +1,252 @@
+/* Copyright (c) 2009, 2010 <Andrew McDermott>
+ * 
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* sharded_hashtbl_test.c - unit tests for sharded_hashtbl */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "CUnitTest.h"
+#include "sharded_hashtbl.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NKEYS			10000
+#define NTHREADS		4
+
+static struct sharded_hashtbl *new_table(int shard_bits)
+{
+	return sharded_hashtbl_create(shard_bits, 16, 0.75,
+				      hashtbl_int_hash, hashtbl_int_equals,
+				      free, free, NULL, NULL);
+}
+
+struct worker {
+	pthread_t tid;
+	struct sharded_hashtbl *s;
+	int first;
+	int last;
+};
+
+static void *insert_worker(void *arg)
+{
+	struct worker *w = arg;
+	int i;
+
+	for (i = w->first; i < w->last; i++)
+		sharded_hashtbl_insert(w->s, test_int(i), test_int(i * 2));
+
+	return NULL;
+}
+
+/* Test basic operations. */
+
+static int test1(void)
+{
+	int i;
+	struct sharded_hashtbl *s = new_table(3);
+
+	CUT_ASSERT_NOT_NULL(s);
+	CUT_ASSERT_EQUAL(8, sharded_hashtbl_nshards(s));
+	CUT_ASSERT_EQUAL(0, sharded_hashtbl_count(s));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, sharded_hashtbl_insert(s, test_int(i), test_int(i * 2)));
+
+	CUT_ASSERT_EQUAL(1000, sharded_hashtbl_count(s));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(i * 2, *(int *)sharded_hashtbl_lookup(s, &i));
+
+	i = 1000;
+	CUT_ASSERT_NULL(sharded_hashtbl_lookup(s, &i));
+	CUT_ASSERT_EQUAL(1, sharded_hashtbl_remove(s, &i));
+
+	for (i = 0; i < 1000; i += 2)
+		CUT_ASSERT_EQUAL(0, sharded_hashtbl_remove(s, &i));
+
+	CUT_ASSERT_EQUAL(500, sharded_hashtbl_count(s));
+
+	for (i = 0; i < 1000; i++) {
+		if (i % 2 == 0)
+			CUT_ASSERT_NULL(sharded_hashtbl_lookup(s, &i));
+		else
+			CUT_ASSERT_NOT_NULL(sharded_hashtbl_lookup(s, &i));
+	}
+
+	sharded_hashtbl_delete(s);
+
+	/* A single shard works as a plain locked table. */
+	s = new_table(0);
+	CUT_ASSERT_NOT_NULL(s);
+	CUT_ASSERT_EQUAL(1, sharded_hashtbl_nshards(s));
+	i = 42;
+	CUT_ASSERT_EQUAL(0, sharded_hashtbl_insert(s, test_int(i), test_int(i)));
+	CUT_ASSERT_EQUAL(42, *(int *)sharded_hashtbl_lookup(s, &i));
+	sharded_hashtbl_delete(s);
+
+	return 0;
+}
+
+/* Test concurrent inserts. */
+
+static int test2(void)
+{
+	int i;
+	struct worker w[NTHREADS];
+	struct sharded_hashtbl *s = new_table(4);
+
+	CUT_ASSERT_NOT_NULL(s);
+
+	for (i = 0; i < NTHREADS; i++) {
+		w[i].s = s;
+		w[i].first = i * (NKEYS / NTHREADS);
+		w[i].last = (i + 1) * (NKEYS / NTHREADS);
+		CUT_ASSERT_EQUAL(0, pthread_create(&w[i].tid, NULL, insert_worker, &w[i]));
+	}
+
+	for (i = 0; i < NTHREADS; i++)
+		pthread_join(w[i].tid, NULL);
+
+	CUT_ASSERT_EQUAL(NKEYS, sharded_hashtbl_count(s));
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(i * 2, *(int *)sharded_hashtbl_lookup(s, &i));
+
+	sharded_hashtbl_delete(s);
+	return 0;
+}
+
+/* Test parallel apply and clear. */
+
+static int test3(void)
+{
+	int i;
+	long expected = 0;
+	atomic_long sum;
+	struct sharded_hashtbl *s = new_table(4);
+
+	CUT_ASSERT_NOT_NULL(s);
+
+	for (i = 0; i < NKEYS; i++) {
+		CUT_ASSERT_EQUAL(0, sharded_hashtbl_insert(s, test_int(i), test_int(i)));
+		expected += i;
+	}
+
+	atomic_init(&sum, 0);
+	CUT_ASSERT_EQUAL(NKEYS, sharded_hashtbl_apply(s, test_sum_fn, &sum, NTHREADS));
+	CUT_ASSERT_EQUAL(expected, atomic_load(&sum));
+
+	/* More threads than shards, and a single thread. */
+	atomic_init(&sum, 0);
+	CUT_ASSERT_EQUAL(NKEYS, sharded_hashtbl_apply(s, test_sum_fn, &sum, 64));
+	CUT_ASSERT_EQUAL(expected, atomic_load(&sum));
+	atomic_init(&sum, 0);
+	CUT_ASSERT_EQUAL(NKEYS, sharded_hashtbl_apply(s, test_sum_fn, &sum, 1));
+	CUT_ASSERT_EQUAL(expected, atomic_load(&sum));
+
+	/* Stopping early stops every worker. */
+	CUT_ASSERT_TRUE(sharded_hashtbl_apply(s, test_stop_fn, NULL, NTHREADS) <= NTHREADS);
+	CUT_ASSERT_EQUAL(1, sharded_hashtbl_apply(s, test_stop_fn, NULL, 1));
+
+	sharded_hashtbl_clear(s, NTHREADS);
+	CUT_ASSERT_EQUAL(0, sharded_hashtbl_count(s));
+	CUT_ASSERT_EQUAL(0, sharded_hashtbl_apply(s, test_sum_fn, &sum, NTHREADS));
+
+	i = 7;
+	CUT_ASSERT_NULL(sharded_hashtbl_lookup(s, &i));
+	CUT_ASSERT_EQUAL(0, sharded_hashtbl_insert(s, test_int(i), test_int(i)));
+	CUT_ASSERT_EQUAL(1, sharded_hashtbl_count(s));
+
+	sharded_hashtbl_delete(s);
+	return 0;
+}
+
+static void *increment_fn(const void *k, void *v, void *p)
+{
+	UNUSED_PARAMETER(k);
+	UNUSED_PARAMETER(p);
+	return test_int(*(int *)v + 1);
+}
+
+static void *compute_worker(void *arg)
+{
+	struct worker *w = arg;
+	int i, k;
+
+	for (i = w->first; i < w->last; i++) {
+		k = i % 16;
+		sharded_hashtbl_compute(w->s, &k, increment_fn, NULL);
+	}
+
+	return NULL;
+}
+
+/* Test atomic read-modify-write from several threads. */
+
+static int test4(void)
+{
+	int i;
+	struct worker workers[NTHREADS];
+	struct sharded_hashtbl *s = new_table(2);
+
+	CUT_ASSERT_NOT_NULL(s);
+
+	for (i = 0; i < 16; i++)
+		CUT_ASSERT_EQUAL(0, sharded_hashtbl_insert(s, test_int(i), test_int(0)));
+
+	for (i = 0; i < NTHREADS; i++) {
+		workers[i].s = s;
+		workers[i].first = 0;
+		workers[i].last = NKEYS;
+		CUT_ASSERT_EQUAL(0, pthread_create(&workers[i].tid, NULL,
+						   compute_worker, &workers[i]));
+	}
+
+	for (i = 0; i < NTHREADS; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	for (i = 0; i < 16; i++)
+		CUT_ASSERT_EQUAL(NTHREADS * NKEYS / 16, *(int *)sharded_hashtbl_lookup(s, &i));
+
+	/* Only replaced when the value is the one expected. */
+	i = 3;
+	CUT_ASSERT_EQUAL(1, sharded_hashtbl_cas(s, &i, NULL, NULL));
+	CUT_ASSERT_EQUAL(0, sharded_hashtbl_cas(s, &i, sharded_hashtbl_lookup(s, &i),
+						test_int(-3)));
+	CUT_ASSERT_EQUAL(-3, *(int *)sharded_hashtbl_lookup(s, &i));
+
+	sharded_hashtbl_delete(s);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,538 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * An open addressed hash table after the layout of Abseil's
+ * SwissTable, with control bytes, keys and values in three arrays.
+ *
+ * Each slot has a control byte: CTRL_EMPTY, CTRL_DELETED (a
+ * tombstone) or, when full, the low 7 bits of the hash (h2).  The
+ * remaining bits (h1) pick a group of GROUP_WIDTH slots to start
+ * probing from.  A probe matches h2 against a whole group of control
+ * bytes (with SSE2 when available) and only compares the keys that
+ * match; it stops at the first group that has an empty slot.  Groups
+ * are probed in triangular order, which visits every group of a
+ * power of 2 sized table.
+ *
+ * Because a probe only stops at an empty slot, removing a key must
+ * normally leave a tombstone.  If the key's group still has an
+ * empty slot no probe sequence can have passed through the group,
+ * and the slot can be made empty instead.
+ *
+ * The hash is not stored: resizing calls hash_fn again for each key
+ * rather than carrying a fourth array.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memset */
+#if !defined(_MSC_VER)
+#include <stdint.h>		/* uintptr_t */
+#endif
+#if defined(__SSE2__) && !defined(SOA_HASHTBL_NO_SIMD)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#endif
+#include "soa_hashtbl.h"
+#include "hashtbl_probes.h"
+
+#define UNUSED_PARAMETER(X)		(void) (X)
+
+#ifndef SOA_HASHTBL_MAX_TABLE_SIZE
+#define SOA_HASHTBL_MAX_TABLE_SIZE	(1 << 30)
+#endif
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define CTRL_EMPTY		((signed char)-128)
+#define CTRL_DELETED		((signed char)-2)
+#define GROUP_WIDTH		16
+#define DEFAULT_LOAD_FACTOR	0.875
+#define MAX_LOAD_FACTOR		0.9375
+
+struct soa_hashtbl {
+	double max_load_factor;
+	SOA_HASHTBL_HASH_FN hash_fn;
+	SOA_HASHTBL_EQUALS_FN equals_fn;
+	unsigned long nentries;
+	unsigned long ndeleted;		/* tombstones */
+	unsigned long resize_threshold;	/* of entries plus tombstones */
+	int table_size;
+	SOA_HASHTBL_KEY_FREE_FN key_free_fn;
+	SOA_HASHTBL_VAL_FREE_FN val_free_fn;
+	SOA_HASHTBL_MALLOC_FN malloc_fn;
+	SOA_HASHTBL_FREE_FN free_fn;
+	void **keys;			/* the allocation holding all three */
+	void **vals;
+	signed char *ctrl;
+};
+
+static INLINE unsigned int direct_hash(const void *k)
+{
+	/* Magic numbers from Java 1.4. */
+	unsigned int h = (unsigned int)(uintptr_t) k;
+	h ^= (h >> 20) ^ (h >> 12);
+	return h ^ (h >> 7) ^ (h >> 4);
+}
+
+static INLINE int direct_equals(const void *a, const void *b)
+{
+	return a == b;
+}
+
+/*
+ * Both h1 and h2 come from the hash, so mix it (the MurmurHash3
+ * finalizer) in case the low bits of the client's hash are weak.
+ */
+static INLINE unsigned int mix_hash(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#define H1(HV)		((HV) >> 7)
+#define H2(HV)		((signed char)((HV) & 0x7f))
+
+/* Bit i of the result is set if ctrl[i] == b. */
+
+static INLINE unsigned int match_byte(const signed char *ctrl, signed char b)
+{
+#if defined(USE_SSE2)
+	__m128i group = _mm_loadu_si128((const __m128i *)(const void *)ctrl);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group,
+							      _mm_set1_epi8(b)));
+#else
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < GROUP_WIDTH; i++) {
+		if (ctrl[i] == b)
+			mask |= 1U << i;
+	}
+	return mask;
+#endif
+}
+
+/* Bit i of the result is set if ctrl[i] is empty or deleted. */
+
+static INLINE unsigned int match_free(const signed char *ctrl)
+{
+#if defined(USE_SSE2)
+	__m128i group = _mm_loadu_si128((const __m128i *)(const void *)ctrl);
+	return (unsigned int)_mm_movemask_epi8(group);
+#else
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < GROUP_WIDTH; i++) {
+		if (ctrl[i] < 0)
+			mask |= 1U << i;
+	}
+	return mask;
+#endif
+}
+
+/* Returns the index of the lowest bit set in a non-zero mask. */
+
+static INLINE unsigned int lowest_bit(unsigned int mask)
+{
+#if defined(__GNUC__)
+	return (unsigned int)__builtin_ctz(mask);
+#else
+	unsigned int i = 0;
+
+	while ((mask & 1) == 0) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+static INLINE unsigned long threshold(int table_size, double max_load_factor)
+{
+	unsigned long n = (unsigned long)((double)table_size * max_load_factor);
+
+	/* Always leave one empty slot so that probes terminate. */
+	if (n >= (unsigned long)table_size)
+		n = (unsigned long)table_size - 1;
+	/* But room for at least one entry, however small the factor. */
+	if (n < 1)
+		n = 1;
+	return n;
+}
+
+/*
+ * Search for k.  Returns its slot, or -1 if k is not present.  The
+ * number of groups probed is stored in depth.
+ */
+static INLINE long find(const struct soa_hashtbl *h, unsigned int hv,
+			const void *k, unsigned int *depth)
+{
+	unsigned int gmask = (unsigned int)h->table_size / GROUP_WIDTH - 1;
+	unsigned int g = H1(hv) & gmask;
+	unsigned int n = 0;
+
+	for (;;) {
+		const signed char *ctrl = &h->ctrl[g * GROUP_WIDTH];
+		unsigned int mask = match_byte(ctrl, H2(hv));
+
+		n++;
+		while (mask != 0) {
+			unsigned int slot = g * GROUP_WIDTH + lowest_bit(mask);
+			if (h->equals_fn(h->keys[slot], k)) {
+				*depth = n;
+				return (long)slot;
+			}
+			mask &= mask - 1;
+		}
+		if (match_byte(ctrl, CTRL_EMPTY) != 0)
+			break;
+		g = (g + n) & gmask;
+	}
+
+	*depth = n;
+	return -1;
+}
+
+/* Returns the first empty or deleted slot for hv. */
+
+static INLINE unsigned int find_free_slot(const struct soa_hashtbl *h,
+					  unsigned int hv)
+{
+	unsigned int gmask = (unsigned int)h->table_size / GROUP_WIDTH - 1;
+	unsigned int g = H1(hv) & gmask;
+	unsigned int n = 0, mask;
+
+	while ((mask = match_free(&h->ctrl[g * GROUP_WIDTH])) == 0)
+		g = (g + ++n) & gmask;
+
+	return g * GROUP_WIDTH + lowest_bit(mask);
+}
+
+/*
+ * Rebuild the table with room for at least capacity entries,
+ * dropping any tombstones.
+ */
+static int rehash(struct soa_hashtbl *h, unsigned long capacity)
+{
+	int size = GROUP_WIDTH, old_size = h->table_size, i;
+	void **keys = h->keys, **vals = h->vals;
+	signed char *ctrl = h->ctrl;
+	void *mem;
+
+	while (threshold(size, h->max_load_factor) < capacity &&
+	       size < SOA_HASHTBL_MAX_TABLE_SIZE)
+		size <<= 1;
+
+	/* Can't shrink below the live entries. */
+	while (threshold(size, h->max_load_factor) < h->nentries)
+		size <<= 1;
+
+	/* The pointer arrays come first so that they stay aligned. */
+	mem = h->malloc_fn((size_t) size * (2 * sizeof(void *) + 1));
+	if (mem == NULL)
+		return 1;
+
+	HASHTBL_PROBE3(soa_hashtbl, resize__start, h, old_size, size);
+
+	h->keys = mem;
+	h->vals = h->keys + size;
+	h->ctrl = (signed char *)(void *)(h->vals + size);
+	h->table_size = size;
+	h->ndeleted = 0;
+	h->resize_threshold = threshold(size, h->max_load_factor);
+	memset(h->ctrl, CTRL_EMPTY, (size_t) size);
+
+	for (i = 0; i < old_size; i++) {
+		unsigned int hv, slot;
+		if (ctrl[i] < 0)
+			continue;
+		hv = mix_hash(h->hash_fn(keys[i]));
+		slot = find_free_slot(h, hv);
+		h->ctrl[slot] = H2(hv);
+		h->keys[slot] = keys[i];
+		h->vals[slot] = vals[i];
+	}
+
+	if (keys != NULL)
+		h->free_fn(keys);
+
+	HASHTBL_PROBE3(soa_hashtbl, resize__done, h, old_size, size);
+
+	return 0;
+}
+
+int soa_hashtbl_insert(struct soa_hashtbl *h, void *k, void *v)
+{
+	unsigned int hv = mix_hash(h->hash_fn(k));
+	unsigned int slot, depth;
+	long found;
+
+	if ((found = find(h, hv, k, &depth)) >= 0) {
+		if (h->val_free_fn != NULL)
+			h->val_free_fn(h->vals[found]);
+		h->vals[found] = v;
+		return 0;
+	}
+
+	if (h->nentries + h->ndeleted >= h->resize_threshold) {
+		/* Grows if mostly live, otherwise just drops tombstones. */
+		unsigned long capacity = h->resize_threshold;
+		if (h->ndeleted * 2 <= h->nentries)
+			capacity = (h->nentries + 1) * 2;
+		if (rehash(h, capacity) != 0 ||
+		    h->nentries >= h->resize_threshold)
+			return 1;
+	}
+
+	slot = find_free_slot(h, hv);
+	if (h->ctrl[slot] == CTRL_DELETED)
+		h->ndeleted--;
+	h->ctrl[slot] = H2(hv);
+	h->keys[slot] = k;
+	h->vals[slot] = v;
+	h->nentries++;
+
+	HASHTBL_PROBE3(soa_hashtbl, insert, h, hv, depth);
+
+	return 0;
+}
+
+void *soa_hashtbl_lookup(struct soa_hashtbl *h, const void *k)
+{
+	unsigned int hv = mix_hash(h->hash_fn(k));
+	unsigned int depth;
+	long slot = find(h, hv, k, &depth);
+
+	HASHTBL_PROBE4(soa_hashtbl, lookup, h, hv, depth, slot >= 0);
+
+	return (slot >= 0) ? h->vals[slot] : NULL;
+}
+
+int soa_hashtbl_remove(struct soa_hashtbl *h, const void *k)
+{
+	unsigned int hv = mix_hash(h->hash_fn(k));
+	unsigned int depth;
+	long slot = find(h, hv, k, &depth);
+	long group;
+
+	HASHTBL_PROBE4(soa_hashtbl, remove, h, hv, depth, slot >= 0);
+
+	if (slot < 0)
+		return 1;
+
+	if (h->key_free_fn != NULL)
+		h->key_free_fn(h->keys[slot]);
+	if (h->val_free_fn != NULL && h->vals[slot] != NULL)
+		h->val_free_fn(h->vals[slot]);
+
+	group = slot - slot % GROUP_WIDTH;
+	if (match_byte(&h->ctrl[group], CTRL_EMPTY) != 0) {
+		h->ctrl[slot] = CTRL_EMPTY;
+	} else {
+		h->ctrl[slot] = CTRL_DELETED;
+		h->ndeleted++;
+	}
+
+	h->keys[slot] = NULL;
+	h->vals[slot] = NULL;
+	h->nentries--;
+
+	return 0;
+}
+
+void soa_hashtbl_clear(struct soa_hashtbl *h)
+{
+	int i;
+
+	if (h->key_free_fn != NULL || h->val_free_fn != NULL) {
+		for (i = 0; i < h->table_size; i++) {
+			if (h->ctrl[i] < 0)
+				continue;
+			if (h->key_free_fn != NULL)
+				h->key_free_fn(h->keys[i]);
+			if (h->val_free_fn != NULL)
+				h->val_free_fn(h->vals[i]);
+		}
+	}
+
+	memset(h->ctrl, CTRL_EMPTY, (size_t) h->table_size);
+	h->nentries = 0;
+	h->ndeleted = 0;
+}
+
+void soa_hashtbl_delete(struct soa_hashtbl *h)
+{
+	soa_hashtbl_clear(h);
+	h->free_fn(h->keys);
+	h->free_fn(h);
+}
+
+unsigned long soa_hashtbl_count(const struct soa_hashtbl *h)
+{
+	return h->nentries;
+}
+
+int soa_hashtbl_capacity(const struct soa_hashtbl *h)
+{
+	return h->table_size;
+}
+
+double soa_hashtbl_load_factor(const struct soa_hashtbl *h)
+{
+	return (double)h->nentries / (double)h->table_size;
+}
+
+struct soa_hashtbl *soa_hashtbl_create(int capacity,
+				       double max_load_factor,
+				       SOA_HASHTBL_HASH_FN hash_fn,
+				       SOA_HASHTBL_EQUALS_FN equals_fn,
+				       SOA_HASHTBL_KEY_FREE_FN key_free_fn,
+				       SOA_HASHTBL_VAL_FREE_FN val_free_fn,
+				       SOA_HASHTBL_MALLOC_FN malloc_fn,
+				       SOA_HASHTBL_FREE_FN free_fn)
+{
+	struct soa_hashtbl *h;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+	hash_fn = (hash_fn != NULL) ? hash_fn : direct_hash;
+	equals_fn = (equals_fn != NULL) ? equals_fn : direct_equals;
+
+	if ((h = malloc_fn(sizeof(*h))) == NULL)
+		return NULL;
+
+	if (max_load_factor <= 0.0) {
+		max_load_factor = DEFAULT_LOAD_FACTOR;
+	} else if (max_load_factor > MAX_LOAD_FACTOR) {
+		max_load_factor = MAX_LOAD_FACTOR;
+	}
+
+	h->max_load_factor = max_load_factor;
+	h->hash_fn = hash_fn;
+	h->equals_fn = equals_fn;
+	h->nentries = 0;
+	h->ndeleted = 0;
+	h->resize_threshold = 0;
+	h->table_size = 0;
+	h->key_free_fn = key_free_fn;
+	h->val_free_fn = val_free_fn;
+	h->malloc_fn = malloc_fn;
+	h->free_fn = free_fn;
+	h->keys = NULL;
+	h->vals = NULL;
+	h->ctrl = NULL;
+
+	if (rehash(h, (capacity > 0) ? (unsigned long)capacity : 1) != 0) {
+		free_fn(h);
+		h = NULL;
+	}
+
+	return h;
+}
+
+int soa_hashtbl_resize(struct soa_hashtbl *h, int capacity)
+{
+	return rehash(h, (capacity > 0) ? (unsigned long)capacity : 1);
+}
+
+unsigned long soa_hashtbl_apply(const struct soa_hashtbl *h,
+				SOA_HASHTBL_APPLY_FN apply,
+				void *client_data)
+{
+	unsigned long nentries = 0;
+	int g;
+
+	for (g = 0; g < h->table_size; g += GROUP_WIDTH) {
+		unsigned int full = ~match_free(&h->ctrl[g]) & 0xffff;
+		while (full != 0) {
+			int i = g + (int)lowest_bit(full);
+			nentries++;
+			if (!apply(h->keys[i], h->vals[i], client_data))
+				return nentries;
+			full &= full - 1;
+		}
+	}
+
+	return nentries;
+}
+
+unsigned long soa_hashtbl_apply_values(const struct soa_hashtbl *h,
+				       SOA_HASHTBL_VALUE_FN apply,
+				       void *client_data)
+{
+	unsigned long nentries = 0;
+	int g;
+
+	for (g = 0; g < h->table_size; g += GROUP_WIDTH) {
+		unsigned int full = ~match_free(&h->ctrl[g]) & 0xffff;
+		while (full != 0) {
+			nentries++;
+			if (!apply(h->vals[g + (int)lowest_bit(full)], client_data))
+				return nentries;
+			full &= full - 1;
+		}
+	}
+
+	return nentries;
+}
+
+void soa_hashtbl_iter_init(struct soa_hashtbl *h,
+			   struct soa_hashtbl_iter *iter)
+{
+	/* We have to do some funky casting in order to initialize the
+	 * private fields as they are declared const -- we don't want
+	 * clients changing them but we need to. */
+
+	UNUSED_PARAMETER(h);
+	*(long *) &iter->pos = 0;
+	iter->key = iter->val = NULL;
+}
+
+int soa_hashtbl_iter_next(struct soa_hashtbl *h,
+			  struct soa_hashtbl_iter *iter)
+{
+	long *pos = (long *) &iter->pos;
+
+	while (*pos < h->table_size) {
+		long i = (*pos)++;
+		if (h->ctrl[i] >= 0) {
+			iter->key = h->keys[i];
+			iter->val = h->vals[i];
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+#ifndef SOA_HASHTBL_H
+#define SOA_HASHTBL_H
+
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An open addressed hash table with its slots split across arrays.
+ *
+ * SYNOPSIS
+ *
+ * 1. A hash table is created with soa_hashtbl_create().
+ * 2. To insert an entry use soa_hashtbl_insert().
+ * 3. To lookup a key use soa_hashtbl_lookup().
+ * 4. To remove a key use soa_hashtbl_remove().
+ * 5. To apply a function to all entries use soa_hashtbl_apply().
+ * 6. To apply a function to all values use soa_hashtbl_apply_values().
+ * 7. To clear all keys use soa_hashtbl_clear().
+ * 8. To delete a hash table instance use soa_hashtbl_delete().
+ * 9. To iterate over all entries use soa_hashtbl_iter_init(), soa_hashtbl_iter_next().
+ *
+ * A slot is a control byte, a key and a value, and each lives in its
+ * own array (a "structure of arrays").  The control byte holds 7
+ * bits of the key's hash, so a probe compares a group of 16 control
+ * bytes at once and only reads the keys whose bits match; the values
+ * are read once the key is found.  A scan over the values reads the
+ * control bytes and one dense array of values, and never the keys.
+ *
+ * Compared with hashtbl there are no per-entry allocations and the
+ * table always resizes automatically.  Removing a key may leave a
+ * tombstone which is reclaimed by the next resize.
+ *
+ * Note: neither the keys or the values are copied so their lifetime
+ * must match that of the hash table.  NULL keys are not permitted.
+ * Inserting, removing or lookup up NULL keys is therefore undefined.
+ */
+
+#include <stddef.h>		/* size_t */
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Opaque types. */
+struct soa_hashtbl;
+
+/* Hash function. */
+typedef unsigned int (*SOA_HASHTBL_HASH_FN) (const void *k);
+
+/* Key equality function. */
+typedef int (*SOA_HASHTBL_EQUALS_FN) (const void *a, const void *b);
+
+/* Apply function. */
+typedef int (*SOA_HASHTBL_APPLY_FN) (const void *key,
+				     const void *val,
+				     const void *client_data);
+
+/* Apply function for soa_hashtbl_apply_values(). */
+typedef int (*SOA_HASHTBL_VALUE_FN) (const void *val,
+				     const void *client_data);
+
+/* Functions for deleting keys and values. */
+typedef void (*SOA_HASHTBL_KEY_FREE_FN) (void *k);
+typedef void (*SOA_HASHTBL_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*SOA_HASHTBL_MALLOC_FN) (size_t n);
+typedef void (*SOA_HASHTBL_FREE_FN) (void *ptr);
+
+struct soa_hashtbl_iter {
+	void *key;
+	void *val;
+	/* The remaining fields are private: don't modify them. */
+	const long pos;
+};
+
+/*
+ * Creates a new hash table.
+ *
+ * @param initial_capacity - number of entries before the first resize
+ * @param max_load_factor  - (0.0 uses a default value of 0.875; at
+ *			     most 0.9375)
+ * @param hash_func	   - function that computes a hash value from a key
+ * @param equals_func	   - function that checks keys for equality
+ * @param key_free_func	   - function to delete keys
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * The table rehashes every key when it resizes, so hash_func is
+ * called more than once per key.
+ *
+ * Returns non-null if the table was created successfully.
+ */
+struct soa_hashtbl *soa_hashtbl_create(int initial_capacity,
+				       double max_load_factor,
+				       SOA_HASHTBL_HASH_FN hash_fun,
+				       SOA_HASHTBL_EQUALS_FN equals_fun,
+				       SOA_HASHTBL_KEY_FREE_FN key_free_func,
+				       SOA_HASHTBL_VAL_FREE_FN val_free_func,
+				       SOA_HASHTBL_MALLOC_FN malloc_func,
+				       SOA_HASHTBL_FREE_FN free_func);
+
+/*
+ * Deletes the hash table instance.
+ *
+ * All the entries are removed via soa_hashtbl_clear().
+ */
+void soa_hashtbl_delete(struct soa_hashtbl *h);
+
+/*
+ * Removes a key and value from the table.
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int soa_hashtbl_remove(struct soa_hashtbl *h, const void *k);
+
+/*
+ * Clears all entries.
+ */
+void soa_hashtbl_clear(struct soa_hashtbl *h);
+
+/*
+ * Inserts a new key with associated value.
+ *
+ * Returns 0 if insertion was successful, otherwise 1.
+ */
+int soa_hashtbl_insert(struct soa_hashtbl *h, void *k, void *v);
+
+/*
+ * Lookup an existing key.
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *soa_hashtbl_lookup(struct soa_hashtbl *h, const void *k);
+
+/*
+ * Returns the number of entries in the table.
+ */
+unsigned long soa_hashtbl_count(const struct soa_hashtbl *h);
+
+/*
+ * Returns the number of slots in the table.
+ */
+int soa_hashtbl_capacity(const struct soa_hashtbl *h);
+
+/*
+ * Apply a function to all entries.  Returning 0 from fn stops the
+ * enumeration.
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long soa_hashtbl_apply(const struct soa_hashtbl *h,
+				SOA_HASHTBL_APPLY_FN fn,
+				void *client_data);
+
+/*
+ * Apply a function to all values, in the same order as
+ * soa_hashtbl_apply() but without reading the keys.  Returning 0
+ * from fn stops the enumeration.
+ *
+ * Returns the number of values the function was applied to.
+ */
+unsigned long soa_hashtbl_apply_values(const struct soa_hashtbl *h,
+				       SOA_HASHTBL_VALUE_FN fn,
+				       void *client_data);
+
+/*
+ * Returns the load factor of the hash table.
+ */
+double soa_hashtbl_load_factor(const struct soa_hashtbl *h);
+
+/*
+ * Resize the table so that it holds at least capacity entries
+ * before growing again.  Also reclaims any tombstones.
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int soa_hashtbl_resize(struct soa_hashtbl *h, int capacity);
+
+/*
+ * Initialize an iterator.
+ *
+ * The current entry may be removed while iterating; inserting new
+ * keys invalidates the iterator.
+ */
+void soa_hashtbl_iter_init(struct soa_hashtbl *h,
+			   struct soa_hashtbl_iter *iter);
+
+/*
+ * Advances the iterator.
+ *
+ * Returns 1 while there more entries, otherwise 0.  The key and value
+ * for each entry can be accessed through the iterator structure.
+ */
+int soa_hashtbl_iter_next(struct soa_hashtbl *h,
+			  struct soa_hashtbl_iter *iter);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SOA_HASHTBL_H */
@@ -0,0 +1,243 @@
+/* Copyright (c) 2010 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/hashtbl.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* soa_hashtbl_test.c - unit tests for soa_hashtbl */
+
+#include <stdlib.h>
+#include "CUnitTest.h"
+#include "soa_hashtbl.h"
+#include "hashtbl_funcs.h"
+#include "hashtbl_test_funcs.h"
+
+#define NKEYS			40000
+
+static struct soa_hashtbl *new_table(SOA_HASHTBL_HASH_FN hash)
+{
+	return soa_hashtbl_create(1, 0.0, hash, hashtbl_int_equals,
+				  free, free, NULL, NULL);
+}
+
+static unsigned int constant_hash(const void *k)
+{
+	UNUSED_PARAMETER(k);
+	return 42;
+}
+
+static int sum_fn(const void *k, const void *v, const void *p)
+{
+	UNUSED_PARAMETER(k);
+	*(long *)p += *(const int *)v;
+	return 1;
+}
+
+static int sum_values_fn(const void *v, const void *p)
+{
+	*(long *)p += *(const int *)v;
+	return 1;
+}
+
+static int stop_fn(const void *v, const void *p)
+{
+	UNUSED_PARAMETER(v);
+	UNUSED_PARAMETER(p);
+	return 0;
+}
+
+/* Test insert, lookup and remove as the table grows. */
+
+static int test1(void)
+{
+	int i, *k;
+	struct soa_hashtbl *h = new_table(hashtbl_int_hash);
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(16, soa_hashtbl_capacity(h));
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, test_int(i), test_int(i * 2)));
+
+	CUT_ASSERT_EQUAL(NKEYS, soa_hashtbl_count(h));
+	CUT_ASSERT_TRUE(soa_hashtbl_load_factor(h) <= 0.875);
+
+	for (i = 0; i < NKEYS; i++)
+		CUT_ASSERT_EQUAL(i * 2, *(int *)soa_hashtbl_lookup(h, &i));
+
+	i = NKEYS;
+	CUT_ASSERT_NULL(soa_hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(1, soa_hashtbl_remove(h, &i));
+
+	for (i = 0; i < NKEYS; i += 2)
+		CUT_ASSERT_EQUAL(0, soa_hashtbl_remove(h, &i));
+
+	CUT_ASSERT_EQUAL(NKEYS / 2, soa_hashtbl_count(h));
+
+	for (i = 0; i < NKEYS; i++) {
+		if (i % 2 == 0)
+			CUT_ASSERT_NULL(soa_hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_EQUAL(i * 2, *(int *)soa_hashtbl_lookup(h, &i));
+	}
+
+	/* Replacing a value keeps the original key. */
+	i = 1;
+	k = test_int(i);
+	CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, k, test_int(-1)));
+	free(k);
+	CUT_ASSERT_EQUAL(-1, *(int *)soa_hashtbl_lookup(h, &i));
+	CUT_ASSERT_EQUAL(NKEYS / 2, soa_hashtbl_count(h));
+
+	soa_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test that churn reuses tombstones rather than growing the table. */
+
+static int test2(void)
+{
+	int i, capacity;
+	long sum = 0, sum_values = 0;
+	struct soa_hashtbl *h = new_table(hashtbl_int_hash);
+	struct soa_hashtbl_iter iter;
+
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, soa_hashtbl_resize(h, 100));
+	capacity = soa_hashtbl_capacity(h);
+
+	for (i = 0; i < 100000; i++) {
+		int j = i - 50;
+		CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, test_int(i), test_int(i)));
+		if (j >= 0)
+			CUT_ASSERT_EQUAL(0, soa_hashtbl_remove(h, &j));
+	}
+
+	CUT_ASSERT_EQUAL(50, soa_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(capacity, soa_hashtbl_capacity(h));
+
+	for (i = 99950; i < 100000; i++)
+		CUT_ASSERT_EQUAL(i, *(int *)soa_hashtbl_lookup(h, &i));
+
+	/* apply, apply_values and the iterator agree. */
+	CUT_ASSERT_EQUAL(50, soa_hashtbl_apply(h, sum_fn, &sum));
+	CUT_ASSERT_EQUAL(50, soa_hashtbl_apply_values(h, sum_values_fn, &sum_values));
+	CUT_ASSERT_EQUAL(sum, sum_values);
+	CUT_ASSERT_EQUAL(1, soa_hashtbl_apply_values(h, stop_fn, NULL));
+
+	sum_values = 0;
+	soa_hashtbl_iter_init(h, &iter);
+	while (soa_hashtbl_iter_next(h, &iter)) {
+		CUT_ASSERT_EQUAL(*(int *)iter.key, *(int *)iter.val);
+		sum_values += *(int *)iter.val;
+	}
+	CUT_ASSERT_EQUAL(sum, sum_values);
+
+	soa_hashtbl_clear(h);
+	CUT_ASSERT_EQUAL(0, soa_hashtbl_count(h));
+	CUT_ASSERT_EQUAL(0, soa_hashtbl_apply(h, sum_fn, &sum));
+
+	soa_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test probing past full groups when every key collides. */
+
+static int test3(void)
+{
+	int i;
+	struct soa_hashtbl *h = new_table(constant_hash);
+
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (i = 0; i < 200; i++)
+		CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, test_int(i), test_int(i)));
+
+	/* Remove from the first groups probed, which leaves tombstones
+	 * that later probes must pass. */
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, soa_hashtbl_remove(h, &i));
+
+	for (i = 0; i < 200; i++) {
+		if (i < 100)
+			CUT_ASSERT_NULL(soa_hashtbl_lookup(h, &i));
+		else
+			CUT_ASSERT_EQUAL(i, *(int *)soa_hashtbl_lookup(h, &i));
+	}
+
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, test_int(i), test_int(i)));
+
+	CUT_ASSERT_EQUAL(0, soa_hashtbl_resize(h, 1000));
+	CUT_ASSERT_EQUAL(200, soa_hashtbl_count(h));
+
+	for (i = 0; i < 200; i++)
+		CUT_ASSERT_EQUAL(i, *(int *)soa_hashtbl_lookup(h, &i));
+
+	soa_hashtbl_delete(h);
+	return 0;
+}
+
+/* Test the table grows under small load factors. */
+
+static int test4(void)
+{
+	static const double factors[] = { 0.01, 0.05, 0.10, 0.25 };
+	unsigned int f;
+	int i;
+
+	for (f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+		struct soa_hashtbl *h;
+
+		h = soa_hashtbl_create(1, factors[f], hashtbl_int_hash,
+				       hashtbl_int_equals, free, free,
+				       NULL, NULL);
+		CUT_ASSERT_NOT_NULL(h);
+
+		for (i = 0; i < 1000; i++)
+			CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, test_int(i), test_int(i)));
+
+		CUT_ASSERT_EQUAL(1000, soa_hashtbl_count(h));
+		CUT_ASSERT_TRUE(soa_hashtbl_load_factor(h) <= factors[f] * 2);
+
+		for (i = 0; i < 1000; i += 2)
+			CUT_ASSERT_EQUAL(0, soa_hashtbl_remove(h, &i));
+		for (i = 0; i < 1000; i += 2)
+			CUT_ASSERT_EQUAL(0, soa_hashtbl_insert(h, test_int(i), test_int(i)));
+
+		for (i = 0; i < 1000; i++)
+			CUT_ASSERT_EQUAL(i, *(int *)soa_hashtbl_lookup(h, &i));
+
+		soa_hashtbl_delete(h);
+	}
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS
+CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS